@@ -1,23 +1,91 @@
 /* nsemu - LGPL - Copyright 2017 rkx1209<rkx1209dev@gmail.com> */
 #include "Nsemu.hpp"
-static Interpreter *cpu_engine;
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+static thread_local CpuEngine *cpu_engine; // Engine of the core running on this thread
 namespace ARMv8 {
 
-ARMv8State arm_state;
+ARMv8State core_state[CPU_NUM_CORES];
+thread_local ARMv8State *arm_state = &core_state[0];
+EngineType engine_type = EngineType::Interpreter;
+
+HostFeatures::HostFeatures() {
+#if defined(__x86_64__)
+        /* May run before the constructor of libgcc that fills the cpu model */
+        __builtin_cpu_init ();
+        ssse3 = __builtin_cpu_supports ("ssse3");
+        sse4_2 = __builtin_cpu_supports ("sse4.2");
+        pclmul = __builtin_cpu_supports ("pclmul");
+        aes = __builtin_cpu_supports ("aes");
+        sha = __builtin_cpu_supports ("sha");
+#else
+        ssse3 = sse4_2 = pclmul = aes = sha = false;
+#endif
+}
+
+const HostFeatures host_features;
 
 void Init() {
-        uint64_t tls_base = (1 << 24) + 0x1000 * 1;
-        size_t tls_size = 0xfff;
-	Interpreter::create ();
-	cpu_engine = Interpreter::get_instance ();
+        if (engine_type == EngineType::Jit && (GdbStub::enabled || Cpu::TraceOut || is_debug ())) {
+                ns_print ("JIT doesn't support gdb, trace or debug mode. Use interpreter instead\n");
+                engine_type = EngineType::Interpreter;
+        }
+        Disassembler::Init ();
+        /* Main thread is picked up by core 0 */
+        Thread *main_thread = ThreadManager::Create (0x0, 0, 0x3100000, THREAD_PRIO_DEFAULT, 0);
+        main_thread->context.gpr[1].x = main_thread->handle; // Assign main thread handle to X1
+        ThreadManager::Start (main_thread);
+}
+
+void InitCore(unsigned int id) {
+        arm_state = &core_state[id];
+        /* Engines keep per core translation caches, so each vCPU thread gets its own */
+        if (engine_type == EngineType::Jit) {
+                Jit::create ();
+                cpu_engine = Jit::get_instance ();
+        } else {
+                Interpreter::create ();
+                cpu_engine = Interpreter::get_instance ();
+        }
         cpu_engine->Init ();
-        PC = 0x0;
-        SP = 0x3100000;
-        Thread *main_thread = ThreadManager::Create();
-        X(1) = main_thread->handle; // Assign main thread handle to X1
-        SYSR.tpidrro_el[0] = tls_base;
-        SYSR.tczid_el[0] = 0x4; //FIXME: calclulate at runtime
-        Memory::AddMemmap (tls_base, tls_size);
+        /* Host FP environment is per thread */
+        SetFPCR (arm_state->fpcr);
+        SetFPSR (arm_state->fpsr);
+}
+
+void SetFPCR(uint32_t fpcr) {
+        static const int rmode[] = { FE_TONEAREST, FE_UPWARD, FE_DOWNWARD, FE_TOWARDZERO };
+        arm_state->fpcr = fpcr;
+        fesetround (rmode[(fpcr >> FPCR_RMODE_SHIFT) & 3]);
+#if defined(__SSE2__)
+        /* FZ flushes both denormal results (FTZ) and inputs (DAZ) */
+        uint32_t csr = _mm_getcsr () & ~0x8040;
+        _mm_setcsr ((fpcr & FPCR_FZ) ? csr | 0x8040 : csr);
+#endif
+}
+
+uint32_t GetFPSR() {
+        int host = fetestexcept (FE_ALL_EXCEPT);
+        if (host) {
+                if (host & FE_INVALID)
+                        arm_state->fpsr |= FPSR_IOC;
+                if (host & FE_DIVBYZERO)
+                        arm_state->fpsr |= FPSR_DZC;
+                if (host & FE_OVERFLOW)
+                        arm_state->fpsr |= FPSR_OFC;
+                if (host & FE_UNDERFLOW)
+                        arm_state->fpsr |= FPSR_UFC;
+                if (host & FE_INEXACT)
+                        arm_state->fpsr |= FPSR_IXC;
+                feclearexcept (FE_ALL_EXCEPT);
+        }
+        return arm_state->fpsr;
+}
+
+void SetFPSR(uint32_t fpsr) {
+        feclearexcept (FE_ALL_EXCEPT);
+        arm_state->fpsr = fpsr;
 }
 
 void RunLoop() {
@@ -41,7 +109,7 @@ void Dump() {
                 ns_print ("0x%016lx%c", X(r), cnt % 3 == 0 ? '\n' : '\t');
                 cnt++;
         }
-        ns_print ("NZCV:\t0x%016lx\n", NZCV);
+        ns_print ("NZCV:\t0x%016lx\n", GetNZCV ());
 }
 
 static uint64_t counter;
@@ -51,7 +119,7 @@ void DumpJson(FILE *fp, bool deep) {
         for (r = 0; r <= PC_IDX; r++) {
                 file_print (fp, "\"X%d\" : \"0x%016lx\",\n", r, X(r));
         }
-        file_print (fp, "\"X%d\" : \"0x%016x\"\n", r, NZCV);
+        file_print (fp, "\"X%d\" : \"0x%016x\"\n", r, GetNZCV ());
         if (deep) {
                 /* Dump Vector regs */
                 for (r = 0; r < VREG_DUMMY; r++) {
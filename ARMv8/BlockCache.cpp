@@ -0,0 +1,641 @@
+/* nsemu - LGPL - Copyright 2018 rkx1209<rkx1209dev@gmail.com> */
+#include "Nsemu.hpp"
+#include "ARMv8/DisassemblerImpl.hpp"
+
+/* ####### Recording callbacks ####### */
+
+void RecordCallback::MoviI64(unsigned int reg_idx, uint64_t imm, bool bit64) {
+        Emit (MicroOp_MoviI64, reg_idx, imm, bit64);
+}
+
+void RecordCallback::DepositI64(unsigned int rd_idx, uint64_t imm, unsigned int pos, unsigned int len, bool bit64) {
+        Emit (MicroOp_DepositI64, rd_idx, imm, pos, len, bit64);
+}
+
+void RecordCallback::DepositReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64) {
+        Emit (MicroOp_DepositReg, rd_idx, rn_idx, pos, len, bit64);
+}
+
+void RecordCallback::DepositZeroI64(unsigned int rd_idx, uint64_t imm, unsigned int pos, unsigned int len, bool bit64) {
+        Emit (MicroOp_DepositZeroI64, rd_idx, imm, pos, len, bit64);
+}
+
+void RecordCallback::DepositZeroReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64) {
+        Emit (MicroOp_DepositZeroReg, rd_idx, rn_idx, pos, len, bit64);
+}
+
+void RecordCallback::MovReg(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Emit (MicroOp_MovReg, rd_idx, rn_idx, bit64);
+}
+
+void RecordCallback::CondMovReg(unsigned int cond, unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64) {
+        Emit (MicroOp_CondMovReg, cond, rd_idx, rn_idx, rm_idx, bit64);
+}
+
+void RecordCallback::AddI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64) {
+        Emit (MicroOp_AddI64, rd_idx, rn_idx, imm, setflags, bit64);
+}
+
+void RecordCallback::SubI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64) {
+        Emit (MicroOp_SubI64, rd_idx, rn_idx, imm, setflags, bit64);
+}
+
+void RecordCallback::AddReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Emit (MicroOp_AddReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void RecordCallback::SubReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Emit (MicroOp_SubReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void RecordCallback::MulReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign, bool dst64, bool src64) {
+        Emit (MicroOp_MulReg, rd_idx, rn_idx, rm_idx, sign, dst64, src64);
+}
+
+void RecordCallback::Mul2Reg(unsigned int rh_idx, unsigned int rl_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign) {
+        Emit (MicroOp_Mul2Reg, rh_idx, rl_idx, rn_idx, rm_idx, sign);
+}
+
+void RecordCallback::DivReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign, bool bit64) {
+        Emit (MicroOp_DivReg, rd_idx, rn_idx, rm_idx, sign, bit64);
+}
+
+void RecordCallback::ShiftReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, unsigned int shift_type, bool bit64) {
+        Emit (MicroOp_ShiftReg, rd_idx, rn_idx, rm_idx, shift_type, bit64);
+}
+
+void RecordCallback::AddcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Emit (MicroOp_AddcReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void RecordCallback::SubcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Emit (MicroOp_SubcReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void RecordCallback::AndI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool setflags, bool bit64) {
+        Emit (MicroOp_AndI64, rd_idx, rn_idx, wmask, setflags, bit64);
+}
+
+void RecordCallback::OrrI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool bit64) {
+        Emit (MicroOp_OrrI64, rd_idx, rn_idx, wmask, bit64);
+}
+
+void RecordCallback::EorI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool bit64) {
+        Emit (MicroOp_EorI64, rd_idx, rn_idx, wmask, bit64);
+}
+
+void RecordCallback::ShiftI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int shift_type, unsigned int shift_amount, bool bit64) {
+        Emit (MicroOp_ShiftI64, rd_idx, rn_idx, shift_type, shift_amount, bit64);
+}
+
+void RecordCallback::AndReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Emit (MicroOp_AndReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void RecordCallback::OrrReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64) {
+        Emit (MicroOp_OrrReg, rd_idx, rn_idx, rm_idx, bit64);
+}
+
+void RecordCallback::EorReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64) {
+        Emit (MicroOp_EorReg, rd_idx, rn_idx, rm_idx, bit64);
+}
+
+void RecordCallback::BicReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Emit (MicroOp_BicReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void RecordCallback::NotReg(unsigned int rd_idx, unsigned int rm_idx, bool bit64) {
+        Emit (MicroOp_NotReg, rd_idx, rm_idx, bit64);
+}
+
+void RecordCallback::ExtendReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int extend_type, bool bit64) {
+        Emit (MicroOp_ExtendReg, rd_idx, rn_idx, extend_type, bit64);
+}
+
+void RecordCallback::LoadReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64) {
+        Emit (MicroOp_LoadReg, rd_idx, base_idx, rm_idx, size, is_sign, extend, post, bit64);
+}
+
+void RecordCallback::LoadRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend) {
+        Emit (MicroOp_LoadRegI64, rd_idx, ad_idx, size, is_sign, extend);
+}
+
+void RecordCallback::StoreReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64) {
+        Emit (MicroOp_StoreReg, rd_idx, base_idx, rm_idx, size, is_sign, extend, post, bit64);
+}
+
+void RecordCallback::StoreRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend) {
+        Emit (MicroOp_StoreRegI64, rd_idx, ad_idx, size, is_sign, extend);
+}
+
+void RecordCallback::LoadStorePair(unsigned int rt_idx, unsigned int rt2_idx, unsigned int ad_idx, int size, bool is_sign, bool is_vector, bool is_load) {
+        Emit (MicroOp_LoadStorePair, rt_idx, rt2_idx, ad_idx, size, is_sign, is_vector, is_load);
+}
+
+void RecordCallback::LoadExclusive(unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair) {
+        Emit (MicroOp_LoadExclusive, rt_idx, rt2_idx, rn_idx, size, pair);
+}
+
+void RecordCallback::StoreExclusive(unsigned int rs_idx, unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair) {
+        Emit (MicroOp_StoreExclusive, rs_idx, rt_idx, rt2_idx, rn_idx, size, pair);
+}
+
+void RecordCallback::ClearExclusive() {
+        Emit (MicroOp_ClearExclusive);
+}
+
+void RecordCallback::Barrier(int type) {
+        Emit (MicroOp_Barrier, type);
+}
+
+void RecordCallback::Hint(int type) {
+        Emit (MicroOp_Hint, type);
+        /* The thread may be parked right after */
+        block_end = true;
+}
+
+void RecordCallback::_LoadReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend) {
+        Emit (MicroOp__LoadReg, rd_idx, addr, size, is_sign, extend);
+}
+
+void RecordCallback::_StoreReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend) {
+        Emit (MicroOp__StoreReg, rd_idx, addr, size, is_sign, extend);
+}
+
+void RecordCallback::SExtractI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64) {
+        Emit (MicroOp_SExtractI64, rd_idx, rn_idx, pos, len, bit64);
+}
+
+void RecordCallback::UExtractI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64) {
+        Emit (MicroOp_UExtractI64, rd_idx, rn_idx, pos, len, bit64);
+}
+
+void RecordCallback::SExt32(unsigned int rd_idx, unsigned int rn_idx) {
+        Emit (MicroOp_SExt32, rd_idx, rn_idx);
+}
+
+void RecordCallback::RevBit(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Emit (MicroOp_RevBit, rd_idx, rn_idx, bit64);
+}
+
+void RecordCallback::RevByte16(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Emit (MicroOp_RevByte16, rd_idx, rn_idx, bit64);
+}
+
+void RecordCallback::RevByte32(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Emit (MicroOp_RevByte32, rd_idx, rn_idx, bit64);
+}
+
+void RecordCallback::RevByte64(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Emit (MicroOp_RevByte64, rd_idx, rn_idx, bit64);
+}
+
+void RecordCallback::CntLeadZero(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Emit (MicroOp_CntLeadZero, rd_idx, rn_idx, bit64);
+}
+
+void RecordCallback::CntLeadSign(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Emit (MicroOp_CntLeadSign, rd_idx, rn_idx, bit64);
+}
+
+void RecordCallback::Crc32(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, int size, bool castagnoli) {
+        Emit (MicroOp_Crc32, rd_idx, rn_idx, rm_idx, size, castagnoli);
+}
+
+void RecordCallback::CondCmpI64(unsigned int rn_idx, unsigned int imm, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64) {
+        Emit (MicroOp_CondCmpI64, rn_idx, imm, nzcv, cond, op, bit64);
+}
+
+void RecordCallback::CondCmpReg(unsigned int rn_idx, unsigned int rm_idx, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64) {
+        Emit (MicroOp_CondCmpReg, rn_idx, rm_idx, nzcv, cond, op, bit64);
+}
+
+void RecordCallback::BranchI64(uint64_t imm) {
+        Emit (MicroOp_BranchI64, imm);
+        block->target = imm + 4;
+        block_end = true;
+}
+
+void RecordCallback::BranchCondiI64(unsigned int cond, unsigned int rt_idx, uint64_t imm, uint64_t addr, bool bit64) {
+        Emit (MicroOp_BranchCondiI64, cond, rt_idx, imm, addr, bit64);
+        block->target = addr + 4;
+        block_end = true;
+}
+
+void RecordCallback::BranchFlag(unsigned int cond, uint64_t addr) {
+        Emit (MicroOp_BranchFlag, cond, addr);
+        block->target = addr + 4;
+        block_end = true;
+}
+
+void RecordCallback::SetPCReg(unsigned int rt_idx) {
+        Emit (MicroOp_SetPCReg, rt_idx);
+        block_end = true;
+}
+
+void RecordCallback::SVC(unsigned int svc_num) {
+        Emit (MicroOp_SVC, svc_num);
+        block_end = true;
+}
+
+void RecordCallback::BRK(unsigned int memo) {
+        Emit (MicroOp_BRK, memo);
+        block_end = true;
+}
+
+void RecordCallback::HleCall(unsigned int id) {
+        Emit (MicroOp_HleCall, id);
+}
+
+void RecordCallback::ReadWriteSysReg(unsigned int rd_idx, int offset, bool read) {
+        Emit (MicroOp_ReadWriteSysReg, rd_idx, offset, read);
+}
+
+void RecordCallback::ReadWriteNZCV(unsigned int rd_idx, bool read) {
+        Emit (MicroOp_ReadWriteNZCV, rd_idx, read);
+}
+
+void RecordCallback::ReadWriteFPCR(unsigned int rd_idx, bool read) {
+        Emit (MicroOp_ReadWriteFPCR, rd_idx, read);
+}
+
+void RecordCallback::ReadWriteFPSR(unsigned int rd_idx, bool read) {
+        Emit (MicroOp_ReadWriteFPSR, rd_idx, read);
+}
+
+void RecordCallback::DcZva(unsigned int rt_idx) {
+        Emit (MicroOp_DcZva, rt_idx);
+}
+
+void RecordCallback::FMovReg(unsigned int fd_idx, unsigned int fn_idx, int type) {
+        Emit (MicroOp_FMovReg, fd_idx, fn_idx, type);
+}
+
+void RecordCallback::FMovConv(unsigned int rd_idx, unsigned int rn_idx, int type, bool itof) {
+        Emit (MicroOp_FMovConv, rd_idx, rn_idx, type, itof);
+}
+
+void RecordCallback::FpArith(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) {
+        Emit (MicroOp_FpArith, vd_idx, vn_idx, vm_idx, dbl, elements, op);
+}
+
+void RecordCallback::FpPairwise(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) {
+        Emit (MicroOp_FpPairwise, vd_idx, vn_idx, vm_idx, dbl, elements, op);
+}
+
+void RecordCallback::FpMulAdd(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, unsigned int va_idx, bool dbl, int elements, bool neg_prod, bool neg_acc) {
+        Emit (MicroOp_FpMulAdd, vd_idx, vn_idx, vm_idx, va_idx, dbl, elements, neg_prod, neg_acc);
+}
+
+void RecordCallback::FpUnary(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, int op) {
+        Emit (MicroOp_FpUnary, vd_idx, vn_idx, dbl, elements, op);
+}
+
+void RecordCallback::FpConvert(unsigned int vd_idx, unsigned int vn_idx, int from_type, int to_type) {
+        Emit (MicroOp_FpConvert, vd_idx, vn_idx, from_type, to_type);
+}
+
+void RecordCallback::FpConvertVec(unsigned int vd_idx, unsigned int vn_idx, bool to_dbl, bool is_q) {
+        Emit (MicroOp_FpConvertVec, vd_idx, vn_idx, to_dbl, is_q);
+}
+
+void RecordCallback::FpToInt(unsigned int rd_idx, unsigned int vn_idx, bool dbl, bool bit64, bool sign, int rounding, int fbits) {
+        Emit (MicroOp_FpToInt, rd_idx, vn_idx, dbl, bit64, sign, rounding, fbits);
+}
+
+void RecordCallback::IntToFp(unsigned int vd_idx, unsigned int rn_idx, bool dbl, bool bit64, bool sign, int fbits) {
+        Emit (MicroOp_IntToFp, vd_idx, rn_idx, dbl, bit64, sign, fbits);
+}
+
+void RecordCallback::FpToIntVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign, int rounding) {
+        Emit (MicroOp_FpToIntVec, vd_idx, vn_idx, dbl, elements, sign, rounding);
+}
+
+void RecordCallback::IntToFpVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign) {
+        Emit (MicroOp_IntToFpVec, vd_idx, vn_idx, dbl, elements, sign);
+}
+
+void RecordCallback::FpCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, bool cmp_zero, bool signal) {
+        Emit (MicroOp_FpCompare, vn_idx, vm_idx, dbl, cmp_zero, signal);
+}
+
+void RecordCallback::FpCondCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int nzcv, unsigned int cond, bool signal) {
+        Emit (MicroOp_FpCondCompare, vn_idx, vm_idx, dbl, nzcv, cond, signal);
+}
+
+void RecordCallback::FpCondSelect(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int cond) {
+        Emit (MicroOp_FpCondSelect, vd_idx, vn_idx, vm_idx, dbl, cond);
+}
+
+void RecordCallback::AndVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
+        Emit (MicroOp_AndVecReg, rd_idx, rn_idx, rm_idx);
+}
+
+void RecordCallback::OrrVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
+        Emit (MicroOp_OrrVecReg, rd_idx, rn_idx, rm_idx);
+}
+
+void RecordCallback::EorVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
+        Emit (MicroOp_EorVecReg, rd_idx, rn_idx, rm_idx);
+}
+
+void RecordCallback::BicVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
+        Emit (MicroOp_BicVecReg, rd_idx, rn_idx, rm_idx);
+}
+
+void RecordCallback::NotVecReg(unsigned int rd_idx, unsigned int rm_idx) {
+        Emit (MicroOp_NotVecReg, rd_idx, rm_idx);
+}
+
+void RecordCallback::LoadVecReg(unsigned int vd_idx, int element, unsigned int rn_idx, int size) {
+        Emit (MicroOp_LoadVecReg, vd_idx, element, rn_idx, size);
+}
+
+void RecordCallback::StoreVecReg(unsigned int rd_idx, int element, unsigned int vn_idx, int size) {
+        Emit (MicroOp_StoreVecReg, rd_idx, element, vn_idx, size);
+}
+
+void RecordCallback::LoadStoreMulti(unsigned int vt_idx, unsigned int ad_idx, int size, int rpt, int selem, bool is_q, bool is_load) {
+        Emit (MicroOp_LoadStoreMulti, vt_idx, ad_idx, size, rpt, selem, is_q, is_load);
+}
+
+void RecordCallback::LoadFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64) {
+        Emit (MicroOp_LoadFpReg, rd_idx, base_idx, rm_idx, size, post, bit64);
+}
+
+void RecordCallback::StoreFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64) {
+        Emit (MicroOp_StoreFpReg, rd_idx, base_idx, rm_idx, size, post, bit64);
+}
+
+void RecordCallback::LoadFpRegI64(unsigned int fd_idx, unsigned int ad_idx, int size) {
+        Emit (MicroOp_LoadFpRegI64, fd_idx, ad_idx, size);
+}
+
+void RecordCallback::StoreFpRegI64(unsigned int fd_idx, unsigned int ad_idx, int size) {
+        Emit (MicroOp_StoreFpRegI64, fd_idx, ad_idx, size);
+}
+
+void RecordCallback::ReadVecReg(unsigned int fd_idx, unsigned int vn_idx, unsigned int index, int size) {
+        Emit (MicroOp_ReadVecReg, fd_idx, vn_idx, index, size);
+}
+
+void RecordCallback::ReadVecElem(unsigned int rd_idx, unsigned int vn_idx, unsigned int index, int size) {
+        Emit (MicroOp_ReadVecElem, rd_idx, vn_idx, index, size);
+}
+
+void RecordCallback::WriteVecElem(unsigned int vd_idx, unsigned int rn_idx, unsigned int index, int size) {
+        Emit (MicroOp_WriteVecElem, vd_idx, rn_idx, index, size);
+}
+
+void RecordCallback::DupVecImmI32(unsigned int vd_idx, uint32_t imm, int size, int dstsize) {
+        Emit (MicroOp_DupVecImmI32, vd_idx, imm, size, dstsize);
+}
+
+void RecordCallback::DupVecImmI64(unsigned int vd_idx, uint64_t imm, int size, int dstsize) {
+        Emit (MicroOp_DupVecImmI64, vd_idx, imm, size, dstsize);
+}
+
+void RecordCallback::DupVecReg(unsigned int vd_idx, unsigned int vn_idx, unsigned int index, int size, int dstsize) {
+        Emit (MicroOp_DupVecReg, vd_idx, vn_idx, index, size, dstsize);
+}
+
+void RecordCallback::DupVecRegFromGen(unsigned int vd_idx, unsigned int rn_idx, int size, int dstsize) {
+        Emit (MicroOp_DupVecRegFromGen, vd_idx, rn_idx, size, dstsize);
+}
+
+void RecordCallback::CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Emit (MicroOp_CompareEqualVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void RecordCallback::CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Emit (MicroOp_CompareTestBitsVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void RecordCallback::CompareGreaterVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign, bool equal) {
+        Emit (MicroOp_CompareGreaterVec, vd_idx, vn_idx, vm_idx, size, is_q, sign, equal);
+}
+
+void RecordCallback::AddVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Emit (MicroOp_AddVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void RecordCallback::SubVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Emit (MicroOp_SubVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void RecordCallback::MulVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Emit (MicroOp_MulVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void RecordCallback::MaxVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+        Emit (MicroOp_MaxVec, vd_idx, vn_idx, vm_idx, size, is_q, sign);
+}
+
+void RecordCallback::MinVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+        Emit (MicroOp_MinVec, vd_idx, vn_idx, vm_idx, size, is_q, sign);
+}
+
+void RecordCallback::AddSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+        Emit (MicroOp_AddSatVec, vd_idx, vn_idx, vm_idx, size, is_q, sign);
+}
+
+void RecordCallback::SubSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+        Emit (MicroOp_SubSatVec, vd_idx, vn_idx, vm_idx, size, is_q, sign);
+}
+
+void RecordCallback::PolyMulLong(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool upper) {
+        Emit (MicroOp_PolyMulLong, vd_idx, vn_idx, vm_idx, size, upper);
+}
+
+void RecordCallback::CryptoAes(unsigned int vd_idx, unsigned int vn_idx, int op) {
+        Emit (MicroOp_CryptoAes, vd_idx, vn_idx, op);
+}
+
+void RecordCallback::CryptoSha(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int op) {
+        Emit (MicroOp_CryptoSha, vd_idx, vn_idx, vm_idx, op);
+}
+
+namespace BlockCache {
+
+/* Every vCPU thread owns a cache, so lookup and translation need no locking.
+ * Invalidation is broadcast: other threads drop the range at their next lookup. */
+struct Cache {
+        std::unordered_map<uint64_t, BasicBlock *> blocks;
+        /* Blocks invalidated while one of them may still be running (e.g. from SVC) */
+        std::vector<BasicBlock *> retired;
+        uint64_t generation;
+        BasicBlock *lookup_cache[BLOCK_LOOKUP_SIZE];
+        std::atomic<bool> pending_dirty;
+        std::vector<std::pair<uint64_t, uint64_t>> pending; // Ranges invalidated by other threads
+        Cache() : generation(0), lookup_cache{}, pending_dirty(false) {}
+};
+
+static std::mutex caches_lock; // Protects caches and Cache::pending
+static std::vector<Cache *> caches;
+static thread_local Cache *cache;
+
+static Cache *Local() {
+        if (!cache) {
+                cache = new Cache;
+                std::lock_guard<std::mutex> lock (caches_lock);
+                caches.push_back (cache);
+        }
+        return cache;
+}
+
+static inline BasicBlock *&LookupSlot(uint64_t addr) {
+        return cache->lookup_cache[(addr >> 2) & (BLOCK_LOOKUP_SIZE - 1)];
+}
+
+static void Retire(BasicBlock *block) {
+        block->retired = true;
+        cache->retired.push_back (block);
+        cache->generation++;
+}
+
+static void Reclaim() {
+        if (!cache->retired.empty ()) {
+                for (BasicBlock *block : cache->retired)
+                        delete block;
+                cache->retired.clear ();
+        }
+}
+
+static void InvalidateLocal(uint64_t addr, uint64_t len) {
+        auto it = cache->blocks.begin ();
+        while (it != cache->blocks.end ()) {
+                BasicBlock *block = it->second;
+                if (block->addr < addr + len && addr < block->end ()) {
+                        if (LookupSlot (block->addr) == block)
+                                LookupSlot (block->addr) = nullptr;
+                        Retire (block);
+                        it = cache->blocks.erase (it);
+                } else {
+                        ++it;
+                }
+        }
+}
+
+/* Apply invalidations requested by other threads */
+static inline void Sync() {
+        if (!cache->pending_dirty.load (std::memory_order_acquire))
+                return;
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        {
+                std::lock_guard<std::mutex> lock (caches_lock);
+                ranges.swap (cache->pending);
+                cache->pending_dirty = false;
+        }
+        for (auto [addr, len] : ranges)
+                InvalidateLocal (addr, len);
+}
+
+static BasicBlock *Translate(uint64_t addr) {
+        BasicBlock *block = new BasicBlock (addr);
+        RecordCallback rec (block);
+        uint64_t saved_pc = PC;
+        jmp_buf fail;
+        while (!rec.IsBlockEnd () && block->num_insts < BLOCK_MAX_INSTS) {
+                /* Decoder resolves PC relative addresses with current PC */
+                PC = block->end ();
+                size_t num_ops = block->ops.size ();
+                if (block->num_insts > 0) {
+                        /* Undecodable instruction starts its own block, so that it faults only when reached */
+                        if (setjmp (fail)) {
+                                block->ops.resize (num_ops);
+                                break;
+                        }
+                        Disassembler::decode_fail = &fail;
+                }
+                int hook = HLE::Find (PC);
+                if (hook >= 0) {
+                        /* Hooked function gets a block of its own, which returns right away */
+                        if (block->num_insts > 0)
+                                break;
+                        rec.HleCall (hook);
+                        rec.SetPCReg (GPR_LR);
+                } else {
+                        Disassembler::DisasA64 (ARMv8::ReadInst (PC), &rec);
+                }
+                Disassembler::decode_fail = nullptr;
+                rec.NextInsn ();
+                block->num_insts++;
+        }
+        Disassembler::decode_fail = nullptr;
+        PC = saved_pc;
+        if (Optimizer::enabled)
+                Optimizer::Run (block);
+        block->idle = Optimizer::IsIdleLoop (block);
+        debug_print ("Translate block: 0x%lx - 0x%lx (%u ops)\n", block->addr, block->end (), block->ops.size ());
+        cache->blocks[addr] = block;
+        return block;
+}
+
+static BasicBlock *Find(uint64_t addr) {
+        BasicBlock *&slot = LookupSlot (addr);
+        if (slot && slot->addr == addr)
+                return slot;
+        auto it = cache->blocks.find (addr);
+        if (it != cache->blocks.end ())
+                slot = it->second;
+        else
+                slot = Translate (addr);
+        return slot;
+}
+
+BasicBlock *Lookup(uint64_t addr) {
+        Local ();
+        Sync ();
+        Reclaim ();
+        return Find (addr);
+}
+
+BasicBlock *Next(BasicBlock *block, uint64_t addr) {
+        BasicBlock *next;
+        Sync ();
+        int i = addr == block->target ? 0 : (addr == block->end () ? 1 : -1);
+        if (i < 0 || block->retired) {
+                /* Indirect branch */
+                next = Find (addr);
+        } else {
+                if (block->link_gen != cache->generation) {
+                        block->link[0] = block->link[1] = nullptr;
+                        block->link_gen = cache->generation;
+                }
+                if (!block->link[i])
+                        block->link[i] = Find (addr);
+                next = block->link[i];
+        }
+        Reclaim ();
+        return next;
+}
+
+void Invalidate(uint64_t addr, uint64_t len) {
+        {
+                std::lock_guard<std::mutex> lock (caches_lock);
+                for (Cache *other : caches) {
+                        if (other == cache)
+                                continue;
+                        other->pending.push_back (std::make_pair (addr, len));
+                        other->pending_dirty.store (true, std::memory_order_release);
+                }
+        }
+        if (cache)
+                InvalidateLocal (addr, len);
+}
+
+void Flush() {
+        Local ();
+        for (auto &it : cache->blocks)
+                Retire (it.second);
+        cache->blocks.clear ();
+        memset (cache->lookup_cache, 0, sizeof(cache->lookup_cache));
+}
+
+uint64_t Generation() {
+        Local ();
+        Sync ();
+        return cache->generation;
+}
+
+}
@@ -1,11 +1,16 @@
 /* nsemu - LGPL - Copyright 2017 rkx1209<rkx1209dev@gmail.com> */
 #include "Nsemu.hpp"
+#include "ARMv8/DisassemblerImpl.hpp"
+#if defined(__x86_64__)
+#include <immintrin.h>
+/* Built for an extension past the baseline: only called when ARMv8::host_features has it */
+#define HOST_TARGET(isa) __attribute__((target (isa)))
+#endif
 
-Interpreter *Interpreter::inst = nullptr;
-IntprCallback *Interpreter::disas_cb = nullptr;
+thread_local Interpreter *Interpreter::inst = nullptr;
+thread_local IntprCallback *Interpreter::disas_cb = nullptr;
 
 void Interpreter::Init() {
-        Disassembler::Init();
 }
 
 int Interpreter::SingleStep() {
@@ -17,14 +22,514 @@ int Interpreter::SingleStep() {
 	return 0;
 }
 
-static uint64_t counter;
+void Interpreter::RunBlock(BasicBlock *block) {
+        for (const MicroOp &op : block->ops) {
+                if (op.type == MicroOp_NextInsn) {
+                        PC += op.arg[0] * sizeof(uint32_t);
+                        X(GPR_ZERO) = 0; //Reset Zero register
+                } else {
+                        ReplayMicroOp (disas_cb, op);
+                }
+        }
+}
+
+/* Same semantics as RunBlock, but each op jumps straight to the next handler */
+void Interpreter::RunThreaded(BasicBlock *block) {
+        static thread_local const void *handlers[MicroOp_Max + 1];
+        if (!handlers[MicroOp_Max]) {
+#define HANDLER(name) handlers[MicroOp_##name] = &&op_##name
+                HANDLER(NextInsn);
+                HANDLER(MoviI64);
+                HANDLER(DepositI64);
+                HANDLER(DepositReg);
+                HANDLER(DepositZeroI64);
+                HANDLER(DepositZeroReg);
+                HANDLER(MovReg);
+                HANDLER(CondMovReg);
+                HANDLER(AddI64);
+                HANDLER(SubI64);
+                HANDLER(AddReg);
+                HANDLER(SubReg);
+                HANDLER(MulReg);
+                HANDLER(Mul2Reg);
+                HANDLER(DivReg);
+                HANDLER(ShiftReg);
+                HANDLER(AddcReg);
+                HANDLER(SubcReg);
+                HANDLER(AndI64);
+                HANDLER(OrrI64);
+                HANDLER(EorI64);
+                HANDLER(ShiftI64);
+                HANDLER(AndReg);
+                HANDLER(OrrReg);
+                HANDLER(EorReg);
+                HANDLER(BicReg);
+                HANDLER(NotReg);
+                HANDLER(ExtendReg);
+                HANDLER(LoadReg);
+                HANDLER(LoadRegI64);
+                HANDLER(StoreReg);
+                HANDLER(StoreRegI64);
+                HANDLER(LoadStorePair);
+                HANDLER(LoadExclusive);
+                HANDLER(StoreExclusive);
+                HANDLER(ClearExclusive);
+                HANDLER(Barrier);
+                HANDLER(Hint);
+                HANDLER(_LoadReg);
+                HANDLER(_StoreReg);
+                HANDLER(SExtractI64);
+                HANDLER(UExtractI64);
+                HANDLER(SExt32);
+                HANDLER(RevBit);
+                HANDLER(RevByte16);
+                HANDLER(RevByte32);
+                HANDLER(RevByte64);
+                HANDLER(CntLeadZero);
+                HANDLER(CntLeadSign);
+                HANDLER(Crc32);
+                HANDLER(CondCmpI64);
+                HANDLER(CondCmpReg);
+                HANDLER(BranchI64);
+                HANDLER(BranchCondiI64);
+                HANDLER(BranchFlag);
+                HANDLER(SetPCReg);
+                HANDLER(SVC);
+                HANDLER(BRK);
+                HANDLER(HleCall);
+                HANDLER(ReadWriteSysReg);
+                HANDLER(ReadWriteNZCV);
+                HANDLER(ReadWriteFPCR);
+                HANDLER(ReadWriteFPSR);
+                HANDLER(DcZva);
+                HANDLER(FMovReg);
+                HANDLER(FMovConv);
+                HANDLER(FpArith);
+                HANDLER(FpPairwise);
+                HANDLER(FpMulAdd);
+                HANDLER(FpUnary);
+                HANDLER(FpConvert);
+                HANDLER(FpConvertVec);
+                HANDLER(FpToInt);
+                HANDLER(IntToFp);
+                HANDLER(FpToIntVec);
+                HANDLER(IntToFpVec);
+                HANDLER(FpCompare);
+                HANDLER(FpCondCompare);
+                HANDLER(FpCondSelect);
+                HANDLER(AndVecReg);
+                HANDLER(OrrVecReg);
+                HANDLER(EorVecReg);
+                HANDLER(BicVecReg);
+                HANDLER(NotVecReg);
+                HANDLER(LoadVecReg);
+                HANDLER(StoreVecReg);
+                HANDLER(LoadStoreMulti);
+                HANDLER(LoadFpReg);
+                HANDLER(StoreFpReg);
+                HANDLER(LoadFpRegI64);
+                HANDLER(StoreFpRegI64);
+                HANDLER(ReadVecReg);
+                HANDLER(ReadVecElem);
+                HANDLER(WriteVecElem);
+                HANDLER(DupVecImmI32);
+                HANDLER(DupVecImmI64);
+                HANDLER(DupVecReg);
+                HANDLER(DupVecRegFromGen);
+                HANDLER(CompareEqualVec);
+                HANDLER(CompareTestBitsVec);
+                HANDLER(CompareGreaterVec);
+                HANDLER(AddVec);
+                HANDLER(SubVec);
+                HANDLER(MulVec);
+                HANDLER(MaxVec);
+                HANDLER(MinVec);
+                HANDLER(AddSatVec);
+                HANDLER(SubSatVec);
+                HANDLER(PolyMulLong);
+                HANDLER(CryptoAes);
+                HANDLER(CryptoSha);
+                HANDLER(CmpI64Branch);
+                HANDLER(CmpRegBranch);
+                HANDLER(LoadBranchZero);
+                HANDLER(MoviPair);
+#undef HANDLER
+                handlers[MicroOp_Max] = &&op_End;
+        }
+        if (block->threaded.empty ()) {
+                for (const MicroOp &op : block->ops)
+                        block->threaded.push_back ({ handlers[op.type], op.arg });
+                block->threaded.push_back ({ handlers[MicroOp_Max], nullptr });
+        }
+        const ThreadedOp *ip = block->threaded.data ();
+        const uint64_t *a = ip->arg;
+#define NEXT() do { a = (++ip)->arg; goto *ip->handler; } while (0)
+        goto *ip->handler;
+op_NextInsn:
+        PC += a[0] * sizeof(uint32_t);
+        X(GPR_ZERO) = 0; //Reset Zero register
+        NEXT ();
+op_MoviI64:
+        disas_cb->MoviI64 (a[0], a[1], a[2]);
+        NEXT ();
+op_DepositI64:
+        disas_cb->DepositI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_DepositReg:
+        disas_cb->DepositReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_DepositZeroI64:
+        disas_cb->DepositZeroI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_DepositZeroReg:
+        disas_cb->DepositZeroReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_MovReg:
+        disas_cb->MovReg (a[0], a[1], a[2]);
+        NEXT ();
+op_CondMovReg:
+        disas_cb->CondMovReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_AddI64:
+        disas_cb->AddI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_SubI64:
+        disas_cb->SubI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_AddReg:
+        disas_cb->AddReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_SubReg:
+        disas_cb->SubReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_MulReg:
+        disas_cb->MulReg (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_Mul2Reg:
+        disas_cb->Mul2Reg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_DivReg:
+        disas_cb->DivReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_ShiftReg:
+        disas_cb->ShiftReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_AddcReg:
+        disas_cb->AddcReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_SubcReg:
+        disas_cb->SubcReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_AndI64:
+        disas_cb->AndI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_OrrI64:
+        disas_cb->OrrI64 (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_EorI64:
+        disas_cb->EorI64 (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_ShiftI64:
+        disas_cb->ShiftI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_AndReg:
+        disas_cb->AndReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_OrrReg:
+        disas_cb->OrrReg (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_EorReg:
+        disas_cb->EorReg (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_BicReg:
+        disas_cb->BicReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_NotReg:
+        disas_cb->NotReg (a[0], a[1], a[2]);
+        NEXT ();
+op_ExtendReg:
+        disas_cb->ExtendReg (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_LoadReg:
+        disas_cb->LoadReg (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+        NEXT ();
+op_LoadRegI64:
+        disas_cb->LoadRegI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_StoreReg:
+        disas_cb->StoreReg (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+        NEXT ();
+op_StoreRegI64:
+        disas_cb->StoreRegI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_LoadStorePair:
+        disas_cb->LoadStorePair (a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+        NEXT ();
+op_LoadExclusive:
+        disas_cb->LoadExclusive (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_StoreExclusive:
+        disas_cb->StoreExclusive (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_ClearExclusive:
+        disas_cb->ClearExclusive ();
+        NEXT ();
+op_Barrier:
+        disas_cb->Barrier (a[0]);
+        NEXT ();
+op_Hint:
+        disas_cb->Hint (a[0]);
+        NEXT ();
+op__LoadReg:
+        disas_cb->_LoadReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op__StoreReg:
+        disas_cb->_StoreReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_SExtractI64:
+        disas_cb->SExtractI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_UExtractI64:
+        disas_cb->UExtractI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_SExt32:
+        disas_cb->SExt32 (a[0], a[1]);
+        NEXT ();
+op_RevBit:
+        disas_cb->RevBit (a[0], a[1], a[2]);
+        NEXT ();
+op_RevByte16:
+        disas_cb->RevByte16 (a[0], a[1], a[2]);
+        NEXT ();
+op_RevByte32:
+        disas_cb->RevByte32 (a[0], a[1], a[2]);
+        NEXT ();
+op_RevByte64:
+        disas_cb->RevByte64 (a[0], a[1], a[2]);
+        NEXT ();
+op_CntLeadZero:
+        disas_cb->CntLeadZero (a[0], a[1], a[2]);
+        NEXT ();
+op_CntLeadSign:
+        disas_cb->CntLeadSign (a[0], a[1], a[2]);
+        NEXT ();
+op_Crc32:
+        disas_cb->Crc32 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_CondCmpI64:
+        disas_cb->CondCmpI64 (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_CondCmpReg:
+        disas_cb->CondCmpReg (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_BranchI64:
+        disas_cb->BranchI64 (a[0]);
+        NEXT ();
+op_BranchCondiI64:
+        disas_cb->BranchCondiI64 (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_BranchFlag:
+        disas_cb->BranchFlag (a[0], a[1]);
+        NEXT ();
+op_SetPCReg:
+        disas_cb->SetPCReg (a[0]);
+        NEXT ();
+op_SVC:
+        disas_cb->SVC (a[0]);
+        NEXT ();
+op_BRK:
+        disas_cb->BRK (a[0]);
+        NEXT ();
+op_HleCall:
+        disas_cb->HleCall (a[0]);
+        NEXT ();
+op_ReadWriteSysReg:
+        disas_cb->ReadWriteSysReg (a[0], a[1], a[2]);
+        NEXT ();
+op_ReadWriteNZCV:
+        disas_cb->ReadWriteNZCV (a[0], a[1]);
+        NEXT ();
+op_ReadWriteFPCR:
+        disas_cb->ReadWriteFPCR (a[0], a[1]);
+        NEXT ();
+op_ReadWriteFPSR:
+        disas_cb->ReadWriteFPSR (a[0], a[1]);
+        NEXT ();
+op_DcZva:
+        disas_cb->DcZva (a[0]);
+        NEXT ();
+op_FMovReg:
+        disas_cb->FMovReg (a[0], a[1], a[2]);
+        NEXT ();
+op_FMovConv:
+        disas_cb->FMovConv (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_FpArith:
+        disas_cb->FpArith (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_FpPairwise:
+        disas_cb->FpPairwise (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_FpMulAdd:
+        disas_cb->FpMulAdd (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+        NEXT ();
+op_FpUnary:
+        disas_cb->FpUnary (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_FpConvert:
+        disas_cb->FpConvert (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_FpConvertVec:
+        disas_cb->FpConvertVec (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_FpToInt:
+        disas_cb->FpToInt (a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+        NEXT ();
+op_IntToFp:
+        disas_cb->IntToFp (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_FpToIntVec:
+        disas_cb->FpToIntVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_IntToFpVec:
+        disas_cb->IntToFpVec (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_FpCompare:
+        disas_cb->FpCompare (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_FpCondCompare:
+        disas_cb->FpCondCompare (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_FpCondSelect:
+        disas_cb->FpCondSelect (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_AndVecReg:
+        disas_cb->AndVecReg (a[0], a[1], a[2]);
+        NEXT ();
+op_OrrVecReg:
+        disas_cb->OrrVecReg (a[0], a[1], a[2]);
+        NEXT ();
+op_EorVecReg:
+        disas_cb->EorVecReg (a[0], a[1], a[2]);
+        NEXT ();
+op_BicVecReg:
+        disas_cb->BicVecReg (a[0], a[1], a[2]);
+        NEXT ();
+op_NotVecReg:
+        disas_cb->NotVecReg (a[0], a[1]);
+        NEXT ();
+op_LoadVecReg:
+        disas_cb->LoadVecReg (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_StoreVecReg:
+        disas_cb->StoreVecReg (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_LoadStoreMulti:
+        disas_cb->LoadStoreMulti (a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+        NEXT ();
+op_LoadFpReg:
+        disas_cb->LoadFpReg (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_StoreFpReg:
+        disas_cb->StoreFpReg (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_LoadFpRegI64:
+        disas_cb->LoadFpRegI64 (a[0], a[1], a[2]);
+        NEXT ();
+op_StoreFpRegI64:
+        disas_cb->StoreFpRegI64 (a[0], a[1], a[2]);
+        NEXT ();
+op_ReadVecReg:
+        disas_cb->ReadVecReg (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_ReadVecElem:
+        disas_cb->ReadVecElem (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_WriteVecElem:
+        disas_cb->WriteVecElem (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_DupVecImmI32:
+        disas_cb->DupVecImmI32 (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_DupVecImmI64:
+        disas_cb->DupVecImmI64 (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_DupVecReg:
+        disas_cb->DupVecReg (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_DupVecRegFromGen:
+        disas_cb->DupVecRegFromGen (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_CompareEqualVec:
+        disas_cb->CompareEqualVec (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_CompareTestBitsVec:
+        disas_cb->CompareTestBitsVec (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_CompareGreaterVec:
+        disas_cb->CompareGreaterVec (a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+        NEXT ();
+op_AddVec:
+        disas_cb->AddVec (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_SubVec:
+        disas_cb->SubVec (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_MulVec:
+        disas_cb->MulVec (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_MaxVec:
+        disas_cb->MaxVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_MinVec:
+        disas_cb->MinVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_AddSatVec:
+        disas_cb->AddSatVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_SubSatVec:
+        disas_cb->SubSatVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_PolyMulLong:
+        disas_cb->PolyMulLong (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_CryptoAes:
+        disas_cb->CryptoAes (a[0], a[1], a[2]);
+        NEXT ();
+op_CryptoSha:
+        disas_cb->CryptoSha (a[0], a[1], a[2], a[3]);
+        NEXT ();
+op_CmpI64Branch:
+        disas_cb->CmpI64Branch (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_CmpRegBranch:
+        disas_cb->CmpRegBranch (a[0], a[1], a[2], a[3], a[4]);
+        NEXT ();
+op_LoadBranchZero:
+        disas_cb->LoadBranchZero (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+        NEXT ();
+op_MoviPair:
+        disas_cb->MoviPair (a[0], a[1], a[2], a[3], a[4], a[5]);
+        NEXT ();
+op_End:
+        return;
+#undef NEXT
+}
+
+/* Instructions run by this core, to start tracing late */
+static thread_local uint64_t counter;
 void Interpreter::Run() {
 	debug_print ("Running with Interpreter\n");
+        BasicBlock *block = nullptr;
+        unsigned int idle_spins = 0;
 
-        uint64_t estimate = 3728000, mx = 400000;
-        //uint64_t estimate = 3000000, mx = 10000;
-        //uint64_t estimate = 0, mx = 1000000;
+        uint64_t estimate = 3728000;
 	while (Cpu::GetState () == Cpu::State::Running) {
+                if (ARMv8::arm_state->ticks <= 0) {
+                        /* Time slice used up, or the thread blocked */
+                        ThreadManager::Schedule ();
+                        continue;
+                }
 		if (GdbStub::enabled) {
                         if (GdbStub::cont) {
                                 SingleStep();
@@ -36,16 +541,31 @@ void Interpreter::Run() {
                                         GdbStub::Trap(); // Notify SIGTRAP to gdb client
                                 }
                         }
-		} else {
+		} else if (is_debug () || Cpu::TraceOut) {
+		    /* Tracing dumps machine state per instruction */
 		    if (counter >= estimate){
 				Cpu::DumpMachine ();
 		    }
-                    //Cpu::DumpMachine ();
-		    // if (counter >= estimate + mx) {
-		    //     break;
-                    //  }
                      SingleStep ();
 		    counter++;
+                    ARMv8::arm_state->ticks--;
+		} else {
+                        block = block ? BlockCache::Next (block, PC) : BlockCache::Lookup (PC);
+                        if (ARMv8::engine_type == ARMv8::EngineType::Threaded)
+                                RunThreaded (block);
+                        else
+                                RunBlock (block);
+                        counter += block->num_insts;
+                        ARMv8::arm_state->ticks -= block->num_insts;
+                        /* Polling memory nobody writes: park until another core does something */
+                        if (block->idle && PC == block->addr) {
+                                if (++idle_spins >= IDLE_SPIN_LIMIT) {
+                                        idle_spins = 0;
+                                        ThreadManager::WaitForEvent (IDLE_PARK_NS, false);
+                                }
+                        } else {
+                                idle_spins = 0;
+                        }
 		}
 	}
 }
@@ -68,33 +588,6 @@ enum OpType{
 
 const char *OpStrs[] = { "<<", ">>", ">>", "ROR", "+", "-", "&", "|", "^" };
 
-static bool CondHold(unsigned int cond) {
-        bool result = false;
-        if (cond >> 1 == 0x0) {
-                result = ((NZCV & Z_MASK) != 0);
-        } else if (cond >> 1 == 0x1) {
-                result = ((NZCV & C_MASK) != 0);
-        } else if (cond >> 1 == 0x2) {
-                result = ((NZCV & N_MASK) != 0);
-        } else if (cond >> 1 == 0x3) {
-                result = ((NZCV & V_MASK) != 0);
-        } else if (cond >> 1 == 0x4) {
-                result = ((NZCV & C_MASK) != 0) & ((NZCV & Z_MASK) == 0);
-                //printf("nzcv = 0x%016lx, result=%d(%lx,%lx)\n", NZCV, result, (NZCV & C_MASK), !(NZCV & Z_MASK));
-        } else if (cond >> 1 == 0x5) {
-                result = ((NZCV & N_MASK) != 0) == ((NZCV & V_MASK) != 0);
-        } else if (cond >> 1 == 0x6) {
-                result = (((NZCV & N_MASK) != 0) == ((NZCV & V_MASK) != 0)) & ((NZCV & Z_MASK) == 0);
-        } else if (cond >> 1 == 0x7) {
-                return true;
-        } else {
-                ns_abort ("Unknown condition\n");
-        }
-        if (cond & 0x1)
-                result = !result;
-        return result;
-}
-
 static inline bool IsNegative32(uint32_t num) {
         return (num & (1UL << 31)) != 0;
 }
@@ -131,6 +624,103 @@ static void UpdateFlag64(uint64_t res, uint64_t arg1, uint64_t arg2) {
         NZCV = nzcv;
 }
 
+/* Flags of arg1 - arg2 (C is set when no borrow occurs) */
+static void UpdateSubFlag32(uint32_t res, uint32_t arg1, uint32_t arg2) {
+        uint32_t nzcv = 0;
+        if (IsNegative32(res)) nzcv |= N_MASK; // N
+        if (res == 0UL) nzcv |= Z_MASK; // Z
+        if (arg1 >= arg2) nzcv |= C_MASK; // C
+        if (IsNegative32((arg1 ^ arg2) & (arg1 ^ res))) nzcv |= V_MASK; // V
+        NZCV = nzcv;
+}
+static void UpdateSubFlag64(uint64_t res, uint64_t arg1, uint64_t arg2) {
+        uint32_t nzcv = 0;
+        if (IsNegative64(res)) nzcv |= N_MASK; // N
+        if (res == 0ULL) nzcv |= Z_MASK; // Z
+        if (arg1 >= arg2) nzcv |= C_MASK; // C
+        if (IsNegative64((arg1 ^ arg2) & (arg1 ^ res))) nzcv |= V_MASK; // V
+        NZCV = nzcv;
+}
+
+/* Flag setting instructions only record their operands. NZCV is computed here when it's actually read */
+static inline void LazyFlag(ARMv8::FlagOp op, uint64_t res, uint64_t arg1, uint64_t arg2) {
+        ARMv8::ARMv8State::LazyFlag &lf = ARMv8::arm_state->lazy_flag;
+        lf.op = op;
+        lf.res = res;
+        lf.arg1 = arg1;
+        lf.arg2 = arg2;
+}
+
+void ARMv8::EvalFlags() {
+        ARMv8State::LazyFlag &lf = arm_state->lazy_flag;
+        switch (lf.op) {
+        case FLAG_OP_ADD32:
+                UpdateFlag32 (lf.res, lf.arg1, lf.arg2);
+                break;
+        case FLAG_OP_ADD64:
+                UpdateFlag64 (lf.res, lf.arg1, lf.arg2);
+                break;
+        case FLAG_OP_SUB32:
+                UpdateSubFlag32 (lf.res, lf.arg1, lf.arg2);
+                break;
+        case FLAG_OP_SUB64:
+                UpdateSubFlag64 (lf.res, lf.arg1, lf.arg2);
+                break;
+        }
+        lf.op = FLAG_OP_NONE;
+}
+
+/* Condition on flags of arg1 - arg2, evaluated without building NZCV (CMP + B.cond/CSEL) */
+template<typename T> static inline bool SubCondHold(unsigned int cond, T arg1, T arg2) {
+        typedef typename std::make_signed<T>::type S;
+        bool result;
+        switch (cond >> 1) {
+        case 0x0: result = arg1 == arg2; break; // EQ
+        case 0x1: result = arg1 >= arg2; break; // CS
+        case 0x2: result = (S)(T)(arg1 - arg2) < 0; break; // MI
+        case 0x3: result = (S)(T)((arg1 ^ arg2) & (arg1 ^ (T)(arg1 - arg2))) < 0; break; // VS
+        case 0x4: result = arg1 > arg2; break; // HI
+        case 0x5: result = (S)arg1 >= (S)arg2; break; // GE
+        case 0x6: result = (S)arg1 > (S)arg2; break; // GT
+        default: return true;
+        }
+        if (cond & 0x1)
+                result = !result;
+        return result;
+}
+
+static bool CondHold(unsigned int cond) {
+        const ARMv8::ARMv8State::LazyFlag &lf = ARMv8::arm_state->lazy_flag;
+        if (lf.op == ARMv8::FLAG_OP_SUB64)
+                return SubCondHold<uint64_t> (cond, lf.arg1, lf.arg2);
+        if (lf.op == ARMv8::FLAG_OP_SUB32)
+                return SubCondHold<uint32_t> (cond, lf.arg1, lf.arg2);
+        uint32_t nzcv = ARMv8::GetNZCV ();
+        bool result = false;
+        if (cond >> 1 == 0x0) {
+                result = ((nzcv & Z_MASK) != 0);
+        } else if (cond >> 1 == 0x1) {
+                result = ((nzcv & C_MASK) != 0);
+        } else if (cond >> 1 == 0x2) {
+                result = ((nzcv & N_MASK) != 0);
+        } else if (cond >> 1 == 0x3) {
+                result = ((nzcv & V_MASK) != 0);
+        } else if (cond >> 1 == 0x4) {
+                result = ((nzcv & C_MASK) != 0) & ((nzcv & Z_MASK) == 0);
+        } else if (cond >> 1 == 0x5) {
+                result = ((nzcv & N_MASK) != 0) == ((nzcv & V_MASK) != 0);
+        } else if (cond >> 1 == 0x6) {
+                result = (((nzcv & N_MASK) != 0) == ((nzcv & V_MASK) != 0)) & ((nzcv & Z_MASK) == 0);
+        } else if (cond >> 1 == 0x7) {
+                return true;
+        } else {
+                ns_abort ("Unknown condition\n");
+        }
+        if (cond & 0x1)
+                result = !result;
+        return result;
+}
+
 static uint64_t RotateRight(uint64_t val, uint64_t rot) {
         uint64_t left = (val & (1 << rot - 1)) << (64 - rot);
         return left | (val >> rot);
@@ -242,7 +832,7 @@ static uint64_t ALCalc(uint64_t arg1, uint64_t arg2, bool bit64, OpType op) {
         return 0;
 }
 static uint64_t _ArithmeticLogic(uint64_t arg1, uint64_t arg2, bool setflags, bool bit64, OpType _op) {
-        uint64_t result;
+        uint64_t result, subtrahend = arg2;
         OpType op = _op;
         if (_op == AL_TYPE_SUB) {
                 if (bit64) {
@@ -254,13 +844,15 @@ static uint64_t _ArithmeticLogic(uint64_t arg1, uint64_t arg2, bool setflags, bo
         }
         result = ALCalc (arg1, arg2, bit64, op);
         if (setflags) {
-                if (bit64) {
-                        UpdateFlag64 (result, arg1, arg2);
-                        if (_op == AL_TYPE_SUB && arg2 == 0) {
-                                NZCV |= C_MASK;
-                        }
+                if (_op == AL_TYPE_SUB) {
+                        if (bit64)
+                                LazyFlag (ARMv8::FLAG_OP_SUB64, result, arg1, subtrahend);
+                        else
+                                LazyFlag (ARMv8::FLAG_OP_SUB32, (uint32_t) result, (uint32_t) arg1, (uint32_t) subtrahend);
+                } else if (bit64) {
+                        LazyFlag (ARMv8::FLAG_OP_ADD64, result, arg1, arg2);
                 } else {
-                        UpdateFlag32 (result, arg1, arg2);
+                        LazyFlag (ARMv8::FLAG_OP_ADD32, (uint32_t) result, (uint32_t) arg1, (uint32_t) arg2);
                 }
         }
         return result;
@@ -430,7 +1022,7 @@ void IntprCallback::ShiftReg(unsigned int rd_idx, unsigned int rn_idx, unsigned
 void IntprCallback::AddcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
         AddReg (rd_idx, rn_idx, rm_idx, setflags, bit64);
         /* Add carry */
-        if (NZCV & C_MASK) {
+        if (ARMv8::GetNZCV () & C_MASK) {
                 if (bit64)
                         X(rd_idx) = X(rd_idx) + 1;
                 else
@@ -440,7 +1032,7 @@ void IntprCallback::AddcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned i
 void IntprCallback::SubcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
         SubReg (rd_idx, rn_idx, rm_idx, setflags, bit64);
         /* Add carry */
-        if (NZCV & C_MASK) {
+        if (ARMv8::GetNZCV () & C_MASK) {
                 if (bit64)
                         X(rd_idx) = X(rd_idx) + 1;
                 else
@@ -671,6 +1263,122 @@ void IntprCallback::StoreRegI64(unsigned int rd_idx, unsigned int ad_idx, int si
                 _StoreReg (rd_idx, X(ad_idx), size, is_sign, extend);
 }
 
+void IntprCallback::LoadStorePair(unsigned int rt_idx, unsigned int rt2_idx, unsigned int ad_idx, int size,
+                                  bool is_sign, bool is_vector, bool is_load) {
+        uint64_t addr = X(ad_idx);
+        unsigned int regs[2] = { rt_idx, rt2_idx };
+        int bytes = 1 << size;
+        uint8_t buf[32];
+        debug_print ("%s pair(%d): %c[%u], %c[%u] [0x%lx]\n", is_load ? "Load" : "Store", size,
+                     is_vector ? 'V' : 'X', rt_idx, is_vector ? 'V' : 'X', rt2_idx, addr);
+        if (is_load) {
+                /* No register is modified before the whole access went through */
+                ARMv8::ReadRange (addr, buf, bytes * 2);
+                for (int i = 0; i < 2; i++) {
+                        const uint8_t *src = buf + i * bytes;
+                        if (is_vector) {
+                                VREG(regs[i]).d[0] = VREG(regs[i]).d[1] = 0;
+                                std::memcpy (VREG(regs[i]).b, src, bytes);
+                        } else if (size == 3) {
+                                std::memcpy (&X(regs[i]), src, 8);
+                        } else {
+                                uint32_t w;
+                                std::memcpy (&w, src, 4);
+                                X(regs[i]) = is_sign ? (uint64_t) (int64_t) (int32_t) w : w;
+                        }
+                }
+        } else {
+                for (int i = 0; i < 2; i++) {
+                        if (is_vector)
+                                std::memcpy (buf + i * bytes, VREG(regs[i]).b, bytes);
+                        else
+                                std::memcpy (buf + i * bytes, &X(regs[i]), bytes);
+                }
+                ARMv8::WriteRange (addr, buf, bytes * 2);
+        }
+}
+
+void IntprCallback::LoadExclusive(unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair) {
+        ARMv8::ARMv8State::Exclusive &excl = ARMv8::arm_state->excl;
+        excl.addr = X(rn_idx);
+        excl.size = pair ? size + 1 : size;
+        debug_print ("LoadExclusive(%d): [0x%lx]\n", excl.size, excl.addr);
+        ARMv8::ReadExclusive (excl.addr, excl.size, excl.val);
+        excl.armed = true;
+        if (!pair) {
+                X(rt_idx) = excl.val[0];
+        } else if (size == 2) {
+                X(rt_idx) = (uint32_t) excl.val[0];
+                X(rt2_idx) = excl.val[0] >> 32;
+        } else {
+                X(rt_idx) = excl.val[0];
+                X(rt2_idx) = excl.val[1];
+        }
+}
+
+void IntprCallback::StoreExclusive(unsigned int rs_idx, unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair) {
+        ARMv8::ARMv8State::Exclusive &excl = ARMv8::arm_state->excl;
+        uint64_t addr = X(rn_idx);
+        uint64_t val[2];
+        if (!pair) {
+                val[0] = X(rt_idx);
+        } else if (size == 2) {
+                val[0] = W(rt_idx) | (uint64_t) W(rt2_idx) << 32;
+                size++;
+        } else {
+                val[0] = X(rt_idx);
+                val[1] = X(rt2_idx);
+                size++;
+        }
+        bool ok = excl.armed && excl.addr == addr && excl.size == size && ARMv8::CompareAndSwap (addr, size, excl.val, val);
+        debug_print ("StoreExclusive(%d): [0x%lx] %s\n", size, addr, ok ? "success" : "fail");
+        excl.armed = false;
+        X(rs_idx) = ok ? 0 : 1;
+        /* The store clears the monitors of cores waiting on the location in WFE, which wakes them */
+        if (ok && ThreadManager::HasEventWaiters ())
+                ThreadManager::SendEvent (false);
+}
+
+void IntprCallback::ClearExclusive() {
+        ARMv8::arm_state->excl.armed = false;
+}
+
+void IntprCallback::Barrier(int type) {
+        switch (type) {
+        case Disassembler::Barrier_ACQUIRE:
+                std::atomic_thread_fence (std::memory_order_acquire);
+                break;
+        case Disassembler::Barrier_RELEASE:
+                std::atomic_thread_fence (std::memory_order_release);
+                break;
+        default:
+                std::atomic_thread_fence (std::memory_order_seq_cst);
+                break;
+        }
+}
+
+void IntprCallback::Hint(int type) {
+        switch (type) {
+        case Disassembler::Hint_YIELD:
+                /* Let other threads of the core run */
+                ARMv8::arm_state->ticks = 0;
+                break;
+        case Disassembler::Hint_WFE:
+                ThreadManager::WaitForEvent (IDLE_PARK_NS, true);
+                break;
+        case Disassembler::Hint_WFI:
+                /* No interrupts are delivered: just idle for a while */
+                ThreadManager::WaitForEvent (IDLE_PARK_NS, false);
+                break;
+        case Disassembler::Hint_SEV:
+                ThreadManager::SendEvent (false);
+                break;
+        case Disassembler::Hint_SEVL:
+                ThreadManager::SendEvent (true);
+                break;
+        }
+}
+
 /* Load/Store for vector */
 void IntprCallback::LoadVecReg(unsigned int vd_idx, int element, unsigned int rn_idx, int size) {
         uint64_t addr = X(ARMv8::HandleAsSP (rn_idx));
@@ -703,6 +1411,134 @@ void IntprCallback::StoreVecReg(unsigned int rd_idx, int element, unsigned int v
         }
 }
 
+#if defined(__x86_64__)
+/*
+ * LD2/LD4 and ST2/ST4 within 16 byte lanes: a byte shuffle gathers element k
+ * of the structures of each lane into its k-th 16 / selem bytes, which leaves
+ * a transpose of those pieces across the lanes. Both steps are inverted for
+ * stores. Needs 16 / selem >= element size, LD3/ST3 straddle the lanes.
+ */
+struct StructShuffle {
+        __m128i gather[4][2]; // [size][selem == 4]
+        __m128i scatter[4][2];
+        StructShuffle() {
+                for (int size = 0; size < 4; size++) {
+                        for (int selem = 2; selem <= 4; selem += 2) {
+                                int ebytes = 1 << size, group = 16 / selem;
+                                alignas(16) uint8_t g[16], sc[16];
+                                for (int i = 0; i < 16; i++)
+                                        g[i] = sc[i] = i;
+                                for (int k = 0; k < selem && ebytes <= group; k++) {
+                                        for (int j = 0; j < group / ebytes; j++) {
+                                                for (int b = 0; b < ebytes; b++) {
+                                                        int out = k * group + j * ebytes + b;
+                                                        int in = (j * selem + k) * ebytes + b;
+                                                        g[out] = in;
+                                                        sc[in] = out;
+                                                }
+                                        }
+                                }
+                                gather[size][selem == 4] = _mm_load_si128 ((const __m128i *) g);
+                                scatter[size][selem == 4] = _mm_load_si128 ((const __m128i *) sc);
+                        }
+                }
+        }
+};
+static const StructShuffle struct_shuffle;
+
+/* Self inverse */
+static inline void TransposeLanes(__m128i *v, int selem) {
+        if (selem == 2) {
+                __m128i t = v[0];
+                v[0] = _mm_unpacklo_epi64 (t, v[1]);
+                v[1] = _mm_unpackhi_epi64 (t, v[1]);
+        } else {
+                __m128i t0 = _mm_unpacklo_epi32 (v[0], v[1]);
+                __m128i t1 = _mm_unpacklo_epi32 (v[2], v[3]);
+                __m128i t2 = _mm_unpackhi_epi32 (v[0], v[1]);
+                __m128i t3 = _mm_unpackhi_epi32 (v[2], v[3]);
+                v[0] = _mm_unpacklo_epi64 (t0, t1);
+                v[1] = _mm_unpackhi_epi64 (t0, t1);
+                v[2] = _mm_unpacklo_epi64 (t2, t3);
+                v[3] = _mm_unpackhi_epi64 (t2, t3);
+        }
+}
+
+HOST_TARGET("ssse3") static void TransferStructsHost(uint8_t *buf, unsigned int vt_idx, int size, int selem, bool is_load) {
+        __m128i v[4];
+        if (is_load) {
+                for (int i = 0; i < selem; i++)
+                        v[i] = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) buf + i),
+                                                 struct_shuffle.gather[size][selem == 4]);
+                /* 64-bit forms read zeros into the upper halves */
+                TransposeLanes (v, selem);
+                for (int i = 0; i < selem; i++)
+                        _mm_storeu_si128 ((__m128i *) VREG((vt_idx + i) % 32).b, v[i]);
+        } else {
+                for (int i = 0; i < selem; i++)
+                        v[i] = _mm_loadu_si128 ((const __m128i *) VREG((vt_idx + i) % 32).b);
+                TransposeLanes (v, selem);
+                for (int i = 0; i < selem; i++)
+                        _mm_storeu_si128 ((__m128i *) buf + i,
+                                          _mm_shuffle_epi8 (v[i], struct_shuffle.scatter[size][selem == 4]));
+        }
+}
+#endif
+
+/* Between buf (as in memory, zero padded to 64 bytes) and selem registers from vt_idx on */
+static void TransferStructs(uint8_t *buf, unsigned int vt_idx, int size, int selem, bool is_q, bool is_load) {
+        int ebytes = 1 << size;
+        int elements = (is_q ? 16 : 8) >> size;
+#if defined(__x86_64__)
+        if (ARMv8::host_features.ssse3 && selem != 3 && ebytes <= 16 / selem) {
+                TransferStructsHost (buf, vt_idx, size, selem, is_load);
+                return;
+        }
+#endif
+        if (is_load) {
+                for (int i = 0; i < selem; i++)
+                        VREG((vt_idx + i) % 32).d[0] = VREG((vt_idx + i) % 32).d[1] = 0;
+        }
+        for (int e = 0; e < elements; e++) {
+                for (int i = 0; i < selem; i++) {
+                        uint8_t *elem = &VREG((vt_idx + i) % 32).b[e * ebytes];
+                        uint8_t *mem = buf + (e * selem + i) * ebytes;
+                        if (is_load)
+                                std::memcpy (elem, mem, ebytes);
+                        else
+                                std::memcpy (mem, elem, ebytes);
+                }
+        }
+}
+
+void IntprCallback::LoadStoreMulti(unsigned int vt_idx, unsigned int ad_idx, int size, int rpt, int selem,
+                                   bool is_q, bool is_load) {
+        uint64_t addr = X(ad_idx);
+        int rbytes = is_q ? 16 : 8;
+        int len = rpt * selem * rbytes;
+        alignas(16) uint8_t buf[64] = {};
+        debug_print ("%s multi(%d): V[%u] x %d (%d elements) [0x%lx]\n", is_load ? "Load" : "Store",
+                     size, vt_idx, rpt * selem, selem, addr);
+        if (is_load)
+                ARMv8::ReadRange (addr, buf, len);
+        if (selem == 1) {
+                /* LD1/ST1 of consecutive registers: nothing to interleave */
+                for (int r = 0; r < rpt; r++) {
+                        unsigned int vreg = (vt_idx + r) % 32;
+                        if (is_load) {
+                                VREG(vreg).d[1] = 0;
+                                std::memcpy (VREG(vreg).b, buf + r * rbytes, rbytes);
+                        } else {
+                                std::memcpy (buf + r * rbytes, VREG(vreg).b, rbytes);
+                        }
+                }
+        } else {
+                TransferStructs (buf, vt_idx, size, selem, is_q, is_load);
+        }
+        if (!is_load)
+                ARMv8::WriteRange (addr, buf, len);
+}
+
 static void _LoadFpReg(unsigned int fd_idx, uint64_t addr, int size) {
         VREG(fd_idx).d[0] = VREG(fd_idx).d[1] = 0; // 0 clear
         if (size == 0) { // 1byte (8B/16B)
@@ -889,6 +1725,92 @@ void IntprCallback::CntLeadSign(unsigned int rd_idx, unsigned int rn_idx, bool b
                 X(rd_idx) = Cls32 (W(rn_idx));
 }
 
+/* Both CRCs are bit reflected and take the accumulator as is (no inversion before
+ * or after), like the host crc32 instruction which computes CRC32C */
+#define CRC32_POLY  0xedb88320U
+#define CRC32C_POLY 0x82f63b78U
+
+struct CrcTable {
+        uint32_t t[256];
+        CrcTable(uint32_t poly) {
+                for (uint32_t i = 0; i < 256; i++) {
+                        uint32_t crc = i;
+                        for (int b = 0; b < 8; b++)
+                                crc = (crc >> 1) ^ ((crc & 1) ? poly : 0);
+                        t[i] = crc;
+                }
+        }
+};
+
+static inline uint32_t CrcTableUpdate(const CrcTable &table, uint32_t crc, uint64_t val, int size) {
+        for (int i = 0; i < (1 << size); i++, val >>= 8)
+                crc = table.t[(crc ^ val) & 0xff] ^ (crc >> 8);
+        return crc;
+}
+
+#if defined(__x86_64__)
+/* Barrett reduction of a reflected 64bit remainder: v * x^32 mod P */
+HOST_TARGET("pclmul") static inline uint32_t CrcBarrett(uint64_t v) {
+        const __m128i k = _mm_set_epi64x (0x1f7011641, 0x1db710641); // floor(x^64 / P), P (both reflected)
+        const __m128i mask32 = _mm_set_epi32 (0, 0, 0, -1);
+        __m128i x = _mm_cvtsi64_si128 (v);
+        __m128i t = _mm_clmulepi64_si128 (_mm_and_si128 (x, mask32), k, 0x10);
+        t = _mm_clmulepi64_si128 (_mm_and_si128 (t, mask32), k, 0x00);
+        return _mm_cvtsi128_si64 (_mm_xor_si128 (x, t)) >> 32;
+}
+
+HOST_TARGET("pclmul") static uint32_t CrcIeeeHost(uint32_t crc, uint64_t val, int size) {
+        switch (size) {
+        case 0:
+                return (crc >> 8) ^ CrcBarrett ((uint64_t) ((crc ^ val) & 0xff) << 24);
+        case 1:
+                return (crc >> 16) ^ CrcBarrett ((uint64_t) ((crc ^ val) & 0xffff) << 16);
+        case 2:
+                return CrcBarrett ((crc ^ val) & 0xffffffff);
+        default:
+                return CrcBarrett (CrcBarrett (crc ^ (val & 0xffffffff)) ^ (val >> 32));
+        }
+}
+
+HOST_TARGET("sse4.2") static uint32_t CrcCastagnoliHost(uint32_t crc, uint64_t val, int size) {
+        switch (size) {
+        case 0:
+                return _mm_crc32_u8 (crc, val);
+        case 1:
+                return _mm_crc32_u16 (crc, val);
+        case 2:
+                return _mm_crc32_u32 (crc, val);
+        default:
+                return _mm_crc32_u64 (crc, val);
+        }
+}
+#endif
+
+static const CrcTable crc32_table (CRC32_POLY);
+static const CrcTable crc32c_table (CRC32C_POLY);
+
+static uint32_t CrcIeee(uint32_t crc, uint64_t val, int size) {
+#if defined(__x86_64__)
+        if (ARMv8::host_features.pclmul)
+                return CrcIeeeHost (crc, val, size);
+#endif
+        return CrcTableUpdate (crc32_table, crc, val, size);
+}
+
+static uint32_t CrcCastagnoli(uint32_t crc, uint64_t val, int size) {
+#if defined(__x86_64__)
+        if (ARMv8::host_features.sse4_2)
+                return CrcCastagnoliHost (crc, val, size);
+#endif
+        return CrcTableUpdate (crc32c_table, crc, val, size);
+}
+
+void IntprCallback::Crc32(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, int size, bool castagnoli) {
+        uint32_t acc = W(rn_idx);
+        uint64_t val = X(rm_idx);
+        X(rd_idx) = castagnoli ? CrcCastagnoli (acc, val, size) : CrcIeee (acc, val, size);
+}
+
 /* Conditional compare... with Immediate value */
 void IntprCallback::CondCmpI64(unsigned int rn_idx, unsigned int imm, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64) {
         if (CondHold (cond)) {
@@ -899,7 +1821,7 @@ void IntprCallback::CondCmpI64(unsigned int rn_idx, unsigned int imm, unsigned i
                 }
         } else {
                 /* Set new nzcv */
-                NZCV = (nzcv) << 28;
+                ARMv8::SetNZCV ((nzcv) << 28);
         }
 }
 /* Conditional compare... between registers */
@@ -912,7 +1834,7 @@ void IntprCallback::CondCmpReg(unsigned int rn_idx, unsigned int rm_idx, unsigne
                 }
         } else {
                 /* Set new nzcv */
-                NZCV = (nzcv) << 28;
+                ARMv8::SetNZCV ((nzcv) << 28);
         }
 }
 
@@ -958,6 +1880,7 @@ void IntprCallback::SetPCReg(unsigned int rt_idx) {
 /* Super Visor Call */
 void IntprCallback::SVC(unsigned int svc_num) {
         ns_print ("SVC: 0x%02x\n", svc_num);
+        std::lock_guard<std::mutex> lock (SVC::kernel_lock);
         if (SVC::svc_handlers[svc_num])
                 SVC::svc_handlers[svc_num]();
         else
@@ -970,6 +1893,11 @@ void IntprCallback::BRK(unsigned int memo) {
         GdbStub::Trap();
 }
 
+/* Hooked guest function */
+void IntprCallback::HleCall(unsigned int id) {
+        HLE::Call (id);
+}
+
 /* Read Vector register to FP register */
 void IntprCallback::ReadVecReg(unsigned int rd_idx, unsigned int vn_idx, unsigned int index, int size) {
         VREG(rd_idx).d[0] = VREG(rd_idx).d[1] = 0; // 0 clear
@@ -984,20 +1912,169 @@ void IntprCallback::ReadVecReg(unsigned int rd_idx, unsigned int vn_idx, unsigne
         }
 }
 
+/* ####### NEON vector helpers ####### */
+/* Vector callbacks work on the whole register. With SSE2 an op is an aligned
+ * load of each source, one or two host instructions and a store. Hosts without
+ * SSE2 (and the lane sizes SSE2 lacks) go through VecLanes instead.
+ * A 64bit (!is_q) result clears the upper half of Vd. */
+
+#if defined(__SSE2__)
+static inline __m128i LoadVec(unsigned int idx) {
+        return _mm_load_si128 ((const __m128i *) &VREG(idx));
+}
+
+static inline void StoreVec(unsigned int idx, __m128i v, bool is_q) {
+        if (!is_q)
+                v = _mm_move_epi64 (v);
+        _mm_store_si128 ((__m128i *) &VREG(idx), v);
+}
+
+static inline __m128i SplatVec(uint64_t imm, int size) {
+        switch (size) {
+        case 0:
+                return _mm_set1_epi8 ((char) imm);
+        case 1:
+                return _mm_set1_epi16 ((short) imm);
+        case 2:
+                return _mm_set1_epi32 ((int) imm);
+        default:
+                return _mm_set1_epi64x ((long long) imm);
+        }
+}
+
+static inline __m128i SelectVec(__m128i mask, __m128i a, __m128i b) {
+        return _mm_or_si128 (_mm_and_si128 (mask, a), _mm_andnot_si128 (mask, b));
+}
+
+static inline __m128i CmpEqVec(__m128i n, __m128i m, int size) {
+        switch (size) {
+        case 0:
+                return _mm_cmpeq_epi8 (n, m);
+        case 1:
+                return _mm_cmpeq_epi16 (n, m);
+        case 2:
+                return _mm_cmpeq_epi32 (n, m);
+        default: {
+                /* Both 32bit halves have to match */
+                __m128i eq = _mm_cmpeq_epi32 (n, m);
+                return _mm_and_si128 (eq, _mm_shuffle_epi32 (eq, _MM_SHUFFLE (2, 3, 0, 1)));
+        }
+        }
+}
+
+/* Greater than mask. SSE2 only compares signed, so unsigned operands get their
+ * sign bits flipped first. Returns false for 64bit lanes without SSE4.2 */
+static inline bool CmpGtVec(__m128i n, __m128i m, int size, bool sign, __m128i *res) {
+        if (!sign) {
+                __m128i bias = SplatVec (1ULL << ((8 << size) - 1), size);
+                n = _mm_xor_si128 (n, bias);
+                m = _mm_xor_si128 (m, bias);
+        }
+        switch (size) {
+        case 0:
+                *res = _mm_cmpgt_epi8 (n, m);
+                return true;
+        case 1:
+                *res = _mm_cmpgt_epi16 (n, m);
+                return true;
+        case 2:
+                *res = _mm_cmpgt_epi32 (n, m);
+                return true;
+        default:
+#if defined(__SSE4_2__)
+                *res = _mm_cmpgt_epi64 (n, m);
+                return true;
+#else
+                return false;
+#endif
+        }
+}
+#endif
+
+/* Vd[e] = op (Vn[e], Vm[e]) for each T sized element */
+template<typename T, typename F>
+static void VecLanes(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool is_q, F op) {
+        const int lanes = 16 / sizeof(T);
+        T n[lanes], m[lanes], d[lanes] = {};
+        int elements = is_q ? lanes : lanes / 2;
+        memcpy (n, &VREG(vn_idx), sizeof(n));
+        memcpy (m, &VREG(vm_idx), sizeof(m));
+        for (int e = 0; e < elements; e++)
+                d[e] = op (n[e], m[e]);
+        memcpy (&VREG(vd_idx), d, sizeof(d));
+}
+
+template<typename F>
+static void VecLanesBySize(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign, F op) {
+        switch (size + 4 * sign) {
+        case 0:
+                VecLanes<uint8_t> (vd_idx, vn_idx, vm_idx, is_q, op);
+                break;
+        case 1:
+                VecLanes<uint16_t> (vd_idx, vn_idx, vm_idx, is_q, op);
+                break;
+        case 2:
+                VecLanes<uint32_t> (vd_idx, vn_idx, vm_idx, is_q, op);
+                break;
+        case 3:
+                VecLanes<uint64_t> (vd_idx, vn_idx, vm_idx, is_q, op);
+                break;
+        case 4:
+                VecLanes<int8_t> (vd_idx, vn_idx, vm_idx, is_q, op);
+                break;
+        case 5:
+                VecLanes<int16_t> (vd_idx, vn_idx, vm_idx, is_q, op);
+                break;
+        case 6:
+                VecLanes<int32_t> (vd_idx, vn_idx, vm_idx, is_q, op);
+                break;
+        default:
+                VecLanes<int64_t> (vd_idx, vn_idx, vm_idx, is_q, op);
+                break;
+        }
+}
+
 template<typename T>
-static void DupVecImm(unsigned int vd_idx, T imm, int size, int dstsize) {
-        uint32_t i;
-        int sec_size = sizeof(T) * 8;
-        for (i = 0; i + sec_size <= dstsize; i += sec_size){
+static T LaneMask(bool cond) {
+        return cond ? (T) ~(T) 0 : (T) 0;
+}
+
+template<typename T>
+static T SaturateAdd(T a, T b) {
+        T res;
+        if (!__builtin_add_overflow (a, b, &res))
+                return res;
+        return std::is_signed<T>::value && b < 0 ? std::numeric_limits<T>::min () : std::numeric_limits<T>::max ();
+}
+
+template<typename T>
+static T SaturateSub(T a, T b) {
+        T res;
+        if (!__builtin_sub_overflow (a, b, &res))
+                return res;
+        if (!std::is_signed<T>::value)
+                return 0;
+        return b < 0 ? std::numeric_limits<T>::max () : std::numeric_limits<T>::min ();
+}
+
+/* Duplicate imm into each element of the low dstsize bits, the rest is cleared */
+static void DupVecImm(unsigned int vd_idx, uint64_t imm, int size, int dstsize) {
+#if defined(__SSE2__)
+        StoreVec (vd_idx, SplatVec (imm, size), dstsize == 128);
+#else
+        ARMv8::vreg_t res = {};
+        for (int e = 0; e < (dstsize >> 3) >> size; e++) {
                 if (size == 0)
-                        VREG(vd_idx).b[i / sec_size] = imm;
+                        res.b[e] = imm;
                 else if (size == 1)
-                        VREG(vd_idx).h[i / sec_size] = imm;
+                        res.h[e] = imm;
                 else if (size == 2)
-                        VREG(vd_idx).s[i / sec_size] = imm;
+                        res.s[e] = imm;
                 else
-                        VREG(vd_idx).d[i / sec_size] = imm;
+                        res.d[e] = imm;
         }
+        VREG(vd_idx) = res;
+#endif
 }
 
 void IntprCallback::DupVecImmI32(unsigned int vd_idx, uint32_t imm, int size, int dstsize) {
@@ -1023,15 +2100,7 @@ void IntprCallback::DupVecReg(unsigned int vd_idx, unsigned int vn_idx, unsigned
 
 /* Duplicate an general register into vector register */
 void IntprCallback::DupVecRegFromGen(unsigned int vd_idx, unsigned int rn_idx, int size, int dstsize) {
-        if (size == 0) {
-                DupVecImm(vd_idx, (uint8_t) (X(rn_idx) & 0xff), size, dstsize);
-        } else if (size == 1) {
-                DupVecImm(vd_idx, (uint16_t) (X(rn_idx) & 0xffff), size, dstsize);
-        } else if (size == 2) {
-                DupVecImm(vd_idx, (uint32_t) (X(rn_idx) & 0xffffffff), size, dstsize);
-        } else if (size == 3) {
-                DupVecImm(vd_idx, X(rn_idx), size, dstsize);
-        }
+        DupVecImm(vd_idx, X(rn_idx), size, dstsize);
 }
 
 /* Read/Write Sysreg */
@@ -1047,38 +2116,66 @@ void IntprCallback::ReadWriteSysReg(unsigned int rd_idx, int offset, bool read)
 /* Read/Write NZCV */
 void IntprCallback::ReadWriteNZCV(unsigned int rd_idx, bool read) {
         if (read) {
-                X(rd_idx) = NZCV;
+                X(rd_idx) = ARMv8::GetNZCV ();
         } else {
-                NZCV = (uint32_t)(X(rd_idx) & 0xffffffff);
+                ARMv8::SetNZCV ((uint32_t)(X(rd_idx) & 0xffffffff));
         }
 }
 
+/* Read/Write FPCR/FPSR */
+void IntprCallback::ReadWriteFPCR(unsigned int rd_idx, bool read) {
+        if (read) {
+                X(rd_idx) = ARMv8::arm_state->fpcr;
+        } else {
+                ARMv8::SetFPCR ((uint32_t)(X(rd_idx) & 0xffffffff));
+        }
+}
+
+void IntprCallback::ReadWriteFPSR(unsigned int rd_idx, bool read) {
+        if (read) {
+                X(rd_idx) = ARMv8::GetFPSR ();
+        } else {
+                ARMv8::SetFPSR ((uint32_t)(X(rd_idx) & 0xffffffff));
+        }
+}
+
+/* DC ZVA */
+void IntprCallback::DcZva(unsigned int rt_idx) {
+        /* DCZID_EL0.BS is log2 of the block size in words */
+        uint64_t len = 4ULL << (SYSR.tczid_el[0] & 0xf);
+        ARMv8::ZeroRange (X(rt_idx) & ~(len - 1), len);
+}
+
 /* Fp Mov between registers */
 void IntprCallback::FMovReg(unsigned int fd_idx, unsigned int fn_idx, int type) {
+        uint64_t v = VREG(fn_idx).d[0];
+        VREG(fd_idx).d[0] = VREG(fd_idx).d[1] = 0; // 0 clear
         if (type == 0) {
-                S(fd_idx) = S(fn_idx);
+                S(fd_idx) = (uint32_t) v;
         } else if (type == 1) {
-                D(fd_idx) = D(fn_idx);
+                D(fd_idx) = v;
         } else if (type == 3) {
-                H(fd_idx) = H(fn_idx);
+                H(fd_idx) = (uint16_t) v;
         }
-
 }
+
 /* Fp Mov between registers (float <-> int)*/
 void IntprCallback::FMovConv(unsigned int rd_idx, unsigned int rn_idx, int type, bool itof) {
         if (itof) {
                 // Float <= Int
+                if (type == 2) {
+                        /* FMOV Vd.D[1], Xn keeps the low half */
+                        VREG(rd_idx).d[1] = X(rn_idx);
+                        return;
+                }
                 VREG(rd_idx).d[0] = VREG(rd_idx).d[1] = 0; // 0 clear
                 switch (type) {
                 case 0:
-                        H(rd_idx) = W(rn_idx);
+                        S(rd_idx) = W(rn_idx);
                         break;
                 case 1:
                         D(rd_idx) = X(rn_idx);
                         break;
-                case 2:
-                        VREG(rd_idx).d[1] = X(rn_idx);
-                        break;
                 case 3:
                         H(rd_idx) = X(rn_idx);
                         break;
@@ -1102,34 +2199,833 @@ void IntprCallback::FMovConv(unsigned int rd_idx, unsigned int rn_idx, int type,
         }
 }
 
+/* ####### Floating point ####### */
+/* FP ops run on host float/double arithmetic. The host rounding mode and flush-to-zero
+ * follow FPCR (ARMv8::SetFPCR) and host exception flags are collected into FPSR when it
+ * is read, so the common case is one host instruction per element. Only NaN results take
+ * the slow path, to get ARM's NaN propagation and default NaN (x86's is negative). */
+
+template<typename T> struct FpTraits;
+template<> struct FpTraits<float> {
+        typedef uint32_t Bits;
+        typedef int32_t SBits;
+        static const int frac_bits = 23;
+        static const int exp_bits = 8;
+        static const Bits default_nan = 0x7fc00000;
+};
+template<> struct FpTraits<double> {
+        typedef uint64_t Bits;
+        typedef int64_t SBits;
+        static const int frac_bits = 52;
+        static const int exp_bits = 11;
+        static const Bits default_nan = 0x7ff8000000000000ULL;
+};
+
+template<typename T> static inline typename FpTraits<T>::Bits FpToBits(T v) {
+        typename FpTraits<T>::Bits b;
+        memcpy (&b, &v, sizeof(b));
+        return b;
+}
+
+template<typename T> static inline T FpFromBits(typename FpTraits<T>::Bits b) {
+        T v;
+        memcpy (&v, &b, sizeof(v));
+        return v;
+}
+
+template<typename T> static inline typename FpTraits<T>::Bits FpSignBit() {
+        return (typename FpTraits<T>::Bits) 1 << (sizeof(T) * 8 - 1);
+}
+
+static inline void FpRaise(uint32_t flags) {
+        ARMv8::arm_state->fpsr |= flags;
+}
+
+template<typename T> static inline bool FpIsSNaN(T v) {
+        return std::isnan (v) && !(FpToBits (v) & ((typename FpTraits<T>::Bits) 1 << (FpTraits<T>::frac_bits - 1)));
+}
+
+template<typename T> static inline T FpDefaultNaN() {
+        return FpFromBits<T> (FpTraits<T>::default_nan);
+}
+
+/* FPProcessNaN: quiet a signalling NaN, or replace it with the default NaN in DN mode */
+template<typename T> static T FpProcessNaN(T v) {
+        if (FpIsSNaN (v)) {
+                FpRaise (FPSR_IOC);
+                v = FpFromBits<T> (FpToBits (v) | ((typename FpTraits<T>::Bits) 1 << (FpTraits<T>::frac_bits - 1)));
+        }
+        if (ARMv8::arm_state->fpcr & FPCR_DN)
+                return FpDefaultNaN<T> ();
+        return v;
+}
+
+/* FPProcessNaNs: signalling NaNs first, then quiet ones, each in operand order */
+template<typename T> static T FpProcessNaNs(T a, T b) {
+        if (FpIsSNaN (a))
+                return FpProcessNaN (a);
+        if (FpIsSNaN (b))
+                return FpProcessNaN (b);
+        if (std::isnan (a))
+                return FpProcessNaN (a);
+        return FpProcessNaN (b);
+}
+
+template<typename T> static T FpProcessNaNs3(T a, T b, T c) {
+        if (FpIsSNaN (a))
+                return FpProcessNaN (a);
+        if (FpIsSNaN (b))
+                return FpProcessNaN (b);
+        if (FpIsSNaN (c))
+                return FpProcessNaN (c);
+        if (std::isnan (a))
+                return FpProcessNaN (a);
+        if (std::isnan (b))
+                return FpProcessNaN (b);
+        return FpProcessNaN (c);
+}
+
+/* Host op returned NaN: either an operand was NaN, or the op was invalid (host raised it) */
+template<typename T> static T FpFixNaN(T a, T b) {
+        if (std::isnan (a) || std::isnan (b))
+                return FpProcessNaNs (a, b);
+        return FpDefaultNaN<T> ();
+}
+
+template<typename T> static inline T FpNeg(T a) {
+        return FpFromBits<T> (FpToBits (a) ^ FpSignBit<T> ());
+}
+
+template<typename T> static inline T FpAbs(T a) {
+        return FpFromBits<T> (FpToBits (a) & ~FpSignBit<T> ());
+}
+
+template<typename T> static inline T FpAdd(T a, T b) {
+        T r = a + b;
+        return std::isnan (r) ? FpFixNaN (a, b) : r;
+}
+
+template<typename T> static inline T FpSub(T a, T b) {
+        T r = a - b;
+        return std::isnan (r) ? FpFixNaN (a, b) : r;
+}
+
+template<typename T> static inline T FpMul(T a, T b) {
+        T r = a * b;
+        return std::isnan (r) ? FpFixNaN (a, b) : r;
+}
+
+template<typename T> static inline T FpDiv(T a, T b) {
+        T r = a / b;
+        return std::isnan (r) ? FpFixNaN (a, b) : r;
+}
+
+template<typename T> static T FpMax(T a, T b) {
+        if (std::isnan (a) || std::isnan (b))
+                return FpProcessNaNs (a, b);
+        if (a == b)
+                return std::signbit (a) ? b : a; // +0 beats -0
+        return a > b ? a : b;
+}
+
+template<typename T> static T FpMin(T a, T b) {
+        if (std::isnan (a) || std::isnan (b))
+                return FpProcessNaNs (a, b);
+        if (a == b)
+                return std::signbit (a) ? a : b;
+        return a < b ? a : b;
+}
+
+/* FMAXNM/FMINNM: a single quiet NaN loses against a number */
+template<typename T> static T FpMaxNum(T a, T b) {
+        bool qa = std::isnan (a) && !FpIsSNaN (a), qb = std::isnan (b) && !FpIsSNaN (b);
+        if (qa && !qb)
+                a = -std::numeric_limits<T>::infinity ();
+        else if (!qa && qb)
+                b = -std::numeric_limits<T>::infinity ();
+        return FpMax (a, b);
+}
+
+template<typename T> static T FpMinNum(T a, T b) {
+        bool qa = std::isnan (a) && !FpIsSNaN (a), qb = std::isnan (b) && !FpIsSNaN (b);
+        if (qa && !qb)
+                a = std::numeric_limits<T>::infinity ();
+        else if (!qa && qb)
+                b = std::numeric_limits<T>::infinity ();
+        return FpMin (a, b);
+}
+
+static inline bool FpInfTimesZero(double a, double b) {
+        return (std::isinf (a) && b == 0) || (a == 0 && std::isinf (b));
+}
+
+/* FMULX: like FMUL but inf * 0 is 2.0 */
+template<typename T> static T FpMulX(T a, T b) {
+        if (!std::isnan (a) && !std::isnan (b) && FpInfTimesZero (a, b))
+                return std::signbit (a) != std::signbit (b) ? -2.0 : 2.0;
+        return FpMul (a, b);
+}
+
+/* FRECPS: 2.0 - a * b, FRSQRTS: (3.0 - a * b) / 2, both fused */
+template<typename T> static T FpRecipStep(T a, T b) {
+        a = FpNeg (a);
+        if (std::isnan (a) || std::isnan (b))
+                return FpProcessNaNs (a, b);
+        if (FpInfTimesZero (a, b))
+                return 2.0;
+        return std::fma (a, b, (T) 2.0);
+}
+
+template<typename T> static T FpRSqrtStep(T a, T b) {
+        a = FpNeg (a);
+        if (std::isnan (a) || std::isnan (b))
+                return FpProcessNaNs (a, b);
+        if (FpInfTimesZero (a, b))
+                return 1.5;
+        return std::fma (a, b, (T) 3.0) / 2;
+}
+
+/* FPMulAdd: acc + n * m with a single rounding */
+template<typename T> static T FpMulAdd(T acc, T n, T m) {
+        if (std::isnan (acc) || std::isnan (n) || std::isnan (m)) {
+                /* A quiet NaN addend does not hide an invalid product */
+                if (!FpIsSNaN (acc) && std::isnan (acc) && !std::isnan (n) && !std::isnan (m) && FpInfTimesZero (n, m)) {
+                        FpRaise (FPSR_IOC);
+                        return FpDefaultNaN<T> ();
+                }
+                return FpProcessNaNs3 (acc, n, m);
+        }
+        T r = std::fma (n, m, acc);
+        return std::isnan (r) ? FpDefaultNaN<T> () : r;
+}
+
+/* Compare results are all ones / all zeros element masks */
+template<typename T> static inline T FpMask(bool cond) {
+        return FpFromBits<T> (cond ? ~(typename FpTraits<T>::Bits) 0 : 0);
+}
+
+/* FCMEQ only signals on signalling NaNs, ordered compares on any NaN */
+template<typename T> static T FpCompareOp(T a, T b, int op) {
+        if (std::isnan (a) || std::isnan (b)) {
+                if (op != Disassembler::FpOp_CMEQ || FpIsSNaN (a) || FpIsSNaN (b))
+                        FpRaise (FPSR_IOC);
+                return FpMask<T> (false);
+        }
+        switch (op) {
+        case Disassembler::FpOp_CMEQ:
+                return FpMask<T> (a == b);
+        case Disassembler::FpOp_CMGE:
+                return FpMask<T> (a >= b);
+        case Disassembler::FpOp_CMGT:
+                return FpMask<T> (a > b);
+        case Disassembler::FpOp_ACGE:
+                return FpMask<T> (std::fabs (a) >= std::fabs (b));
+        default:
+                return FpMask<T> (std::fabs (a) > std::fabs (b));
+        }
+}
+
+/* Round to integral in the given rounding (FpRounding_FPCR uses the host mode, which follows FPCR) */
+template<typename T> static T FpRoundInt(T a, int rounding, bool exact) {
+        if (std::isnan (a))
+                return FpProcessNaN (a);
+        if (std::isinf (a) || a == 0)
+                return a;
+        T r;
+        switch (rounding) {
+        case Disassembler::FpRounding_TIEEVEN:
+                r = std::round (a);
+                if (std::fabs (a - std::trunc (a)) == (T) 0.5)
+                        r = 2 * std::round (a / 2);
+                break;
+        case Disassembler::FpRounding_POSINF:
+                r = std::ceil (a);
+                break;
+        case Disassembler::FpRounding_NEGINF:
+                r = std::floor (a);
+                break;
+        case Disassembler::FpRounding_ZERO:
+                r = std::trunc (a);
+                break;
+        case Disassembler::FpRounding_TIEAWAY:
+                r = std::round (a);
+                break;
+        default:
+                r = std::nearbyint (a);
+                break;
+        }
+        if (r == 0)
+                r = std::copysign ((T) 0, a);
+        if (exact && r != a)
+                FpRaise (FPSR_IXC);
+        return r;
+}
+
+/* FPToFixed: scale by 2^fbits, round and saturate to a bits wide (un)signed integer */
+template<typename T> static uint64_t FpToFixed(T a, int fbits, bool sign, int bits, int rounding) {
+        if (std::isnan (a)) {
+                FpRaise (FPSR_IOC);
+                return 0;
+        }
+        T v = std::ldexp (a, fbits);
+        T r = FpRoundInt (v, rounding, false);
+        T lo = sign ? -std::ldexp ((T) 1, bits - 1) : 0;
+        T hi = std::ldexp ((T) 1, sign ? bits - 1 : bits);
+        if (r < lo) {
+                FpRaise (FPSR_IOC);
+                return sign ? (uint64_t) 1 << (bits - 1) : 0;
+        }
+        if (r >= hi) {
+                FpRaise (FPSR_IOC);
+                return ~(uint64_t) 0 >> (64 - bits + sign);
+        }
+        if (r != v)
+                FpRaise (FPSR_IXC);
+        return sign ? (uint64_t) (int64_t) r : (uint64_t) r;
+}
+
+/* FixedToFP: rounding of the host conversion follows FPCR */
+template<typename T> static T FixedToFp(uint64_t v, int fbits, bool sign, int bits) {
+        T r;
+        if (bits == 32)
+                r = sign ? (T) (int32_t) v : (T) (uint32_t) v;
+        else
+                r = sign ? (T) (int64_t) v : (T) v;
+        return fbits ? std::ldexp (r, -fbits) : r;
+}
+
+/* ARM FRECPE/FRSQRTE estimates (8 bit precision), see RecipEstimate() in ARM ARM */
+static unsigned int RecipEstimate(unsigned int a) {
+        a = a * 2 + 1;
+        unsigned int b = (1 << 19) / a;
+        return (b + 1) / 2;
+}
+
+static unsigned int RecipSqrtEstimate(unsigned int a) {
+        static uint16_t table[512];
+        if (!table[a]) {
+                uint64_t x = a < 256 ? a * 2 + 1 : ((a >> 1) << 1) * 2 + 2;
+                uint64_t b = 512;
+                while (x * (b + 1) * (b + 1) < (1ULL << 28))
+                        b++;
+                table[a] = (b + 1) / 2;
+        }
+        return table[a];
+}
+
+template<typename T> static T FpRecipEstimate(T a) {
+        typedef FpTraits<T> F;
+        typedef typename F::Bits Bits;
+        const int fb = F::frac_bits, emax = (1 << F::exp_bits) - 1;
+        Bits bits = FpToBits (a), sign = bits & FpSignBit<T> ();
+        int exp = (bits >> fb) & emax;
+        uint64_t frac = (uint64_t) (bits & (((Bits) 1 << fb) - 1)) << (52 - fb);
+        if (std::isnan (a))
+                return FpProcessNaN (a);
+        if (std::isinf (a))
+                return FpFromBits<T> (sign);
+        if (a == 0 || (exp == 0 && (ARMv8::arm_state->fpcr & FPCR_FZ))) {
+                FpRaise (FPSR_DZC);
+                return FpFromBits<T> (sign | FpToBits (std::numeric_limits<T>::infinity ()));
+        }
+        if (std::fabs (a) < std::ldexp ((T) 1, -(1 << (F::exp_bits - 1)))) {
+                /* Result overflows: rounding decides between infinity and the max normal */
+                int rmode = (ARMv8::arm_state->fpcr >> FPCR_RMODE_SHIFT) & 3;
+                bool to_inf = rmode == 0 || (rmode == 1 && !sign) || (rmode == 2 && sign);
+                FpRaise (FPSR_OFC | FPSR_IXC);
+                return FpFromBits<T> (sign | FpToBits (to_inf ? std::numeric_limits<T>::infinity () : std::numeric_limits<T>::max ()));
+        }
+        if ((ARMv8::arm_state->fpcr & FPCR_FZ) && std::fabs (a) >= std::ldexp ((T) 1, (1 << (F::exp_bits - 1)) - 2)) {
+                FpRaise (FPSR_UFC);
+                return FpFromBits<T> (sign);
+        }
+        if (exp == 0) {
+                if (!(frac & (1ULL << 51))) {
+                        exp = -1;
+                        frac = (frac << 2) & ((1ULL << 52) - 1);
+                } else {
+                        frac = (frac << 1) & ((1ULL << 52) - 1);
+                }
+        }
+        unsigned int estimate = RecipEstimate (0x100 | (frac >> 44));
+        int result_exp = 2 * (emax >> 1) - 1 - exp;
+        frac = (uint64_t) (estimate & 0xff) << 44;
+        if (result_exp == 0) {
+                frac = (1ULL << 51) | (frac >> 1);
+        } else if (result_exp == -1) {
+                frac = (1ULL << 50) | (frac >> 2);
+                result_exp = 0;
+        }
+        return FpFromBits<T> (sign | ((Bits) result_exp << fb) | (Bits) (frac >> (52 - fb)));
+}
+
+template<typename T> static T FpRSqrtEstimate(T a) {
+        typedef FpTraits<T> F;
+        typedef typename F::Bits Bits;
+        const int fb = F::frac_bits, emax = (1 << F::exp_bits) - 1;
+        Bits bits = FpToBits (a), sign = bits & FpSignBit<T> ();
+        int exp = (bits >> fb) & emax;
+        uint64_t frac = (uint64_t) (bits & (((Bits) 1 << fb) - 1)) << (52 - fb);
+        if (std::isnan (a))
+                return FpProcessNaN (a);
+        if (a == 0 || (exp == 0 && (ARMv8::arm_state->fpcr & FPCR_FZ))) {
+                FpRaise (FPSR_DZC);
+                return FpFromBits<T> (sign | FpToBits (std::numeric_limits<T>::infinity ()));
+        }
+        if (sign) {
+                FpRaise (FPSR_IOC);
+                return FpDefaultNaN<T> ();
+        }
+        if (std::isinf (a))
+                return 0;
+        if (exp == 0) {
+                while (!(frac & (1ULL << 51))) {
+                        frac = (frac << 1) & ((1ULL << 52) - 1);
+                        exp--;
+                }
+                frac = (frac << 1) & ((1ULL << 52) - 1);
+        }
+        unsigned int scaled = (exp & 1) ? 0x80 | (frac >> 45) : 0x100 | (frac >> 44);
+        int result_exp = (3 * (emax >> 1) - 1 - exp) / 2;
+        unsigned int estimate = RecipSqrtEstimate (scaled);
+        return FpFromBits<T> (((Bits) result_exp << fb) | ((Bits) (estimate & 0xff) << (fb - 8)));
+}
+
+/* Half precision is only converted from/to (IEEE format, FPCR.AHP is not modeled) */
+static double HalfToDouble(uint16_t h) {
+        int exp = (h >> 10) & 0x1f;
+        unsigned int frac = h & 0x3ff;
+        double sign = (h & 0x8000) ? -1.0 : 1.0;
+        if (exp == 0x1f) {
+                if (!frac)
+                        return sign * std::numeric_limits<double>::infinity ();
+                if (!(frac & 0x200))
+                        FpRaise (FPSR_IOC);
+                if (ARMv8::arm_state->fpcr & FPCR_DN)
+                        return FpDefaultNaN<double> ();
+                return FpFromBits<double> (((uint64_t) (h & 0x8000) << 48) | 0x7ff8000000000000ULL | ((uint64_t) frac << 42));
+        }
+        if (exp == 0)
+                return sign * std::ldexp ((double) frac, -24);
+        return sign * std::ldexp ((double) (frac | 0x400), exp - 25);
+}
+
+/* Rounds in the FPCR mode. The value is exact in double, so only this rounding happens */
+static uint16_t DoubleToHalf(double d) {
+        uint16_t sign = (FpToBits (d) >> 48) & 0x8000;
+        if (std::isnan (d)) {
+                d = FpProcessNaN (d);
+                if (ARMv8::arm_state->fpcr & FPCR_DN)
+                        return 0x7e00;
+                return sign | 0x7e00 | ((FpToBits (d) >> 42) & 0x1ff);
+        }
+        double a = std::fabs (d);
+        if (std::isinf (d))
+                return sign | 0x7c00;
+        /* FpRounding_{TIEEVEN,POSINF,NEGINF,ZERO} are in FPCR.RMode order */
+        int rounding = (ARMv8::arm_state->fpcr >> FPCR_RMODE_SHIFT) & 3;
+        int exp = a < std::ldexp (1.0, -14) ? -14 : std::ilogb (a);
+        double scaled = std::ldexp (a, 10 - exp);
+        double q = exp > 15 ? 2048 : std::fabs (FpRoundInt (std::copysign (scaled, d), rounding, false));
+        if (exp >= 15 && q >= 2048) {
+                FpRaise (FPSR_OFC | FPSR_IXC);
+                /* Infinity unless rounding towards zero for this sign */
+                bool inf = rounding == Disassembler::FpRounding_TIEEVEN ||
+                           rounding == (sign ? Disassembler::FpRounding_NEGINF : Disassembler::FpRounding_POSINF);
+                return sign | (inf ? 0x7c00 : 0x7bff);
+        }
+        if (q != scaled)
+                FpRaise (exp == -14 && q < 1024 ? FPSR_UFC | FPSR_IXC : FPSR_IXC);
+        /* q carries into the exponent field when it rounds up to 2048 */
+        return sign | (((exp + 14) << 10) + (uint16_t) q);
+}
+
+/* Vd[e] = op (Vn[e], Vm[e]) for the low elements, the rest of Vd is cleared */
+template<typename T, typename F>
+static void FpLanes(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int elements, F op) {
+        const int lanes = 16 / sizeof(T);
+        T n[lanes], m[lanes], d[lanes] = {};
+        memcpy (n, &VREG(vn_idx), sizeof(n));
+        memcpy (m, &VREG(vm_idx), sizeof(m));
+        for (int e = 0; e < elements; e++)
+                d[e] = op (n[e], m[e]);
+        memcpy (&VREG(vd_idx), d, sizeof(d));
+}
+
+#if defined(__SSE2__)
+/* Whole vector FADD/FSUB/FMUL/FDIV. Returns false (nothing written) if a lane needs NaN handling */
+static bool FpArithSse(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) {
+        int bytes = elements << (dbl ? 3 : 2);
+        /* Unused upper lanes are zero: fine for add/sub/mul, but 0/0 would raise invalid */
+        if (bytes < 8 || (bytes == 8 && op == Disassembler::FpOp_DIV))
+                return false;
+        bool is_q = bytes == 16;
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx);
+        if (!is_q) {
+                n = _mm_move_epi64 (n);
+                m = _mm_move_epi64 (m);
+        }
+        __m128i r;
+        if (dbl) {
+                __m128d a = _mm_castsi128_pd (n), b = _mm_castsi128_pd (m), res;
+                switch (op) {
+                case Disassembler::FpOp_ADD: res = _mm_add_pd (a, b); break;
+                case Disassembler::FpOp_SUB: res = _mm_sub_pd (a, b); break;
+                case Disassembler::FpOp_MUL: res = _mm_mul_pd (a, b); break;
+                default: res = _mm_div_pd (a, b); break;
+                }
+                if (_mm_movemask_pd (_mm_cmpunord_pd (res, res)))
+                        return false;
+                r = _mm_castpd_si128 (res);
+        } else {
+                __m128 a = _mm_castsi128_ps (n), b = _mm_castsi128_ps (m), res;
+                switch (op) {
+                case Disassembler::FpOp_ADD: res = _mm_add_ps (a, b); break;
+                case Disassembler::FpOp_SUB: res = _mm_sub_ps (a, b); break;
+                case Disassembler::FpOp_MUL: res = _mm_mul_ps (a, b); break;
+                default: res = _mm_div_ps (a, b); break;
+                }
+                if (_mm_movemask_ps (_mm_cmpunord_ps (res, res)))
+                        return false;
+                r = _mm_castps_si128 (res);
+        }
+        StoreVec (vd_idx, r, is_q);
+        return true;
+}
+#endif
+
+template<typename T>
+static void FpArithLanes(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int elements, int op) {
+        switch (op) {
+        case Disassembler::FpOp_ADD:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpAdd (a, b); });
+                break;
+        case Disassembler::FpOp_SUB:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpSub (a, b); });
+                break;
+        case Disassembler::FpOp_MUL:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpMul (a, b); });
+                break;
+        case Disassembler::FpOp_DIV:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpDiv (a, b); });
+                break;
+        case Disassembler::FpOp_MAX:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpMax (a, b); });
+                break;
+        case Disassembler::FpOp_MIN:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpMin (a, b); });
+                break;
+        case Disassembler::FpOp_MAXNM:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpMaxNum (a, b); });
+                break;
+        case Disassembler::FpOp_MINNM:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpMinNum (a, b); });
+                break;
+        case Disassembler::FpOp_NMUL:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpNeg (FpMul (a, b)); });
+                break;
+        case Disassembler::FpOp_ABD:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpAbs (FpSub (a, b)); });
+                break;
+        case Disassembler::FpOp_MULX:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpMulX (a, b); });
+                break;
+        case Disassembler::FpOp_RECPS:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpRecipStep (a, b); });
+                break;
+        case Disassembler::FpOp_RSQRTS:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [](T a, T b) { return FpRSqrtStep (a, b); });
+                break;
+        case Disassembler::FpOp_CMEQ:
+        case Disassembler::FpOp_CMGE:
+        case Disassembler::FpOp_CMGT:
+        case Disassembler::FpOp_ACGE:
+        case Disassembler::FpOp_ACGT:
+                FpLanes<T> (vd_idx, vn_idx, vm_idx, elements, [op](T a, T b) { return FpCompareOp (a, b, op); });
+                break;
+        default:
+                ns_abort ("Unknown FP op %d\n", op);
+        }
+}
+
+template<typename T>
+static void FpUnaryLanes(unsigned int vd_idx, unsigned int vn_idx, int elements, int op) {
+        switch (op) {
+        case Disassembler::FpOp_ABS:
+                FpLanes<T> (vd_idx, vn_idx, vn_idx, elements, [](T a, T) { return FpAbs (a); });
+                break;
+        case Disassembler::FpOp_NEG:
+                FpLanes<T> (vd_idx, vn_idx, vn_idx, elements, [](T a, T) { return FpNeg (a); });
+                break;
+        case Disassembler::FpOp_SQRT:
+                FpLanes<T> (vd_idx, vn_idx, vn_idx, elements, [](T a, T) {
+                        if (std::isnan (a))
+                                return FpProcessNaN (a);
+                        T r = std::sqrt (a);
+                        return std::isnan (r) ? FpDefaultNaN<T> () : r;
+                });
+                break;
+        case Disassembler::FpOp_RECPE:
+                FpLanes<T> (vd_idx, vn_idx, vn_idx, elements, [](T a, T) { return FpRecipEstimate (a); });
+                break;
+        case Disassembler::FpOp_RSQRTE:
+                FpLanes<T> (vd_idx, vn_idx, vn_idx, elements, [](T a, T) { return FpRSqrtEstimate (a); });
+                break;
+        case Disassembler::FpOp_RINTN:
+        case Disassembler::FpOp_RINTP:
+        case Disassembler::FpOp_RINTM:
+        case Disassembler::FpOp_RINTZ:
+        case Disassembler::FpOp_RINTA:
+        {
+                /* FpOp_RINT[NPMZA] are in FpRounding order */
+                int rounding = op - Disassembler::FpOp_RINTN;
+                FpLanes<T> (vd_idx, vn_idx, vn_idx, elements, [rounding](T a, T) { return FpRoundInt (a, rounding, false); });
+                break;
+        }
+        case Disassembler::FpOp_RINTX:
+        case Disassembler::FpOp_RINTI:
+        {
+                bool exact = op == Disassembler::FpOp_RINTX;
+                FpLanes<T> (vd_idx, vn_idx, vn_idx, elements, [exact](T a, T) {
+                        return FpRoundInt (a, Disassembler::FpRounding_FPCR, exact);
+                });
+                break;
+        }
+        default:
+                ns_abort ("Unknown FP op %d\n", op);
+        }
+}
+
+void IntprCallback::FpArith(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) {
+#if defined(__SSE2__)
+        if (op <= Disassembler::FpOp_DIV && FpArithSse (vd_idx, vn_idx, vm_idx, dbl, elements, op))
+                return;
+#endif
+        if (dbl)
+                FpArithLanes<double> (vd_idx, vn_idx, vm_idx, elements, op);
+        else
+                FpArithLanes<float> (vd_idx, vn_idx, vm_idx, elements, op);
+}
+
+/* Pairs of adjacent elements of Vn:Vm are reduced. The scalar form (elements == 1)
+ * reduces the two low elements of Vn */
+template<typename T>
+static void FpPairwiseLanes(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int elements, int op) {
+        const int lanes = 16 / sizeof(T);
+        T src[lanes * 2], n[lanes] = {}, m[lanes] = {};
+        int count = elements == 1 ? 2 : elements;
+        memcpy (src, &VREG(vn_idx), sizeof(T) * count);
+        memcpy (src + count, &VREG(vm_idx), sizeof(T) * count);
+        for (int e = 0; e < elements; e++) {
+                n[e] = src[2 * e];
+                m[e] = src[2 * e + 1];
+        }
+        memcpy (&VREG(VREG_DUMMY), n, sizeof(n));
+        memcpy (&VREG(vd_idx), m, sizeof(m));
+        FpArithLanes<T> (vd_idx, VREG_DUMMY, vd_idx, elements, op);
+}
+
+void IntprCallback::FpPairwise(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) {
+        if (dbl)
+                FpPairwiseLanes<double> (vd_idx, vn_idx, vm_idx, elements, op);
+        else
+                FpPairwiseLanes<float> (vd_idx, vn_idx, vm_idx, elements, op);
+}
+
+template<typename T>
+static void FpMulAddLanes(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, unsigned int va_idx,
+        int elements, bool neg_prod, bool neg_acc) {
+        const int lanes = 16 / sizeof(T);
+        T n[lanes], m[lanes], a[lanes], d[lanes] = {};
+        memcpy (n, &VREG(vn_idx), sizeof(n));
+        memcpy (m, &VREG(vm_idx), sizeof(m));
+        memcpy (a, &VREG(va_idx), sizeof(a));
+        for (int e = 0; e < elements; e++) {
+                T acc = neg_acc ? FpNeg (a[e]) : a[e];
+                d[e] = FpMulAdd (acc, neg_prod ? FpNeg (n[e]) : n[e], m[e]);
+        }
+        memcpy (&VREG(vd_idx), d, sizeof(d));
+}
+
+void IntprCallback::FpMulAdd(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, unsigned int va_idx, bool dbl, int elements, bool neg_prod, bool neg_acc) {
+        if (dbl)
+                FpMulAddLanes<double> (vd_idx, vn_idx, vm_idx, va_idx, elements, neg_prod, neg_acc);
+        else
+                FpMulAddLanes<float> (vd_idx, vn_idx, vm_idx, va_idx, elements, neg_prod, neg_acc);
+}
+
+void IntprCallback::FpUnary(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, int op) {
+        if (dbl)
+                FpUnaryLanes<double> (vd_idx, vn_idx, elements, op);
+        else
+                FpUnaryLanes<float> (vd_idx, vn_idx, elements, op);
+}
+
+/* Fp precision conversion (type: 0 single, 1 double, 3 half) */
+void IntprCallback::FpConvert(unsigned int vd_idx, unsigned int vn_idx, int from_type, int to_type) {
+        double v;
+        if (from_type == 0) {
+                float f = FpFromBits<float> (S(vn_idx));
+                v = std::isnan (f) ? (double) FpProcessNaN (f) : f;
+        } else if (from_type == 1) {
+                v = FpFromBits<double> (D(vn_idx));
+        } else {
+                v = HalfToDouble (H(vn_idx));
+        }
+        VREG(vd_idx).d[0] = VREG(vd_idx).d[1] = 0;
+        if (to_type == 0) {
+                /* Host narrowing rounds in the FPCR mode */
+                float f = std::isnan (v) ? (float) FpProcessNaN (v) : (float) v;
+                S(vd_idx) = FpToBits (f);
+        } else if (to_type == 1) {
+                D(vd_idx) = FpToBits (std::isnan (v) && from_type == 1 ? FpProcessNaN (v) : v);
+        } else {
+                H(vd_idx) = DoubleToHalf (v);
+        }
+}
+
+/* FCVTL(2): single -> double from the low (high) half, FCVTN(2): double -> single into the low (high) half */
+void IntprCallback::FpConvertVec(unsigned int vd_idx, unsigned int vn_idx, bool to_dbl, bool is_q) {
+        ARMv8::vreg_t src = VREG(vn_idx), res = {};
+        if (to_dbl) {
+                for (int e = 0; e < 2; e++) {
+                        float f = FpFromBits<float> (src.s[e + (is_q ? 2 : 0)]);
+                        res.d[e] = FpToBits (std::isnan (f) ? (double) FpProcessNaN (f) : (double) f);
+                }
+        } else {
+                if (is_q)
+                        res.d[0] = VREG(vd_idx).d[0];
+                for (int e = 0; e < 2; e++) {
+                        double v = FpFromBits<double> (src.d[e]);
+                        res.s[e + (is_q ? 2 : 0)] = FpToBits (std::isnan (v) ? (float) FpProcessNaN (v) : (float) v);
+                }
+        }
+        VREG(vd_idx) = res;
+}
+
+/* Fp <-> (fixed point) integer conversion */
+void IntprCallback::FpToInt(unsigned int rd_idx, unsigned int vn_idx, bool dbl, bool bit64, bool sign, int rounding, int fbits) {
+        uint64_t res;
+        if (dbl)
+                res = FpToFixed (FpFromBits<double> (D(vn_idx)), fbits, sign, bit64 ? 64 : 32, rounding);
+        else
+                res = FpToFixed (FpFromBits<float> (S(vn_idx)), fbits, sign, bit64 ? 64 : 32, rounding);
+        X(rd_idx) = bit64 ? res : (uint32_t) res;
+}
+
+void IntprCallback::IntToFp(unsigned int vd_idx, unsigned int rn_idx, bool dbl, bool bit64, bool sign, int fbits) {
+        uint64_t v = X(rn_idx);
+        VREG(vd_idx).d[0] = VREG(vd_idx).d[1] = 0;
+        if (dbl)
+                D(vd_idx) = FpToBits (FixedToFp<double> (v, fbits, sign, bit64 ? 64 : 32));
+        else
+                S(vd_idx) = FpToBits (FixedToFp<float> (v, fbits, sign, bit64 ? 64 : 32));
+}
+
+void IntprCallback::FpToIntVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign, int rounding) {
+        ARMv8::vreg_t src = VREG(vn_idx), res = {};
+        for (int e = 0; e < elements; e++) {
+                if (dbl)
+                        res.d[e] = FpToFixed (FpFromBits<double> (src.d[e]), 0, sign, 64, rounding);
+                else
+                        res.s[e] = FpToFixed (FpFromBits<float> (src.s[e]), 0, sign, 32, rounding);
+        }
+        VREG(vd_idx) = res;
+}
+
+void IntprCallback::IntToFpVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign) {
+        ARMv8::vreg_t src = VREG(vn_idx), res = {};
+        for (int e = 0; e < elements; e++) {
+                if (dbl)
+                        res.d[e] = FpToBits (FixedToFp<double> (src.d[e], 0, sign, 64));
+                else
+                        res.s[e] = FpToBits (FixedToFp<float> (src.s[e], 0, sign, 32));
+        }
+        VREG(vd_idx) = res;
+}
+
+/* FPCompare: NZCV is 0110 equal, 1000 less than, 0010 greater than, 0011 unordered */
+template<typename T> static uint32_t FpCompareFlags(T a, T b, bool signal) {
+        if (std::isnan (a) || std::isnan (b)) {
+                if (signal || FpIsSNaN (a) || FpIsSNaN (b))
+                        FpRaise (FPSR_IOC);
+                return C_MASK | V_MASK;
+        }
+        if (a == b)
+                return Z_MASK | C_MASK;
+        return a < b ? N_MASK : C_MASK;
+}
+
+void IntprCallback::FpCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, bool cmp_zero, bool signal) {
+        uint32_t nzcv;
+        if (dbl)
+                nzcv = FpCompareFlags (FpFromBits<double> (D(vn_idx)), cmp_zero ? 0.0 : FpFromBits<double> (D(vm_idx)), signal);
+        else
+                nzcv = FpCompareFlags (FpFromBits<float> (S(vn_idx)), cmp_zero ? 0.0f : FpFromBits<float> (S(vm_idx)), signal);
+        ARMv8::SetNZCV (nzcv);
+}
+
+void IntprCallback::FpCondCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int nzcv, unsigned int cond, bool signal) {
+        if (CondHold (cond))
+                FpCompare (vn_idx, vm_idx, dbl, false, signal);
+        else
+                ARMv8::SetNZCV (nzcv << 28);
+}
+
+void IntprCallback::FpCondSelect(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int cond) {
+        uint64_t v = CondHold (cond) ? VREG(vn_idx).d[0] : VREG(vm_idx).d[0];
+        VREG(vd_idx).d[0] = dbl ? v : (uint32_t) v;
+        VREG(vd_idx).d[1] = 0;
+}
+
 /* AND/OR/EOR/BIC/NOT ... between vector registers */
 void IntprCallback::AndVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
         debug_print ("AND: V[%u] = V[%u] & V[%u]\n", rd_idx, rn_idx, rm_idx);
+#if defined(__SSE2__)
+        StoreVec (rd_idx, _mm_and_si128 (LoadVec (rn_idx), LoadVec (rm_idx)), true);
+#else
         VREG(rd_idx).d[0] = _ArithmeticLogic (VREG(rn_idx).d[0], VREG(rm_idx).d[0], false, true, AL_TYPE_AND);
         VREG(rd_idx).d[1] = _ArithmeticLogic (VREG(rn_idx).d[1], VREG(rm_idx).d[1], false, true, AL_TYPE_AND);
+#endif
 }
 
 void IntprCallback::OrrVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
         debug_print ("ORR: V[%u] = V[%u] | V[%u]\n", rd_idx, rn_idx, rm_idx);
+#if defined(__SSE2__)
+        StoreVec (rd_idx, _mm_or_si128 (LoadVec (rn_idx), LoadVec (rm_idx)), true);
+#else
         VREG(rd_idx).d[0] = _ArithmeticLogic (VREG(rn_idx).d[0], VREG(rm_idx).d[0], false, true, AL_TYPE_OR);
         VREG(rd_idx).d[1] = _ArithmeticLogic (VREG(rn_idx).d[1], VREG(rm_idx).d[1], false, true, AL_TYPE_OR);
+#endif
 }
 
 void IntprCallback::EorVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
         debug_print ("XOR: V[%u] = V[%u] ^ V[%u]\n", rd_idx, rn_idx, rm_idx);
+#if defined(__SSE2__)
+        StoreVec (rd_idx, _mm_xor_si128 (LoadVec (rn_idx), LoadVec (rm_idx)), true);
+#else
         VREG(rd_idx).d[0] = _ArithmeticLogic (VREG(rn_idx).d[0], VREG(rm_idx).d[0], false, true, AL_TYPE_EOR);
         VREG(rd_idx).d[1] = _ArithmeticLogic (VREG(rn_idx).d[1], VREG(rm_idx).d[1], false, true, AL_TYPE_EOR);
+#endif
 }
 void IntprCallback::BicVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
         debug_print ("BIC: V[%u] = V[%u] & ~V[%u]\n", rd_idx, rn_idx, rm_idx);
+#if defined(__SSE2__)
+        StoreVec (rd_idx, _mm_andnot_si128 (LoadVec (rm_idx), LoadVec (rn_idx)), true);
+#else
         VREG(rd_idx).d[0] = _ArithmeticLogic (VREG(rn_idx).d[0], ~VREG(rm_idx).d[0], false, true, AL_TYPE_AND);
         VREG(rd_idx).d[1] = _ArithmeticLogic (VREG(rn_idx).d[1], ~VREG(rm_idx).d[1], false, true, AL_TYPE_AND);
+#endif
 }
 
 void IntprCallback::NotVecReg(unsigned int rd_idx, unsigned int rm_idx) {
 	debug_print ("NOT: %c[%u] = ~%c[%u]\n", rd_idx, rm_idx);
+#if defined(__SSE2__)
+        StoreVec (rd_idx, _mm_xor_si128 (LoadVec (rm_idx), _mm_set1_epi32 (-1)), true);
+#else
         VREG(rd_idx).d[0] = ~VREG(rm_idx).d[0];
         VREG(rd_idx).d[1] = ~VREG(rm_idx).d[1];
+#endif
 }
 
 /* Read Vector register to general register */
@@ -1158,38 +3054,554 @@ void IntprCallback::WriteVecElem(unsigned int vd_idx, unsigned int rn_idx, unsig
         }
 }
 
-template<typename T>
-static void _CompareTest(T *res, T arg1, T arg2, bool and_test) {
-        T onflag = ~(T)0;
-        if (and_test) {
-                *res = (arg1 & arg2 != 0 ? onflag : 0);
+/* Compare Bit wise equal */
+void IntprCallback::CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+#if defined(__SSE2__)
+        StoreVec (vd_idx, CmpEqVec (LoadVec (vn_idx), LoadVec (vm_idx), size), is_q);
+#else
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, false,
+                [](auto n, auto m) { return LaneMask<decltype(n)> (n == m); });
+#endif
+}
+
+/* Compare Bit wise test bits nonzero */
+void IntprCallback::CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+#if defined(__SSE2__)
+        __m128i zero = CmpEqVec (_mm_and_si128 (LoadVec (vn_idx), LoadVec (vm_idx)), _mm_setzero_si128 (), size);
+        StoreVec (vd_idx, _mm_andnot_si128 (zero, _mm_set1_epi32 (-1)), is_q);
+#else
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, false,
+                [](auto n, auto m) { return LaneMask<decltype(n)> ((n & m) != 0); });
+#endif
+}
+
+/* Compare greater than (or equal), signed or unsigned */
+void IntprCallback::CompareGreaterVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign, bool equal) {
+#if defined(__SSE2__)
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx), gt;
+        /* n >= m is !(m > n) */
+        if (equal ? CmpGtVec (m, n, size, sign, &gt) : CmpGtVec (n, m, size, sign, &gt)) {
+                if (equal)
+                        gt = _mm_andnot_si128 (gt, _mm_set1_epi32 (-1));
+                StoreVec (vd_idx, gt, is_q);
+                return;
+        }
+#endif
+        if (equal) {
+                VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, sign,
+                        [](auto n, auto m) { return LaneMask<decltype(n)> (n >= m); });
         } else {
-                *res = (arg1 == arg2 ? onflag : 0);
+                VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, sign,
+                        [](auto n, auto m) { return LaneMask<decltype(n)> (n > m); });
         }
 }
 
-/* Compare Bit wise equal */
-void IntprCallback::CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int index, int size) {
-        if (size == 0) {
-                _CompareTest(&VREG(vd_idx).b[index], VREG(vn_idx).b[index], VREG(vm_idx).b[index], false);
-        } else if (size == 1) {
-                _CompareTest(&VREG(vd_idx).h[index], VREG(vn_idx).h[index], VREG(vm_idx).h[index], false);
-        } else if (size == 2) {
-                _CompareTest(&VREG(vd_idx).s[index], VREG(vn_idx).s[index], VREG(vm_idx).s[index], false);
-        } else if (size == 3) {
-                _CompareTest(&VREG(vd_idx).d[index], VREG(vn_idx).d[index], VREG(vm_idx).d[index], false);
+/* Element wise arithmetic between vector registers */
+void IntprCallback::AddVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+#if defined(__SSE2__)
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx);
+        switch (size) {
+        case 0:
+                StoreVec (vd_idx, _mm_add_epi8 (n, m), is_q);
+                break;
+        case 1:
+                StoreVec (vd_idx, _mm_add_epi16 (n, m), is_q);
+                break;
+        case 2:
+                StoreVec (vd_idx, _mm_add_epi32 (n, m), is_q);
+                break;
+        default:
+                StoreVec (vd_idx, _mm_add_epi64 (n, m), is_q);
+                break;
         }
+#else
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, false,
+                [](auto n, auto m) { return (decltype(n)) (n + m); });
+#endif
+}
+
+void IntprCallback::SubVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+#if defined(__SSE2__)
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx);
+        switch (size) {
+        case 0:
+                StoreVec (vd_idx, _mm_sub_epi8 (n, m), is_q);
+                break;
+        case 1:
+                StoreVec (vd_idx, _mm_sub_epi16 (n, m), is_q);
+                break;
+        case 2:
+                StoreVec (vd_idx, _mm_sub_epi32 (n, m), is_q);
+                break;
+        default:
+                StoreVec (vd_idx, _mm_sub_epi64 (n, m), is_q);
+                break;
+        }
+#else
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, false,
+                [](auto n, auto m) { return (decltype(n)) (n - m); });
+#endif
+}
+
+void IntprCallback::MulVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+#if defined(__SSE2__)
+        /* SSE2 only has a 16bit lane multiply */
+        if (size == 1) {
+                StoreVec (vd_idx, _mm_mullo_epi16 (LoadVec (vn_idx), LoadVec (vm_idx)), is_q);
+                return;
+        }
+#endif
+        /* Multiply unsigned so that promoted lanes can not overflow int */
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, false,
+                [](auto n, auto m) { return (decltype(n)) ((uint64_t) n * (uint64_t) m); });
+}
+
+void IntprCallback::MaxVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+#if defined(__SSE2__)
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx), gt;
+        if (CmpGtVec (n, m, size, sign, &gt)) {
+                StoreVec (vd_idx, SelectVec (gt, n, m), is_q);
+                return;
+        }
+#endif
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, sign,
+                [](auto n, auto m) { return n > m ? n : m; });
 }
 
-/* Compare Bit wise test bits nonzero */
-void IntprCallback::CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int index, int size) {
-        if (size == 0) {
-                _CompareTest(&VREG(vd_idx).b[index], VREG(vn_idx).b[index], VREG(vm_idx).b[index], true);
-        } else if (size == 1) {
-                _CompareTest(&VREG(vd_idx).h[index], VREG(vn_idx).h[index], VREG(vm_idx).h[index], true);
-        } else if (size == 2) {
-                _CompareTest(&VREG(vd_idx).s[index], VREG(vn_idx).s[index], VREG(vm_idx).s[index], true);
-        } else if (size == 3) {
-                _CompareTest(&VREG(vd_idx).d[index], VREG(vn_idx).d[index], VREG(vm_idx).d[index], true);
+void IntprCallback::MinVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+#if defined(__SSE2__)
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx), gt;
+        if (CmpGtVec (n, m, size, sign, &gt)) {
+                StoreVec (vd_idx, SelectVec (gt, m, n), is_q);
+                return;
         }
+#endif
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, sign,
+                [](auto n, auto m) { return n < m ? n : m; });
+}
+
+/* Saturating add/sub (QC is not tracked) */
+void IntprCallback::AddSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+#if defined(__SSE2__)
+        /* SSE2 saturates 8 and 16bit lanes only */
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx);
+        switch (size + 4 * sign) {
+        case 0:
+                StoreVec (vd_idx, _mm_adds_epu8 (n, m), is_q);
+                return;
+        case 1:
+                StoreVec (vd_idx, _mm_adds_epu16 (n, m), is_q);
+                return;
+        case 4:
+                StoreVec (vd_idx, _mm_adds_epi8 (n, m), is_q);
+                return;
+        case 5:
+                StoreVec (vd_idx, _mm_adds_epi16 (n, m), is_q);
+                return;
+        }
+#endif
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, sign,
+                [](auto n, auto m) { return SaturateAdd (n, m); });
+}
+
+void IntprCallback::SubSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+#if defined(__SSE2__)
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx);
+        switch (size + 4 * sign) {
+        case 0:
+                StoreVec (vd_idx, _mm_subs_epu8 (n, m), is_q);
+                return;
+        case 1:
+                StoreVec (vd_idx, _mm_subs_epu16 (n, m), is_q);
+                return;
+        case 4:
+                StoreVec (vd_idx, _mm_subs_epi8 (n, m), is_q);
+                return;
+        case 5:
+                StoreVec (vd_idx, _mm_subs_epi16 (n, m), is_q);
+                return;
+        }
+#endif
+        VecLanesBySize (vd_idx, vn_idx, vm_idx, size, is_q, sign,
+                [](auto n, auto m) { return SaturateSub (n, m); });
+}
+
+/* ####### Crypto ####### */
+/* Built with -maes, -mpclmul or -msha (plus -mssse3), the crypto callbacks run on
+ * the matching host instructions. Otherwise they fall back to table and scalar code.
+ * Arm and x86 lay the AES state out alike (byte i is row i % 4, column i / 4),
+ * so AES-NI rounds map directly onto the Arm round steps. */
+
+static inline uint32_t Rol32(uint32_t x, int n) {
+        return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t Ror32(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+}
+
+/* Carry-less 64x64 -> 128bit multiply */
+static inline uint64_t ClMul64(uint64_t a, uint64_t b, uint64_t *hi) {
+        uint64_t lo = 0, h = 0;
+        for (int i = 0; i < 64; i++) {
+                if ((b >> i) & 1) {
+                        lo ^= a << i;
+                        h ^= i ? a >> (64 - i) : 0;
+                }
+        }
+        *hi = h;
+        return lo;
+}
+
+#if defined(__x86_64__)
+HOST_TARGET("pclmul") static void PolyMulLongHost(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool upper) {
+        __m128i n = LoadVec (vn_idx), m = LoadVec (vm_idx);
+        StoreVec (vd_idx, upper ? _mm_clmulepi64_si128 (n, m, 0x11) : _mm_clmulepi64_si128 (n, m, 0x00), true);
+}
+#endif
+
+void IntprCallback::PolyMulLong(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool upper) {
+        if (size == 3) {
+#if defined(__x86_64__)
+                if (ARMv8::host_features.pclmul) {
+                        PolyMulLongHost (vd_idx, vn_idx, vm_idx, upper);
+                        return;
+                }
+#endif
+                uint64_t hi, lo = ClMul64 (VREG(vn_idx).d[upper], VREG(vm_idx).d[upper], &hi);
+                VREG(vd_idx).d[0] = lo;
+                VREG(vd_idx).d[1] = hi;
+                return;
+        }
+        uint8_t n[8], m[8];
+        uint16_t d[8];
+        memcpy (n, &VREG(vn_idx).b[upper * 8], sizeof(n));
+        memcpy (m, &VREG(vm_idx).b[upper * 8], sizeof(m));
+        for (int e = 0; e < 8; e++) {
+                uint16_t prod = 0;
+                for (int i = 0; i < 8; i++) {
+                        if ((m[e] >> i) & 1)
+                                prod ^= (uint16_t) n[e] << i;
+                }
+                d[e] = prod;
+        }
+        memcpy (&VREG(vd_idx), d, sizeof(d));
+}
+
+static inline uint8_t Xtime(uint8_t x) {
+        return (x << 1) ^ ((x >> 7) * 0x1b);
+}
+
+static inline uint8_t GfMul(uint8_t a, uint8_t b) {
+        uint8_t p = 0;
+        for (; b; b >>= 1) {
+                if (b & 1)
+                        p ^= a;
+                a = Xtime (a);
+        }
+        return p;
+}
+
+static inline uint8_t Rol8(uint8_t x, int n) {
+        return (x << n) | (x >> (8 - n));
+}
+
+struct AesTables {
+        uint8_t sbox[256];
+        uint8_t inv_sbox[256];
+        AesTables() {
+                /* Inverse in GF(2^8) through log tables of generator 3, then the affine map */
+                uint8_t exp[255], log[256] = {};
+                uint8_t x = 1;
+                for (int i = 0; i < 255; i++) {
+                        exp[i] = x;
+                        log[x] = i;
+                        x ^= Xtime (x);
+                }
+                for (int i = 0; i < 256; i++) {
+                        uint8_t inv = i ? exp[(255 - log[i]) % 255] : 0;
+                        uint8_t s = inv ^ Rol8 (inv, 1) ^ Rol8 (inv, 2) ^ Rol8 (inv, 3) ^ Rol8 (inv, 4) ^ 0x63;
+                        sbox[i] = s;
+                        inv_sbox[s] = i;
+                }
+        }
+};
+static const AesTables aes_tables;
+
+/* (Inv)MixColumns: each column times the circulant matrix with first row coef */
+static void AesMixColumns(uint8_t *s, const uint8_t coef[4]) {
+        for (int c = 0; c < 4; c++) {
+                uint8_t a[4], *col = &s[4 * c];
+                memcpy (a, col, sizeof(a));
+                for (int r = 0; r < 4; r++) {
+                        col[r] = 0;
+                        for (int j = 0; j < 4; j++)
+                                col[r] ^= GfMul (a[(r + j) % 4], coef[j]);
+                }
+        }
+}
+
+#if defined(__x86_64__)
+HOST_TARGET("aes") static void CryptoAesHost(unsigned int vd_idx, unsigned int vn_idx, int op) {
+        const __m128i zero = _mm_setzero_si128 ();
+        __m128i n = LoadVec (vn_idx);
+        switch (op) {
+        case Disassembler::AesOp_AESE:
+                /* SubBytes and ShiftRows commute */
+                StoreVec (vd_idx, _mm_aesenclast_si128 (_mm_xor_si128 (LoadVec (vd_idx), n), zero), true);
+                break;
+        case Disassembler::AesOp_AESD:
+                StoreVec (vd_idx, _mm_aesdeclast_si128 (_mm_xor_si128 (LoadVec (vd_idx), n), zero), true);
+                break;
+        case Disassembler::AesOp_AESMC:
+                /* AESENC is ShiftRows, SubBytes, MixColumns: cancel the first two beforehand */
+                StoreVec (vd_idx, _mm_aesenc_si128 (_mm_aesdeclast_si128 (n, zero), zero), true);
+                break;
+        default:
+                StoreVec (vd_idx, _mm_aesimc_si128 (n), true);
+                break;
+        }
+}
+#endif
+
+void IntprCallback::CryptoAes(unsigned int vd_idx, unsigned int vn_idx, int op) {
+#if defined(__x86_64__)
+        if (ARMv8::host_features.aes) {
+                CryptoAesHost (vd_idx, vn_idx, op);
+                return;
+        }
+#endif
+        static const uint8_t mix[4] = { 2, 3, 1, 1 }, inv_mix[4] = { 14, 11, 13, 9 };
+        uint8_t s[16], d[16];
+        memcpy (s, &VREG(vn_idx), sizeof(s));
+        switch (op) {
+        case Disassembler::AesOp_AESE:
+        case Disassembler::AesOp_AESD: {
+                bool enc = op == Disassembler::AesOp_AESE;
+                const uint8_t *box = enc ? aes_tables.sbox : aes_tables.inv_sbox;
+                for (int i = 0; i < 16; i++)
+                        s[i] ^= VREG(vd_idx).b[i];
+                for (int c = 0; c < 4; c++) {
+                        for (int r = 0; r < 4; r++) {
+                                /* Row r rotates left by r columns (right when decrypting) */
+                                int from = enc ? (c + r) % 4 : (c - r + 4) % 4;
+                                d[r + 4 * c] = box[s[r + 4 * from]];
+                        }
+                }
+                memcpy (&VREG(vd_idx), d, sizeof(d));
+                return;
+        }
+        case Disassembler::AesOp_AESMC:
+                AesMixColumns (s, mix);
+                break;
+        default:
+                AesMixColumns (s, inv_mix);
+                break;
+        }
+        memcpy (&VREG(vd_idx), s, sizeof(s));
+}
+
+/* Four SHA1 rounds (Arm SHA1HashFunction). W already holds the round constant */
+static void Sha1Hash(uint32_t x[4], uint32_t y, const uint32_t w[4], int op) {
+        for (int e = 0; e < 4; e++) {
+                uint32_t t;
+                switch (op) {
+                case Disassembler::ShaOp_SHA1C:
+                        t = (x[1] & x[2]) | (~x[1] & x[3]);
+                        break;
+                case Disassembler::ShaOp_SHA1P:
+                        t = x[1] ^ x[2] ^ x[3];
+                        break;
+                default:
+                        t = (x[1] & x[2]) | (x[1] & x[3]) | (x[2] & x[3]);
+                        break;
+                }
+                y += Rol32 (x[0], 5) + t + w[e];
+                x[1] = Rol32 (x[1], 30);
+                /* Y:X = ROL(Y:X, 32) */
+                uint32_t top = x[3];
+                x[3] = x[2];
+                x[2] = x[1];
+                x[1] = x[0];
+                x[0] = y;
+                y = top;
+        }
+}
+
+/* Four SHA256 rounds on X = {a, b, c, d} and Y = {e, f, g, h} (Arm SHA256hash) */
+static void Sha256Hash(uint32_t x[4], uint32_t y[4], const uint32_t w[4]) {
+        for (int e = 0; e < 4; e++) {
+                uint32_t chs = (y[0] & y[1]) ^ (~y[0] & y[2]);
+                uint32_t maj = (x[0] & x[1]) ^ (x[0] & x[2]) ^ (x[1] & x[2]);
+                uint32_t t = y[3] + (Ror32 (y[0], 6) ^ Ror32 (y[0], 11) ^ Ror32 (y[0], 25)) + chs + w[e];
+                x[3] += t;
+                y[3] = t + (Ror32 (x[0], 2) ^ Ror32 (x[0], 13) ^ Ror32 (x[0], 22)) + maj;
+                /* Y:X = ROL(Y:X, 32) */
+                uint32_t x_top = x[3], y_top = y[3];
+                x[3] = x[2];
+                x[2] = x[1];
+                x[1] = x[0];
+                x[0] = y_top;
+                y[3] = y[2];
+                y[2] = y[1];
+                y[1] = y[0];
+                y[0] = x_top;
+        }
+}
+
+static inline uint32_t Sha256Sigma0(uint32_t x) {
+        return Ror32 (x, 7) ^ Ror32 (x, 18) ^ (x >> 3);
+}
+
+static inline uint32_t Sha256Sigma1(uint32_t x) {
+        return Ror32 (x, 17) ^ Ror32 (x, 19) ^ (x >> 10);
+}
+
+#if defined(__x86_64__)
+/* SHA-NI keeps the SHA1 state in reversed lane order and the SHA256 state as
+ * ABEF/CDGH pairs, so the Arm operands are shuffled around the host ops.
+ * False for the ops left to the scalar code */
+HOST_TARGET("sha,ssse3") static bool ShaHost(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int op) {
+        __m128i d = LoadVec (vd_idx), n = LoadVec (vn_idx), m = LoadVec (vm_idx), res;
+        switch (op) {
+        case Disassembler::ShaOp_SHA1C:
+        case Disassembler::ShaOp_SHA1P:
+        case Disassembler::ShaOp_SHA1M: {
+                /* SHA1RNDS4 adds the round constant which Arm code has already added to W,
+                 * and takes E added to the first W */
+                static const uint32_t k[3] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc };
+                __m128i abcd = _mm_shuffle_epi32 (d, 0x1b);
+                __m128i w = _mm_sub_epi32 (_mm_shuffle_epi32 (m, 0x1b), _mm_set1_epi32 (k[op]));
+                w = _mm_add_epi32 (w, _mm_slli_si128 (_mm_cvtsi32_si128 (_mm_cvtsi128_si32 (n)), 12));
+                if (op == Disassembler::ShaOp_SHA1C)
+                        res = _mm_sha1rnds4_epu32 (abcd, w, 0);
+                else if (op == Disassembler::ShaOp_SHA1P)
+                        res = _mm_sha1rnds4_epu32 (abcd, w, 1);
+                else
+                        res = _mm_sha1rnds4_epu32 (abcd, w, 2);
+                res = _mm_shuffle_epi32 (res, 0x1b);
+                break;
+        }
+        case Disassembler::ShaOp_SHA256H:
+        case Disassembler::ShaOp_SHA256H2: {
+                bool h2 = op == Disassembler::ShaOp_SHA256H2;
+                __m128i x = h2 ? n : d, y = h2 ? d : n;
+                __m128i abef = _mm_shuffle_epi32 (_mm_unpacklo_epi64 (y, x), 0xb1);
+                __m128i cdgh = _mm_shuffle_epi32 (_mm_unpackhi_epi64 (y, x), 0xb1);
+                /* Two rounds each, the old ABEF becomes the new CDGH */
+                __m128i abef2 = _mm_sha256rnds2_epu32 (cdgh, abef, m);
+                __m128i abef4 = _mm_sha256rnds2_epu32 (abef, abef2, _mm_shuffle_epi32 (m, 0x0e));
+                if (h2)
+                        res = _mm_shuffle_epi32 (_mm_unpacklo_epi64 (abef2, abef4), 0x1b);
+                else
+                        res = _mm_shuffle_epi32 (_mm_unpackhi_epi64 (abef2, abef4), 0x1b);
+                break;
+        }
+        case Disassembler::ShaOp_SHA256SU0:
+                res = _mm_sha256msg1_epu32 (d, n);
+                break;
+        case Disassembler::ShaOp_SHA256SU1:
+                res = _mm_sha256msg2_epu32 (_mm_add_epi32 (d, _mm_alignr_epi8 (m, n, 4)), m);
+                break;
+        default:
+                return false;
+        }
+        StoreVec (vd_idx, res, true);
+        return true;
+}
+#endif
+
+void IntprCallback::CryptoSha(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int op) {
+#if defined(__x86_64__)
+        if (ARMv8::host_features.sha && ARMv8::host_features.ssse3 && ShaHost (vd_idx, vn_idx, vm_idx, op))
+                return;
+#endif
+        uint32_t d[4], n[4], m[4], res[4] = {};
+        memcpy (d, &VREG(vd_idx), sizeof(d));
+        memcpy (n, &VREG(vn_idx), sizeof(n));
+        memcpy (m, &VREG(vm_idx), sizeof(m));
+        switch (op) {
+        case Disassembler::ShaOp_SHA1C:
+        case Disassembler::ShaOp_SHA1P:
+        case Disassembler::ShaOp_SHA1M:
+                Sha1Hash (d, n[0], m, op);
+                memcpy (res, d, sizeof(res));
+                break;
+        case Disassembler::ShaOp_SHA1SU0: {
+                uint32_t t[4] = { d[2], d[3], n[0], n[1] };
+                for (int e = 0; e < 4; e++)
+                        res[e] = t[e] ^ d[e] ^ m[e];
+                break;
+        }
+        case Disassembler::ShaOp_SHA256H:
+                Sha256Hash (d, n, m);
+                memcpy (res, d, sizeof(res));
+                break;
+        case Disassembler::ShaOp_SHA256H2:
+                Sha256Hash (n, d, m);
+                memcpy (res, d, sizeof(res));
+                break;
+        case Disassembler::ShaOp_SHA256SU1: {
+                uint32_t t[4] = { n[1], n[2], n[3], m[0] };
+                res[0] = d[0] + t[0] + Sha256Sigma1 (m[2]);
+                res[1] = d[1] + t[1] + Sha256Sigma1 (m[3]);
+                res[2] = d[2] + t[2] + Sha256Sigma1 (res[0]);
+                res[3] = d[3] + t[3] + Sha256Sigma1 (res[1]);
+                break;
+        }
+        case Disassembler::ShaOp_SHA1H:
+                res[0] = Rol32 (n[0], 30);
+                break;
+        case Disassembler::ShaOp_SHA1SU1: {
+                uint32_t t[4] = { d[0] ^ n[1], d[1] ^ n[2], d[2] ^ n[3], d[3] };
+                for (int e = 0; e < 4; e++)
+                        res[e] = Rol32 (t[e], 1);
+                res[3] ^= Rol32 (t[0], 2);
+                break;
+        }
+        default: {
+                /* SHA256SU0 */
+                uint32_t t[4] = { d[1], d[2], d[3], n[0] };
+                for (int e = 0; e < 4; e++)
+                        res[e] = d[e] + Sha256Sigma0 (t[e]);
+                break;
+        }
+        }
+        memcpy (&VREG(vd_idx), res, sizeof(res));
+}
+
+/* Decoder with IntprCallback inlined (also used by JIT single stepping) */
+template void Disassembler::DisasA64<IntprCallback>(uint32_t insn, IntprCallback *cb);
+
+/* ####### Superinstructions ####### */
+
+/* What MicroOp_NextInsn does between the two halves */
+static inline void EndInsn() {
+        PC += sizeof(uint32_t);
+        X(GPR_ZERO) = 0; //Reset Zero register
+}
+
+void IntprCallback::CmpI64Branch(unsigned int rn_idx, uint64_t imm, bool bit64, unsigned int cond, uint64_t addr) {
+        SubI64 (GPR_ZERO, rn_idx, imm, true, bit64);
+        EndInsn ();
+        BranchFlag (cond, addr);
+}
+
+void IntprCallback::CmpRegBranch(unsigned int rn_idx, unsigned int rm_idx, bool bit64, unsigned int cond, uint64_t addr) {
+        SubReg (GPR_ZERO, rn_idx, rm_idx, true, bit64);
+        EndInsn ();
+        BranchFlag (cond, addr);
+}
+
+void IntprCallback::LoadBranchZero(unsigned int rt_idx, unsigned int ad_idx, int size, bool is_sign, bool extend,
+                                   unsigned int cond, uint64_t addr, bool bit64) {
+        LoadRegI64 (rt_idx, ad_idx, size, is_sign, extend);
+        EndInsn ();
+        BranchCondiI64 (cond, rt_idx, 0, addr, bit64);
+}
+
+void IntprCallback::MoviPair(unsigned int rd_idx, uint64_t imm, bool bit64, unsigned int rd2_idx, uint64_t imm2, bool bit64_2) {
+        MoviI64 (rd_idx, imm, bit64);
+        EndInsn ();
+        MoviI64 (rd2_idx, imm2, bit64_2);
 }
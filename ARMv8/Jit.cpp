@@ -0,0 +1,1206 @@
+/* nsemu - LGPL - Copyright 2018 rkx1209<rkx1209dev@gmail.com> */
+#include "Nsemu.hpp"
+#include <sys/mman.h>
+
+thread_local Jit *Jit::inst = nullptr;
+thread_local JitCallback *Jit::jit_cb = nullptr;
+thread_local IntprCallback *Jit::intpr_cb = nullptr;
+
+/* Host registers */
+enum {
+        RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+/* Condition codes of Jcc/SETcc/CMOVcc */
+enum {
+        CC_O = 0, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+        CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G,
+};
+
+/* Group 1 ALU (/digit of 0x81, opcode of reg form is (ext << 3) | 1) */
+enum {
+        ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7,
+};
+
+/* Group 2 shift (/digit of 0xC1) */
+enum {
+        SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7,
+};
+
+#define GPR_OFF(r) (int32_t) (offsetof(ARMv8::ARMv8State, gpr) + (r) * sizeof(ARMv8::reg_t))
+#define NZCV_OFF (int32_t) offsetof(ARMv8::ARMv8State, nzcv)
+#define TICKS_OFF (int32_t) offsetof(ARMv8::ARMv8State, ticks)
+#define SYSR_OFF(o) (int32_t) (offsetof(ARMv8::ARMv8State, sysr) + (o))
+#define EXCL_ARMED_OFF (int32_t) offsetof(ARMv8::ARMv8State, excl.armed)
+#define IBTC_OFF (int32_t) offsetof(JitRuntime, ibtc)
+#define RAS_OFF (int32_t) offsetof(JitRuntime, ras)
+#define RAS_TOP_OFF (int32_t) offsetof(JitRuntime, ras_top)
+
+/* ####### Code emitter ####### */
+
+void JitCallback::Emit8(uint8_t val) {
+        *ptr++ = val;
+}
+
+void JitCallback::Emit32(uint32_t val) {
+        memcpy (ptr, &val, sizeof(val));
+        ptr += sizeof(val);
+}
+
+void JitCallback::Emit64(uint64_t val) {
+        memcpy (ptr, &val, sizeof(val));
+        ptr += sizeof(val);
+}
+
+void JitCallback::EmitRex(bool w, unsigned int reg, unsigned int rm) {
+        uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+        if (rex != 0x40)
+                Emit8 (rex);
+}
+
+/* op reg, [base + off] (base must not be rsp/r12) */
+void JitCallback::EmitMemBase(unsigned int op, unsigned int reg, unsigned int base, bool w, int32_t off) {
+        EmitRex (w, reg, base);
+        Emit8 (op);
+        Emit8 (0x80 | ((reg & 7) << 3) | (base & 7));
+        Emit32 (off);
+}
+
+/* op reg, [rbx + off] (guest state) */
+void JitCallback::EmitMem(unsigned int op, unsigned int reg, bool w, int32_t off) {
+        EmitMemBase (op, reg, RBX, w, off);
+}
+
+void JitCallback::MovImm(unsigned int host, uint64_t imm) {
+        if (imm <= 0xffffffffULL) {
+                EmitRex (false, 0, host);
+                Emit8 (0xb8 + (host & 7));
+                Emit32 (imm);
+        } else if ((int64_t) imm == (int32_t) imm) {
+                EmitRex (true, 0, host);
+                Emit8 (0xc7);
+                Emit8 (0xc0 | (host & 7));
+                Emit32 (imm);
+        } else {
+                EmitRex (true, 0, host);
+                Emit8 (0xb8 + (host & 7));
+                Emit64 (imm);
+        }
+}
+
+/* 32bit load zero-extends, as W() does */
+void JitCallback::LoadGpr(unsigned int host, unsigned int idx, bool bit64) {
+        if (idx == PC_IDX && !pc_in_mem) {
+                MovImm (host, bit64 ? cur_pc : (uint32_t) cur_pc);
+                return;
+        }
+        EmitMem (0x8b, host, bit64, GPR_OFF(idx));
+}
+
+void JitCallback::StoreGpr(unsigned int host, unsigned int idx) {
+        EmitMem (0x89, host, true, GPR_OFF(idx));
+        if (idx == GPR_ZERO)
+                zero_dirty = true;
+        if (idx == PC_IDX)
+                pc_in_mem = true;
+}
+
+/* op dst, src */
+void JitCallback::AluReg(unsigned int op, unsigned int dst, unsigned int src, bool bit64) {
+        EmitRex (bit64, src, dst);
+        Emit8 (op);
+        Emit8 (0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void JitCallback::AluImm(unsigned int ext, unsigned int dst, uint64_t imm, bool bit64) {
+        if (bit64 && (int64_t) imm != (int32_t) imm) {
+                MovImm (R11, imm);
+                AluReg ((ext << 3) | 1, dst, R11, bit64);
+                return;
+        }
+        EmitRex (bit64, 0, dst);
+        Emit8 (0x81);
+        Emit8 (0xc0 | (ext << 3) | (dst & 7));
+        Emit32 (imm);
+}
+
+void JitCallback::ShiftImm(unsigned int ext, unsigned int reg, unsigned int amount, bool bit64) {
+        EmitRex (bit64, 0, reg);
+        Emit8 (0xc1);
+        Emit8 (0xc0 | (ext << 3) | (reg & 7));
+        Emit8 (amount);
+}
+
+void JitCallback::Setcc(int cc, unsigned int reg) {
+        EmitRex (false, 0, reg);
+        Emit8 (0x0f);
+        Emit8 (0x90 + cc);
+        Emit8 (0xc0 | (reg & 7));
+}
+
+void JitCallback::Movzx8(unsigned int dst, unsigned int src) {
+        EmitRex (false, dst, src);
+        Emit8 (0x0f);
+        Emit8 (0xb6);
+        Emit8 (0xc0 | ((dst & 7) << 3) | (src & 7));
+}
+
+/* Build NZCV from host flags of the last add/sub (ARM carry is inverted borrow) */
+void JitCallback::StoreFlags(bool sub) {
+        Setcc (CC_S, RCX);
+        Setcc (CC_E, RDX);
+        Setcc (sub ? CC_AE : CC_B, R8);
+        Setcc (CC_O, R9);
+        Movzx8 (RCX, RCX);
+        ShiftImm (SHIFT_SHL, RCX, 31, false);
+        Movzx8 (RDX, RDX);
+        ShiftImm (SHIFT_SHL, RDX, 30, false);
+        AluReg (0x09, RCX, RDX, false);
+        Movzx8 (RDX, R8);
+        ShiftImm (SHIFT_SHL, RDX, 29, false);
+        AluReg (0x09, RCX, RDX, false);
+        Movzx8 (RDX, R9);
+        ShiftImm (SHIFT_SHL, RDX, 28, false);
+        AluReg (0x09, RCX, RDX, false);
+        EmitMem (0x89, RCX, false, NZCV_OFF);
+}
+
+/* Evaluate condition on NZCV, return host condition code which holds it (-1: always) */
+int JitCallback::CondTest(unsigned int cond) {
+        int cc;
+        switch (cond >> 1) {
+        case 0x0:
+        case 0x1:
+        case 0x2:
+        case 0x3: {
+                static const uint32_t masks[] = { Z_MASK, C_MASK, N_MASK, V_MASK };
+                /* test dword [nzcv], mask */
+                EmitMem (0xf7, 0, false, NZCV_OFF);
+                Emit32 (masks[cond >> 1]);
+                cc = CC_NE;
+                break;
+        }
+        case 0x4:
+                /* C && !Z */
+                EmitMem (0x8b, RAX, false, NZCV_OFF);
+                AluImm (ALU_AND, RAX, C_MASK | Z_MASK, false);
+                AluImm (ALU_CMP, RAX, C_MASK, false);
+                cc = CC_E;
+                break;
+        case 0x5:
+        case 0x6:
+                /* N == V (&& !Z) */
+                EmitMem (0x8b, RAX, false, NZCV_OFF);
+                AluImm (ALU_AND, RAX, N_MASK | Z_MASK | C_MASK | V_MASK, false);
+                AluReg (0x89, RCX, RAX, false);
+                ShiftImm (SHIFT_SHL, RCX, 3, false);
+                AluReg (0x31, RAX, RCX, false);
+                Emit8 (0xa9); // test eax, imm32
+                Emit32 (cond >> 1 == 0x5 ? N_MASK : N_MASK | Z_MASK);
+                cc = CC_E;
+                break;
+        default:
+                return -1;
+        }
+        if (cond & 0x1)
+                cc ^= 1;
+        return cc;
+}
+
+void JitCallback::StorePC(uint64_t val) {
+        MovImm (RAX, val);
+        StoreGpr (RAX, PC_IDX);
+}
+
+/* Make guest PC in memory valid before it can be observed */
+void JitCallback::SyncPC() {
+        if (!pc_in_mem)
+                StorePC (cur_pc);
+}
+
+void JitCallback::CallHelper(void *fn, uint64_t arg) {
+        MovImm (RDI, arg);
+        MovImm (RAX, (uint64_t) fn);
+        Emit8 (0xff); // call rax
+        Emit8 (0xd0);
+}
+
+void JitCallback::EmitFallback(const MicroOp &op) {
+        SyncPC ();
+        block->fallback_ops.push_back (op);
+        CallHelper ((void *) Jit::Fallback, (uint64_t) &block->fallback_ops.back ());
+        zero_dirty = true;
+}
+
+/* jmp rel32, returns the displacement to patch */
+uint8_t *JitCallback::EmitJmp() {
+        Emit8 (0xe9);
+        uint8_t *patch = ptr;
+        Emit32 (0);
+        return patch;
+}
+
+/* Point rel32 at patch to the current position */
+void JitCallback::PatchJump(uint8_t *patch) {
+        int32_t rel = ptr - (patch + 4);
+        memcpy (patch, &rel, sizeof(rel));
+}
+
+/* ####### Fastmem ####### */
+
+/* Watchpoints need every access to go through MMU */
+bool JitCallback::FastmemInline(int size) {
+        return Memory::fastmem_base && !GdbStub::enabled && size <= 3;
+}
+
+/* Guest address in rax to host address, returns jcc rel32 to patch to the
+ * slow path taken for addresses outside of the reservation */
+uint8_t *JitCallback::EmitFastmemAddr() {
+        AluReg (0x89, RCX, RAX, true);
+        ShiftImm (SHIFT_SHR, RCX, GUEST_VA_BITS, true);
+        Emit8 (0x0f); // jnz slow
+        Emit8 (0x80 + CC_NE);
+        uint8_t *patch = ptr;
+        Emit32 (0);
+        MovImm (RCX, (uint64_t) Memory::fastmem_base);
+        AluReg (0x01, RAX, RCX, true);
+        return patch;
+}
+
+/* Load from host address in rax as _LoadReg does */
+void JitCallback::EmitGuestLoad(unsigned int rd_idx, int size, bool sext32) {
+        switch (size) {
+        case 0:
+        case 1:
+                Emit8 (0x0f); // movzx edx, byte/word [rax] (no REX)
+                EmitMemBase (size ? 0xb7 : 0xb6, RDX, RAX, false, 0);
+                break;
+        default:
+                EmitMemBase (0x8b, RDX, RAX, size == 3, 0);
+                break;
+        }
+        if (sext32) {
+                /* movsxd rdx, edx */
+                EmitRex (true, RDX, RDX);
+                Emit8 (0x63);
+                Emit8 (0xc0 | ((RDX & 7) << 3) | (RDX & 7));
+        }
+        StoreGpr (RDX, rd_idx);
+}
+
+/* Store to host address in rax as _StoreReg does */
+void JitCallback::EmitGuestStore(unsigned int rd_idx, int size) {
+        LoadGpr (RDX, rd_idx, true);
+        if (size == 1)
+                Emit8 (0x66); // Operand size prefix
+        EmitMemBase (size ? 0x89 : 0x88, RDX, RAX, size == 3, 0);
+}
+
+/* Leave block to known target. Jump at the head is patched to chain the target block */
+void JitCallback::EmitExit(uint64_t target) {
+        uint8_t *site = ptr;
+        Emit8 (0xe9);
+        Emit32 (0);
+        StorePC (target);
+        MovImm (RAX, (uint64_t) site);
+        Emit8 (0xe9); // jmp exit_stub
+        Emit32 (exit_stub - (ptr + 4));
+}
+
+/* Leave block to address held in rax */
+void JitCallback::EmitIndirect(bool ret) {
+        EmitMem (0x89, RAX, true, GPR_OFF(PC_IDX));
+        MovImm (RDX, (uint64_t) &Jit::get_instance ()->runtime);
+        if (ret) {
+                /* Pop return address stack */
+                EmitMemBase (0x8b, RCX, RDX, false, RAS_TOP_OFF);
+                AluReg (0x89, RSI, RCX, false);
+                AluImm (ALU_SUB, RSI, 1, false);
+                AluImm (ALU_AND, RSI, JIT_RAS_SIZE - 1, false);
+                EmitMemBase (0x89, RSI, RDX, false, RAS_TOP_OFF);
+                ShiftImm (SHIFT_SHL, RCX, 4, false);
+                AluReg (0x01, RCX, RDX, true);
+                EmitMemBase (0x3b, RAX, RCX, true, RAS_OFF);
+                Emit8 (0x70 + CC_NE);
+                Emit8 (6);
+                EmitMemBase (0xff, 4, RCX, false, RAS_OFF + 8); // jmp [entry.code]
+        }
+        /* Indirect branch target cache */
+        AluReg (0x89, RCX, RAX, true);
+        ShiftImm (SHIFT_SHR, RCX, 2, true);
+        AluImm (ALU_AND, RCX, JIT_IBTC_SIZE - 1, false);
+        ShiftImm (SHIFT_SHL, RCX, 4, false);
+        AluReg (0x01, RCX, RDX, true);
+        EmitMemBase (0x3b, RAX, RCX, true, IBTC_OFF);
+        Emit8 (0x70 + CC_NE);
+        Emit8 (6);
+        EmitMemBase (0xff, 4, RCX, false, IBTC_OFF + 8);
+        /* Miss: back to dispatcher */
+        AluReg (0x31, RAX, RAX, false);
+        Emit8 (0xe9);
+        Emit32 (exit_stub - (ptr + 4));
+}
+
+/* Push return address for the following RET, returns imm64 to be filled with its host code */
+uint8_t *JitCallback::EmitRasPush(uint64_t ret_addr) {
+        MovImm (RDX, (uint64_t) &Jit::get_instance ()->runtime);
+        EmitMemBase (0x8b, RCX, RDX, false, RAS_TOP_OFF);
+        AluImm (ALU_ADD, RCX, 1, false);
+        AluImm (ALU_AND, RCX, JIT_RAS_SIZE - 1, false);
+        EmitMemBase (0x89, RCX, RDX, false, RAS_TOP_OFF);
+        ShiftImm (SHIFT_SHL, RCX, 4, false);
+        AluReg (0x01, RCX, RDX, true);
+        MovImm (RSI, ret_addr);
+        EmitMemBase (0x89, RSI, RCX, true, RAS_OFF);
+        /* movabs rsi, imm64 */
+        EmitRex (true, 0, RSI);
+        Emit8 (0xb8 + RSI);
+        uint8_t *imm = ptr;
+        Emit64 (0);
+        EmitMemBase (0x89, RSI, RCX, true, RAS_OFF + 8);
+        return imm;
+}
+
+void JitCallback::Begin(JitBlock *_block, uint8_t *_ptr, uint8_t *_exit_stub) {
+        block = _block;
+        ptr = _ptr;
+        exit_stub = _exit_stub;
+        cur_pc = block->addr;
+        pc_in_mem = false;
+        zero_dirty = false;
+        exit_type = EXIT_NEXT;
+        link_addr = JIT_INVALID_ADDR;
+        exit_ret = false;
+        /* Charge the time slice on entry, chained blocks included. Back to dispatcher once it is used up */
+        EmitMem (0x81, 5, true, TICKS_OFF); // sub qword [ticks], imm32
+        Emit32 (block->num_insts);
+        Emit8 (0x0f); // jns body
+        Emit8 (0x80 + CC_NS);
+        uint8_t *patch = ptr;
+        Emit32 (0);
+        StorePC (block->addr);
+        AluReg (0x31, RAX, RAX, false);
+        Emit8 (0xe9);
+        Emit32 (exit_stub - (ptr + 4));
+        int32_t rel = ptr - (patch + 4);
+        memcpy (patch, &rel, sizeof(rel));
+        pc_in_mem = false; // Only the exit path above stored it
+}
+
+void JitCallback::NextInsn() {
+        if (zero_dirty) {
+                /* mov qword [X(ZERO)], 0 */
+                EmitMem (0xc7, 0, true, GPR_OFF(GPR_ZERO));
+                Emit32 (0);
+                zero_dirty = false;
+        }
+        cur_pc += sizeof(uint32_t);
+        pc_in_mem = false;
+        link_addr = JIT_INVALID_ADDR;
+}
+
+uint8_t *JitCallback::End() {
+        bool advance = pc_in_mem;
+        uint64_t next_pc = cur_pc + sizeof(uint32_t);
+        uint64_t ret_addr = link_addr;
+        uint8_t *stub_imm = nullptr;
+        NextInsn ();
+        if (ret_addr != JIT_INVALID_ADDR)
+                stub_imm = EmitRasPush (ret_addr);
+        switch (exit_type) {
+        case EXIT_COND: {
+                Emit8 (0x0f); // jcc taken
+                Emit8 (0x80 + exit_cc);
+                uint8_t *patch = ptr;
+                Emit32 (0);
+                EmitExit (next_pc);
+                int32_t rel = ptr - (patch + 4);
+                memcpy (patch, &rel, sizeof(rel));
+                EmitExit (exit_target);
+                break;
+        }
+        case EXIT_DIRECT:
+                EmitExit (exit_target);
+                break;
+        case EXIT_INDIRECT:
+                EmitIndirect (exit_ret && ret_addr == JIT_INVALID_ADDR);
+                break;
+        case EXIT_DISPATCH:
+                /* add qword [PC], 4 */
+                EmitMem (0x83, 0, true, GPR_OFF(PC_IDX));
+                Emit8 (sizeof(uint32_t));
+                AluReg (0x31, RAX, RAX, false);
+                Emit8 (0xe9);
+                Emit32 (exit_stub - (ptr + 4));
+                break;
+        default:
+                if (advance) {
+                        /* add qword [PC], 4 */
+                        EmitMem (0x83, 0, true, GPR_OFF(PC_IDX));
+                        Emit8 (sizeof(uint32_t));
+                        LoadGpr (RAX, PC_IDX, true);
+                        EmitIndirect (false);
+                } else {
+                        EmitExit (next_pc);
+                }
+                break;
+        }
+        if (stub_imm) {
+                /* Return stub referenced from return address stack */
+                uint64_t stub = (uint64_t) ptr;
+                memcpy (stub_imm, &stub, sizeof(stub));
+                EmitExit (ret_addr);
+        }
+        return ptr;
+}
+
+/* ####### Native callbacks ####### */
+
+void JitCallback::MoviI64(unsigned int reg_idx, uint64_t imm, bool bit64) {
+        MovImm (RAX, imm);
+        StoreGpr (RAX, reg_idx);
+}
+
+void JitCallback::DepositI64(unsigned int rd_idx, uint64_t imm, unsigned int pos, unsigned int len, bool bit64) {
+        if (len >= 64) {
+                Fallback (MicroOp_DepositI64, rd_idx, imm, pos, len, bit64);
+                return;
+        }
+        uint64_t mask = (1ULL << len) - 1;
+        LoadGpr (RAX, rd_idx, true);
+        MovImm (RCX, ~(mask << pos));
+        AluReg (0x21, RAX, RCX, true);
+        MovImm (RCX, imm << pos);
+        AluReg (0x09, RAX, RCX, true);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::DepositZeroI64(unsigned int rd_idx, uint64_t imm, unsigned int pos, unsigned int len, bool bit64) {
+        if (len >= 64) {
+                Fallback (MicroOp_DepositZeroI64, rd_idx, imm, pos, len, bit64);
+                return;
+        }
+        MoviI64 (rd_idx, (imm & ((1ULL << len) - 1)) << pos, true);
+}
+
+void JitCallback::MovReg(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        LoadGpr (RAX, rn_idx, bit64);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::CondMovReg(unsigned int cond, unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64) {
+        int cc = CondTest (cond);
+        /* mov doesn't change host flags */
+        LoadGpr (RDX, rn_idx, bit64);
+        if (cc >= 0) {
+                LoadGpr (R8, rm_idx, bit64);
+                /* cmovncc rdx, r8 */
+                EmitRex (true, RDX, R8);
+                Emit8 (0x0f);
+                Emit8 (0x40 + (cc ^ 1));
+                Emit8 (0xc0 | ((RDX & 7) << 3) | (R8 & 7));
+        }
+        StoreGpr (RDX, rd_idx);
+}
+
+void JitCallback::ArithImm(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64, bool sub) {
+        if (!setflags) {
+                rd_idx = ARMv8::HandleAsSP (rd_idx);
+                rn_idx = ARMv8::HandleAsSP (rn_idx);
+        }
+        if (!setflags && !sub && rn_idx == PC_IDX && !pc_in_mem) {
+                /* Keep track of return address (BL/BLR) */
+                if (rd_idx == GPR_LR && imm == sizeof(uint32_t))
+                        link_addr = cur_pc + imm;
+        }
+        LoadGpr (RAX, rn_idx, bit64);
+        AluImm (sub ? ALU_SUB : ALU_ADD, RAX, imm, bit64);
+        if (setflags)
+                StoreFlags (sub);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::ArithReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64, unsigned int ext) {
+        LoadGpr (RAX, rn_idx, bit64);
+        LoadGpr (RCX, rm_idx, bit64);
+        AluReg ((ext << 3) | 1, RAX, RCX, bit64);
+        if (setflags)
+                StoreFlags (ext == ALU_SUB);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::AddI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64) {
+        ArithImm (rd_idx, rn_idx, imm, setflags, bit64, false);
+}
+
+void JitCallback::SubI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64) {
+        ArithImm (rd_idx, rn_idx, imm, setflags, bit64, true);
+}
+
+void JitCallback::AddReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        ArithReg (rd_idx, rn_idx, rm_idx, setflags, bit64, ALU_ADD);
+}
+
+void JitCallback::SubReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        ArithReg (rd_idx, rn_idx, rm_idx, setflags, bit64, ALU_SUB);
+}
+
+void JitCallback::AndI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool setflags, bool bit64) {
+        if (setflags) {
+                Fallback (MicroOp_AndI64, rd_idx, rn_idx, wmask, setflags, bit64);
+                return;
+        }
+        LoadGpr (RAX, rn_idx, bit64);
+        AluImm (ALU_AND, RAX, wmask, bit64);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::OrrI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool bit64) {
+        LoadGpr (RAX, rn_idx, bit64);
+        AluImm (ALU_OR, RAX, wmask, bit64);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::EorI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool bit64) {
+        LoadGpr (RAX, rn_idx, bit64);
+        AluImm (ALU_XOR, RAX, wmask, bit64);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::ShiftI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int shift_type, unsigned int shift_amount, bool bit64) {
+        static const unsigned int exts[] = { SHIFT_SHL, SHIFT_SHR, SHIFT_SAR };
+        if (shift_type > Disassembler::ShiftType_ASR) {
+                Fallback (MicroOp_ShiftI64, rd_idx, rn_idx, shift_type, shift_amount, bit64);
+                return;
+        }
+        LoadGpr (RAX, rn_idx, bit64);
+        ShiftImm (exts[shift_type], RAX, shift_amount, bit64);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::AndReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        if (setflags) {
+                Fallback (MicroOp_AndReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+                return;
+        }
+        ArithReg (rd_idx, rn_idx, rm_idx, false, bit64, ALU_AND);
+}
+
+void JitCallback::OrrReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64) {
+        ArithReg (ARMv8::HandleAsSP (rd_idx), rn_idx, rm_idx, false, bit64, ALU_OR);
+}
+
+void JitCallback::EorReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64) {
+        ArithReg (ARMv8::HandleAsSP (rd_idx), rn_idx, rm_idx, false, bit64, ALU_XOR);
+}
+
+void JitCallback::NotReg(unsigned int rd_idx, unsigned int rm_idx, bool bit64) {
+        LoadGpr (RAX, rm_idx, bit64);
+        /* not rax */
+        EmitRex (bit64, 0, RAX);
+        Emit8 (0xf7);
+        Emit8 (0xd0);
+        StoreGpr (RAX, rd_idx);
+}
+
+void JitCallback::BranchI64(uint64_t imm) {
+        exit_type = EXIT_DIRECT;
+        exit_target = imm + 4;
+}
+
+void JitCallback::BranchCondiI64(unsigned int cond, unsigned int rt_idx, uint64_t imm, uint64_t addr, bool bit64) {
+        if (cond != Disassembler::CondType_EQ && cond != Disassembler::CondType_NE)
+                return;
+        LoadGpr (RAX, rt_idx, bit64);
+        MovImm (RCX, imm);
+        AluReg ((ALU_CMP << 3) | 1, RAX, RCX, true);
+        exit_type = EXIT_COND;
+        exit_cc = cond == Disassembler::CondType_EQ ? CC_E : CC_NE;
+        exit_target = addr + 4;
+}
+
+void JitCallback::BranchFlag(unsigned int cond, uint64_t addr) {
+        exit_cc = CondTest (cond);
+        exit_type = exit_cc < 0 ? EXIT_DIRECT : EXIT_COND;
+        exit_target = addr + 4;
+}
+
+void JitCallback::SetPCReg(unsigned int rt_idx) {
+        LoadGpr (RAX, rt_idx, true);
+        exit_type = EXIT_INDIRECT;
+        exit_ret = rt_idx == GPR_LR;
+}
+
+/* Fastmem accesses, the interpreter takes addresses outside of guest VA.
+ * PC is synced first: a fault on an unmapped page is reported at this instruction */
+
+void JitCallback::LoadRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend) {
+        if (!FastmemInline (size)) {
+                Fallback (MicroOp_LoadRegI64, rd_idx, ad_idx, size, is_sign, extend);
+                return;
+        }
+        SyncPC ();
+        LoadGpr (RAX, ad_idx, true);
+        uint8_t *slow = EmitFastmemAddr ();
+        EmitGuestLoad (rd_idx, size, extend && is_sign);
+        uint8_t *done = EmitJmp ();
+        PatchJump (slow);
+        Fallback (MicroOp_LoadRegI64, rd_idx, ad_idx, size, is_sign, extend);
+        PatchJump (done);
+}
+
+void JitCallback::StoreRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend) {
+        if (!FastmemInline (size)) {
+                Fallback (MicroOp_StoreRegI64, rd_idx, ad_idx, size, is_sign, extend);
+                return;
+        }
+        SyncPC ();
+        LoadGpr (RAX, ad_idx, true);
+        uint8_t *slow = EmitFastmemAddr ();
+        EmitGuestStore (rd_idx, size);
+        uint8_t *done = EmitJmp ();
+        PatchJump (slow);
+        Fallback (MicroOp_StoreRegI64, rd_idx, ad_idx, size, is_sign, extend);
+        PatchJump (done);
+}
+
+void JitCallback::_LoadReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend) {
+        if (!FastmemInline (size) || addr >> GUEST_VA_BITS) {
+                Fallback (MicroOp__LoadReg, rd_idx, addr, size, is_sign, extend);
+                return;
+        }
+        SyncPC ();
+        MovImm (RAX, (uint64_t) Memory::fastmem_base + addr);
+        EmitGuestLoad (rd_idx, size, extend && is_sign);
+}
+
+void JitCallback::_StoreReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend) {
+        if (!FastmemInline (size) || addr >> GUEST_VA_BITS) {
+                Fallback (MicroOp__StoreReg, rd_idx, addr, size, is_sign, extend);
+                return;
+        }
+        SyncPC ();
+        MovImm (RAX, (uint64_t) Memory::fastmem_base + addr);
+        EmitGuestStore (rd_idx, size);
+}
+
+/* ####### Fallback callbacks (executed by interpreter) ####### */
+
+void JitCallback::DepositReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64) {
+        Fallback (MicroOp_DepositReg, rd_idx, rn_idx, pos, len, bit64);
+}
+
+void JitCallback::DepositZeroReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64) {
+        Fallback (MicroOp_DepositZeroReg, rd_idx, rn_idx, pos, len, bit64);
+}
+
+void JitCallback::MulReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign, bool dst64, bool src64) {
+        Fallback (MicroOp_MulReg, rd_idx, rn_idx, rm_idx, sign, dst64, src64);
+}
+
+void JitCallback::Mul2Reg(unsigned int rh_idx, unsigned int rl_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign) {
+        Fallback (MicroOp_Mul2Reg, rh_idx, rl_idx, rn_idx, rm_idx, sign);
+}
+
+void JitCallback::DivReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign, bool bit64) {
+        Fallback (MicroOp_DivReg, rd_idx, rn_idx, rm_idx, sign, bit64);
+}
+
+void JitCallback::ShiftReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, unsigned int shift_type, bool bit64) {
+        Fallback (MicroOp_ShiftReg, rd_idx, rn_idx, rm_idx, shift_type, bit64);
+}
+
+void JitCallback::AddcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Fallback (MicroOp_AddcReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void JitCallback::SubcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Fallback (MicroOp_SubcReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void JitCallback::BicReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64) {
+        Fallback (MicroOp_BicReg, rd_idx, rn_idx, rm_idx, setflags, bit64);
+}
+
+void JitCallback::ExtendReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int extend_type, bool bit64) {
+        Fallback (MicroOp_ExtendReg, rd_idx, rn_idx, extend_type, bit64);
+}
+
+void JitCallback::LoadReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64) {
+        Fallback (MicroOp_LoadReg, rd_idx, base_idx, rm_idx, size, is_sign, extend, post, bit64);
+}
+
+void JitCallback::StoreReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64) {
+        Fallback (MicroOp_StoreReg, rd_idx, base_idx, rm_idx, size, is_sign, extend, post, bit64);
+}
+
+void JitCallback::LoadStorePair(unsigned int rt_idx, unsigned int rt2_idx, unsigned int ad_idx, int size, bool is_sign, bool is_vector, bool is_load) {
+        Fallback (MicroOp_LoadStorePair, rt_idx, rt2_idx, ad_idx, size, is_sign, is_vector, is_load);
+}
+
+void JitCallback::LoadExclusive(unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair) {
+        Fallback (MicroOp_LoadExclusive, rt_idx, rt2_idx, rn_idx, size, pair);
+}
+
+void JitCallback::StoreExclusive(unsigned int rs_idx, unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair) {
+        Fallback (MicroOp_StoreExclusive, rs_idx, rt_idx, rt2_idx, rn_idx, size, pair);
+}
+
+void JitCallback::ClearExclusive() {
+        /* mov byte [excl.armed], 0 */
+        EmitMem (0xc6, 0, false, EXCL_ARMED_OFF);
+        Emit8 (0);
+}
+
+void JitCallback::Barrier(int type) {
+        /* Generated code keeps program order and x86 only reorders stores after later loads */
+        if (type == Disassembler::Barrier_FULL) {
+                Emit8 (0x0f); // mfence
+                Emit8 (0xae);
+                Emit8 (0xf0);
+        }
+}
+
+void JitCallback::Hint(int type) {
+        Fallback (MicroOp_Hint, type);
+}
+
+void JitCallback::SExtractI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64) {
+        Fallback (MicroOp_SExtractI64, rd_idx, rn_idx, pos, len, bit64);
+}
+
+void JitCallback::UExtractI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64) {
+        Fallback (MicroOp_UExtractI64, rd_idx, rn_idx, pos, len, bit64);
+}
+
+void JitCallback::SExt32(unsigned int rd_idx, unsigned int rn_idx) {
+        Fallback (MicroOp_SExt32, rd_idx, rn_idx);
+}
+
+void JitCallback::RevBit(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Fallback (MicroOp_RevBit, rd_idx, rn_idx, bit64);
+}
+
+void JitCallback::RevByte16(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Fallback (MicroOp_RevByte16, rd_idx, rn_idx, bit64);
+}
+
+void JitCallback::RevByte32(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Fallback (MicroOp_RevByte32, rd_idx, rn_idx, bit64);
+}
+
+void JitCallback::RevByte64(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Fallback (MicroOp_RevByte64, rd_idx, rn_idx, bit64);
+}
+
+void JitCallback::CntLeadZero(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Fallback (MicroOp_CntLeadZero, rd_idx, rn_idx, bit64);
+}
+
+void JitCallback::CntLeadSign(unsigned int rd_idx, unsigned int rn_idx, bool bit64) {
+        Fallback (MicroOp_CntLeadSign, rd_idx, rn_idx, bit64);
+}
+
+void JitCallback::Crc32(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, int size, bool castagnoli) {
+        if (castagnoli && ARMv8::host_features.sse4_2) {
+                LoadGpr (RAX, rn_idx, false);
+                LoadGpr (RCX, rm_idx, size == 3);
+                /* crc32 eax, cl/cx/ecx (rax, rcx): zero extends like a W write */
+                if (size == 1)
+                        Emit8 (0x66);
+                Emit8 (0xf2);
+                EmitRex (size == 3, RAX, RCX);
+                Emit8 (0x0f);
+                Emit8 (0x38);
+                Emit8 (size == 0 ? 0xf0 : 0xf1);
+                Emit8 (0xc0 | ((RAX & 7) << 3) | (RCX & 7));
+                StoreGpr (RAX, rd_idx);
+                return;
+        }
+        Fallback (MicroOp_Crc32, rd_idx, rn_idx, rm_idx, size, castagnoli);
+}
+
+void JitCallback::CondCmpI64(unsigned int rn_idx, unsigned int imm, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64) {
+        Fallback (MicroOp_CondCmpI64, rn_idx, imm, nzcv, cond, op, bit64);
+}
+
+void JitCallback::CondCmpReg(unsigned int rn_idx, unsigned int rm_idx, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64) {
+        Fallback (MicroOp_CondCmpReg, rn_idx, rm_idx, nzcv, cond, op, bit64);
+}
+
+void JitCallback::SVC(unsigned int svc_num) {
+        Fallback (MicroOp_SVC, svc_num);
+        exit_type = EXIT_DISPATCH;
+}
+
+void JitCallback::BRK(unsigned int memo) {
+        Fallback (MicroOp_BRK, memo);
+        exit_type = EXIT_DISPATCH;
+}
+
+void JitCallback::HleCall(unsigned int id) {
+        Fallback (MicroOp_HleCall, id);
+}
+
+/* Offset was resolved by the decoder: a plain move to or from the state */
+void JitCallback::ReadWriteSysReg(unsigned int rd_idx, int offset, bool read) {
+        if (read) {
+                EmitMem (0x8b, RAX, true, SYSR_OFF(offset));
+                StoreGpr (RAX, rd_idx);
+        } else {
+                LoadGpr (RAX, rd_idx, true);
+                EmitMem (0x89, RAX, true, SYSR_OFF(offset));
+        }
+}
+
+void JitCallback::ReadWriteNZCV(unsigned int rd_idx, bool read) {
+        Fallback (MicroOp_ReadWriteNZCV, rd_idx, read);
+}
+
+void JitCallback::ReadWriteFPCR(unsigned int rd_idx, bool read) {
+        Fallback (MicroOp_ReadWriteFPCR, rd_idx, read);
+}
+
+void JitCallback::ReadWriteFPSR(unsigned int rd_idx, bool read) {
+        Fallback (MicroOp_ReadWriteFPSR, rd_idx, read);
+}
+
+void JitCallback::DcZva(unsigned int rt_idx) {
+        Fallback (MicroOp_DcZva, rt_idx);
+}
+
+void JitCallback::FMovReg(unsigned int fd_idx, unsigned int fn_idx, int type) {
+        Fallback (MicroOp_FMovReg, fd_idx, fn_idx, type);
+}
+
+void JitCallback::FMovConv(unsigned int rd_idx, unsigned int rn_idx, int type, bool itof) {
+        Fallback (MicroOp_FMovConv, rd_idx, rn_idx, type, itof);
+}
+
+void JitCallback::FpArith(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) {
+        Fallback (MicroOp_FpArith, vd_idx, vn_idx, vm_idx, dbl, elements, op);
+}
+
+void JitCallback::FpPairwise(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) {
+        Fallback (MicroOp_FpPairwise, vd_idx, vn_idx, vm_idx, dbl, elements, op);
+}
+
+void JitCallback::FpMulAdd(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, unsigned int va_idx, bool dbl, int elements, bool neg_prod, bool neg_acc) {
+        Fallback (MicroOp_FpMulAdd, vd_idx, vn_idx, vm_idx, va_idx, dbl, elements, neg_prod, neg_acc);
+}
+
+void JitCallback::FpUnary(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, int op) {
+        Fallback (MicroOp_FpUnary, vd_idx, vn_idx, dbl, elements, op);
+}
+
+void JitCallback::FpConvert(unsigned int vd_idx, unsigned int vn_idx, int from_type, int to_type) {
+        Fallback (MicroOp_FpConvert, vd_idx, vn_idx, from_type, to_type);
+}
+
+void JitCallback::FpConvertVec(unsigned int vd_idx, unsigned int vn_idx, bool to_dbl, bool is_q) {
+        Fallback (MicroOp_FpConvertVec, vd_idx, vn_idx, to_dbl, is_q);
+}
+
+void JitCallback::FpToInt(unsigned int rd_idx, unsigned int vn_idx, bool dbl, bool bit64, bool sign, int rounding, int fbits) {
+        Fallback (MicroOp_FpToInt, rd_idx, vn_idx, dbl, bit64, sign, rounding, fbits);
+}
+
+void JitCallback::IntToFp(unsigned int vd_idx, unsigned int rn_idx, bool dbl, bool bit64, bool sign, int fbits) {
+        Fallback (MicroOp_IntToFp, vd_idx, rn_idx, dbl, bit64, sign, fbits);
+}
+
+void JitCallback::FpToIntVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign, int rounding) {
+        Fallback (MicroOp_FpToIntVec, vd_idx, vn_idx, dbl, elements, sign, rounding);
+}
+
+void JitCallback::IntToFpVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign) {
+        Fallback (MicroOp_IntToFpVec, vd_idx, vn_idx, dbl, elements, sign);
+}
+
+void JitCallback::FpCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, bool cmp_zero, bool signal) {
+        Fallback (MicroOp_FpCompare, vn_idx, vm_idx, dbl, cmp_zero, signal);
+}
+
+void JitCallback::FpCondCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int nzcv, unsigned int cond, bool signal) {
+        Fallback (MicroOp_FpCondCompare, vn_idx, vm_idx, dbl, nzcv, cond, signal);
+}
+
+void JitCallback::FpCondSelect(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int cond) {
+        Fallback (MicroOp_FpCondSelect, vd_idx, vn_idx, vm_idx, dbl, cond);
+}
+
+void JitCallback::AndVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
+        Fallback (MicroOp_AndVecReg, rd_idx, rn_idx, rm_idx);
+}
+
+void JitCallback::OrrVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
+        Fallback (MicroOp_OrrVecReg, rd_idx, rn_idx, rm_idx);
+}
+
+void JitCallback::EorVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
+        Fallback (MicroOp_EorVecReg, rd_idx, rn_idx, rm_idx);
+}
+
+void JitCallback::BicVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx) {
+        Fallback (MicroOp_BicVecReg, rd_idx, rn_idx, rm_idx);
+}
+
+void JitCallback::NotVecReg(unsigned int rd_idx, unsigned int rm_idx) {
+        Fallback (MicroOp_NotVecReg, rd_idx, rm_idx);
+}
+
+void JitCallback::LoadVecReg(unsigned int vd_idx, int element, unsigned int rn_idx, int size) {
+        Fallback (MicroOp_LoadVecReg, vd_idx, element, rn_idx, size);
+}
+
+void JitCallback::StoreVecReg(unsigned int rd_idx, int element, unsigned int vn_idx, int size) {
+        Fallback (MicroOp_StoreVecReg, rd_idx, element, vn_idx, size);
+}
+
+void JitCallback::LoadStoreMulti(unsigned int vt_idx, unsigned int ad_idx, int size, int rpt, int selem, bool is_q, bool is_load) {
+        Fallback (MicroOp_LoadStoreMulti, vt_idx, ad_idx, size, rpt, selem, is_q, is_load);
+}
+
+void JitCallback::LoadFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64) {
+        Fallback (MicroOp_LoadFpReg, rd_idx, base_idx, rm_idx, size, post, bit64);
+}
+
+void JitCallback::StoreFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64) {
+        Fallback (MicroOp_StoreFpReg, rd_idx, base_idx, rm_idx, size, post, bit64);
+}
+
+void JitCallback::LoadFpRegI64(unsigned int fd_idx, unsigned int ad_idx, int size) {
+        Fallback (MicroOp_LoadFpRegI64, fd_idx, ad_idx, size);
+}
+
+void JitCallback::StoreFpRegI64(unsigned int fd_idx, unsigned int ad_idx, int size) {
+        Fallback (MicroOp_StoreFpRegI64, fd_idx, ad_idx, size);
+}
+
+void JitCallback::ReadVecReg(unsigned int fd_idx, unsigned int vn_idx, unsigned int index, int size) {
+        Fallback (MicroOp_ReadVecReg, fd_idx, vn_idx, index, size);
+}
+
+void JitCallback::ReadVecElem(unsigned int rd_idx, unsigned int vn_idx, unsigned int index, int size) {
+        Fallback (MicroOp_ReadVecElem, rd_idx, vn_idx, index, size);
+}
+
+void JitCallback::WriteVecElem(unsigned int vd_idx, unsigned int rn_idx, unsigned int index, int size) {
+        Fallback (MicroOp_WriteVecElem, vd_idx, rn_idx, index, size);
+}
+
+void JitCallback::DupVecImmI32(unsigned int vd_idx, uint32_t imm, int size, int dstsize) {
+        Fallback (MicroOp_DupVecImmI32, vd_idx, imm, size, dstsize);
+}
+
+void JitCallback::DupVecImmI64(unsigned int vd_idx, uint64_t imm, int size, int dstsize) {
+        Fallback (MicroOp_DupVecImmI64, vd_idx, imm, size, dstsize);
+}
+
+void JitCallback::DupVecReg(unsigned int vd_idx, unsigned int vn_idx, unsigned int index, int size, int dstsize) {
+        Fallback (MicroOp_DupVecReg, vd_idx, vn_idx, index, size, dstsize);
+}
+
+void JitCallback::DupVecRegFromGen(unsigned int vd_idx, unsigned int rn_idx, int size, int dstsize) {
+        Fallback (MicroOp_DupVecRegFromGen, vd_idx, rn_idx, size, dstsize);
+}
+
+void JitCallback::CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Fallback (MicroOp_CompareEqualVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void JitCallback::CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Fallback (MicroOp_CompareTestBitsVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void JitCallback::CompareGreaterVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign, bool equal) {
+        Fallback (MicroOp_CompareGreaterVec, vd_idx, vn_idx, vm_idx, size, is_q, sign, equal);
+}
+
+void JitCallback::AddVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Fallback (MicroOp_AddVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void JitCallback::SubVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Fallback (MicroOp_SubVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void JitCallback::MulVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) {
+        Fallback (MicroOp_MulVec, vd_idx, vn_idx, vm_idx, size, is_q);
+}
+
+void JitCallback::MaxVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+        Fallback (MicroOp_MaxVec, vd_idx, vn_idx, vm_idx, size, is_q, sign);
+}
+
+void JitCallback::MinVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+        Fallback (MicroOp_MinVec, vd_idx, vn_idx, vm_idx, size, is_q, sign);
+}
+
+void JitCallback::AddSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+        Fallback (MicroOp_AddSatVec, vd_idx, vn_idx, vm_idx, size, is_q, sign);
+}
+
+void JitCallback::SubSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) {
+        Fallback (MicroOp_SubSatVec, vd_idx, vn_idx, vm_idx, size, is_q, sign);
+}
+
+void JitCallback::PolyMulLong(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool upper) {
+        Fallback (MicroOp_PolyMulLong, vd_idx, vn_idx, vm_idx, size, upper);
+}
+
+void JitCallback::CryptoAes(unsigned int vd_idx, unsigned int vn_idx, int op) {
+        Fallback (MicroOp_CryptoAes, vd_idx, vn_idx, op);
+}
+
+void JitCallback::CryptoSha(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int op) {
+        Fallback (MicroOp_CryptoSha, vd_idx, vn_idx, vm_idx, op);
+}
+
+void JitCallback::CmpI64Branch(unsigned int rn_idx, uint64_t imm, bool bit64, unsigned int cond, uint64_t addr) {
+        SubI64 (GPR_ZERO, rn_idx, imm, true, bit64);
+        NextInsn ();
+        BranchFlag (cond, addr);
+}
+
+void JitCallback::CmpRegBranch(unsigned int rn_idx, unsigned int rm_idx, bool bit64, unsigned int cond, uint64_t addr) {
+        SubReg (GPR_ZERO, rn_idx, rm_idx, true, bit64);
+        NextInsn ();
+        BranchFlag (cond, addr);
+}
+
+void JitCallback::LoadBranchZero(unsigned int rt_idx, unsigned int ad_idx, int size, bool is_sign, bool extend,
+                                 unsigned int cond, uint64_t addr, bool bit64) {
+        LoadRegI64 (rt_idx, ad_idx, size, is_sign, extend);
+        NextInsn ();
+        BranchCondiI64 (cond, rt_idx, 0, addr, bit64);
+}
+
+void JitCallback::MoviPair(unsigned int rd_idx, uint64_t imm, bool bit64, unsigned int rd2_idx, uint64_t imm2, bool bit64_2) {
+        MoviI64 (rd_idx, imm, bit64);
+        NextInsn ();
+        MoviI64 (rd2_idx, imm2, bit64_2);
+}
+
+/* ####### JIT engine ####### */
+
+void Jit::Init() {
+        void *data;
+        if ((data = mmap (nullptr, JIT_CODE_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+                ns_abort ("Failed to allocate JIT code cache\n");
+        }
+        code_cache = (uint8_t *) data;
+        uint8_t *p = code_cache;
+        /* Entry: push rbx; mov rbx, rdi; jmp rsi */
+        entry = (JitEntry) p;
+        *p++ = 0x53;
+        *p++ = 0x48; *p++ = 0x89; *p++ = 0xfb;
+        *p++ = 0xff; *p++ = 0xe6;
+        /* Exit: pop rbx; ret */
+        exit_stub = p;
+        *p++ = 0x5b;
+        *p++ = 0xc3;
+        code_start = code_ptr = p;
+        Flush ();
+}
+
+void Jit::Fallback(const MicroOp *op) {
+        ReplayMicroOp (intpr_cb, *op);
+        /* Generated code reads NZCV directly */
+        ARMv8::GetNZCV ();
+}
+
+void Jit::Flush() {
+        debug_print ("Flush JIT code cache\n");
+        for (auto &it : blocks)
+                delete it.second;
+        blocks.clear ();
+        code_ptr = code_start;
+        cache_gen = BlockCache::Generation ();
+        flush_count++;
+        for (JitLookupEntry &ent : runtime.ibtc)
+                ent.addr = JIT_INVALID_ADDR;
+        for (JitLookupEntry &ent : runtime.ras)
+                ent.addr = JIT_INVALID_ADDR;
+}
+
+/* Chain exit site to target block */
+void Jit::Link(uint8_t *site, uint8_t *target) {
+        int32_t rel = target - (site + 5);
+        memcpy (site + 1, &rel, sizeof(rel));
+}
+
+JitBlock *Jit::Compile(BasicBlock *bb) {
+        JitBlock *block = new JitBlock (bb->addr, bb->num_insts);
+        block->code = code_ptr;
+        block->idle = bb->idle;
+        jit_cb->Begin (block, code_ptr, exit_stub);
+        for (size_t i = 0; i < bb->ops.size (); i++) {
+                const MicroOp &op = bb->ops[i];
+                if (op.type != MicroOp_NextInsn) {
+                        ReplayMicroOp (jit_cb, op);
+                        continue;
+                }
+                /* End () finishes the last instruction */
+                uint64_t insns = i + 1 < bb->ops.size () ? op.arg[0] : op.arg[0] - 1;
+                for (uint64_t n = 0; n < insns; n++)
+                        jit_cb->NextInsn ();
+        }
+        code_ptr = jit_cb->End ();
+        if (code_ptr - block->code > JIT_BLOCK_MAX_SIZE) {
+                ns_abort ("JIT block overflow (0x%lx)\n", block->addr);
+        }
+        blocks[block->addr] = block;
+        return block;
+}
+
+JitBlock *Jit::Lookup(uint64_t addr) {
+        if (cache_gen != BlockCache::Generation ())
+                Flush ();
+        auto it = blocks.find (addr);
+        if (it != blocks.end ())
+                return it->second;
+        if (code_ptr + JIT_BLOCK_MAX_SIZE > code_cache + JIT_CODE_CACHE_SIZE)
+                Flush ();
+        return Compile (BlockCache::Lookup (addr));
+}
+
+int Jit::SingleStep() {
+	uint32_t inst = ARMv8::ReadInst (PC);
+	debug_print ("Run Code: 0x%lx: 0x%08lx\n", PC, inst);
+	Disassembler::DisasA64 (inst, intpr_cb);
+	PC += sizeof(uint32_t);
+        X(GPR_ZERO) = 0; //Reset Zero register
+	return 0;
+}
+
+void Jit::Run() {
+	debug_print ("Running with JIT\n");
+        uint8_t *site = nullptr;
+        unsigned int idle_spins = 0;
+	while (Cpu::GetState () == Cpu::State::Running) {
+                if (ARMv8::arm_state->ticks <= 0) {
+                        /* Time slice used up, or the thread blocked. Another thread may come back */
+                        ThreadManager::Schedule ();
+                        site = nullptr;
+                        continue;
+                }
+                uint64_t flushes = flush_count;
+                JitBlock *block = Lookup (PC);
+                if (site && flushes == flush_count && !block->idle)
+                        Link (site, block->code);
+                JitLookupEntry &ent = runtime.ibtc[(PC >> 2) & (JIT_IBTC_SIZE - 1)];
+                ent.addr = PC;
+                ent.code = block->code;
+                site = entry (ARMv8::arm_state, block->code);
+                if (block->idle && PC == block->addr) {
+                        if (++idle_spins >= IDLE_SPIN_LIMIT) {
+                                idle_spins = 0;
+                                ThreadManager::WaitForEvent (IDLE_PARK_NS, false);
+                        }
+                } else {
+                        idle_spins = 0;
+                }
+	}
+}
@@ -1,27 +1,107 @@
 /* nsemu - LGPL - Copyright 2017 rkx1209<rkx1209dev@gmail.com> */
+#include <sys/mman.h>
 #include "Nsemu.hpp"
 
 namespace ARMv8 {
 
+/* ####### Software TLB ####### */
+
+/* Direct mapped, one per host thread. Tags are page addresses with bit 0 set,
+ * so a zeroed entry matches nothing */
+#define TLB_BITS 8
+#define TLB_SIZE (1 << TLB_BITS)
+
+struct TlbEntry {
+        uint64_t read_tag;
+        uint64_t write_tag;
+        uint8_t *host; // Host address of the page start
+};
+
+static thread_local struct {
+        TlbEntry entries[TLB_SIZE];
+        uint64_t generation; // Memory::tlb_generation the entries are valid for
+} tlb;
+
+static inline uint64_t TlbTag(uint64_t gva) {
+        return (gva & ~GUEST_PAGE_MASK) | 1;
+}
+
+static inline TlbEntry &TlbSlot(uint64_t gva) {
+        return tlb.entries[(gva >> GUEST_PAGE_BITS) & (TLB_SIZE - 1)];
+}
+
+/* Page walk, then cache the translation */
+static uint8_t *TlbFill(uint64_t gva, bool write) {
+        uint64_t generation = Memory::tlb_generation.load (std::memory_order_acquire);
+        if (tlb.generation != generation) {
+                memset (tlb.entries, 0, sizeof(tlb.entries));
+                tlb.generation = generation;
+        }
+        PageEntry *page = Memory::LookupPage (gva);
+        uint8_t *host = page ? page->host.load (std::memory_order_acquire) : nullptr;
+        int perm = host ? page->perm.load (std::memory_order_relaxed) : 0;
+        if (!(perm & (write ? PROT_WRITE : PROT_READ))) {
+                ns_abort ("Guest page fault: %s 0x%lx\n", write ? "write to" : "read from", gva);
+        }
+        TlbEntry &entry = TlbSlot (gva);
+        entry.read_tag = (perm & PROT_READ) ? TlbTag (gva) : 0;
+        entry.write_tag = (perm & PROT_WRITE) ? TlbTag (gva) : 0;
+        entry.host = host;
+        return host + (gva & GUEST_PAGE_MASK);
+}
+
+/* Host address of gva. The access must not cross a page */
+template<bool write>
+static inline uint8_t *Translate(uint64_t gva) {
+        /* Unmapped guest pages fault on the host */
+        if (Memory::fastmem_base && gva < (1ULL << GUEST_VA_BITS))
+                return Memory::fastmem_base + gva;
+        TlbEntry &entry = TlbSlot (gva);
+        if ((write ? entry.write_tag : entry.read_tag) == TlbTag (gva) &&
+            tlb.generation == Memory::tlb_generation.load (std::memory_order_relaxed))
+                return entry.host + (gva & GUEST_PAGE_MASK);
+        return TlbFill (gva, write);
+}
+
+static inline bool CrossesPage(uint64_t gva, uint64_t len) {
+        if (Memory::fastmem_base && gva < (1ULL << GUEST_VA_BITS))
+                return false;
+        return (gva & GUEST_PAGE_MASK) + len > GUEST_PAGE_SIZE;
+}
+
+/* Page by page copy for accesses crossing pages */
+template<bool write>
+static void CopyPages(uint64_t gva, uint8_t *buf, uint64_t len) {
+        while (len) {
+                uint64_t n = std::min (len, GUEST_PAGE_SIZE - (gva & GUEST_PAGE_MASK));
+                if (write)
+                        std::memcpy (Translate<true> (gva), buf, n);
+                else
+                        std::memcpy (buf, Translate<false> (gva), n);
+                gva += n;
+                buf += n;
+                len -= n;
+        }
+}
+
 uint32_t ReadInst(uint64_t gva) {
 	return ReadU32 (gva);
 }
 
 uint64_t GvaToHva(const uint64_t gva) {
-        uint64_t gpa = gva;
-        return (uint64_t) &Memory::pRAM[gpa];
+        return (uint64_t) Memory::GetRawPtr (gva, 1);
 }
 
+/* Guest and host are both little endian: accesses are plain host loads and
+ * stores of sizeof(T), memcpy keeps unaligned ones well defined */
 template<typename T>
 static T ReadFromRAM(const uint64_t gpa) {
-	T value = 0;
-        uint8_t *emu_mem = static_cast<uint8_t *>(Memory::GetRawPtr(gpa, sizeof(T)));
+	T value;
+        if (CrossesPage (gpa, sizeof(T)))
+                CopyPages<false> (gpa, (uint8_t *) &value, sizeof(T));
+        else
+                std::memcpy (&value, Translate<false> (gpa), sizeof(T));
         debug_print("ReadFromRAM: 0x%lx, (%d)\n", gpa, sizeof(T));
-	for (uint64_t addr = gpa; addr < gpa + sizeof(T); addr++) {
-		uint8_t byte;
-		std::memcpy (&byte, &emu_mem[addr - gpa], sizeof(uint8_t));
-		value = value | ((uint64_t)byte << (8 * (addr - gpa)));
-	}
         if (GdbStub::enabled) {
                 GdbStub::NotifyMemAccess (gpa, sizeof(T), true);
         }
@@ -30,107 +110,193 @@ static T ReadFromRAM(const uint64_t gpa) {
 
 template<typename T>
 static void WriteToRAM(const uint64_t gpa, T value) {
-        uint8_t *emu_mem = static_cast<uint8_t *>(Memory::GetRawPtr(gpa, sizeof(T)));
-        debug_print("WriteToRAM: 0x%lx, (%d) RawPtr(%p)\n", gpa, sizeof(T), (void *)emu_mem);
-	for (uint64_t addr = gpa; addr < gpa + sizeof(T); addr++) {
-                uint8_t byte = value & 0xff;
-		std::memcpy (&emu_mem[addr - gpa], &byte, sizeof(uint8_t));
-		value >>= 8;
-	}
+        debug_print("WriteToRAM: 0x%lx, (%d)\n", gpa, sizeof(T));
+        if (CrossesPage (gpa, sizeof(T)))
+                CopyPages<true> (gpa, (uint8_t *) &value, sizeof(T));
+        else
+                std::memcpy (Translate<true> (gpa), &value, sizeof(T));
         if (GdbStub::enabled) {
                 GdbStub::NotifyMemAccess (gpa, sizeof(T), false);
         }
 }
 
-void ReadBytes(uint64_t gva, uint8_t *ptr, int size) {
-        uint64_t gpa = gva;
-        for (int i = 0; i < size; i++) {
-                uint8_t byte = ReadU8 (gpa + i);
-                ptr[i] = byte;
+/* One translation and one copy for the whole access, unless it crosses pages */
+void ReadRange(const uint64_t gva, void *dst, int len) {
+	uint64_t gpa = gva;
+        if (CrossesPage (gpa, len))
+                CopyPages<false> (gpa, (uint8_t *) dst, len);
+        else
+                std::memcpy (dst, Translate<false> (gpa), len);
+        if (GdbStub::enabled) {
+                GdbStub::NotifyMemAccess (gpa, len, true);
+        }
+}
+
+void WriteRange(const uint64_t gva, const void *src, int len) {
+	uint64_t gpa = gva;
+        if (CrossesPage (gpa, len))
+                CopyPages<true> (gpa, (uint8_t *) src, len);
+        else
+                std::memcpy (Translate<true> (gpa), src, len);
+        if (GdbStub::enabled) {
+                GdbStub::NotifyMemAccess (gpa, len, false);
         }
 }
 
+void ZeroRange(const uint64_t gva, int len) {
+	uint64_t gpa = gva;
+        /* DC ZVA blocks are aligned and smaller than a page */
+        std::memset (Translate<true> (gpa), 0, len);
+        if (GdbStub::enabled) {
+                GdbStub::NotifyMemAccess (gpa, len, false);
+        }
+}
+
+void ReadBytes(uint64_t gva, uint8_t *ptr, int size) {
+        ReadRange (gva, ptr, size);
+}
+
 void GdbReadBytes(uint64_t gva, uint8_t *ptr, int size) {
-        /* XXX: temporaly, disable GdbStub */
-        bool enabled = GdbStub::enabled;
-        GdbStub::enabled = false;
+        GdbStub::quiet = true;
         ReadBytes (gva, ptr, size);
-        GdbStub::enabled = enabled;
+        GdbStub::quiet = false;
 }
 
 std::string ReadString(uint64_t gva) {
         uint64_t gpa = gva;
-        int mx_size = (1 << 30);
-        char byte;
-        int sz = 0;
-        do {
-                byte = (char)ReadU8(gpa + sz);
-                sz++;
-        } while (sz < mx_size && byte != '\0');
-        if (sz >= mx_size) {
-                ns_abort("Can not find any string from addr 0x%lx\n", gva);
+        size_t mx_size = (1 << 30);
+        std::string str;
+        /* Scan a page at a time */
+        while (true) {
+                size_t n = GUEST_PAGE_SIZE - (gpa & GUEST_PAGE_MASK);
+                const char *bytes = (const char *) Translate<false> (gpa);
+                const char *nul = (const char *) std::memchr (bytes, '\0', n);
+                str.append (bytes, nul ? nul - bytes : n);
+                if (nul)
+                        break;
+                if (str.size () >= mx_size) {
+                        ns_abort("Can not find any string from addr 0x%lx\n", gva);
+                }
+                gpa += n;
         }
-        char *bytes = new char[sz];
-        for (int i = 0; i < sz; i++) {
-                bytes[i] = (char)ReadU8(gpa + i);
+        if (GdbStub::enabled) {
+                GdbStub::NotifyMemAccess (gva, str.size () + 1, true);
         }
-        std::string str = std::string(bytes);
-        delete[] bytes;
         return str;
 }
 void WriteBytes(uint64_t gva, uint8_t *ptr, int size) {
-        uint64_t gpa = gva;
-        for (int i = 0; i < size; i++) {
-                WriteU8 (gpa + i, ptr[i]);
-        }
+        WriteRange (gva, ptr, size);
 }
 
 void GdbWriteBytes(uint64_t gva, uint8_t *ptr, int size) {
-        /* XXX: temporaly, disable GdbStub */
-        bool enabled = GdbStub::enabled;
-        GdbStub::enabled = false;
+        GdbStub::quiet = true;
         WriteBytes (gva, ptr, size);
-        GdbStub::enabled = enabled;
+        GdbStub::quiet = false;
+        BlockCache::Invalidate (gva, size);
+}
+
+template<typename T>
+static bool CompareAndSwapRAM(void *ptr, uint64_t expected, uint64_t val) {
+        T old = (T) expected;
+        return __atomic_compare_exchange_n ((T *) ptr, &old, (T) val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static bool CompareAndSwapRAM128(void *ptr, const uint64_t *expected, const uint64_t *val) {
+        uint64_t lo = expected[0], hi = expected[1];
+        bool ok;
+        __asm__ __volatile__ ("lock cmpxchg16b %1"
+                : "=@ccz" (ok), "+m" (*(volatile unsigned __int128 *) ptr), "+a" (lo), "+d" (hi)
+                : "b" (val[0]), "c" (val[1])
+                : "memory");
+        return ok;
+}
+
+void ReadExclusive(const uint64_t gva, int size, uint64_t *val) {
+	uint64_t gpa = gva;
+        if (gpa & ((1 << size) - 1)) {
+                ns_abort ("Unaligned exclusive access 0x%lx (%d)\n", gva, 1 << size);
+        }
+        void *ptr = Translate<false> (gpa);
+        switch (size) {
+        case 0:
+                val[0] = __atomic_load_n ((uint8_t *) ptr, __ATOMIC_SEQ_CST);
+                break;
+        case 1:
+                val[0] = __atomic_load_n ((uint16_t *) ptr, __ATOMIC_SEQ_CST);
+                break;
+        case 2:
+                val[0] = __atomic_load_n ((uint32_t *) ptr, __ATOMIC_SEQ_CST);
+                break;
+        case 3:
+                val[0] = __atomic_load_n ((uint64_t *) ptr, __ATOMIC_SEQ_CST);
+                break;
+        default:
+                val[0] = __atomic_load_n ((uint64_t *) ptr, __ATOMIC_SEQ_CST);
+                val[1] = __atomic_load_n ((uint64_t *) ptr + 1, __ATOMIC_SEQ_CST);
+                break;
+        }
+        if (GdbStub::enabled) {
+                GdbStub::NotifyMemAccess (gpa, 1 << size, true);
+        }
+}
+
+bool CompareAndSwap(const uint64_t gva, int size, const uint64_t *expected, const uint64_t *val) {
+	uint64_t gpa = gva;
+        void *ptr = Translate<true> (gpa);
+        bool ok;
+        switch (size) {
+        case 0:
+                ok = CompareAndSwapRAM<uint8_t> (ptr, expected[0], val[0]);
+                break;
+        case 1:
+                ok = CompareAndSwapRAM<uint16_t> (ptr, expected[0], val[0]);
+                break;
+        case 2:
+                ok = CompareAndSwapRAM<uint32_t> (ptr, expected[0], val[0]);
+                break;
+        case 3:
+                ok = CompareAndSwapRAM<uint64_t> (ptr, expected[0], val[0]);
+                break;
+        default:
+                ok = CompareAndSwapRAM128 (ptr, expected, val);
+                break;
+        }
+        if (GdbStub::enabled) {
+                GdbStub::NotifyMemAccess (gpa, 1 << size, false);
+        }
+        return ok;
 }
 
 uint8_t ReadU8(const uint64_t gva) {
-	/* XXX: Implement Page translation */
 	uint64_t gpa = gva;
 	return ReadFromRAM<uint8_t>(gpa);
 }
 uint16_t ReadU16(const uint64_t gva) {
-	/* XXX: Implement Page translation */
 	uint64_t gpa = gva;
 	return ReadFromRAM<uint16_t>(gpa);
 }
 uint32_t ReadU32(const uint64_t gva) {
-	/* XXX: Implement Page translation */
 	uint64_t gpa = gva;
 	return ReadFromRAM<uint32_t>(gpa);
 }
 uint64_t ReadU64(const uint64_t gva) {
-	/* XXX: Implement Page translation */
 	uint64_t gpa = gva;
 	return ReadFromRAM<uint64_t>(gpa);
 }
 
 void WriteU8(const uint64_t gva, uint8_t value) {
-	/* XXX: Implement Page translation */
 	uint64_t gpa = gva;
 	WriteToRAM<uint8_t>(gpa, value);
 }
 void WriteU16(const uint64_t gva, uint16_t value) {
-	/* XXX: Implement Page translation */
 	uint64_t gpa = gva;
 	WriteToRAM<uint16_t>(gpa, value);
 }
 void WriteU32(const uint64_t gva, uint32_t value) {
-	/* XXX: Implement Page translation */
 	uint64_t gpa = gva;
 	WriteToRAM<uint32_t>(gpa, value);
 }
 void WriteU64(const uint64_t gva, uint64_t value) {
-	/* XXX: Implement Page translation */
 	uint64_t gpa = gva;
 	WriteToRAM<uint64_t>(gpa, value);
 }
@@ -0,0 +1,796 @@
+/* nsemu - LGPL - Copyright 2018 rkx1209<rkx1209dev@gmail.com> */
+#include "Nsemu.hpp"
+
+namespace Optimizer {
+
+bool enabled = true;
+bool stats = false;
+
+/* Statistics of --fusion-stats, counted at translation */
+enum FuseKind {
+        Fuse_CmpBranch,
+        Fuse_LoadCbz,
+        Fuse_ConstAddr,
+        Fuse_MoviPair,
+        Fuse_Folded,
+        Fuse_Max,
+};
+static const char *fuse_names[Fuse_Max] = {
+        "CMP + B.cond",
+        "LDR + CBZ/CBNZ",
+        "ADRP + LDR/STR (constant address)",
+        "ADRP + ADD, MOV + MOV (two constants)",
+        "MOVZ + MOVK, ADRP + ADD (folded)",
+};
+static std::atomic<uint64_t> fuse_count[Fuse_Max];
+
+static inline void Count(FuseKind kind) {
+        if (stats)
+                fuse_count[kind]++;
+}
+
+#define REG_NUM (GPR_DUMMY3 + 1)
+#define REG_BIT(r) (1ULL << (r))
+#define FLAG_BIT (1ULL << REG_NUM)
+#define ALL_REGS (FLAG_BIT - 1)
+/* Registers whose value never reaches the next guest instruction */
+#define SCRATCH_REGS (REG_BIT(GPR_ZERO) | REG_BIT(GPR_DUMMY) | REG_BIT(GPR_DUMMY2) | REG_BIT(GPR_DUMMY3))
+
+/* Register usage of a micro-op */
+struct OpInfo {
+        uint64_t use; // Registers (and FLAG_BIT) read
+        uint64_t def; // Registers (and FLAG_BIT) overwritten
+        uint64_t clobber; // Registers trashed as an implementation detail
+        bool effect; // Memory, PC, vector or system state access
+        bool narrow; // Sources are read as W()
+        int num_src;
+        int src[4]; // Args holding plain source registers
+};
+
+static inline uint64_t UseMask(unsigned int r) {
+        /* Index 31 reads XZR or SP depending on the op */
+        return r == GPR_ZERO ? REG_BIT(GPR_ZERO) | REG_BIT(GPR_SP) : REG_BIT(r);
+}
+
+static inline void Src(OpInfo *info, const MicroOp &op, int slot) {
+        info->src[info->num_src++] = slot;
+        info->use |= UseMask (op.arg[slot]);
+}
+
+static void Describe(const MicroOp &op, OpInfo *info) {
+        const uint64_t *a = op.arg;
+        memset (info, 0, sizeof(OpInfo));
+        switch (op.type) {
+        case MicroOp_MoviI64:
+        case MicroOp_DepositZeroI64:
+                info->def = REG_BIT(a[0]);
+                break;
+        case MicroOp_DepositI64:
+                info->def = REG_BIT(a[0]);
+                info->use = UseMask (a[0]);
+                break;
+        case MicroOp_DepositReg:
+                info->def = REG_BIT(a[0]);
+                info->use = UseMask (a[0]);
+                Src (info, op, 1);
+                break;
+        case MicroOp_MovReg:
+        case MicroOp_NotReg:
+                info->narrow = !a[2];
+        case MicroOp_DepositZeroReg:
+        case MicroOp_ExtendReg:
+        case MicroOp_SExt32:
+        case MicroOp_RevBit:
+        case MicroOp_RevByte16:
+        case MicroOp_RevByte32:
+        case MicroOp_RevByte64:
+        case MicroOp_CntLeadZero:
+        case MicroOp_CntLeadSign:
+                info->def = REG_BIT(a[0]);
+                Src (info, op, 1);
+                break;
+        case MicroOp_SExtractI64:
+        case MicroOp_UExtractI64:
+                /* Interpreter shifts through GPR_DUMMY */
+                info->def = REG_BIT(a[0]);
+                info->clobber = REG_BIT(GPR_DUMMY);
+                Src (info, op, 1);
+                break;
+        case MicroOp_ShiftI64:
+                info->def = REG_BIT(a[0]);
+                info->narrow = !a[4];
+                Src (info, op, 1);
+                break;
+        case MicroOp_CondMovReg:
+                info->def = REG_BIT(a[1]);
+                info->use = FLAG_BIT;
+                Src (info, op, 2);
+                Src (info, op, 3);
+                break;
+        case MicroOp_AddI64:
+        case MicroOp_SubI64:
+                if (a[3])
+                        info->def = REG_BIT(a[0]) | FLAG_BIT;
+                else
+                        info->def = REG_BIT(ARMv8::HandleAsSP (a[0]));
+                info->narrow = !a[4];
+                Src (info, op, 1);
+                break;
+        case MicroOp_AndI64:
+                info->def = REG_BIT(a[0]) | (a[3] ? FLAG_BIT : 0);
+                info->narrow = !a[4];
+                Src (info, op, 1);
+                break;
+        case MicroOp_OrrI64:
+        case MicroOp_EorI64:
+                info->def = REG_BIT(a[0]);
+                info->narrow = !a[3];
+                Src (info, op, 1);
+                break;
+        case MicroOp_AddReg:
+        case MicroOp_SubReg:
+        case MicroOp_AndReg:
+        case MicroOp_BicReg:
+                info->def = REG_BIT(a[0]) | (a[3] ? FLAG_BIT : 0);
+                info->narrow = !a[4];
+                Src (info, op, 1);
+                Src (info, op, 2);
+                break;
+        case MicroOp_OrrReg:
+        case MicroOp_EorReg:
+                info->def = REG_BIT(ARMv8::HandleAsSP (a[0]));
+                info->narrow = !a[3];
+                Src (info, op, 1);
+                Src (info, op, 2);
+                break;
+        case MicroOp_AddcReg:
+        case MicroOp_SubcReg:
+                info->def = REG_BIT(a[0]) | (a[3] ? FLAG_BIT : 0);
+                info->use = FLAG_BIT;
+                Src (info, op, 1);
+                Src (info, op, 2);
+                break;
+        case MicroOp_MulReg:
+        case MicroOp_DivReg:
+        case MicroOp_ShiftReg:
+        case MicroOp_Crc32:
+                info->def = REG_BIT(a[0]);
+                Src (info, op, 1);
+                Src (info, op, 2);
+                break;
+        case MicroOp_Mul2Reg:
+                info->def = REG_BIT(a[0]) | REG_BIT(a[1]);
+                Src (info, op, 2);
+                Src (info, op, 3);
+                break;
+        case MicroOp_LoadReg:
+                info->effect = true;
+                if (a[3] < 4)
+                        info->def = REG_BIT(a[0]);
+                Src (info, op, 1);
+                Src (info, op, 2);
+                break;
+        case MicroOp_LoadRegI64:
+                info->effect = true;
+                if (a[2] < 4)
+                        info->def = REG_BIT(a[0]);
+                Src (info, op, 1);
+                break;
+        case MicroOp_StoreReg:
+                info->effect = true;
+                if (a[3] < 4)
+                        Src (info, op, 0);
+                Src (info, op, 1);
+                Src (info, op, 2);
+                break;
+        case MicroOp_StoreRegI64:
+                info->effect = true;
+                if (a[2] < 4)
+                        Src (info, op, 0);
+                Src (info, op, 1);
+                break;
+        case MicroOp_LoadStorePair:
+                info->effect = true;
+                if (!a[5]) {
+                        if (a[6]) {
+                                info->def = REG_BIT(a[0]) | REG_BIT(a[1]);
+                        } else {
+                                Src (info, op, 0);
+                                Src (info, op, 1);
+                        }
+                }
+                Src (info, op, 2);
+                break;
+        case MicroOp_LoadExclusive:
+                info->effect = true;
+                info->def = REG_BIT(a[0]);
+                if (a[4])
+                        info->def |= REG_BIT(a[1]);
+                Src (info, op, 2);
+                break;
+        case MicroOp_StoreExclusive:
+                info->effect = true;
+                info->def = REG_BIT(a[0]);
+                Src (info, op, 1);
+                if (a[5])
+                        Src (info, op, 2);
+                Src (info, op, 3);
+                break;
+        case MicroOp_ClearExclusive:
+        case MicroOp_Barrier:
+        case MicroOp_Hint:
+                info->effect = true;
+                break;
+        case MicroOp__LoadReg:
+                info->effect = true;
+                if (a[2] < 4)
+                        info->def = REG_BIT(a[0]);
+                break;
+        case MicroOp__StoreReg:
+                info->effect = true;
+                if (a[2] < 4)
+                        Src (info, op, 0);
+                break;
+        case MicroOp_CondCmpI64:
+                /* Interpreter compares into the zero register */
+                info->def = info->use = FLAG_BIT;
+                info->clobber = REG_BIT(GPR_ZERO);
+                Src (info, op, 0);
+                break;
+        case MicroOp_CondCmpReg:
+                info->def = info->use = FLAG_BIT;
+                info->clobber = REG_BIT(GPR_ZERO);
+                Src (info, op, 0);
+                Src (info, op, 1);
+                break;
+        case MicroOp_BranchI64:
+                info->effect = true;
+                break;
+        case MicroOp_BranchCondiI64:
+                info->effect = true;
+                Src (info, op, 1);
+                break;
+        case MicroOp_BranchFlag:
+                info->effect = true;
+                info->use = FLAG_BIT;
+                break;
+        case MicroOp_SetPCReg:
+                /* Not a rewritable source: JIT predicts returns from 'ret x30' */
+                info->effect = true;
+                info->use = UseMask (a[0]);
+                break;
+        case MicroOp_ReadWriteSysReg:
+                /* A read is a plain load from the state, dead if its result is */
+                if (a[2]) {
+                        info->def = REG_BIT(a[0]);
+                } else {
+                        info->effect = true;
+                        Src (info, op, 0);
+                }
+                break;
+        case MicroOp_DcZva:
+                info->effect = true;
+                Src (info, op, 0);
+                break;
+        case MicroOp_ReadWriteNZCV:
+                info->effect = true;
+                if (a[1]) {
+                        info->def = REG_BIT(a[0]);
+                        info->use = FLAG_BIT;
+                } else {
+                        info->def = FLAG_BIT;
+                        Src (info, op, 0);
+                }
+                break;
+        case MicroOp_ReadWriteFPCR:
+        case MicroOp_ReadWriteFPSR:
+                info->effect = true;
+                if (a[1])
+                        info->def = REG_BIT(a[0]);
+                else
+                        Src (info, op, 0);
+                break;
+        case MicroOp_FpToInt:
+                info->effect = true;
+                info->def = REG_BIT(a[0]);
+                break;
+        case MicroOp_IntToFp:
+                info->effect = true;
+                Src (info, op, 1);
+                break;
+        case MicroOp_FpCompare:
+                info->effect = true;
+                info->def = FLAG_BIT;
+                break;
+        case MicroOp_FpCondCompare:
+                info->effect = true;
+                info->def = info->use = FLAG_BIT;
+                break;
+        case MicroOp_FpCondSelect:
+                info->effect = true;
+                info->use = FLAG_BIT;
+                break;
+        case MicroOp_FMovConv:
+                info->effect = true;
+                if (a[3])
+                        Src (info, op, 1);
+                else
+                        info->def = REG_BIT(a[0]);
+                break;
+        case MicroOp_LoadVecReg:
+                info->effect = true;
+                Src (info, op, 2);
+                break;
+        case MicroOp_StoreVecReg:
+                info->effect = true;
+                Src (info, op, 0);
+                break;
+        case MicroOp_LoadStoreMulti:
+                info->effect = true;
+                Src (info, op, 1);
+                break;
+        case MicroOp_LoadFpReg:
+        case MicroOp_StoreFpReg:
+                info->effect = true;
+                Src (info, op, 1);
+                Src (info, op, 2);
+                break;
+        case MicroOp_LoadFpRegI64:
+        case MicroOp_StoreFpRegI64:
+        case MicroOp_WriteVecElem:
+        case MicroOp_DupVecRegFromGen:
+                info->effect = true;
+                Src (info, op, 1);
+                break;
+        case MicroOp_ReadVecElem:
+                info->effect = true;
+                info->def = REG_BIT(a[0]);
+                break;
+        case MicroOp_FMovReg:
+        case MicroOp_AndVecReg:
+        case MicroOp_OrrVecReg:
+        case MicroOp_EorVecReg:
+        case MicroOp_BicVecReg:
+        case MicroOp_NotVecReg:
+        case MicroOp_ReadVecReg:
+        case MicroOp_DupVecImmI32:
+        case MicroOp_DupVecImmI64:
+        case MicroOp_DupVecReg:
+        case MicroOp_CompareEqualVec:
+        case MicroOp_CompareTestBitsVec:
+        case MicroOp_CompareGreaterVec:
+        case MicroOp_AddVec:
+        case MicroOp_SubVec:
+        case MicroOp_MulVec:
+        case MicroOp_MaxVec:
+        case MicroOp_MinVec:
+        case MicroOp_AddSatVec:
+        case MicroOp_SubSatVec:
+        case MicroOp_FpArith:
+        case MicroOp_FpPairwise:
+        case MicroOp_FpMulAdd:
+        case MicroOp_FpUnary:
+        case MicroOp_FpConvert:
+        case MicroOp_FpConvertVec:
+        case MicroOp_FpToIntVec:
+        case MicroOp_IntToFpVec:
+        case MicroOp_PolyMulLong:
+        case MicroOp_CryptoAes:
+        case MicroOp_CryptoSha:
+                info->effect = true;
+                break;
+        case MicroOp_CmpI64Branch:
+                info->effect = true;
+                info->def = FLAG_BIT;
+                Src (info, op, 0);
+                break;
+        case MicroOp_CmpRegBranch:
+                info->effect = true;
+                info->def = FLAG_BIT;
+                Src (info, op, 0);
+                Src (info, op, 1);
+                break;
+        case MicroOp_LoadBranchZero:
+                /* The branch reads the loaded value only */
+                info->effect = true;
+                info->def = REG_BIT(a[0]);
+                Src (info, op, 1);
+                break;
+        case MicroOp_MoviPair:
+                info->def = REG_BIT(a[0]) | REG_BIT(a[3]);
+                break;
+        default:
+                /* SVC, BRK, HleCall: may read and write anything */
+                info->effect = true;
+                info->use = info->clobber = ALL_REGS | FLAG_BIT;
+                break;
+        }
+}
+
+template<typename... Args> static void Rewrite(MicroOp &op, MicroOpType type, Args... args) {
+        op = { (uint16_t) type, { ((uint64_t) args)... } };
+}
+
+static inline uint64_t Trunc(uint64_t val, bool bit64) {
+        return bit64 ? val : (uint32_t) val;
+}
+
+/* ####### Copy propagation / Constant folding ####### */
+
+enum ValueKind {
+        VALUE_UNKNOWN,
+        VALUE_CONST,
+        VALUE_COPY,
+};
+
+/* What a register is known to hold at the current op */
+struct Value {
+        ValueKind kind;
+        bool wide; // Copy holds all 64 bits of src
+        unsigned int src;
+        uint64_t imm;
+};
+
+static thread_local Value values[REG_NUM];
+
+static void Kill(uint64_t mask) {
+        for (int r = 0; r < REG_NUM; r++) {
+                Value &v = values[r];
+                if ((mask & REG_BIT(r)) || (v.kind == VALUE_COPY && (mask & REG_BIT(v.src))))
+                        v.kind = VALUE_UNKNOWN;
+        }
+}
+
+static inline bool GetConst(unsigned int r, uint64_t *imm) {
+        if (r >= REG_NUM || values[r].kind != VALUE_CONST)
+                return false;
+        *imm = values[r].imm;
+        return true;
+}
+
+/* Read registers through known copies */
+static void PropagateCopies(MicroOp &op, const OpInfo &info) {
+        for (int i = 0; i < info.num_src; i++) {
+                uint64_t r = op.arg[info.src[i]];
+                /* 31 may mean SP here, copies never come from 31 either */
+                if (r == GPR_ZERO || r >= REG_NUM)
+                        continue;
+                const Value &v = values[r];
+                if (v.kind == VALUE_COPY && (v.wide || info.narrow))
+                        op.arg[info.src[i]] = v.src;
+        }
+}
+
+/* Identity shifts and additions are plain moves */
+static bool Canonicalize(MicroOp &op) {
+        const uint64_t *a = op.arg;
+        switch (op.type) {
+        case MicroOp_ShiftI64:
+                if (a[3] == 0) {
+                        Rewrite (op, MicroOp_MovReg, a[0], a[1], a[4]);
+                        return true;
+                }
+                break;
+        case MicroOp_AddI64:
+        case MicroOp_SubI64:
+                if (a[2] == 0 && !a[3]) {
+                        Rewrite (op, MicroOp_MovReg, ARMv8::HandleAsSP (a[0]), ARMv8::HandleAsSP (a[1]), a[4]);
+                        return true;
+                }
+                break;
+        }
+        return false;
+}
+
+static bool FoldConstants(MicroOp &op) {
+        const uint64_t a[8] = { op.arg[0], op.arg[1], op.arg[2], op.arg[3],
+                                op.arg[4], op.arg[5], op.arg[6], op.arg[7] };
+        uint64_t x, y;
+        switch (op.type) {
+        case MicroOp_MovReg:
+                if (GetConst (a[1], &x)) {
+                        Rewrite (op, MicroOp_MoviI64, a[0], Trunc (x, a[2]), true);
+                        return true;
+                }
+                break;
+        case MicroOp_NotReg:
+                if (GetConst (a[1], &x)) {
+                        Rewrite (op, MicroOp_MoviI64, a[0], Trunc (~x, a[2]), true);
+                        return true;
+                }
+                break;
+        case MicroOp_AddI64:
+        case MicroOp_SubI64:
+                if (!a[3] && GetConst (ARMv8::HandleAsSP (a[1]), &x)) {
+                        x = op.type == MicroOp_AddI64 ? x + a[2] : x - a[2];
+                        Rewrite (op, MicroOp_MoviI64, ARMv8::HandleAsSP (a[0]), Trunc (x, a[4]), true);
+                        Count (Fuse_Folded);
+                        return true;
+                }
+                break;
+        case MicroOp_AndI64:
+                if (!a[3] && GetConst (a[1], &x)) {
+                        Rewrite (op, MicroOp_MoviI64, a[0], Trunc (x & a[2], a[4]), true);
+                        return true;
+                }
+                break;
+        case MicroOp_OrrI64:
+        case MicroOp_EorI64:
+                if (GetConst (a[1], &x)) {
+                        x = op.type == MicroOp_OrrI64 ? x | a[2] : x ^ a[2];
+                        Rewrite (op, MicroOp_MoviI64, a[0], Trunc (x, a[3]), true);
+                        return true;
+                }
+                break;
+        case MicroOp_ShiftI64:
+                if ((a[2] == Disassembler::ShiftType_LSL || a[2] == Disassembler::ShiftType_LSR) && a[3] < (a[4] ? 64 : 32)
+                    && GetConst (a[1], &x)) {
+                        x = Trunc (x, a[4]);
+                        x = a[2] == Disassembler::ShiftType_LSL ? x << a[3] : x >> a[3];
+                        Rewrite (op, MicroOp_MoviI64, a[0], Trunc (x, a[4]), true);
+                        return true;
+                }
+                break;
+        case MicroOp_DepositI64:
+                if (a[3] < 64 && GetConst (a[0], &x)) {
+                        uint64_t mask = (1ULL << a[3]) - 1;
+                        Rewrite (op, MicroOp_MoviI64, a[0], (x & ~(mask << a[2])) | (a[1] << a[2]), true);
+                        Count (Fuse_Folded);
+                        return true;
+                }
+                break;
+        case MicroOp_DepositZeroI64:
+                if (a[3] < 64) {
+                        Rewrite (op, MicroOp_MoviI64, a[0], (a[1] & ((1ULL << a[3]) - 1)) << a[2], true);
+                        return true;
+                }
+                break;
+        case MicroOp_AddReg:
+        case MicroOp_SubReg:
+                if (!GetConst (a[2], &y))
+                        break;
+                if (!a[3] && GetConst (a[1], &x)) {
+                        x = op.type == MicroOp_AddReg ? x + y : x - y;
+                        Rewrite (op, MicroOp_MoviI64, a[0], Trunc (x, a[4]), true);
+                        return true;
+                }
+                /* Immediate form treats 31 as SP unless flags are set */
+                if (a[3] || (a[0] != GPR_ZERO && a[1] != GPR_ZERO)) {
+                        Rewrite (op, op.type == MicroOp_AddReg ? MicroOp_AddI64 : MicroOp_SubI64,
+                                 a[0], a[1], Trunc (y, a[4]), a[3], a[4]);
+                        return true;
+                }
+                break;
+        case MicroOp_LoadRegI64:
+        case MicroOp_StoreRegI64:
+                /* ADRP + LDR/STR: the address is known */
+                if (GetConst (a[1], &x)) {
+                        Rewrite (op, op.type == MicroOp_LoadRegI64 ? MicroOp__LoadReg : MicroOp__StoreReg,
+                                 a[0], x, a[2], a[3], a[4]);
+                        Count (Fuse_ConstAddr);
+                        return true;
+                }
+                break;
+        case MicroOp_AndReg:
+        case MicroOp_BicReg:
+                if (a[3] || !GetConst (a[2], &y))
+                        break;
+                if (op.type == MicroOp_BicReg)
+                        y = ~y;
+                if (GetConst (a[1], &x))
+                        Rewrite (op, MicroOp_MoviI64, a[0], Trunc (x & y, a[4]), true);
+                else
+                        Rewrite (op, MicroOp_AndI64, a[0], a[1], Trunc (y, a[4]), false, a[4]);
+                return true;
+        case MicroOp_OrrReg:
+        case MicroOp_EorReg:
+                if (!GetConst (a[2], &y))
+                        break;
+                if (GetConst (a[1], &x)) {
+                        x = op.type == MicroOp_OrrReg ? x | y : x ^ y;
+                        Rewrite (op, MicroOp_MoviI64, ARMv8::HandleAsSP (a[0]), Trunc (x, a[3]), true);
+                        return true;
+                }
+                if (a[0] != GPR_ZERO) {
+                        Rewrite (op, op.type == MicroOp_OrrReg ? MicroOp_OrrI64 : MicroOp_EorI64,
+                                 a[0], a[1], Trunc (y, a[3]), a[3]);
+                        return true;
+                }
+                break;
+        }
+        return false;
+}
+
+static void Forward(BasicBlock *block) {
+        for (Value &v : values)
+                v.kind = VALUE_UNKNOWN;
+        for (MicroOp &op : block->ops) {
+                if (op.type == MicroOp_NextInsn) {
+                        Kill (SCRATCH_REGS);
+                        values[GPR_ZERO] = { VALUE_CONST, true, 0, 0 };
+                        continue;
+                }
+                OpInfo info;
+                Describe (op, &info);
+                PropagateCopies (op, info);
+                if (Canonicalize (op) | FoldConstants (op))
+                        Describe (op, &info);
+                /* Value produced by this op, taken before its definitions kill anything */
+                Value val = { VALUE_UNKNOWN, false, 0, 0 };
+                if (op.type == MicroOp_MoviI64) {
+                        val = { VALUE_CONST, true, 0, op.arg[1] };
+                } else if (op.type == MicroOp_MovReg && op.arg[1] != GPR_ZERO && op.arg[1] != PC_IDX
+                           && op.arg[1] != op.arg[0] && op.arg[1] < REG_NUM) {
+                        val = { VALUE_COPY, (bool) op.arg[2], (unsigned int) op.arg[1], 0 };
+                }
+                Kill (info.def | info.clobber);
+                if (val.kind != VALUE_UNKNOWN && op.arg[0] != GPR_ZERO && op.arg[0] < REG_NUM)
+                        values[op.arg[0]] = val;
+        }
+}
+
+/* ####### Dead code / Dead flag elimination ####### */
+
+/* Clear setflags when nothing reads the flags */
+static bool DropFlags(MicroOp &op) {
+        switch (op.type) {
+        case MicroOp_AddI64:
+        case MicroOp_SubI64:
+                /* Without flags, 31 becomes SP */
+                if (op.arg[0] == GPR_ZERO || op.arg[1] == GPR_ZERO)
+                        return false;
+        case MicroOp_AddReg:
+        case MicroOp_SubReg:
+        case MicroOp_AndI64:
+        case MicroOp_AndReg:
+        case MicroOp_BicReg:
+                op.arg[3] = false;
+                return true;
+        }
+        return false;
+}
+
+static inline bool IsLive(const OpInfo &info, uint64_t live) {
+        return info.effect || ((info.def | info.clobber) & live);
+}
+
+static void Backward(BasicBlock *block) {
+        /* Guest registers and flags are live out of the block */
+        uint64_t live = (ALL_REGS & ~SCRATCH_REGS) | FLAG_BIT;
+        for (size_t i = block->ops.size (); i-- > 0;) {
+                MicroOp &op = block->ops[i];
+                if (op.type == MicroOp_NextInsn) {
+                        live &= ~SCRATCH_REGS;
+                        continue;
+                }
+                OpInfo info;
+                Describe (op, &info);
+                if ((info.def & FLAG_BIT) && !(live & FLAG_BIT) && IsLive (info, live & ~FLAG_BIT)
+                    && DropFlags (op))
+                        Describe (op, &info);
+                if (!IsLive (info, live)) {
+                        op.type = MicroOp_Max;
+                        continue;
+                }
+                live = (live & ~info.def) | info.use;
+        }
+        auto end = std::remove_if (block->ops.begin (), block->ops.end (),
+                                   [](const MicroOp &op) { return op.type == MicroOp_Max; });
+        block->ops.erase (end, block->ops.end ());
+}
+
+/* Ops an iteration of a polling loop may contain: nothing but loads, branches and hints */
+static bool IdleOp(const MicroOp &op, const OpInfo &info) {
+        switch (op.type) {
+        case MicroOp_LoadRegI64:
+        case MicroOp__LoadReg:
+                return op.arg[2] < 4;
+        case MicroOp_LoadReg:
+                return op.arg[3] < 4;
+        case MicroOp_LoadStorePair:
+                return op.arg[6] && !op.arg[5];
+        case MicroOp_CmpI64Branch:
+        case MicroOp_CmpRegBranch:
+        case MicroOp_LoadBranchZero:
+                return true;
+        case MicroOp_Hint:
+                return op.arg[0] == Disassembler::Hint_YIELD;
+        case MicroOp_Barrier:
+        case MicroOp_BranchI64:
+        case MicroOp_BranchCondiI64:
+        case MicroOp_BranchFlag:
+                return true;
+        default:
+                return !info.effect;
+        }
+}
+
+bool IsIdleLoop(BasicBlock *block) {
+        if (block->target != block->addr)
+                return false;
+        /* Every iteration must start from the registers the previous one started from,
+         * so only memory written by someone else can make the loop exit */
+        uint64_t live_in = 0, defined = 0;
+        for (const MicroOp &op : block->ops) {
+                if (op.type == MicroOp_NextInsn)
+                        continue;
+                OpInfo info;
+                Describe (op, &info);
+                if (!IdleOp (op, info))
+                        return false;
+                live_in |= info.use & ~defined;
+                defined |= info.def | info.clobber;
+        }
+        return !(live_in & defined & ~SCRATCH_REGS);
+}
+
+/* ####### Superinstructions ####### */
+
+/* a ends a guest instruction and b starts the next one: one op doing both */
+static bool FusePair(const MicroOp &a, const MicroOp &b, MicroOp *fused) {
+        const uint64_t *x = a.arg, *y = b.arg;
+        switch (a.type) {
+        case MicroOp_SubI64:
+        case MicroOp_SubReg:
+                /* CMP + B.cond */
+                if (x[0] != GPR_ZERO || !x[3] || b.type != MicroOp_BranchFlag)
+                        return false;
+                if (a.type == MicroOp_SubI64)
+                        Rewrite (*fused, MicroOp_CmpI64Branch, x[1], x[2], x[4], y[0], y[1]);
+                else
+                        Rewrite (*fused, MicroOp_CmpRegBranch, x[1], x[2], x[4], y[0], y[1]);
+                Count (Fuse_CmpBranch);
+                return true;
+        case MicroOp_LoadRegI64:
+                /* LDR + CBZ/CBNZ of the loaded register */
+                if (x[2] >= 4 || b.type != MicroOp_BranchCondiI64 || y[1] != x[0] || y[2] != 0)
+                        return false;
+                Rewrite (*fused, MicroOp_LoadBranchZero, x[0], x[1], x[2], x[3], x[4], y[0], y[3], y[4]);
+                Count (Fuse_LoadCbz);
+                return true;
+        case MicroOp_MoviI64:
+                if (b.type != MicroOp_MoviI64)
+                        return false;
+                Rewrite (*fused, MicroOp_MoviPair, x[0], x[1], x[2], y[0], y[1], y[2]);
+                Count (Fuse_MoviPair);
+                return true;
+        }
+        return false;
+}
+
+/* Halve dispatches on common pairs, and merge the NextInsn of instructions left without ops */
+static void Fuse(BasicBlock *block) {
+        std::vector<MicroOp> &ops = block->ops;
+        size_t out = 0;
+        for (size_t i = 0; i < ops.size (); i++) {
+                MicroOp fused;
+                if (i + 2 < ops.size () && ops[i + 1].type == MicroOp_NextInsn && ops[i + 1].arg[0] == 1
+                    && FusePair (ops[i], ops[i + 2], &fused)) {
+                        ops[out++] = fused;
+                        i += 2;
+                        continue;
+                }
+                if (ops[i].type == MicroOp_NextInsn && out > 0 && ops[out - 1].type == MicroOp_NextInsn) {
+                        ops[out - 1].arg[0] += ops[i].arg[0];
+                        continue;
+                }
+                ops[out++] = ops[i];
+        }
+        ops.resize (out);
+}
+
+void PrintStats() {
+        ns_print ("Fused at translation:\n");
+        for (int kind = 0; kind < Fuse_Max; kind++)
+                ns_print ("  %-40s %lu\n", fuse_names[kind], fuse_count[kind].load ());
+}
+
+void Run(BasicBlock *block) {
+        size_t num_ops = block->ops.size ();
+        Forward (block);
+        Backward (block);
+        Fuse (block);
+        debug_print ("Optimize block: 0x%lx (%u -> %u ops)\n", block->addr, num_ops, block->ops.size ());
+}
+
+}
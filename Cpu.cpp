@@ -3,33 +3,82 @@
 #include "Service/Dispdrv.hpp"
 namespace Cpu {
 
-static State state = State::PowerDown;
+static std::atomic<State> state[CPU_NUM_CORES];
+static thread_local unsigned int cur_core;
+/* Parked cores wait here for a state change */
+static std::mutex park_lock;
+static std::condition_variable park_cond;
 FILE *TraceOut;
 bool DeepTrace;
+unsigned int num_cores = CPU_NUM_CORES;
 
 void Init() {
+        for (unsigned int id = 0; id < CPU_NUM_CORES; id++)
+                state[id] = State::PowerDown;
+        ThreadManager::Init();
 	ARMv8::Init();
         SVC::Init();
-        ThreadManager::Init();
         NVFlinger::Init();
 }
 
+static void CoreThread(unsigned int id) {
+        cur_core = id;
+        ARMv8::InitCore (id);
+        auto runnable = [id] { return state[id] != State::Halted; };
+        while (true) {
+                /* Idle core also wakes up when one of its sleeping threads is due */
+                auto wakeup = ThreadManager::NextWakeup (id);
+                {
+                        std::unique_lock<std::mutex> lock (park_lock);
+                        if (wakeup == std::chrono::steady_clock::time_point::max ())
+                                park_cond.wait (lock, runnable);
+                        else
+                                park_cond.wait_until (lock, wakeup, runnable);
+                        if (state[id] == State::PowerDown)
+                                break;
+                }
+                ThreadManager::Schedule ();
+                ARMv8::RunLoop ();
+        }
+}
+
 void Run() {
-	switch (state) {
-	case State::Running:
-		ARMv8::RunLoop ();
-		break;
-	case State::PowerDown:
-		break;
-	}
+        if (state[0] != State::Running)
+                return;
+        /* Boot core runs the main thread, the others wait for threads to be started */
+        for (unsigned int id = 1; id < CPU_NUM_CORES; id++)
+                state[id] = id < num_cores ? State::Halted : State::PowerDown;
+        std::thread cores[CPU_NUM_CORES];
+        for (unsigned int id = 0; id < num_cores; id++)
+                cores[id] = std::thread (CoreThread, id);
+        for (unsigned int id = 0; id < num_cores; id++)
+                cores[id].join ();
+}
+
+void Stop() {
+        SetState (State::PowerDown);
 }
 
 void SetState(State _state) {
-	state = _state;
+        std::lock_guard<std::mutex> lock (park_lock);
+        for (unsigned int id = 0; id < CPU_NUM_CORES; id++)
+                state[id] = _state;
+        park_cond.notify_all ();
 }
 
 State GetState() {
-	return state;
+	return state[cur_core].load (std::memory_order_relaxed);
+}
+
+void SetCoreState(unsigned int core, State _state) {
+        std::lock_guard<std::mutex> lock (park_lock);
+        if (state[core] != State::PowerDown)
+                state[core] = _state;
+        park_cond.notify_all ();
+}
+
+unsigned int CurrentCore() {
+        return cur_core;
 }
 
 void DumpMachine() {
@@ -18,6 +18,7 @@ static RSState state = RS_IDLE;
 volatile bool enabled = false;
 volatile bool step = false;
 volatile bool cont = false;
+thread_local bool quiet = false;
 
 std::vector<Breakpoint> bp_list;
 std::vector<Watchpoint> wp_list;
@@ -160,6 +161,9 @@ static int ReadRegister (uint8_t *buf, int reg) {
                         case 32:
                                 *(uint64_t *)buf = X(PC_IDX);
                                 break;
+                        case 33:
+                                *(uint32_t *)buf = ARMv8::GetNZCV (); // cpsr
+                                return sizeof(uint32_t);
                         default:
                                 *(uint64_t *)buf = 0xdeadbeef;
                                 break;
@@ -247,6 +251,8 @@ static void HitWatchpoint(unsigned long addr, int type) {
 }
 
 void NotifyMemAccess(unsigned long addr, size_t len, bool read) {
+        if (quiet)
+                return;
         int type = read ? GDB_WATCHPOINT_READ : GDB_WATCHPOINT_WRITE;
         for (int i = 0; i < wp_list.size(); i++) {
                 Watchpoint wp = wp_list[i];
@@ -319,7 +325,7 @@ static RSState HandleCommand(char *line_buf) {
         break;
     case 'g':
         len = 0;
-        for (addr = 0; addr < 33; addr++) {
+        for (addr = 0; addr < 34; addr++) {
                 reg_size = ReadRegister (mem_buf + len, addr);
                 len += reg_size;
         }
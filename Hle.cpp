@@ -0,0 +1,232 @@
+/* nsemu - LGPL - Copyright 2018 rkx1209<rkx1209dev@gmail.com> */
+#include <elf.h>
+#include "Nsemu.hpp"
+
+namespace HLE {
+
+bool enabled = true;
+
+/* Filled while modules are loaded, before any core runs: lookups need no lock */
+static std::unordered_map<uint64_t, unsigned int> hooks;
+
+/* ####### Guest memory ####### */
+
+/* Host memory is contiguous within a guest page at least */
+/* Bytes from gva to the end of its page (at most len) */
+static inline uint64_t Head(uint64_t gva, uint64_t len) {
+        return std::min (len, GUEST_PAGE_SIZE - (gva & GUEST_PAGE_MASK));
+}
+
+/* Bytes from the start of the page to end (exclusive end, at most len) */
+static inline uint64_t Tail(uint64_t end, uint64_t len) {
+        return std::min (len, ((end - 1) & GUEST_PAGE_MASK) + 1);
+}
+
+static inline uint8_t *Host(uint64_t gva, uint64_t len) {
+        return (uint8_t *) Memory::GetRawPtr (gva, len);
+}
+
+static void Move(uint64_t dst, uint64_t src, uint64_t len) {
+        if (dst - src >= len) {
+                while (len) {
+                        uint64_t n = std::min (Head (dst, len), Head (src, len));
+                        std::memmove (Host (dst, n), Host (src, n), n);
+                        dst += n;
+                        src += n;
+                        len -= n;
+                }
+        } else {
+                /* dst overlaps the end of src: copy backwards */
+                dst += len;
+                src += len;
+                while (len) {
+                        uint64_t n = std::min (Tail (dst, len), Tail (src, len));
+                        dst -= n;
+                        src -= n;
+                        len -= n;
+                        std::memmove (Host (dst, n), Host (src, n), n);
+                }
+        }
+}
+
+static void Fill(uint64_t dst, uint8_t val, uint64_t len) {
+        while (len) {
+                uint64_t n = Head (dst, len);
+                std::memset (Host (dst, n), val, n);
+                dst += n;
+                len -= n;
+        }
+}
+
+/* Difference of the first mismatching bytes as the guest libc returns it */
+static int Compare(uint64_t a, uint64_t b, uint64_t len) {
+        while (len) {
+                uint64_t n = std::min (Head (a, len), Head (b, len));
+                const uint8_t *pa = Host (a, n), *pb = Host (b, n);
+                if (std::memcmp (pa, pb, n)) {
+                        while (*pa == *pb) {
+                                pa++;
+                                pb++;
+                        }
+                        return *pa - *pb;
+                }
+                a += n;
+                b += n;
+                len -= n;
+        }
+        return 0;
+}
+
+static uint64_t Length(uint64_t str) {
+        uint64_t len = 0;
+        while (true) {
+                uint64_t n = Head (str + len, GUEST_PAGE_SIZE);
+                const uint8_t *p = Host (str + len, n);
+                const void *nul = std::memchr (p, 0, n);
+                if (nul)
+                        return len + ((const uint8_t *) nul - p);
+                len += n;
+        }
+}
+
+static int CompareString(uint64_t a, uint64_t b) {
+        while (true) {
+                uint64_t n = std::min (Head (a, GUEST_PAGE_SIZE), Head (b, GUEST_PAGE_SIZE));
+                const uint8_t *pa = Host (a, n), *pb = Host (b, n);
+                for (uint64_t i = 0; i < n; i++) {
+                        if (pa[i] != pb[i] || !pa[i])
+                                return pa[i] - pb[i];
+                }
+                a += n;
+                b += n;
+        }
+}
+
+/* ####### Hooks ####### */
+
+/* AAPCS64: arguments in X0-X7, result in X0 (int results zero extended from W0) */
+
+static void Memcpy() {
+        Move (X(0), X(1), X(2));
+}
+
+static void Memset() {
+        Fill (X(0), (uint8_t) X(1), X(2));
+}
+
+static void Memcmp() {
+        X(0) = (uint32_t) Compare (X(0), X(1), X(2));
+}
+
+static void Strlen() {
+        X(0) = Length (X(0));
+}
+
+static void Strcmp() {
+        X(0) = (uint32_t) CompareString (X(0), X(1));
+}
+
+static const struct {
+        const char *name;
+        void (*func)();
+} hook_table[] = {
+        { "memcpy", Memcpy },
+        { "memmove", Memcpy },
+        { "memset", Memset },
+        { "memcmp", Memcmp },
+        { "strlen", Strlen },
+        { "strcmp", Strcmp },
+};
+
+bool Hook(uint64_t addr, const std::string &name) {
+        for (unsigned int id = 0; id < sizeof(hook_table) / sizeof(hook_table[0]); id++) {
+                if (name == hook_table[id].name) {
+                        ns_print ("HLE: %s at 0x%lx\n", name.c_str (), addr);
+                        hooks[addr] = id;
+                        return true;
+                }
+        }
+        return false;
+}
+
+int Find(uint64_t addr) {
+        if (hooks.empty ())
+                return -1;
+        auto it = hooks.find (addr);
+        return it == hooks.end () ? -1 : (int) it->second;
+}
+
+void Call(unsigned int id) {
+        hook_table[id].func ();
+}
+
+/* ####### Module exports ####### */
+
+struct Mod0Header {
+        uint32_t magic;
+        uint32_t dynamic_off; // Offsets are relative to the header
+        uint32_t bss_start_off;
+        uint32_t bss_end_off;
+        uint32_t eh_frame_hdr_start_off;
+        uint32_t eh_frame_hdr_end_off;
+        uint32_t module_object_off;
+};
+
+template<typename T> static T Peek(uint64_t addr) {
+        T val;
+        Memory::CopyfromEmu (Nsemu::get_instance (), &val, addr, sizeof(T));
+        return val;
+}
+
+void HookModule(uint64_t base, uint64_t size) {
+        /* Host copies would bypass gdb watchpoints and breakpoints inside the
+         * functions, so the guest code runs while debugging */
+        if (!enabled || GdbStub::enabled)
+                return;
+        /* Modules start with a branch over the offset of their MOD0 header */
+        uint32_t mod0_off = Peek<uint32_t> (base + 4);
+        if (mod0_off + sizeof(Mod0Header) > size)
+                return;
+        Mod0Header mod0 = Peek<Mod0Header> (base + mod0_off);
+        if (mod0.magic != byte_swap32_str ("MOD0"))
+                return;
+        uint64_t symtab = 0, strtab = 0, strsz = 0, hash = 0;
+        for (uint64_t dyn = base + mod0_off + mod0.dynamic_off; dyn + sizeof(Elf64_Dyn) <= base + size; dyn += sizeof(Elf64_Dyn)) {
+                Elf64_Dyn entry = Peek<Elf64_Dyn> (dyn);
+                if (entry.d_tag == DT_NULL)
+                        break;
+                switch (entry.d_tag) {
+                case DT_SYMTAB: symtab = entry.d_un.d_ptr; break;
+                case DT_STRTAB: strtab = entry.d_un.d_ptr; break;
+                case DT_STRSZ: strsz = entry.d_un.d_val; break;
+                case DT_HASH: hash = entry.d_un.d_ptr; break;
+                }
+        }
+        if (!symtab || !strtab || strtab + strsz > size)
+                return;
+        /* nchain of the hash table is the symbol count. Without one,
+         * .dynsym is assumed to be followed by .dynstr as linkers lay them out */
+        uint64_t num_syms;
+        if (hash && hash + 8 <= size)
+                num_syms = Peek<uint32_t> (base + hash + 4);
+        else if (symtab < strtab)
+                num_syms = (strtab - symtab) / sizeof(Elf64_Sym);
+        else
+                return;
+        if (symtab + num_syms * sizeof(Elf64_Sym) > size)
+                return;
+        std::vector<char> strings (strsz);
+        Memory::CopyfromEmu (Nsemu::get_instance (), strings.data (), base + strtab, strsz);
+        unsigned int hooked = 0;
+        for (uint64_t i = 0; i < num_syms; i++) {
+                Elf64_Sym sym = Peek<Elf64_Sym> (base + symtab + i * sizeof(Elf64_Sym));
+                if (ELF64_ST_TYPE (sym.st_info) != STT_FUNC || sym.st_shndx == SHN_UNDEF || sym.st_name >= strsz)
+                        continue;
+                const char *name = &strings[sym.st_name];
+                if (Hook (base + sym.st_value, std::string (name, strnlen (name, strsz - sym.st_name))))
+                        hooked++;
+        }
+        ns_print ("HLE: %u functions hooked\n", hooked);
+}
+
+}
@@ -77,7 +77,7 @@ void Banner() {
 }
 
 enum  optionIndex {
-	UNKNOWN, HELP, ENABLE_TRACE, ENABLE_DEEP, ENABLE_GDB, ENABLE_DEBUG,
+	UNKNOWN, HELP, ENABLE_TRACE, ENABLE_DEEP, ENABLE_GDB, ENABLE_DEBUG, ENABLE_JIT, ENABLE_THREADED, DISABLE_OPT, DISABLE_HLE, FASTMEM, FUSION_STATS, BENCH_DECODE, CORES,
 };
 const option::Descriptor usage[] =
 {
@@ -88,12 +88,25 @@ const option::Descriptor usage[] =
     { ENABLE_DEEP, 0, "","deep-trace", Arg::None, "  --deep-trace, -t  \tEnable Deep Trace" },
     { ENABLE_GDB, 0, "s","enable-gdb", Arg::None, "  --enable-gdb -s  \tEnable GDBServer" },
     { ENABLE_DEBUG, 0, "d","enable-debug", Arg::None, "  --enable-debug -d  \tEnable debug mode" },
+    { ENABLE_JIT, 0, "j","enable-jit", Arg::None, "  --enable-jit -j  \tEnable x86-64 JIT" },
+    { ENABLE_THREADED, 0, "","enable-threaded", Arg::None, "  --enable-threaded  \tEnable threaded code interpreter (no JIT code pages)" },
+    { DISABLE_OPT, 0, "","disable-opt", Arg::None, "  --disable-opt  \tRun decoded blocks without micro-op optimization" },
+    { DISABLE_HLE, 0, "","disable-hle", Arg::None, "  --disable-hle  \tRun guest memcpy, strlen, etc. instead of host implementations" },
+    { FASTMEM, 0, "","fastmem", Arg::None, "  --fastmem  \tMap guest memory into a reserved host range and access it directly" },
+    { FUSION_STATS, 0, "","fusion-stats", Arg::None, "  --fusion-stats  \tPrint how many instruction pairs the optimizer fused, at exit" },
+    { BENCH_DECODE, 0, "","bench-decode", Arg::None, "  --bench-decode  \tMeasure decoder throughput on .text and exit" },
+    { CORES, 0, "","cores", Arg::Numeric, "  --cores=<n>  \tNumber of emulated CPU cores (1-4, default 4)" },
 	{ 0, 0, nullptr, nullptr, nullptr, nullptr }
 };
 
 static void SignalHandler(int sig, siginfo_t* sig_info, void* sig_data) {
         if(sig == SIGSEGV) {
-                ns_print ("SEGV: %p\n", sig_info->si_addr );
+                uint64_t gva;
+                /* No guest exception delivery: report and stop */
+                if (Memory::FastmemFault (sig_info->si_addr, &gva))
+                        ns_print ("Guest page fault at 0x%lx\n", gva);
+                else
+                        ns_print ("SEGV: %p\n", sig_info->si_addr );
                 ARMv8::Dump();
                 _Exit(-1);
         }
@@ -129,6 +142,39 @@ printUsage:
         if (options[ENABLE_DEBUG].count () > 0) {
 			enable_debug();
 	}
+        if (options[ENABLE_JIT].count () > 0) {
+			ARMv8::engine_type = ARMv8::EngineType::Jit;
+	}
+        if (options[ENABLE_THREADED].count () > 0) {
+			ARMv8::engine_type = ARMv8::EngineType::Threaded;
+	}
+        if (options[DISABLE_OPT].count () > 0) {
+			Optimizer::enabled = false;
+	}
+        if (options[DISABLE_HLE].count () > 0) {
+			HLE::enabled = false;
+	}
+        if (options[FASTMEM].count () > 0) {
+			Memory::fastmem = true;
+	}
+        if (options[FUSION_STATS].count () > 0) {
+			Optimizer::stats = true;
+	}
+        if (options[BENCH_DECODE].count () > 0) {
+			Disassembler::benchmark = true;
+	}
+        if (options[CORES].count () > 0) {
+			int cores = atoi (options[CORES].arg);
+			if (cores < 1 || cores > CPU_NUM_CORES) {
+				goto printUsage;
+			}
+			Cpu::num_cores = cores;
+	}
+        if (GdbStub::enabled && Cpu::num_cores > 1) {
+                /* Every core would serve the one gdb client and share its step state */
+                ns_print ("gdb stub runs on a single core\n");
+                Cpu::num_cores = 1;
+        }
 
 #if 0
 		if (options[NSO].count () > 0) {
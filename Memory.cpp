@@ -2,7 +2,7 @@
 #include <sys/mman.h>
 #include "Nsemu.hpp"
 
-RAMBlock::RAMBlock (std::string _name, uint64_t _addr, unsigned int _length, int _perm) : block(nullptr){
+RAMBlock::RAMBlock (std::string _name, uint64_t _addr, uint64_t _length, int _perm) : block(nullptr){
 	int page = getpagesize ();
 	name = _name;
 	length = _length;
@@ -12,7 +12,7 @@ RAMBlock::RAMBlock (std::string _name, uint64_t _addr, unsigned int _length, int
 	}
 	addr = _addr;
 }
-RAMBlock::RAMBlock(std::string _name, uint64_t _addr, unsigned int _length, uint8_t *raw, int _perm) {
+RAMBlock::RAMBlock(std::string _name, uint64_t _addr, uint64_t _length, uint8_t *raw, int _perm) {
 	int page = getpagesize ();
 	name = _name;
 	length = _length;
@@ -31,121 +31,334 @@ uint64_t heap_size = 0x0;
 uint8_t *pRAM;	// XXX: Replace raw pointer to View wrapper.
 unsigned int ram_size = 0x10000000;
 uint64_t straight_max = heap_base + heap_size;
-std::vector<RAMBlock*> regions;
-static RAMBlock mem_map_straight[] =
+/* Mapped guest ranges [addr, addr + length) keyed by base address. They
+ * never overlap: mapping over or unmapping part of a region splits it, and
+ * adjacent regions of the same kind are merged */
+static std::map<uint64_t, RAMBlock *> regions;
+/* QueryMemory looks up regions concurrently, SVCs change them */
+static std::shared_mutex regions_lock;
+static std::shared_ptr<const RegionList> snapshot; // Built on demand, reset on change
+static std::mutex snapshot_lock;
+static const RAMBlock mem_map_straight[] =
 {
-	RAMBlock (".text", 0x0, 0x0ffffff, PROT_READ | PROT_WRITE | PROT_EXEC),
-	// RAMBlock (".rdata", 0x1000000, 0x0ffffff, PROT_READ | PROT_WRITE),
-	// RAMBlock (".data", 0x2000000, 0x0ffffff, PROT_READ | PROT_WRITE),
-	RAMBlock ("[stack]", 0x3000000, 0x0ffffff, PROT_READ | PROT_WRITE),
+	RAMBlock (".text", 0x0, 0x1000000, PROT_READ | PROT_WRITE | PROT_EXEC),
+	// RAMBlock (".rdata", 0x1000000, 0x1000000, PROT_READ | PROT_WRITE),
+	// RAMBlock (".data", 0x2000000, 0x1000000, PROT_READ | PROT_WRITE),
+	RAMBlock ("[stack]", 0x3000000, 0x1000000, PROT_READ | PROT_WRITE),
 };
 
+/* The heap is one reserved host range: SetHeapSize only maps and unmaps its
+ * pages and the host kernel commits them on first touch */
+#define HEAP_MAX_SIZE 0x180000000ULL // Heap region of 39 bit address spaces
+static uint8_t *heap_host;
+
 static bool inline IsStraight(uint64_t addr, unsigned int len) {
         return addr + len <= straight_max;
 }
 
-static RAMBlock* FindRamBlock(uint64_t addr, unsigned int len) {
-        //ns_print("Find 0x%lx, 0x%x\n", addr, len);
-        for (int i = 0; i < regions.size(); i++) {
-                //ns_print("region[%d] 0x%lx: 0x%x\n", i, regions[i]->addr, regions[i]->length);
-                //if (regions[i]->addr <= addr && addr + len <= regions[i]->addr + regions[i]->length) {
-                //FIXME: [addr, addr+length] can be laid over contigious ramblocks
-                if (regions[i]->addr <= addr && addr <= regions[i]->addr + regions[i]->length) {
-                        //ns_print("0x%lx, 0x%x => match %d\n", addr, len, i);
-                        return regions[i];
+/* ####### Page table ####### */
+
+/* Two levels: a directory of tables mapping 512 pages (2MiB) each.
+ * Tables are never freed, so lookups need no lock */
+#define PT_BITS 9
+#define PT_SIZE (1 << PT_BITS)
+#define PD_SIZE (1 << (GUEST_VA_BITS - GUEST_PAGE_BITS - PT_BITS))
+static std::atomic<PageEntry *> page_dir[PD_SIZE];
+static std::mutex page_table_lock; // Serializes updates
+std::atomic<uint64_t> tlb_generation;
+
+PageEntry *LookupPage(uint64_t gva) {
+        uint64_t page = gva >> GUEST_PAGE_BITS;
+        if (page >= (uint64_t) PD_SIZE * PT_SIZE)
+                return nullptr;
+        PageEntry *table = page_dir[page >> PT_BITS].load (std::memory_order_acquire);
+        return table ? &table[page & (PT_SIZE - 1)] : nullptr;
+}
+
+void MapPages(uint64_t gva, uint8_t *host, uint64_t len, int perm) {
+        std::lock_guard<std::mutex> lock (page_table_lock);
+        bool remap = false;
+        for (uint64_t off = 0; off < len; off += GUEST_PAGE_SIZE) {
+                uint64_t page = (gva + off) >> GUEST_PAGE_BITS;
+                if (page >= (uint64_t) PD_SIZE * PT_SIZE) {
+                        ns_abort ("Mapping 0x%lx is out of the address space\n", gva + off);
                 }
+                PageEntry *table = page_dir[page >> PT_BITS].load (std::memory_order_relaxed);
+                if (!table) {
+                        table = new PageEntry[PT_SIZE]();
+                        page_dir[page >> PT_BITS].store (table, std::memory_order_release);
+                }
+                PageEntry &entry = table[page & (PT_SIZE - 1)];
+                remap |= entry.host.load (std::memory_order_relaxed) != nullptr;
+                /* Permission first: a reader seeing the pointer sees the right permission */
+                entry.perm.store (perm, std::memory_order_relaxed);
+                entry.host.store (host + off, std::memory_order_release);
+        }
+        if (remap)
+                tlb_generation++;
+}
+
+void UnmapPages(uint64_t gva, uint64_t len) {
+        std::lock_guard<std::mutex> lock (page_table_lock);
+        for (uint64_t off = 0; off < len; off += GUEST_PAGE_SIZE) {
+                PageEntry *entry = LookupPage (gva + off);
+                if (entry)
+                        entry->host.store (nullptr, std::memory_order_release);
+        }
+        tlb_generation++;
+}
+
+static inline uint64_t PageAlignDown(uint64_t addr) {
+        return addr & ~GUEST_PAGE_MASK;
+}
+
+static inline uint64_t PageAlignUp(uint64_t addr) {
+        return (addr + GUEST_PAGE_MASK) & ~GUEST_PAGE_MASK;
+}
+
+/* ####### Fastmem ####### */
+
+#define GUEST_VA_SIZE (1ULL << GUEST_VA_BITS)
+#define FASTMEM_RESERVE (GUEST_VA_SIZE + GUEST_PAGE_SIZE) // Guard page for accesses straddling the end
+bool fastmem = false;
+uint8_t *fastmem_base;
+
+static bool ReserveFastmem() {
+        void *base = mmap (nullptr, FASTMEM_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+                ns_print ("Failed to reserve guest address space, fastmem disabled\n");
+                return false;
         }
-        return nullptr;
+        fastmem_base = (uint8_t *) base;
+        return true;
+}
+
+/* Fresh zeroed pages at base + gva */
+static uint8_t *CommitFastmem(uint64_t gva, uint64_t len, int perm) {
+        void *host = mmap (fastmem_base + gva, len, perm, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (host == MAP_FAILED) {
+                ns_abort ("Failed to map guest memory [0x%lx, 0x%lx)\n", gva, gva + len);
+        }
+        return (uint8_t *) host;
+}
+
+/* Back to a PROT_NONE reservation, freeing the pages */
+static void DecommitFastmem(uint64_t gva, uint64_t len) {
+        mmap (fastmem_base + gva, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+}
+
+bool FastmemFault(const void *host, uint64_t *gva) {
+        if (!fastmem_base || host < fastmem_base || host >= fastmem_base + FASTMEM_RESERVE)
+                return false;
+        *gva = (const uint8_t *) host - fastmem_base;
+        return true;
 }
 
-static void AddAnonStraight(uint64_t addr, unsigned int len, int perm) {
-        ns_print("Add anonymous fixed region [0x%lx, %d]\n", addr, len);
-        RAMBlock *new_ram = new RAMBlock("[anon]", addr, len, perm)        ;
-        regions.push_back(new_ram);
+/* ####### Regions ####### */
+
+static inline uint64_t RegionEnd(const RAMBlock *ram) {
+        return ram->addr + ram->length;
+}
+
+/* Backing of AddMemmap regions is mmap'd, so that any page range of it can be released on its own */
+static uint8_t *AllocBacking(uint64_t addr, uint64_t len, int perm) {
+        if (fastmem_base)
+                return CommitFastmem (addr, len, perm);
+        void *host = mmap (nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return host == MAP_FAILED ? nullptr : (uint8_t *) host;
 }
 
-static void AddAnonRamBlock(uint64_t addr, unsigned int len, int perm) {
-        uint8_t *raw = new uint8_t[len];
+/* [addr, addr + len) of ram goes away */
+static void ReleaseRange(RAMBlock *ram, uint64_t addr, uint64_t len) {
+        /* The straight window stays backed by pRAM */
+        if (!ram->block)
+                return;
+        UnmapPages (addr, len);
+        uint8_t *host = ram->block + (addr - ram->addr);
+        if (fastmem_base)
+                DecommitFastmem (addr, len);
+        else if (host >= heap_host && host < heap_host + HEAP_MAX_SIZE)
+                madvise (host, len, MADV_DONTNEED); // Keep the reservation
+        else
+                munmap (host, len);
+}
+
+/* Take [addr, end) out of the regions, splitting the ones it cuts through */
+static void Carve(uint64_t addr, uint64_t end) {
+        auto it = regions.lower_bound (addr);
+        if (it != regions.begin () && RegionEnd (std::prev (it)->second) > addr)
+                --it;
+        while (it != regions.end () && it->first < end) {
+                RAMBlock *ram = it->second;
+                uint64_t ram_end = RegionEnd (ram);
+                uint64_t cut = std::max (addr, ram->addr), cut_end = std::min (end, ram_end);
+                ReleaseRange (ram, cut, cut_end - cut);
+                if (cut_end < ram_end) {
+                        uint8_t *tail = ram->block ? ram->block + (cut_end - ram->addr) : nullptr;
+                        regions[cut_end] = new RAMBlock (ram->name, cut_end, ram_end - cut_end, tail, ram->perm);
+                }
+                if (ram->addr < cut) {
+                        ram->length = cut - ram->addr;
+                        ++it;
+                } else {
+                        delete ram;
+                        it = regions.erase (it);
+                }
+        }
+        snapshot.reset ();
+}
+
+/* Contiguous in guest and host memory, with the same attributes */
+static bool Mergeable(const RAMBlock *a, const RAMBlock *b) {
+        return RegionEnd (a) == b->addr && a->perm == b->perm && a->name == b->name &&
+               (a->block ? a->block + a->length == b->block : !b->block);
+}
+
+static void Insert(RAMBlock *ram) {
+        auto it = regions.emplace (ram->addr, ram).first;
+        auto next = std::next (it);
+        if (next != regions.end () && Mergeable (ram, next->second)) {
+                ram->length += next->second->length;
+                delete next->second;
+                regions.erase (next);
+        }
+        if (it != regions.begin ()) {
+                RAMBlock *prev = std::prev (it)->second;
+                if (Mergeable (prev, ram)) {
+                        prev->length += ram->length;
+                        delete ram;
+                        regions.erase (it);
+                }
+        }
+        snapshot.reset ();
+}
+
+static void AddAnonStraight(uint64_t addr, uint64_t len, int perm) {
+        ns_print("Add anonymous fixed region [0x%lx, %ld]\n", addr, len);
+        Insert (new RAMBlock ("[anon]", addr, len, perm));
+}
+
+static void AddAnonRamBlock(uint64_t addr, uint64_t len, int perm) {
+        uint8_t *raw = AllocBacking (addr, len, perm);
         if (!raw) {
                 ns_abort("Failed to allocate new RAM Block\n");
         }
-        RAMBlock *new_ram = new RAMBlock("[anon]", addr, len, raw, perm);
-        ns_print("Add anonymous region [0x%lx, %d]\n", new_ram->addr, new_ram->length);
-        regions.push_back(new_ram);
+        ns_print("Add anonymous region [0x%lx, %ld]\n", addr, len);
+        MapPages (addr, raw, len, perm);
+        Insert (new RAMBlock ("[anon]", addr, len, raw, perm));
 }
 
 void AddMemmap(uint64_t addr, unsigned int len) {
-        if (IsStraight(addr, len)) {
+        /* Regions cover whole pages */
+        uint64_t end = PageAlignUp (addr + len);
+        addr = PageAlignDown (addr);
+        std::unique_lock<std::shared_mutex> lock (regions_lock);
+        /* Replaces whatever was mapped there */
+        Carve (addr, end);
+        if (IsStraight(addr, end - addr)) {
                 /* Within straight regions */
-                AddAnonStraight(addr, len, PROT_READ | PROT_WRITE);
+                AddAnonStraight(addr, end - addr, PROT_READ | PROT_WRITE);
                 return;
         }
-        // if (ExistOverlap(addr, len))
-        /* TODO Detect overlapped areas */
-
         /* Necessary to extend memory area */
-        AddAnonRamBlock(addr, len, PROT_READ | PROT_WRITE);
+        AddAnonRamBlock(addr, end - addr, PROT_READ | PROT_WRITE);
 }
 
 void DelMemmap(uint64_t addr, unsigned int len) {
-        auto it = regions.begin();
-        while (it != regions.end()) {
-                RAMBlock *ram = *it;
-                if (addr <= ram->addr && ram->addr + ram->length <= addr + len) {
-                        delete ram;
-                        it = regions.erase(it);
-                } else {
-                        ++it;
-                }
+        BlockCache::Invalidate (addr, len);
+        std::unique_lock<std::shared_mutex> lock (regions_lock);
+        Carve (PageAlignDown (addr), PageAlignUp (addr + len));
+}
+
+/* ####### Heap ####### */
+
+bool SetHeapSize(uint64_t size) {
+        if (size > HEAP_MAX_SIZE)
+                return false;
+        size = PageAlignUp (size);
+        if (size < heap_size)
+                BlockCache::Invalidate (heap_base + size, heap_size - size);
+        std::unique_lock<std::shared_mutex> lock (regions_lock);
+        if (size > heap_size) {
+                uint64_t addr = heap_base + heap_size, len = size - heap_size;
+                Carve (addr, addr + len);
+                uint8_t *host = fastmem_base ? CommitFastmem (addr, len, PROT_READ | PROT_WRITE) : heap_host + heap_size;
+                MapPages (addr, host, len, PROT_READ | PROT_WRITE);
+                Insert (new RAMBlock ("[heap]", addr, len, host, PROT_READ | PROT_WRITE));
+        } else if (size < heap_size) {
+                /* Released pages read as zero when the heap grows back */
+                Carve (heap_base + size, heap_base + heap_size);
         }
+        heap_size = size;
+        return true;
 }
 
 void InitMemmap(Nsemu *nsemu) {
         void *data;
-	if ((data = mmap (nullptr, ram_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        if (fastmem && ReserveFastmem ()) {
+                /* Straight window is the bottom of the reservation */
+                data = CommitFastmem (0, straight_max, PROT_READ | PROT_WRITE | PROT_EXEC);
+        } else if ((data = mmap (nullptr, ram_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
 	 	ns_abort ("Failed to allocate host memory\n");
 	}
         pRAM = (uint8_t *) data;
-        for (int i = 0; i < sizeof(mem_map_straight) / sizeof(RAMBlock); i++) {
-                regions.push_back(&mem_map_straight[i]);
+        MapPages (0, pRAM, straight_max, PROT_READ | PROT_WRITE | PROT_EXEC);
+        if (fastmem_base) {
+                heap_host = fastmem_base + heap_base;
+        } else if ((data = mmap (nullptr, HEAP_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED) {
+                ns_abort ("Failed to reserve heap\n");
+        } else {
+                heap_host = (uint8_t *) data;
+        }
+        std::unique_lock<std::shared_mutex> lock (regions_lock);
+        for (const RAMBlock &ram : mem_map_straight) {
+                Insert (new RAMBlock (ram));
         }
 }
 
-std::list<std::tuple<uint64_t,uint64_t, int>> GetRegions() {
-        std::list<std::tuple<uint64_t,uint64_t, int>> ret;
-        list<tuple<uint64_t, uint64_t>> temp;
-        for (int i = 0; i < regions.size(); i++) {
-                uint64_t addr = regions[i]->addr;
-                unsigned int length = regions[i]->length;
-                temp.push_back(make_tuple(addr, addr + length));
-        }
-        temp.sort([](auto a, auto b) { auto [ab, _] = a; auto [bb, __] = b; return ab < bb; });
+/* Regions apart in host memory only show up as one too */
+static std::shared_ptr<const RegionList> BuildSnapshot() {
+        auto list = std::make_shared<RegionList> ();
         uint64_t last = 0;
-        for(auto [begin, end] : temp) {
-                if(last != begin)
-                        ret.push_back(make_tuple(last, begin - 1, -1));
-        	ret.push_back(make_tuple(begin, end, 0));
-        	last = end + 1;
+        const RAMBlock *prev = nullptr;
+        for (auto &[addr, ram] : regions) {
+                if (prev && RegionEnd (prev) == addr && prev->perm == ram->perm && prev->name == ram->name) {
+                        std::get<1> (list->back ()) = RegionEnd (ram) - 1;
+                } else {
+                        if (last != addr)
+                                list->push_back (make_tuple (last, addr - 1, -1));
+                        list->push_back (make_tuple (addr, RegionEnd (ram) - 1, ram->perm));
+                }
+                last = RegionEnd (ram);
+                prev = ram;
         }
-        if(last != 0xFFFFFFFFFFFFFFFF)
-                ret.push_back(make_tuple(last, 0xFFFFFFFFFFFFFFFF, -1));
-        return ret;
+        list->push_back (make_tuple (last, 0xFFFFFFFFFFFFFFFF, -1));
+        return list;
+}
+
+std::shared_ptr<const RegionList> GetRegions() {
+        std::shared_lock<std::shared_mutex> lock (regions_lock);
+        std::lock_guard<std::mutex> guard (snapshot_lock);
+        if (!snapshot)
+                snapshot = BuildSnapshot ();
+        return snapshot;
+}
+
+std::tuple<uint64_t, uint64_t, int> QueryRegion(uint64_t addr) {
+        auto list = GetRegions ();
+        /* The last entry ends at the top of the address space */
+        return *std::lower_bound (list->begin (), list->end (), addr,
+                                  [](const auto &region, uint64_t a) { return std::get<1> (region) < a; });
 }
 
 void *GetRawPtr(uint64_t gpa, unsigned int len) {
-        void *emu_mem = 0;
-        if (IsStraight(gpa, len)) {
-                emu_mem = (void *)&pRAM[gpa];
-        } else {
-                RAMBlock *ram = FindRamBlock (gpa, len);
-                if (!ram) {
-                        ns_abort("Cannnot find addr: 0x%lx size: %d\n", gpa, len);
-                        return nullptr;
-                }
-                debug_print("Uncontigious block\n");
-                emu_mem = (void *)&ram->block[gpa - ram->addr];
+        PageEntry *page = LookupPage (gpa);
+        uint8_t *host = page ? page->host.load (std::memory_order_acquire) : nullptr;
+        if (!host) {
+                ns_abort("Cannnot find addr: 0x%lx size: %d\n", gpa, len);
+                return nullptr;
         }
-        return emu_mem;
+        return host + (gpa & GUEST_PAGE_MASK);
 }
 
 static bool _CopyMemEmu(void *data, uint64_t gpa, unsigned int len, bool load) {
@@ -47,6 +47,8 @@ int Nso::load(Nsemu *nsemu) {
 	bindump (txt_dump, 105);
 	/* ---------------- */
 	delete[] text;
+        text_addr = base + hdr.textLoc;
+        text_size = hdr.textSize;
         ns_print(".text[0x%x] size = 0x%x\n", hdr.textOff, hdr.textSize);
         ns_print(".rdata[0x%x] size = 0x%x\n", hdr.rdataOff, hdr.rdataSize);
         ns_print(".data[0x%x] size = 0x%x\n", hdr.dataOff, hdr.dataSize);
@@ -64,6 +66,7 @@ int Nso::load(Nsemu *nsemu) {
 	}
 	delete[] data;
 
+        HLE::HookModule (base, size);
 	return size;
 }
 
@@ -10,6 +10,8 @@ std::unordered_map<uint32_t, KObject *> handles;
 static void LoadNso(Nsemu *nsemu, string path) {
 	Nso nso (path);
 	nso.load (nsemu);
+        if (Disassembler::benchmark)
+                Disassembler::Benchmark (nso.text_addr, nso.text_size);
 }
 
 static void CpuThread() {
@@ -24,10 +26,14 @@ bool Nsemu::BootUp(const std::string& path) {
 	ns_print ("Booting... %s\n", path.c_str ());
 	Memory::InitMemmap (this);
 	LoadNso (this, path);
+        if (Disassembler::benchmark)
+                return true;
         IPC::InitIPC();
         handle_id = 0xde00; // XXX: Magic number?
 	cpu_thread = std::thread (CpuThread);
 	/* Run cpu */
 	cpu_thread.join ();
+        if (Optimizer::stats)
+                Optimizer::PrintStats ();
 	return true;
 }
@@ -42,6 +42,7 @@
 namespace SVC {
 
 std::function<void()> svc_handlers[0x80];
+std::mutex kernel_lock;
 
 void RegisterSvcHandler (unsigned int num, std::function<void()> handler) {
         svc_handlers[num] = handler;
@@ -60,9 +61,9 @@ void Init() {
         RegisterSvcRetX0(0x0B, SleepThread, X(0));
         RegisterSvcRetX01(0x0C, GetThreadPriority, (uint32_t) X(0));
         RegisterSvcRetX0(0x0D, SetThreadPriority, (uint32_t) X(0), X(1));
-        RegisterSvcRetX012(0x0E, GetThreadCoreMask, X(0));
-        RegisterSvcRetX0(0x0F, SetThreadCoreMask, X(0));
-        RegisterSvcRetX0(0x10, GetCurrentProcessorNumber, X(0));
+        RegisterSvcRetX012(0x0E, GetThreadCoreMask, (uint32_t) X(2));
+        RegisterSvcRetX0(0x0F, SetThreadCoreMask, (uint32_t) X(0), (uint32_t) X(1), X(2));
+        RegisterSvcRetX0(0x10, GetCurrentProcessorNumber);
         RegisterSvcRetX0(0x11, SignalEvent, (uint32_t) X(0));
         RegisterSvcRetX0(0x12, ClearEvent, (uint32_t) X(0));
         RegisterSvcRetX0(0x13, MapMemoryBlock, (uint32_t) X(0), X(1), X(2), X(3));
@@ -105,13 +106,10 @@ void Init() {
 }
 std::tuple<uint64_t, uint64_t> SetHeapSize(uint64_t size) {
 	ns_print("SetHeapSize 0x%lx\n", size);
-        if (Memory::heap_size < size) {
-                Memory::AddMemmap (Memory::heap_base + Memory::heap_size, size - Memory::heap_size - 1);
-        } else if (Memory::heap_size > size) {
-                /* TODO: */
-        }
-
-        Memory::heap_size = size;
+        if (size & 0x1fffff)
+                return make_tuple(0xca01, 0); // Invalid size: heap grows by 2MiB
+        if (!Memory::SetHeapSize (size))
+                return make_tuple(0xd001, 0); // Out of memory
 	return make_tuple(0, Memory::heap_base);
 }
 
@@ -148,31 +146,26 @@ typedef struct {
 
 std::tuple<uint64_t, uint64_t> QueryMemory(uint64_t meminfo, uint64_t pageinfo, uint64_t addr) {
         ns_print("QueryMemory 0x%lx\n", addr);
-        for(auto [begin, end, perm] : Memory::GetRegions()) {
-                //ns_print("Region [0x%lx, 0x%lx %d]\n", begin, end, perm);
-                if (begin <= addr && addr <= end) {
-                        //ns_print("found region at 0x%lx, 0x%lx\n", begin, end);
-                        MemInfo minfo;
-                        minfo.begin = begin;
-                        minfo.size = end - begin + 1;
-			minfo.memory_type = perm == -1 ? 0 : 3; // FREE or CODE
-			minfo.memory_attribute = 0;
-                        if(addr >= Memory::heap_base && addr < Memory::heap_base + Memory::heap_size) {
-				minfo.memory_type = 5; // HEAP
-			}
-                        minfo.permission = 0;
-			if(perm != -1) {
-				auto offset = *ARMv8::GuestPtr<uint32_t>(begin + 4);
-				if(begin + offset + 4 < end && *ARMv8::GuestPtr<uint32_t>(begin + offset) == byte_swap32_str("MOD0"))
-					minfo.permission = 5;
-				else
-					minfo.permission = 3;
-			}
-                        MemInfo *ptr = ARMv8::GuestPtr<MemInfo>(meminfo);
-                        *ptr = minfo;
-                        break;
-                }
-        }
+        auto [begin, end, perm] = Memory::QueryRegion(addr);
+        //ns_print("found region at 0x%lx, 0x%lx\n", begin, end);
+        MemInfo minfo;
+        minfo.begin = begin;
+        minfo.size = end - begin + 1;
+	minfo.memory_type = perm == -1 ? 0 : 3; // FREE or CODE
+	minfo.memory_attribute = 0;
+        if(addr >= Memory::heap_base && addr < Memory::heap_base + Memory::heap_size) {
+		minfo.memory_type = 5; // HEAP
+	}
+        minfo.permission = 0;
+	if(perm != -1) {
+		auto offset = *ARMv8::GuestPtr<uint32_t>(begin + 4);
+		if(begin + offset + 4 < end && *ARMv8::GuestPtr<uint32_t>(begin + offset) == byte_swap32_str("MOD0"))
+			minfo.permission = 5;
+		else
+			minfo.permission = 3;
+	}
+        MemInfo *ptr = ARMv8::GuestPtr<MemInfo>(meminfo);
+        *ptr = minfo;
 	return make_tuple(0, 0);
 }
 
@@ -185,42 +178,93 @@ void ExitProcess(uint64_t exitCode) {
 }
 
 std::tuple<uint64_t, uint64_t> CreateThread(uint64_t pc, uint64_t x0, uint64_t sp, uint64_t prio, uint64_t proc) {
-	return make_tuple(0, 0);
+	ns_print("CreateThread pc=0x%lx sp=0x%lx prio=%ld core=%d\n", pc, sp, prio, (int) proc);
+        int core = (int) proc;
+        if (core == -2) {
+                /* Process default core */
+                core = 0;
+        }
+        if (core < 0 || core >= CPU_NUM_CORES)
+                return make_tuple(ERR_INVALID_CORE_ID, 0);
+        if (prio >= THREAD_PRIO_NUM)
+                return make_tuple(ERR_INVALID_PRIORITY, 0);
+        Thread *thread = ThreadManager::Create (pc, x0, sp, (int) prio, core);
+	return make_tuple(0, thread->handle);
 }
 
 uint64_t StartThread(uint32_t handle) {
+	ns_print("StartThread 0x%x\n", handle);
+        Thread *thread = ThreadManager::FromHandle (handle);
+        if (!thread)
+                return ERR_INVALID_HANDLE;
+        if (thread->state != ThreadState::Created)
+                return ERR_INVALID_STATE;
+        ThreadManager::Start (thread);
 	return 0;
 }
 
 void ExitThread() {
+	ns_print("ExitThread\n");
+        ThreadManager::Exit ();
 }
 
 uint64_t SleepThread(uint64_t ns) {
         ns_print("SleepThread 0x%lx [ns]\n", ns);
+        ThreadManager::Sleep ((int64_t) ns);
 	return 0;
 }
 
 std::tuple<uint64_t, uint64_t> GetThreadPriority(uint32_t handle) {
-	return make_tuple(0, 0);
+        Thread *thread = ThreadManager::FromHandle (handle);
+        if (!thread)
+                return make_tuple(ERR_INVALID_HANDLE, 0);
+	return make_tuple(0, thread->priority);
 }
 
 uint64_t SetThreadPriority(uint32_t handle, uint64_t priority) {
+        Thread *thread = ThreadManager::FromHandle (handle);
+        if (!thread)
+                return ERR_INVALID_HANDLE;
+        if (priority >= THREAD_PRIO_NUM)
+                return ERR_INVALID_PRIORITY;
+        ThreadManager::SetPriority (thread, (int) priority);
 	return 0;
 }
 
-std::tuple<uint64_t, uint64_t, uint64_t> GetThreadCoreMask(uint64_t tmp) {
-	ns_print("GetThreadCoreMask\n");
-	return make_tuple(0, 0xFF, 0xFF);
-}
-
-uint64_t SetThreadCoreMask(uint64_t tmp) {
-	ns_print("GetThreadCoreMask\n");
+std::tuple<uint64_t, uint64_t, uint64_t> GetThreadCoreMask(uint32_t handle) {
+	ns_print("GetThreadCoreMask 0x%x\n", handle);
+        Thread *thread = ThreadManager::FromHandle (handle);
+        if (!thread)
+                return make_tuple(ERR_INVALID_HANDLE, 0, 0);
+	return make_tuple(0, thread->ideal_core, thread->affinity_mask);
+}
+
+uint64_t SetThreadCoreMask(uint32_t handle, uint32_t ideal_core, uint64_t affinity_mask) {
+	ns_print("SetThreadCoreMask 0x%x %d 0x%lx\n", handle, (int) ideal_core, affinity_mask);
+        Thread *thread = ThreadManager::FromHandle (handle);
+        if (!thread)
+                return ERR_INVALID_HANDLE;
+        int core = (int) ideal_core;
+        if (core == -3) {
+                /* Keep ideal core */
+                core = thread->ideal_core;
+        } else if (core == -2) {
+                /* Process default core */
+                core = 0;
+        }
+        if (core < 0 || core >= CPU_NUM_CORES)
+                return ERR_INVALID_CORE_ID;
+        if (!affinity_mask || (affinity_mask & ~((1ULL << CPU_NUM_CORES) - 1)))
+                return ERR_INVALID_CORE_ID;
+        if (!(affinity_mask & (1ULL << core)))
+                return ERR_INVALID_COMBINATION;
+        ThreadManager::SetCoreMask (thread, core, affinity_mask);
 	return 0;
 }
 
-uint64_t GetCurrentProcessorNumber(uint64_t tmp) {
+uint64_t GetCurrentProcessorNumber() {
 	ns_print("GetCurrentProcessorNumber\n");
-	return 0;
+	return Cpu::CurrentCore ();
 }
 
 uint64_t SignalEvent(uint32_t handle) {
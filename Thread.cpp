@@ -3,16 +3,303 @@
 namespace ThreadManager {
 std::unordered_map<uint32_t, Thread *> threads;
 unsigned long thread_id;
+/* Protects everything below and thread states */
+static std::mutex sched_lock;
+static Thread *running[CPU_NUM_CORES];
+static std::deque<Thread *> ready[THREAD_PRIO_NUM];
+static std::vector<Thread *> sleeping;
+static unsigned int live_threads; // Started and not yet exited
+static bool event[CPU_NUM_CORES]; // Event registers of WFE/SEV
+static std::atomic<unsigned int> event_waiters; // Threads with wait_event set
 
 void Init() {
         thread_id = 0;
 }
 
-Thread *Create() {
+Thread *Create(uint64_t entry, uint64_t arg, uint64_t sp, int priority, int core) {
         Thread *thread = new Thread();
-        threads[thread_id++] = thread;
+        thread->id = thread_id++;
+        threads[thread->id] = thread;
         thread->handle = NewHandle(thread);
+        thread->priority = priority;
+        thread->ideal_core = core;
+        thread->affinity_mask = 1ULL << core;
+        uint64_t tls_base = (1 << 24) + 0x1000 * (thread->id + 1);
+        size_t tls_size = 0xfff;
+        ARMv8::ARMv8State &ctx = thread->context;
+        ctx.gpr[0].x = arg;
+        ctx.gpr[GPR_SP].x = sp;
+        ctx.gpr[PC_IDX].x = entry;
+        ctx.sysr.tpidrro_el[0] = tls_base;
+        ctx.sysr.tczid_el[0] = 0x4; //FIXME: calclulate at runtime
+        Memory::AddMemmap (tls_base, tls_size);
         return thread;
 }
 
+Thread *Current() {
+        return running[Cpu::CurrentCore ()];
+}
+
+Thread *FromHandle(uint32_t handle) {
+        if (handle == CURRENT_THREAD_HANDLE)
+                return Current ();
+        for (auto &it : threads) {
+                if (it.second->handle == handle)
+                        return it.second;
+        }
+        return nullptr;
+}
+
+static inline bool Allowed(Thread *thread, unsigned int core) {
+        uint64_t online = (1ULL << Cpu::num_cores) - 1;
+        /* Threads bound to cores that aren't run may go anywhere */
+        if (!(thread->affinity_mask & online))
+                return true;
+        return (thread->affinity_mask >> core) & 1;
+}
+
+/* Wake an idle core able to run thread */
+static void Kick(Thread *thread) {
+        int target = -1;
+        for (unsigned int core = 0; core < Cpu::num_cores; core++) {
+                if (!running[core] && Allowed (thread, core) && (target < 0 || (int) core == thread->ideal_core))
+                        target = core;
+        }
+        if (target >= 0)
+                Cpu::SetCoreState (target, Cpu::State::Running);
+}
+
+/* Queue a thread whose context is saved */
+static void MakeReady(Thread *thread, bool wake) {
+        thread->state = ThreadState::Ready;
+        ready[thread->priority].push_back (thread);
+        if (wake)
+                Kick (thread);
+}
+
+/* False if the thread isn't queued (e.g. it is Ready but still on a core after yielding) */
+static bool Dequeue(Thread *thread) {
+        auto &queue = ready[thread->priority];
+        auto it = std::find (queue.begin (), queue.end (), thread);
+        if (it == queue.end ())
+                return false;
+        queue.erase (it);
+        return true;
+}
+
+/* Highest priority thread runnable on core, down to priority max_prio */
+static Thread *FindReady(unsigned int core, int max_prio, bool remove) {
+        for (int prio = 0; prio <= max_prio; prio++) {
+                for (auto it = ready[prio].begin (); it != ready[prio].end (); ++it) {
+                        Thread *thread = *it;
+                        if (!Allowed (thread, core))
+                                continue;
+                        if (remove)
+                                ready[prio].erase (it);
+                        return thread;
+                }
+        }
+        return nullptr;
+}
+
+static inline void ClearWaitEvent(Thread *thread) {
+        if (thread->wait_event) {
+                thread->wait_event = false;
+                event_waiters--;
+        }
+}
+
+static void WakeSleepers(std::chrono::steady_clock::time_point now) {
+        auto it = sleeping.begin ();
+        while (it != sleeping.end ()) {
+                Thread *thread = *it;
+                if (thread->wake_time <= now) {
+                        ClearWaitEvent (thread);
+                        it = sleeping.erase (it);
+                        MakeReady (thread, true);
+                } else {
+                        ++it;
+                }
+        }
+}
+
+/* Ask the calling core to reschedule before it runs the next block */
+static inline void Yield() {
+        ARMv8::arm_state->ticks = 0;
+}
+
+void Start(Thread *thread) {
+        std::lock_guard<std::mutex> lock (sched_lock);
+        live_threads++;
+        MakeReady (thread, true);
+        Thread *cur = Current ();
+        if (cur && thread->priority < cur->priority && Allowed (thread, Cpu::CurrentCore ()))
+                Yield ();
+}
+
+void Exit() {
+        std::lock_guard<std::mutex> lock (sched_lock);
+        Thread *thread = Current ();
+        ns_print ("Thread 0x%x exited\n", thread->handle);
+        thread->state = ThreadState::Terminated;
+        Yield ();
+        if (--live_threads == 0) {
+                ns_print ("All threads exited\n");
+                Cpu::SetState (Cpu::State::PowerDown);
+        }
+}
+
+void Sleep(int64_t ns) {
+        std::lock_guard<std::mutex> lock (sched_lock);
+        Thread *thread = Current ();
+        ClearWaitEvent (thread);
+        if (ns <= 0) {
+                /* Back to the end of its run queue */
+                thread->state = ThreadState::Ready;
+        } else {
+                thread->state = ThreadState::Sleeping;
+                thread->wake_time = std::chrono::steady_clock::now () + std::chrono::nanoseconds (ns);
+        }
+        Yield ();
+}
+
+void WaitForEvent(int64_t ns, bool consume) {
+        unsigned int core = Cpu::CurrentCore ();
+        std::lock_guard<std::mutex> lock (sched_lock);
+        if (consume && event[core]) {
+                event[core] = false;
+                return;
+        }
+        Thread *thread = Current ();
+        thread->state = ThreadState::Sleeping;
+        thread->wake_time = std::chrono::steady_clock::now () + std::chrono::nanoseconds (ns);
+        if (!thread->wait_event) {
+                thread->wait_event = true;
+                event_waiters++;
+        }
+        Yield ();
+}
+
+void SendEvent(bool local) {
+        std::lock_guard<std::mutex> lock (sched_lock);
+        if (local) {
+                event[Cpu::CurrentCore ()] = true;
+                return;
+        }
+        for (unsigned int core = 0; core < Cpu::num_cores; core++) {
+                event[core] = true;
+                /* Still on its core: Schedule finds it running again */
+                Thread *thread = running[core];
+                if (thread && thread->wait_event) {
+                        ClearWaitEvent (thread);
+                        thread->state = ThreadState::Running;
+                }
+        }
+        auto it = sleeping.begin ();
+        while (it != sleeping.end ()) {
+                Thread *thread = *it;
+                if (thread->wait_event) {
+                        ClearWaitEvent (thread);
+                        it = sleeping.erase (it);
+                        MakeReady (thread, true);
+                } else {
+                        ++it;
+                }
+        }
+}
+
+bool HasEventWaiters() {
+        return event_waiters.load (std::memory_order_relaxed) != 0;
+}
+
+void SetPriority(Thread *thread, int priority) {
+        std::lock_guard<std::mutex> lock (sched_lock);
+        if (thread->state == ThreadState::Ready && Dequeue (thread)) {
+                thread->priority = priority;
+                MakeReady (thread, false);
+        } else {
+                thread->priority = priority;
+        }
+        if (thread == Current ())
+                Yield ();
+}
+
+void SetCoreMask(Thread *thread, int ideal_core, uint64_t affinity_mask) {
+        std::lock_guard<std::mutex> lock (sched_lock);
+        thread->ideal_core = ideal_core;
+        thread->affinity_mask = affinity_mask;
+        if (thread == Current ()) {
+                if (!Allowed (thread, Cpu::CurrentCore ()))
+                        Yield ();
+        } else if (thread->state == ThreadState::Ready && Dequeue (thread)) {
+                MakeReady (thread, true);
+        }
+        /* A thread running elsewhere moves at the end of that core's quantum */
+}
+
+void Schedule() {
+        unsigned int core = Cpu::CurrentCore ();
+        std::lock_guard<std::mutex> lock (sched_lock);
+        WakeSleepers (std::chrono::steady_clock::now ());
+        Thread *cur = running[core];
+        if (cur) {
+                bool runnable = cur->state == ThreadState::Running && Allowed (cur, core);
+                if (runnable && !FindReady (core, cur->priority, false)) {
+                        /* Nothing else to run here: keep going */
+                        ARMv8::arm_state->ticks = THREAD_QUANTUM;
+                        return;
+                }
+                ARMv8::GetFPSR (); // Fold host FP flags into the context
+                cur->context = *ARMv8::arm_state;
+                switch (cur->state) {
+                case ThreadState::Running:
+                case ThreadState::Ready:
+                        MakeReady (cur, false);
+                        break;
+                case ThreadState::Sleeping:
+                        sleeping.push_back (cur);
+                        break;
+                default:
+                        break;
+                }
+                running[core] = nullptr;
+        }
+        Thread *next = FindReady (core, THREAD_PRIO_NUM - 1, true);
+        if (!next) {
+                Cpu::SetCoreState (core, Cpu::State::Halted);
+                return;
+        }
+        if (next != cur)
+                debug_print ("Core %u: switch to thread 0x%x\n", core, next->handle);
+        running[core] = next;
+        next->state = ThreadState::Running;
+        if (!cur) {
+                /* Core may be Halted still, when it woke up on a sleeper's timeout */
+                Cpu::SetCoreState (core, Cpu::State::Running);
+                /* next may be what another core was kicked for: kick again for the rest */
+                for (auto &queue : ready) {
+                        for (Thread *thread : queue)
+                                Kick (thread);
+                }
+        }
+        /* Preempted thread may go on on another core */
+        if (cur && cur != next && cur->state == ThreadState::Ready)
+                Kick (cur);
+        *ARMv8::arm_state = next->context;
+        ARMv8::arm_state->excl.armed = false; // As the kernel does CLREX on a switch
+        ARMv8::SetFPCR (ARMv8::arm_state->fpcr);
+        ARMv8::SetFPSR (ARMv8::arm_state->fpsr);
+        ARMv8::arm_state->ticks = THREAD_QUANTUM;
+}
+
+std::chrono::steady_clock::time_point NextWakeup(unsigned int core) {
+        std::lock_guard<std::mutex> lock (sched_lock);
+        auto wakeup = std::chrono::steady_clock::time_point::max ();
+        for (Thread *thread : sleeping) {
+                if (Allowed (thread, core))
+                        wakeup = std::min (wakeup, thread->wake_time);
+        }
+        return wakeup;
+}
+
 };
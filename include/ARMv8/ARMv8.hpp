@@ -8,8 +8,8 @@ typedef union {
         uint64_t x;
 }reg_t;
 
-/* NEON & FP register */
-typedef union {
+/* NEON & FP register (aligned so that it can be loaded as one host vector) */
+typedef union alignas(16) {
         uint8_t  b[16];
         uint16_t h[8];
         uint32_t s[4];
@@ -28,6 +28,28 @@ struct ARMv8State {
 
         uint32_t nzcv;  // flag register
 
+        /* Last flag setting operation. NZCV is evaluated from it on demand */
+        struct LazyFlag {
+                uint32_t op;
+                uint64_t res, arg1, arg2;
+        } lazy_flag;
+
+        /* Floating point control/status. The host FP environment follows fpcr,
+         * and host exception flags are folded into fpsr when it is read */
+        uint32_t fpcr, fpsr;
+
+        /* Instructions left in the running thread's time slice */
+        int64_t ticks;
+
+        /* Exclusive monitor. Store exclusive is a host compare-and-swap against the
+         * value load exclusive saw, so a write from another core in between fails it */
+        struct Exclusive {
+                bool armed;
+                int size; // log2 of the access size (pairs count as one access)
+                uint64_t addr;
+                uint64_t val[2];
+        } excl;
+
         /* System register */
         struct SysReg {
                 union {
@@ -38,7 +60,10 @@ struct ARMv8State {
         } sysr;
 };
 
-extern ARMv8State arm_state;
+/* One register file per core. arm_state points to the one of the core running
+ * on the calling host thread (threads other than vCPUs see core 0) */
+extern ARMv8State core_state[CPU_NUM_CORES];
+extern thread_local ARMv8State *arm_state;
 
 #define GPR_LR          30
 /* Zero register share the same encoding as SP register.
@@ -52,9 +77,9 @@ extern ARMv8State arm_state;
 #define GPR_DUMMY3        36
 #define VREG_DUMMY        32
 
-#define GPR(r) ARMv8::arm_state.gpr[r]
-#define VREG(r) ARMv8::arm_state.vreg[r] // SIMD registers
-#define SYSR (ARMv8::arm_state.sysr)
+#define GPR(r) ARMv8::arm_state->gpr[r]
+#define VREG(r) ARMv8::arm_state->vreg[r] // SIMD registers
+#define SYSR (ARMv8::arm_state->sysr)
 
 #define X(r) GPR(r).x
 #define W(r) GPR(r).w[0]
@@ -70,19 +95,78 @@ extern ARMv8State arm_state;
 #define ZERO X(GPR_ZERO)
 #define PC X(PC_IDX)
 
-#define NZCV ARMv8::arm_state.nzcv
+#define NZCV ARMv8::arm_state->nzcv
 #define N_MASK          0x80000000UL
 #define Z_MASK          0x40000000UL
 #define C_MASK          0x20000000UL
 #define V_MASK          0x10000000UL
 
+#define FPCR_RMODE_SHIFT        22
+#define FPCR_FZ         (1 << 24)
+#define FPCR_DN         (1 << 25)
+#define FPSR_IOC        (1 << 0)
+#define FPSR_DZC        (1 << 1)
+#define FPSR_OFC        (1 << 2)
+#define FPSR_UFC        (1 << 3)
+#define FPSR_IXC        (1 << 4)
+#define FPSR_IDC        (1 << 7)
+
+/* Operation recorded in lazy_flag */
+enum FlagOp {
+        FLAG_OP_NONE,   // NZCV is up to date
+        FLAG_OP_ADD32,
+        FLAG_OP_ADD64,
+        FLAG_OP_SUB32,
+        FLAG_OP_SUB64,
+};
+
+void EvalFlags();
+
+/* Read NZCV, materializing pending lazy flags */
+inline uint32_t GetNZCV() {
+        if (arm_state->lazy_flag.op != FLAG_OP_NONE)
+                EvalFlags ();
+        return arm_state->nzcv;
+}
+
+inline void SetNZCV(uint32_t nzcv) {
+        arm_state->lazy_flag.op = FLAG_OP_NONE;
+        arm_state->nzcv = nzcv;
+}
+
+/* FPCR writes reprogram host rounding and flush-to-zero */
+void SetFPCR(uint32_t fpcr);
+uint32_t GetFPSR();
+void SetFPSR(uint32_t fpsr);
+
 /* See: C6.1.3 Use of the stack pointer */
 inline unsigned int HandleAsSP(unsigned r_idx) {
         return r_idx == GPR_ZERO ? GPR_SP : r_idx;
 }
 
+/* Execution engine selected at startup */
+enum class EngineType {
+        Interpreter,
+        Threaded, // Interpreter dispatching predecoded ops with computed goto
+        Jit,
+};
+
+extern EngineType engine_type;
+
+/* x86 extensions of the host. The build targets baseline x86-64, so the
+ * engines check these before taking a path that needs more */
+struct HostFeatures {
+        bool ssse3, sse4_2, pclmul, aes, sha;
+        HostFeatures();
+};
+
+extern const HostFeatures host_features;
+
 void Init();
 
+/* Bind the calling host thread to core id and set up its execution engine */
+void InitCore(unsigned int id);
+
 void RunLoop();
 
 void Dump();
@@ -92,4 +176,12 @@ void DumpJson(FILE *fp, bool deep);
 uint64_t GetTls();
 
 }
+
+/* Interface of CPU execution engines (Interpreter, Jit) */
+class CpuEngine {
+public:
+virtual void Init() = 0;
+virtual void Run() = 0;
+virtual int SingleStep() = 0;
+};
 #endif
@@ -0,0 +1,653 @@
+#ifndef _BLOCKCACHE_HPP
+#define _BLOCKCACHE_HPP
+
+/* Predecoded basic blocks.
+ * A block is decoded only once: every callback issued by the decoder is
+ * recorded as a MicroOp, and the run loop replays the recorded ops later. */
+
+#define BLOCK_MAX_INSTS 128
+#define BLOCK_NO_TARGET (~0ULL)
+#define BLOCK_LOOKUP_SIZE 4096 // Direct mapped PC -> block cache (power of 2)
+
+enum MicroOpType {
+        MicroOp_NextInsn = 0, // End of arg[0] guest instructions (PC += 4 * arg[0], reset zero register)
+        MicroOp_MoviI64,
+        MicroOp_DepositI64,
+        MicroOp_DepositReg,
+        MicroOp_DepositZeroI64,
+        MicroOp_DepositZeroReg,
+        MicroOp_MovReg,
+        MicroOp_CondMovReg,
+        MicroOp_AddI64,
+        MicroOp_SubI64,
+        MicroOp_AddReg,
+        MicroOp_SubReg,
+        MicroOp_MulReg,
+        MicroOp_Mul2Reg,
+        MicroOp_DivReg,
+        MicroOp_ShiftReg,
+        MicroOp_AddcReg,
+        MicroOp_SubcReg,
+        MicroOp_AndI64,
+        MicroOp_OrrI64,
+        MicroOp_EorI64,
+        MicroOp_ShiftI64,
+        MicroOp_AndReg,
+        MicroOp_OrrReg,
+        MicroOp_EorReg,
+        MicroOp_BicReg,
+        MicroOp_NotReg,
+        MicroOp_ExtendReg,
+        MicroOp_LoadReg,
+        MicroOp_LoadRegI64,
+        MicroOp_StoreReg,
+        MicroOp_StoreRegI64,
+        MicroOp_LoadStorePair,
+        MicroOp_LoadExclusive,
+        MicroOp_StoreExclusive,
+        MicroOp_ClearExclusive,
+        MicroOp_Barrier,
+        MicroOp_Hint,
+        MicroOp__LoadReg,
+        MicroOp__StoreReg,
+        MicroOp_SExtractI64,
+        MicroOp_UExtractI64,
+        MicroOp_SExt32,
+        MicroOp_RevBit,
+        MicroOp_RevByte16,
+        MicroOp_RevByte32,
+        MicroOp_RevByte64,
+        MicroOp_CntLeadZero,
+        MicroOp_CntLeadSign,
+        MicroOp_Crc32,
+        MicroOp_CondCmpI64,
+        MicroOp_CondCmpReg,
+        MicroOp_BranchI64,
+        MicroOp_BranchCondiI64,
+        MicroOp_BranchFlag,
+        MicroOp_SetPCReg,
+        MicroOp_SVC,
+        MicroOp_BRK,
+        MicroOp_HleCall,
+        MicroOp_ReadWriteSysReg,
+        MicroOp_ReadWriteNZCV,
+        MicroOp_ReadWriteFPCR,
+        MicroOp_ReadWriteFPSR,
+        MicroOp_DcZva,
+        MicroOp_FMovReg,
+        MicroOp_FMovConv,
+        MicroOp_FpArith,
+        MicroOp_FpPairwise,
+        MicroOp_FpMulAdd,
+        MicroOp_FpUnary,
+        MicroOp_FpConvert,
+        MicroOp_FpConvertVec,
+        MicroOp_FpToInt,
+        MicroOp_IntToFp,
+        MicroOp_FpToIntVec,
+        MicroOp_IntToFpVec,
+        MicroOp_FpCompare,
+        MicroOp_FpCondCompare,
+        MicroOp_FpCondSelect,
+        MicroOp_AndVecReg,
+        MicroOp_OrrVecReg,
+        MicroOp_EorVecReg,
+        MicroOp_BicVecReg,
+        MicroOp_NotVecReg,
+        MicroOp_LoadVecReg,
+        MicroOp_StoreVecReg,
+        MicroOp_LoadStoreMulti,
+        MicroOp_LoadFpReg,
+        MicroOp_StoreFpReg,
+        MicroOp_LoadFpRegI64,
+        MicroOp_StoreFpRegI64,
+        MicroOp_ReadVecReg,
+        MicroOp_ReadVecElem,
+        MicroOp_WriteVecElem,
+        MicroOp_DupVecImmI32,
+        MicroOp_DupVecImmI64,
+        MicroOp_DupVecReg,
+        MicroOp_DupVecRegFromGen,
+        MicroOp_CompareEqualVec,
+        MicroOp_CompareTestBitsVec,
+        MicroOp_CompareGreaterVec,
+        MicroOp_AddVec,
+        MicroOp_SubVec,
+        MicroOp_MulVec,
+        MicroOp_MaxVec,
+        MicroOp_MinVec,
+        MicroOp_AddSatVec,
+        MicroOp_SubSatVec,
+        MicroOp_PolyMulLong,
+        MicroOp_CryptoAes,
+        MicroOp_CryptoSha,
+        /* Superinstructions, only built by Optimizer::Fuse */
+        MicroOp_CmpI64Branch,
+        MicroOp_CmpRegBranch,
+        MicroOp_LoadBranchZero,
+        MicroOp_MoviPair,
+        MicroOp_Max,
+};
+
+struct MicroOp {
+        uint16_t type;
+        uint64_t arg[8]; // Callback arguments in declaration order
+};
+
+/* Threaded code: handler address of the op and its recorded arguments */
+struct ThreadedOp {
+        const void *handler;
+        const uint64_t *arg;
+};
+
+class BasicBlock {
+public:
+        uint64_t addr;
+        unsigned int num_insts;
+        std::vector<MicroOp> ops;
+        std::vector<ThreadedOp> threaded; // Built on first run by the threaded interpreter
+        uint64_t target; // Branch target known at translation time
+        BasicBlock *link[2]; // Chained successors (target, fall through)
+        uint64_t link_gen;
+        bool retired;
+        bool idle; // Polling self loop, see Optimizer::IsIdleLoop
+        BasicBlock(uint64_t _addr) : addr(_addr), num_insts(0), target(BLOCK_NO_TARGET),
+                                     link{nullptr, nullptr}, link_gen(0), retired(false), idle(false) {}
+        uint64_t end() { return addr + num_insts * sizeof(uint32_t); }
+};
+
+/* Records decoder callbacks into a BasicBlock */
+class RecordCallback final : public DisasCallback {
+private:
+BasicBlock *block;
+bool block_end;
+
+template<typename... Args> void Emit(MicroOpType type, Args... args) {
+        MicroOp op = { (uint16_t) type, { ((uint64_t) args)... } };
+        block->ops.push_back (op);
+}
+public:
+RecordCallback(BasicBlock *_block) : block(_block), block_end(false) {}
+bool IsBlockEnd() {
+        return block_end;
+}
+void NextInsn() {
+        Emit (MicroOp_NextInsn, 1);
+}
+
+void MoviI64(unsigned int reg_idx, uint64_t imm, bool bit64);
+void DepositI64(unsigned int rd_idx, uint64_t imm, unsigned int pos, unsigned int len, bool bit64);
+void DepositReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64);
+void DepositZeroI64(unsigned int rd_idx, uint64_t imm, unsigned int pos, unsigned int len, bool bit64);
+void DepositZeroReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64);
+void MovReg(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void CondMovReg(unsigned int cond, unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64);
+void AddI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64);
+void SubI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64);
+void AddReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void SubReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void MulReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign, bool dst64, bool src64);
+void Mul2Reg(unsigned int rh_idx, unsigned int rl_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign);
+void DivReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign, bool bit64);
+void ShiftReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, unsigned int shift_type, bool bit64);
+void AddcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void SubcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void AndI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool setflags, bool bit64);
+void OrrI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool bit64);
+void EorI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool bit64);
+void ShiftI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int shift_type, unsigned int shift_amount, bool bit64);
+void AndReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void OrrReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64);
+void EorReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64);
+void BicReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void NotReg(unsigned int rd_idx, unsigned int rm_idx, bool bit64);
+void ExtendReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int extend_type, bool bit64);
+void LoadReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64);
+void LoadRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend);
+void StoreReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64);
+void StoreRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend);
+void LoadStorePair(unsigned int rt_idx, unsigned int rt2_idx, unsigned int ad_idx, int size, bool is_sign, bool is_vector, bool is_load);
+void LoadExclusive(unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair);
+void StoreExclusive(unsigned int rs_idx, unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair);
+void ClearExclusive();
+void Barrier(int type);
+void Hint(int type);
+void _LoadReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend);
+void _StoreReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend);
+void SExtractI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64);
+void UExtractI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64);
+void SExt32(unsigned int rd_idx, unsigned int rn_idx);
+void RevBit(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void RevByte16(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void RevByte32(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void RevByte64(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void CntLeadZero(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void CntLeadSign(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void Crc32(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, int size, bool castagnoli);
+void CondCmpI64(unsigned int rn_idx, unsigned int imm, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64);
+void CondCmpReg(unsigned int rn_idx, unsigned int rm_idx, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64);
+void BranchI64(uint64_t imm);
+void BranchCondiI64(unsigned int cond, unsigned int rt_idx, uint64_t imm, uint64_t addr, bool bit64);
+void BranchFlag(unsigned int cond, uint64_t addr);
+void SetPCReg(unsigned int rt_idx);
+void SVC(unsigned int svc_num);
+void BRK(unsigned int memo);
+void HleCall(unsigned int id);
+void ReadWriteSysReg(unsigned int rd_idx, int offset, bool read);
+void ReadWriteNZCV(unsigned int rd_idx, bool read);
+void ReadWriteFPCR(unsigned int rd_idx, bool read);
+void ReadWriteFPSR(unsigned int rd_idx, bool read);
+void DcZva(unsigned int rt_idx);
+void FMovReg(unsigned int fd_idx, unsigned int fn_idx, int type);
+void FMovConv(unsigned int rd_idx, unsigned int rn_idx, int type, bool itof);
+void FpArith(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op);
+void FpPairwise(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op);
+void FpMulAdd(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, unsigned int va_idx, bool dbl, int elements, bool neg_prod, bool neg_acc);
+void FpUnary(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, int op);
+void FpConvert(unsigned int vd_idx, unsigned int vn_idx, int from_type, int to_type);
+void FpConvertVec(unsigned int vd_idx, unsigned int vn_idx, bool to_dbl, bool is_q);
+void FpToInt(unsigned int rd_idx, unsigned int vn_idx, bool dbl, bool bit64, bool sign, int rounding, int fbits);
+void IntToFp(unsigned int vd_idx, unsigned int rn_idx, bool dbl, bool bit64, bool sign, int fbits);
+void FpToIntVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign, int rounding);
+void IntToFpVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign);
+void FpCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, bool cmp_zero, bool signal);
+void FpCondCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int nzcv, unsigned int cond, bool signal);
+void FpCondSelect(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int cond);
+void AndVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx);
+void OrrVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx);
+void EorVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx);
+void BicVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx);
+void NotVecReg(unsigned int rd_idx, unsigned int rm_idx);
+void LoadVecReg(unsigned int vd_idx, int element, unsigned int rn_idx, int size);
+void StoreVecReg(unsigned int rd_idx, int element, unsigned int vn_idx, int size);
+void LoadStoreMulti(unsigned int vt_idx, unsigned int ad_idx, int size, int rpt, int selem, bool is_q, bool is_load);
+void LoadFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64);
+void StoreFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64);
+void LoadFpRegI64(unsigned int fd_idx, unsigned int ad_idx, int size);
+void StoreFpRegI64(unsigned int fd_idx, unsigned int ad_idx, int size);
+void ReadVecReg(unsigned int fd_idx, unsigned int vn_idx, unsigned int index, int size);
+void ReadVecElem(unsigned int rd_idx, unsigned int vn_idx, unsigned int index, int size);
+void WriteVecElem(unsigned int vd_idx, unsigned int rn_idx, unsigned int index, int size);
+void DupVecImmI32(unsigned int vd_idx, uint32_t imm, int size, int dstsize);
+void DupVecImmI64(unsigned int vd_idx, uint64_t imm, int size, int dstsize);
+void DupVecReg(unsigned int vd_idx, unsigned int vn_idx, unsigned int index, int size, int dstsize);
+void DupVecRegFromGen(unsigned int vd_idx, unsigned int rn_idx, int size, int dstsize);
+void CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void CompareGreaterVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign, bool equal);
+void AddVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void SubVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void MulVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void MaxVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void MinVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void AddSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void SubSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void PolyMulLong(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool upper);
+void CryptoAes(unsigned int vd_idx, unsigned int vn_idx, int op);
+void CryptoSha(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int op);
+};
+
+/* Replay a recorded op through another callback (MicroOp_NextInsn is left to the caller) */
+template<typename CB> inline void ReplayMicroOp(CB *cb, const MicroOp &op) {
+        const uint64_t *a = op.arg;
+        switch (op.type) {
+        case MicroOp_MoviI64:
+                cb->MoviI64 (a[0], a[1], a[2]);
+                break;
+        case MicroOp_DepositI64:
+                cb->DepositI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_DepositReg:
+                cb->DepositReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_DepositZeroI64:
+                cb->DepositZeroI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_DepositZeroReg:
+                cb->DepositZeroReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_MovReg:
+                cb->MovReg (a[0], a[1], a[2]);
+                break;
+        case MicroOp_CondMovReg:
+                cb->CondMovReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_AddI64:
+                cb->AddI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_SubI64:
+                cb->SubI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_AddReg:
+                cb->AddReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_SubReg:
+                cb->SubReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_MulReg:
+                cb->MulReg (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_Mul2Reg:
+                cb->Mul2Reg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_DivReg:
+                cb->DivReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_ShiftReg:
+                cb->ShiftReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_AddcReg:
+                cb->AddcReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_SubcReg:
+                cb->SubcReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_AndI64:
+                cb->AndI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_OrrI64:
+                cb->OrrI64 (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_EorI64:
+                cb->EorI64 (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_ShiftI64:
+                cb->ShiftI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_AndReg:
+                cb->AndReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_OrrReg:
+                cb->OrrReg (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_EorReg:
+                cb->EorReg (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_BicReg:
+                cb->BicReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_NotReg:
+                cb->NotReg (a[0], a[1], a[2]);
+                break;
+        case MicroOp_ExtendReg:
+                cb->ExtendReg (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_LoadReg:
+                cb->LoadReg (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+                break;
+        case MicroOp_LoadRegI64:
+                cb->LoadRegI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_StoreReg:
+                cb->StoreReg (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+                break;
+        case MicroOp_StoreRegI64:
+                cb->StoreRegI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_LoadStorePair:
+                cb->LoadStorePair (a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+                break;
+        case MicroOp_LoadExclusive:
+                cb->LoadExclusive (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_StoreExclusive:
+                cb->StoreExclusive (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_ClearExclusive:
+                cb->ClearExclusive ();
+                break;
+        case MicroOp_Barrier:
+                cb->Barrier (a[0]);
+                break;
+        case MicroOp_Hint:
+                cb->Hint (a[0]);
+                break;
+        case MicroOp__LoadReg:
+                cb->_LoadReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp__StoreReg:
+                cb->_StoreReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_SExtractI64:
+                cb->SExtractI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_UExtractI64:
+                cb->UExtractI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_SExt32:
+                cb->SExt32 (a[0], a[1]);
+                break;
+        case MicroOp_RevBit:
+                cb->RevBit (a[0], a[1], a[2]);
+                break;
+        case MicroOp_RevByte16:
+                cb->RevByte16 (a[0], a[1], a[2]);
+                break;
+        case MicroOp_RevByte32:
+                cb->RevByte32 (a[0], a[1], a[2]);
+                break;
+        case MicroOp_RevByte64:
+                cb->RevByte64 (a[0], a[1], a[2]);
+                break;
+        case MicroOp_CntLeadZero:
+                cb->CntLeadZero (a[0], a[1], a[2]);
+                break;
+        case MicroOp_CntLeadSign:
+                cb->CntLeadSign (a[0], a[1], a[2]);
+                break;
+        case MicroOp_Crc32:
+                cb->Crc32 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_CondCmpI64:
+                cb->CondCmpI64 (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_CondCmpReg:
+                cb->CondCmpReg (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_BranchI64:
+                cb->BranchI64 (a[0]);
+                break;
+        case MicroOp_BranchCondiI64:
+                cb->BranchCondiI64 (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_BranchFlag:
+                cb->BranchFlag (a[0], a[1]);
+                break;
+        case MicroOp_SetPCReg:
+                cb->SetPCReg (a[0]);
+                break;
+        case MicroOp_SVC:
+                cb->SVC (a[0]);
+                break;
+        case MicroOp_BRK:
+                cb->BRK (a[0]);
+                break;
+        case MicroOp_HleCall:
+                cb->HleCall (a[0]);
+                break;
+        case MicroOp_ReadWriteSysReg:
+                cb->ReadWriteSysReg (a[0], a[1], a[2]);
+                break;
+        case MicroOp_ReadWriteNZCV:
+                cb->ReadWriteNZCV (a[0], a[1]);
+                break;
+        case MicroOp_ReadWriteFPCR:
+                cb->ReadWriteFPCR (a[0], a[1]);
+                break;
+        case MicroOp_ReadWriteFPSR:
+                cb->ReadWriteFPSR (a[0], a[1]);
+                break;
+        case MicroOp_DcZva:
+                cb->DcZva (a[0]);
+                break;
+        case MicroOp_FMovReg:
+                cb->FMovReg (a[0], a[1], a[2]);
+                break;
+        case MicroOp_FMovConv:
+                cb->FMovConv (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_FpArith:
+                cb->FpArith (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_FpPairwise:
+                cb->FpPairwise (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_FpMulAdd:
+                cb->FpMulAdd (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+                break;
+        case MicroOp_FpUnary:
+                cb->FpUnary (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_FpConvert:
+                cb->FpConvert (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_FpConvertVec:
+                cb->FpConvertVec (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_FpToInt:
+                cb->FpToInt (a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+                break;
+        case MicroOp_IntToFp:
+                cb->IntToFp (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_FpToIntVec:
+                cb->FpToIntVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_IntToFpVec:
+                cb->IntToFpVec (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_FpCompare:
+                cb->FpCompare (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_FpCondCompare:
+                cb->FpCondCompare (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_FpCondSelect:
+                cb->FpCondSelect (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_AndVecReg:
+                cb->AndVecReg (a[0], a[1], a[2]);
+                break;
+        case MicroOp_OrrVecReg:
+                cb->OrrVecReg (a[0], a[1], a[2]);
+                break;
+        case MicroOp_EorVecReg:
+                cb->EorVecReg (a[0], a[1], a[2]);
+                break;
+        case MicroOp_BicVecReg:
+                cb->BicVecReg (a[0], a[1], a[2]);
+                break;
+        case MicroOp_NotVecReg:
+                cb->NotVecReg (a[0], a[1]);
+                break;
+        case MicroOp_LoadVecReg:
+                cb->LoadVecReg (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_StoreVecReg:
+                cb->StoreVecReg (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_LoadStoreMulti:
+                cb->LoadStoreMulti (a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+                break;
+        case MicroOp_LoadFpReg:
+                cb->LoadFpReg (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_StoreFpReg:
+                cb->StoreFpReg (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_LoadFpRegI64:
+                cb->LoadFpRegI64 (a[0], a[1], a[2]);
+                break;
+        case MicroOp_StoreFpRegI64:
+                cb->StoreFpRegI64 (a[0], a[1], a[2]);
+                break;
+        case MicroOp_ReadVecReg:
+                cb->ReadVecReg (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_ReadVecElem:
+                cb->ReadVecElem (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_WriteVecElem:
+                cb->WriteVecElem (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_DupVecImmI32:
+                cb->DupVecImmI32 (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_DupVecImmI64:
+                cb->DupVecImmI64 (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_DupVecReg:
+                cb->DupVecReg (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_DupVecRegFromGen:
+                cb->DupVecRegFromGen (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_CompareEqualVec:
+                cb->CompareEqualVec (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_CompareTestBitsVec:
+                cb->CompareTestBitsVec (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_CompareGreaterVec:
+                cb->CompareGreaterVec (a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+                break;
+        case MicroOp_AddVec:
+                cb->AddVec (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_SubVec:
+                cb->SubVec (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_MulVec:
+                cb->MulVec (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_MaxVec:
+                cb->MaxVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_MinVec:
+                cb->MinVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_AddSatVec:
+                cb->AddSatVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_SubSatVec:
+                cb->SubSatVec (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        case MicroOp_PolyMulLong:
+                cb->PolyMulLong (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_CryptoAes:
+                cb->CryptoAes (a[0], a[1], a[2]);
+                break;
+        case MicroOp_CryptoSha:
+                cb->CryptoSha (a[0], a[1], a[2], a[3]);
+                break;
+        case MicroOp_CmpI64Branch:
+                cb->CmpI64Branch (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_CmpRegBranch:
+                cb->CmpRegBranch (a[0], a[1], a[2], a[3], a[4]);
+                break;
+        case MicroOp_LoadBranchZero:
+                cb->LoadBranchZero (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+                break;
+        case MicroOp_MoviPair:
+                cb->MoviPair (a[0], a[1], a[2], a[3], a[4], a[5]);
+                break;
+        default:
+                ns_abort ("Unknown micro op %u\n", op.type);
+        }
+}
+
+namespace BlockCache {
+
+BasicBlock *Lookup(uint64_t addr);
+/* Successor of block starting at addr (follows chained links) */
+BasicBlock *Next(BasicBlock *block, uint64_t addr);
+void Invalidate(uint64_t addr, uint64_t len);
+void Flush();
+/* Incremented whenever cached blocks are dropped */
+uint64_t Generation();
+
+}
+
+#endif
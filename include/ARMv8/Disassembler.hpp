@@ -53,6 +53,20 @@ virtual void LoadReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm
 virtual void LoadRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend) = 0;
 virtual void StoreReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64) = 0;
 virtual void StoreRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend) = 0;
+/* LDP/STP: both registers in one access of 2 << size bytes at [Xad] */
+virtual void LoadStorePair(unsigned int rt_idx, unsigned int rt2_idx, unsigned int ad_idx, int size, bool is_sign, bool is_vector, bool is_load) = 0;
+
+/* Exclusive Load/Store. The store writes 0 to Rs on success, 1 on failure */
+virtual void LoadExclusive(unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair) = 0;
+virtual void StoreExclusive(unsigned int rs_idx, unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair) = 0;
+virtual void ClearExclusive() = 0;
+
+/* Memory barrier. type is a Disassembler::BarrierType */
+virtual void Barrier(int type) = 0;
+
+/* WFE, WFI, YIELD, SEV, SEVL. type is a Disassembler::HintType */
+virtual void Hint(int type) = 0;
+
 virtual void _LoadReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend) = 0;
 virtual void _StoreReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend) = 0;
 
@@ -75,6 +89,8 @@ virtual void RevByte64(unsigned int rd_idx, unsigned int rn_idx, bool bit64) = 0
 virtual void CntLeadZero(unsigned int rd_idx, unsigned int rn_idx, bool bit64) = 0;
 /* Count Leading Signed bits */
 virtual void CntLeadSign(unsigned int rd_idx, unsigned int rn_idx, bool bit64) = 0;
+/* CRC32 (IEEE) or CRC32C (Castagnoli) of the low 8 << size bits of Rm into Wn */
+virtual void Crc32(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, int size, bool castagnoli) = 0;
 
 /* Conditional compare... with Immediate value */
 virtual void CondCmpI64(unsigned int rn_idx, unsigned int imm, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64) = 0;
@@ -98,17 +114,47 @@ virtual void SetPCReg(unsigned int rt_idx) = 0;
 virtual void SVC(unsigned int svc_num) = 0;
 /* Breakpoint exception */
 virtual void BRK(unsigned int memo) = 0;
+/* Host implementation of a hooked guest function (HLE) */
+virtual void HleCall(unsigned int id) = 0;
 
 /* Read/Write Sysreg */
 virtual void ReadWriteSysReg(unsigned int rd_idx, int offset, bool read) = 0;
 /* Read/Write NZCV */
 virtual void ReadWriteNZCV(unsigned int rd_idx, bool read) = 0;
+/* Read/Write FPCR and FPSR */
+virtual void ReadWriteFPCR(unsigned int rd_idx, bool read) = 0;
+virtual void ReadWriteFPSR(unsigned int rd_idx, bool read) = 0;
+
+/* DC ZVA: zero the DCZID_EL0 sized block containing Xt */
+virtual void DcZva(unsigned int rt_idx) = 0;
 
 /* Fp Mov between registers */
 virtual void FMovReg(unsigned int fd_idx, unsigned int fn_idx, int type) = 0;
 /* Fp Mov between registers (float <-> int)*/
 virtual void FMovConv(unsigned int rd_idx, unsigned int rn_idx, int type, bool itof) = 0;
 
+/* Fp ops on the low elements (single or double) of vector registers, the rest of Vd is cleared.
+ * Scalar instructions are the one element case. op is a Disassembler::FpOpType */
+virtual void FpArith(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) = 0;
+virtual void FpPairwise(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op) = 0;
+virtual void FpMulAdd(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, unsigned int va_idx, bool dbl, int elements, bool neg_prod, bool neg_acc) = 0;
+virtual void FpUnary(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, int op) = 0;
+
+/* Fp precision conversion (type: 0 single, 1 double, 3 half) */
+virtual void FpConvert(unsigned int vd_idx, unsigned int vn_idx, int from_type, int to_type) = 0;
+virtual void FpConvertVec(unsigned int vd_idx, unsigned int vn_idx, bool to_dbl, bool is_q) = 0;
+
+/* Fp <-> (fixed point) integer conversion. rounding is a Disassembler::FpRounding */
+virtual void FpToInt(unsigned int rd_idx, unsigned int vn_idx, bool dbl, bool bit64, bool sign, int rounding, int fbits) = 0;
+virtual void IntToFp(unsigned int vd_idx, unsigned int rn_idx, bool dbl, bool bit64, bool sign, int fbits) = 0;
+virtual void FpToIntVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign, int rounding) = 0;
+virtual void IntToFpVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign) = 0;
+
+/* Fp compare into NZCV and conditional select */
+virtual void FpCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, bool cmp_zero, bool signal) = 0;
+virtual void FpCondCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int nzcv, unsigned int cond, bool signal) = 0;
+virtual void FpCondSelect(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int cond) = 0;
+
 /* #######  Vector ####### */
 
 /* AND/OR/EOR/BIC/NOT ... between vector registers */
@@ -121,6 +167,8 @@ virtual void NotVecReg(unsigned int rd_idx, unsigned int rm_idx) = 0;
 /* Load/Store for vector */
 virtual void LoadVecReg(unsigned int vd_idx, int element, unsigned int rn_idx, int size) = 0;
 virtual void StoreVecReg(unsigned int rd_idx, int element, unsigned int vn_idx, int size) = 0;
+/* LD1-LD4/ST1-ST4: rpt * selem registers from Vt on, structures of selem elements (de)interleaved, in one access at [Xad] */
+virtual void LoadStoreMulti(unsigned int vt_idx, unsigned int ad_idx, int size, int rpt, int selem, bool is_q, bool is_load) = 0;
 
 /* Load/Store for FP */
 virtual void LoadFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64) = 0;
@@ -148,10 +196,34 @@ virtual void DupVecReg(unsigned int vd_idx, unsigned int vn_idx, unsigned int in
 virtual void DupVecRegFromGen(unsigned int vd_idx, unsigned int rn_idx, int size, int dstsize) = 0;
 
 /* Compare Bit wise equal */
-virtual void CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int index, int size) = 0;
+virtual void CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) = 0;
 
 /* Compare Bit wise test bits nonzero */
-virtual void CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int index, int size) = 0;
+virtual void CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) = 0;
+
+/* Compare greater than (or equal), signed or unsigned */
+virtual void CompareGreaterVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign, bool equal) = 0;
+
+/* Element wise arithmetic between vector registers */
+virtual void AddVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) = 0;
+virtual void SubVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) = 0;
+virtual void MulVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q) = 0;
+virtual void MaxVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) = 0;
+virtual void MinVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) = 0;
+
+/* Saturating add/sub (QC is not tracked) */
+virtual void AddSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) = 0;
+virtual void SubSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign) = 0;
+
+/* Polynomial multiply long of 8bit (size 0) or 64bit (size 3) lanes. upper takes the sources' upper halves (PMULL2) */
+virtual void PolyMulLong(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool upper) = 0;
+
+/* #######  Crypto ####### */
+
+/* AES round steps. op is a Disassembler::AesOpType */
+virtual void CryptoAes(unsigned int vd_idx, unsigned int vn_idx, int op) = 0;
+/* SHA1/SHA256 hash updates and message schedule. op is a Disassembler::ShaOpType, two register ops ignore vm_idx */
+virtual void CryptoSha(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int op) = 0;
 
 };
 
@@ -165,6 +237,90 @@ enum ShiftType {
         ShiftType_ROR
 };
 
+/* Floating point ops of FpArith, FpPairwise and FpUnary */
+enum FpOpType {
+        FpOp_ADD = 0,
+        FpOp_SUB,
+        FpOp_MUL,
+        FpOp_DIV,
+        FpOp_MAX,
+        FpOp_MIN,
+        FpOp_MAXNM,
+        FpOp_MINNM,
+        FpOp_NMUL,
+        FpOp_ABD,
+        FpOp_MULX,
+        FpOp_RECPS,
+        FpOp_RSQRTS,
+        FpOp_CMEQ,
+        FpOp_CMGE,
+        FpOp_CMGT,
+        FpOp_ACGE,
+        FpOp_ACGT,
+        /* Unary */
+        FpOp_ABS,
+        FpOp_NEG,
+        FpOp_SQRT,
+        FpOp_RECPE,
+        FpOp_RSQRTE,
+        FpOp_RINTN,
+        FpOp_RINTP,
+        FpOp_RINTM,
+        FpOp_RINTZ,
+        FpOp_RINTA,
+        FpOp_RINTX,
+        FpOp_RINTI
+};
+
+/* Rounding of Fp -> integer conversions (FPRounding order). FPCR uses the current mode */
+enum FpRounding {
+        FpRounding_TIEEVEN = 0,
+        FpRounding_POSINF,
+        FpRounding_NEGINF,
+        FpRounding_ZERO,
+        FpRounding_TIEAWAY,
+        FpRounding_FPCR
+};
+
+/* Ordering enforced by Barrier */
+enum BarrierType {
+        Barrier_ACQUIRE = 0, // Later accesses stay after earlier loads (LDAR, LDAXR, DMB LD)
+        Barrier_RELEASE, // Earlier accesses stay before later stores (STLR, STLXR, DMB ST)
+        Barrier_FULL // Earlier stores are also visible before later loads (DMB, DSB)
+};
+
+/* Selectors of HINT handled by Hint */
+enum HintType {
+        Hint_YIELD = 1,
+        Hint_WFE,
+        Hint_WFI,
+        Hint_SEV,
+        Hint_SEVL
+};
+
+/* Ops of CryptoAes */
+enum AesOpType {
+        AesOp_AESE = 0, // AddRoundKey, SubBytes, ShiftRows
+        AesOp_AESD, // AddRoundKey, InvSubBytes, InvShiftRows
+        AesOp_AESMC, // MixColumns
+        AesOp_AESIMC // InvMixColumns
+};
+
+/* Ops of CryptoSha. Three register ops come in opcode order */
+enum ShaOpType {
+        ShaOp_SHA1C = 0,
+        ShaOp_SHA1P,
+        ShaOp_SHA1M,
+        ShaOp_SHA1SU0,
+        ShaOp_SHA256H,
+        ShaOp_SHA256H2,
+        ShaOp_SHA256SU1,
+        /* Two registers */
+        ShaOp_SHA1H,
+        ShaOp_SHA1SU1,
+        ShaOp_SHA256SU0
+};
+
 enum ExtendType {
         ExtendType_UXTB = 0,
         ExtendType_UXTH,
@@ -230,7 +386,9 @@ enum CondType {
 #define ARM_CP_NZCV              (ARM_CP_SPECIAL | 0x0300)
 #define ARM_CP_CURRENTEL         (ARM_CP_SPECIAL | 0x0400)
 #define ARM_CP_DC_ZVA            (ARM_CP_SPECIAL | 0x0500)
-#define ARM_LAST_SPECIAL         ARM_CP_DC_ZVA
+#define ARM_CP_FPCR              (ARM_CP_SPECIAL | 0x0600)
+#define ARM_CP_FPSR              (ARM_CP_SPECIAL | 0x0700)
+#define ARM_LAST_SPECIAL         ARM_CP_FPSR
 #define ARM_CP_FPU               0x1000
 #define ARM_CP_SVE               0x2000
 #define ARM_CP_SENTINEL          0xffff
@@ -268,8 +426,6 @@ enum {
         ((crm) << CP_REG_ARM64_SYSREG_CRM_SHIFT) |         \
         ((op2) << CP_REG_ARM64_SYSREG_OP2_SHIFT))
 
-typedef void A64DecodeFn(uint32_t insn, DisasCallback *cb);
-
 class A64SysRegInfo {
 public:
         std::string name;
@@ -287,18 +443,22 @@ public:
                         uint8_t _crn, uint8_t _crm, int _o) : name(_name), state(_state), cp(_cp), crn(_crn),
                         crm(_crm), opc0(_opc0), opc1(_opc1), opc2(_opc2), offset(_o) {}
         A64SysRegInfo (std::string _name, int _state, uint8_t _opc0, uint8_t _opc1, uint8_t _opc2,
-                        uint8_t _crn, uint8_t _crm, int _o) : name(_name), state(_state),
-                        opc0(_opc0), opc1(_opc1), opc2(_opc2), crn(_crn), crm(_crm), offset(_o) {}
+                        uint8_t _crn, uint8_t _crm, int _o, int _type = 0) : name(_name), state(_state),
+                        opc0(_opc0), opc1(_opc1), opc2(_opc2), crn(_crn), crm(_crm), type(_type), offset(_o) {}
         A64SysRegInfo (int _type) : type(_type) {}
 };
 
-typedef struct AArch64DecodeTable {
-        uint32_t pattern;
-        uint32_t mask;
-        A64DecodeFn *disas_fn;
-} A64DecodeTable;
+const A64SysRegInfo* GetSysReg(uint32_t encoded_op);
+
+/* If set, decoding failure longjmps here instead of aborting (used by block predecoder) */
+extern thread_local jmp_buf *decode_fail;
+
+/* Instantiated for DisasCallback (virtual), IntprCallback and RecordCallback */
+template<typename CB> void DisasA64(uint32_t insn, CB *cb);
 
-void DisasA64(uint32_t insn, DisasCallback *cb);
+/* Decode-only benchmark (--bench-decode) */
+extern bool benchmark;
+void Benchmark(uint64_t addr, uint64_t size);
 
 void Init();
 };
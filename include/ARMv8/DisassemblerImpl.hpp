@@ -0,0 +1,3044 @@
+/* nsemu - LGPL - Copyright 2018 rkx1209<rkx1209dev@gmail.com> */
+#ifndef _DISASSEMBLER_IMPL_HPP
+#define _DISASSEMBLER_IMPL_HPP
+
+/*
+ * A64 decoder templated over the callback type. DisasA64<CB> is instantiated
+ * where CB's methods are defined, so they are called directly (and inlined)
+ * instead of through DisasCallback's vtable.
+ */
+namespace Disassembler {
+
+static inline void DecodeFail() {
+        if (decode_fail)
+                longjmp (*decode_fail, 1);
+}
+
+static inline void UnsupportedOp (const char *op) {
+        DecodeFail ();
+        ns_abort ("[TODO] Unsupported op %s (Disas fail)\n", op);
+}
+
+#define UnallocatedOp(insn) do { \
+        DecodeFail (); \
+        ns_abort ("Unallocated operation 0x%08lx\n", insn); \
+} while (0)
+
+static inline bool FpAccessCheck(uint32_t insn) {
+        /* TODO: */
+        return true;
+}
+
+static bool LogicImmDecode(uint64_t *wmask, unsigned int immn, unsigned int imms, unsigned int immr) {
+	assert (immn < 2 && imms < 64 && immr < 64);
+        uint64_t mask;
+        unsigned int e, levels, s, r;
+        int len = 31 - clz32((immn << 6 | (~imms & 0x3f)));
+        if (len < 1) {
+                /* This is the immn == 0, imms == 0x11111x case */
+                return false;
+        }
+        e = 1 << len;
+
+        levels = e - 1;
+        s = imms & levels;
+        r = immr & levels;
+
+        if (s == levels) {
+                /* <length of run - 1> mustn't be all-ones. */
+                return false;
+        }
+
+        /* Create the value of one element: s+1 set bits rotated
+         * by r within the element (which is e bits wide)...
+         */
+        mask = bitmask64(s + 1);
+        if (r) {
+                mask = (mask >> r) | (mask << (e - r));
+                mask &= bitmask64(e);
+        }
+        mask = replicate64 (mask, e);
+        *wmask = mask;
+        return true;
+}
+
+template<typename CB>
+static void DisasPCRelAddr(uint32_t insn, CB *cb) {
+	unsigned int rd, page;
+	uint64_t offset;
+
+	page = extract32 (insn, 31, 1);
+	offset = sextract64 (insn, 5, 19);
+	offset = offset << 2 | extract32 (insn, 29, 2);
+	rd = extract32 (insn, 0, 5);
+        /* PC is known at decode time */
+        uint64_t base = PC;
+	if (page) {
+                base &= ~0xfffULL;
+		offset <<= 12;
+	}
+        cb->MoviI64 (rd, base + offset, true);
+}
+
+template<typename CB>
+static void DisasAddSubImm(uint32_t insn, CB *cb) {
+	unsigned int rd = extract32 (insn, 0, 5);
+	unsigned int rn = extract32 (insn, 5, 5);
+	uint64_t imm = extract32 (insn, 10, 12);
+	unsigned int shift = extract32 (insn, 22, 2);
+	bool setflags = extract32 (insn, 29, 1);
+	bool sub_op = extract32 (insn, 30, 1);
+	bool is_64bit = extract32 (insn, 31, 1);
+
+	switch (shift) {
+	case 0x0:
+		break;
+	case 0x1:
+		imm <<= 12;
+		break;
+	default:
+		UnallocatedOp (insn);
+		return;
+	}
+
+	if (sub_op) {
+		cb->SubI64 (rd, rn, imm, setflags, is_64bit);
+	} else {
+		cb->AddI64 (rd, rn, imm, setflags, is_64bit);
+	}
+}
+
+template<typename CB>
+static void DisasLogImm(uint32_t insn, CB *cb) {
+	unsigned long is_64bit = extract32 (insn, 31, 1);
+	unsigned long opc = extract32 (insn, 29, 2);
+	unsigned long is_n = extract32 (insn, 22, 1);
+	unsigned long immr = extract32 (insn, 16, 6);
+	unsigned long imms = extract32 (insn, 10, 6);
+	unsigned int rn = extract32 (insn, 5, 5);
+	unsigned int rd = extract32 (insn, 0, 5);
+	uint64_t wmask;
+
+	if (!LogicImmDecode (&wmask, is_n, imms, immr)) {
+		UnallocatedOp (insn);
+		return;
+	}
+        if (!is_64bit) {
+                wmask &= 0xffffffff;
+        }
+	switch (opc) {
+	case 0x3:	/* ANDS */
+		cb->AndI64 (rd, rn, wmask, true, is_64bit);
+		break;
+	case 0x0:	/* AND */
+		cb->AndI64 (rd, rn, wmask, false, is_64bit);
+		break;
+	case 0x1:	/* ORR */
+		cb->OrrI64 (rd, rn, wmask, is_64bit);
+		break;
+	case 0x2:	/* EOR */
+		cb->EorI64 (rd, rn, wmask, is_64bit);
+		break;
+	default:
+		ns_abort ("Invalid Logical opcode: %u\n", opc);
+	}
+}
+
+template<typename CB>
+static void DisasMovwImm(uint32_t insn, CB *cb) {
+        unsigned int is_64bit = extract32(insn, 31, 1);
+        unsigned int opc = extract32(insn, 29, 2);
+        uint64_t imm = extract32(insn, 5, 16);
+        unsigned int pos = extract32(insn, 21, 2) << 4;
+        unsigned int rd = extract32(insn, 0, 5);
+
+        if (!is_64bit && (pos >= 32)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        switch (opc) {
+        case 0: /* MOVN */
+        case 2: /* MOVZ */
+                imm <<= pos;
+                if (opc == 0) {
+                        imm = ~imm;
+                }
+                if (!is_64bit) {
+                        imm &= 0xffffffffu;
+                }
+                cb->MoviI64 (rd, imm, is_64bit);
+                break;
+        case 3: /* MOVK */
+                cb->DepositI64 (rd, imm, pos, 16, is_64bit);
+                break;
+        default:
+            UnallocatedOp (insn);
+            break;
+        }
+}
+
+template<typename CB>
+static void DisasBitfield(uint32_t insn, CB *cb) {
+        unsigned int is_64bit = extract32(insn, 31, 1);
+        unsigned int opc = extract32(insn, 29, 2);
+        unsigned int n = extract32(insn, 22, 1);
+        unsigned int ri = extract32(insn, 16, 6);
+        unsigned int si = extract32(insn, 10, 6);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int bitsize = is_64bit ? 64 : 32;
+        unsigned int pos, len;
+        if (is_64bit != n || ri >= bitsize || si >= bitsize || opc > 2) {
+                UnallocatedOp(insn);
+                return;
+        }
+
+        /* Recognize simple(r) extractions.  */
+        cb->MovReg (GPR_DUMMY, rn, true);
+        if (si >= ri) {
+                /* Xd<0:r> = Xn<(s-r+1):s> */
+                len = (si - ri) + 1;
+                if (opc == 0) { /* SBFM: ASR, SBFX, SXTB, SXTH, SXTW */
+                        cb->SExtractI64(rd, GPR_DUMMY, ri, len, is_64bit);
+                        return;
+                } else if (opc == 2) { /* UBFM: UBFX, LSR, UXTB, UXTH */
+                        cb->UExtractI64(rd, GPR_DUMMY, ri, len, is_64bit);
+                        return;
+                }
+                /* opc == 1, BXFIL fall through to deposit */
+                cb->UExtractI64(GPR_DUMMY, GPR_DUMMY, ri, len, is_64bit);
+                pos = 0;
+        } else {
+                /* Handle the ri > si case with a deposit
+                 * Xd<64-r:64-r+s> = Xn<0:s>
+                 */
+                len = si + 1;
+                pos = (bitsize - ri) & (bitsize - 1);
+         }
+
+         if (opc == 0 && len < ri) {
+                /* SBFM: sign extend the destination field from len to fill
+                   the balance of the word.  Let the deposit below insert all
+                   of those sign bits.  */
+                cb->SExtractI64(GPR_DUMMY, GPR_DUMMY, 0, len, is_64bit);
+                len = ri;
+         }
+
+         if (opc == 1) { /* BFM, BXFIL */
+                cb->DepositReg (rd, GPR_DUMMY, pos, len, is_64bit);
+         } else {
+                /* SBFM or UBFM: We start with zero, and we haven't modified
+                   any bits outside bitsize, therefore the zero-extension
+                   below is unneeded.  */
+                cb->DepositZeroReg (rd, GPR_DUMMY, pos, len, is_64bit);
+         }
+         return;
+}
+
+template<typename CB>
+static void DisasExtract(uint32_t insn, CB *cb) {
+        unsigned int sf = extract32(insn, 31, 1);
+        unsigned int n = extract32(insn, 22, 1);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int imm = extract32(insn, 10, 6);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int op21 = extract32(insn, 29, 2);
+        unsigned int op0 = extract32(insn, 21, 1);
+        unsigned int bitsize = sf ? 64 : 32;
+
+        if (sf != n || op21 || op0 || imm >= bitsize) {
+                UnallocatedOp (insn);
+        } else {
+               if (imm == 0) {
+                       cb->MovReg(rd, rm, sf);
+               } else if (rm == rn) { /* ROR */
+                       cb->ShiftI64 (rd, rm, ShiftType_ROR, imm, sf);
+               } else {
+                       cb->ShiftI64 (rm, rm, ShiftType_LSR, imm, sf);
+                       cb->ShiftI64 (rn, rn, ShiftType_LSR, imm, sf);
+                       cb->OrrReg(rd, rm, rn, sf);
+               }
+       }
+       return;
+}
+
+template<typename CB>
+static void DisasUncondBrImm(uint32_t insn, CB *cb) {
+        uint64_t addr = PC + sextract32(insn, 0, 26) * 4 - 4;
+        if (insn & (1U << 31)) {
+                /* BL Branch with link */
+                cb->AddI64(GPR_LR, PC_IDX, 4, false, true);
+        }
+
+        /* B Branch / BL Branch with link */
+        cb->BranchI64(addr);
+}
+
+template<typename CB>
+static void DisasCompBrImm(uint32_t insn, CB *cb) {
+        unsigned int sf = extract32(insn, 31, 1);
+        unsigned int op = extract32(insn, 24, 1); /* 0: CBZ; 1: CBNZ */
+        unsigned int rt = extract32(insn, 0, 5);
+        uint64_t addr = PC + sextract32(insn, 5, 19) * 4 - 4;
+        cb->BranchCondiI64 (op ? CondType_NE : CondType_EQ, rt, 0, addr, sf);
+}
+
+template<typename CB>
+static void DisasTestBrImm(uint32_t insn, CB *cb) {
+        unsigned int bit_pos = (extract32(insn, 31, 1) << 5) | extract32(insn, 19, 5);
+        unsigned int op = extract32(insn, 24, 1); /* 0: TBZ; 1: TBNZ */
+        uint64_t addr = PC + sextract32(insn, 5, 14) * 4 - 4;
+        uint64_t rt = extract32(insn, 0, 5);
+        /* XXX: Dummy register is used as temporaly register. */
+        cb->AndI64(GPR_DUMMY, rt, (1ULL << bit_pos), false, true);
+        cb->BranchCondiI64 (op ? CondType_NE : CondType_EQ, GPR_DUMMY, 0, addr, true);
+}
+
+template<typename CB>
+static void DisasCondBrImm(uint32_t insn, CB *cb) {
+        if ((insn & (1 << 4)) || (insn & (1 << 24))) {
+                UnallocatedOp (insn);
+                return;
+        }
+        unsigned int cond = extract32(insn, 0, 4);
+        uint64_t addr = PC + sextract32(insn, 5, 19) * 4 - 4;
+        if (cond < 0xe) {
+                cb->BranchFlag (cond, addr);
+        } else {
+                /* Always: */
+                cb->BranchI64 (addr);
+        }
+}
+
+template<typename CB>
+static void DisasUncondBrReg(uint32_t insn, CB *cb) {
+        unsigned int opc = extract32(insn, 21, 4);
+        unsigned int op2 = extract32(insn, 16, 5);
+        unsigned int op3 = extract32(insn, 10, 6);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int op4 = extract32(insn, 0, 5);
+
+        if (op4 != 0x0 || op3 != 0x0 || op2 != 0x1f) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        switch (opc) {
+        case 1: /* BLR */
+                cb->AddI64(GPR_LR, PC_IDX, 4, false, true);
+        case 0: /* BR */
+        case 2: /* RET */
+                cb->SetPCReg (rn);
+                break;
+        case 4: /* ERET */
+                //TODO:
+                UnsupportedOp ("ERET");
+                break;
+        case 5: /* DRPS */
+                //TODO:
+                UnsupportedOp ("DRPS");
+                break;
+        default:
+                UnallocatedOp (insn);
+                break;
+        }
+}
+
+template<typename CB>
+static void DisasException(uint32_t insn, CB *cb) {
+        unsigned int opc = extract32(insn, 21, 3);
+        unsigned int op2_ll = extract32(insn, 0, 5);
+        unsigned int imm16 = extract32(insn, 5, 16);
+        switch (opc) {
+        case 0:
+                switch (op2_ll) {
+                case 1: /* SVC */
+                        cb->SVC (imm16);
+                        break;
+                case 2: /* HVC */
+                        //TODO:
+                        UnsupportedOp ("HVC");
+                        break;
+                case 3: /* SMC */
+                        //TODO:
+                        UnsupportedOp ("SMC");
+                        break;
+                default:
+                        UnallocatedOp (insn);
+                        break;
+                }
+                break;
+        case 1: /* BRK */
+                cb->BRK(imm16);
+                break;
+        case 2: /* HLT */
+                UnsupportedOp ("HLT");
+                //TODO:
+                break;
+        case 5: /* DCPS1,2,3 */
+                //TODO:
+                UnsupportedOp ("DCPS");
+                break;
+        default:
+                UnallocatedOp (insn);
+                break;
+
+        }
+}
+
+template<typename CB>
+static void DisasHint(uint32_t insn, unsigned int op1, unsigned int op2, unsigned int crm, CB *cb) {
+        unsigned int selector = crm << 3 | op2;
+
+        if (op1 != 3) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        switch (selector) {
+        case 0: /* NOP */
+                return;
+        case Hint_YIELD:
+        case Hint_WFE:
+        case Hint_WFI:
+        case Hint_SEV:
+        case Hint_SEVL:
+                cb->Hint (selector);
+                return;
+        default:
+                /* Unallocated hints behave as NOP */
+                return;
+        }
+}
+
+/* CLREX, DSB, DMB, ISB */
+template<typename CB>
+static void DisasSync(uint32_t insn, unsigned int op1, unsigned int op2, unsigned int crm, CB *cb) {
+        if (op1 != 3) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        switch (op2) {
+        case 2: /* CLREX */
+                cb->ClearExclusive ();
+                return;
+        case 4: /* DSB */
+        case 5: /* DMB */
+                switch (crm & 3) {
+                case 1: /* MBReqTypes_Reads */
+                        cb->Barrier (Barrier_ACQUIRE);
+                        break;
+                case 2: /* MBReqTypes_Writes */
+                        cb->Barrier (Barrier_RELEASE);
+                        break;
+                default: /* MBReqTypes_All */
+                        cb->Barrier (Barrier_FULL);
+                        break;
+                }
+                return;
+        case 6: /* ISB */
+                /* Code modification is picked up through BlockCache::Invalidate */
+                return;
+        default:
+                UnallocatedOp (insn);
+                return;
+        }
+}
+
+template<typename CB>
+static void DisasSystem(uint32_t insn, CB *cb) {
+        unsigned int l, op0, op1, crn, crm, op2, rt;
+        const A64SysRegInfo *ri;
+        l = extract32(insn, 21, 1);
+        op0 = extract32(insn, 19, 2);
+        op1 = extract32(insn, 16, 3);
+        crn = extract32(insn, 12, 4);
+        crm = extract32(insn, 8, 4);
+        op2 = extract32(insn, 5, 3);
+        rt = extract32(insn, 0, 5);
+        if (op0 == 0) {
+                if (l || rt != 31) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                switch (crn) {
+                case 2: /* HINT (including allocated hints like NOP, YIELD, etc) */
+                        DisasHint (insn, op1, op2, crm, cb);
+                        break;
+                case 3: /* CLREX, DSB, DMB, ISB */
+                        DisasSync(insn, op1, op2, crm, cb);
+                        break;
+                case 4: /* MSR (immediate) */
+                        UnsupportedOp ("MSR immediate");
+                        //handle_msr_i(s, insn, op1, op2, crm);
+                        break;
+                default:
+                        UnallocatedOp (insn);
+                        break;
+                }
+                return;
+        }
+        bool isread = l;
+        ri = GetSysReg(ENCODE_SYSTEM_REG(CP_REG_ARM64_SYSREG_CP,
+                                          crn, crm, op0, op1, op2));
+        if (!ri) {
+                DecodeFail ();
+                ns_abort("Unknown system register\n");
+        }
+        /* Handle special cases first */
+        switch (ri->type & ~(ARM_CP_FLAG_MASK & ~ARM_CP_SPECIAL)) {
+        case ARM_CP_NOP:
+                return;
+        case ARM_CP_NZCV:
+                cb->ReadWriteNZCV (rt, isread);
+                return;
+        case ARM_CP_FPCR:
+                cb->ReadWriteFPCR (rt, isread);
+                return;
+        case ARM_CP_FPSR:
+                cb->ReadWriteFPSR (rt, isread);
+                return;
+        case ARM_CP_CURRENTEL:
+                UnsupportedOp ("MSR/MRS Current EL");
+                return;
+        case ARM_CP_DC_ZVA:
+                cb->DcZva (rt);
+                return;
+        }
+        cb->ReadWriteSysReg(rt, ri->offset, isread);
+}
+
+template<typename CB>
+static void DisasLogicReg(uint32_t insn, CB *cb) {
+        unsigned int sf = extract32(insn, 31, 1);
+        unsigned int opc = extract32(insn, 29, 2);
+        unsigned int shift_type = extract32(insn, 22, 2);
+        unsigned int invert = extract32(insn, 21, 1);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int shift_amount = extract32(insn, 10, 6);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (!sf && (shift_amount & (1 << 5))) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (opc == 1 && shift_amount == 0 && shift_type == 0 && rn == 31) {
+                /* Unshifted ORR and ORN with WZR/XZR is the standard encoding for
+                * register-register MOV and MVN, so it is worth special casing.
+                */
+                if (invert) {
+                        cb->NotReg (rd, rm, sf);
+                } else {
+                        cb->MovReg (rd, rm, sf);
+                }
+                return;
+        }
+        cb->MovReg (GPR_DUMMY, rm, true);
+        if (shift_amount) {
+                cb->ShiftI64 (GPR_DUMMY, rm, shift_type, shift_amount, sf);
+        }
+        switch (opc | (invert << 2)) {
+        case 0: /* AND */
+                cb->AndReg (rd, rn, GPR_DUMMY, false, sf);
+                break;
+        case 3: /* ANDS */
+                cb->AndReg (rd, rn, GPR_DUMMY, true, sf);
+                break;
+        case 1: /* ORR */
+                cb->OrrReg (rd, rn, GPR_DUMMY, sf);
+                break;
+        case 2: /* EOR */
+                cb->EorReg (rd, rn, GPR_DUMMY, sf);
+                break;
+        case 4: /* BIC */
+                cb->BicReg (rd, rn, GPR_DUMMY, false, sf);
+                break;
+        case 7: /* BICS */
+                cb->BicReg (rd, rn, GPR_DUMMY, true, sf);
+                break;
+        case 5: /* ORN */
+                cb->NotReg (GPR_DUMMY, GPR_DUMMY, sf);
+                cb->OrrReg (rd, rn, GPR_DUMMY, sf);
+                break;
+        case 6: /* EON */
+                cb->NotReg (GPR_DUMMY, GPR_DUMMY, sf);
+                cb->EorReg (rd, rn, GPR_DUMMY, sf);
+                break;
+        default:
+                ns_abort ("Invalid Logical(Reg) opcode: %u\n", opc);
+        break;
+    }
+}
+
+template<typename CB>
+static void DisasAddSubExtReg(uint32_t insn, CB *cb) {
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int imm3 = extract32(insn, 10, 3);
+        unsigned int option = extract32(insn, 13, 3);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned setflags = extract32(insn, 29, 1);
+        unsigned sub_op = extract32(insn, 30, 1);
+        unsigned sf = extract32(insn, 31, 1);
+        if (imm3 > 4) {
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->ExtendReg (GPR_DUMMY, rm, option, sf);
+        cb->ShiftI64 (GPR_DUMMY, GPR_DUMMY, ShiftType_LSL, imm3, sf);
+        if (sub_op) {
+                cb->SubReg (rd, rn, GPR_DUMMY, setflags, sf);
+        } else {
+                cb->AddReg (rd, rn, GPR_DUMMY, setflags, sf);
+        }
+}
+
+template<typename CB>
+static void DisasAddSubReg(uint32_t insn, CB *cb) {
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int imm6 = extract32(insn, 10, 6);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int shift_type = extract32(insn, 22, 2);
+        unsigned setflags = extract32(insn, 29, 1);
+        unsigned sub_op = extract32(insn, 30, 1);
+        unsigned sf = extract32(insn, 31, 1);
+        if ((shift_type == 3) || (!sf && (imm6 > 31))) {
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->MovReg (GPR_DUMMY, rm, true);
+        cb->ShiftI64 (GPR_DUMMY, GPR_DUMMY, shift_type, imm6, sf);
+        if (sub_op) {
+                cb->SubReg (rd, rn, GPR_DUMMY, setflags, sf);
+        } else {
+                cb->AddReg (rd, rn, GPR_DUMMY, setflags, sf);
+        }
+}
+
+template<typename CB>
+static void DisasDataProc3src(uint32_t insn, CB *cb) {
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int ra = extract32(insn, 10, 5);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int op_id = (extract32(insn, 29, 3) << 4) |
+                        (extract32(insn, 21, 3) << 1) | extract32(insn, 15, 1);
+        bool sf = extract32(insn, 31, 1);
+        bool is_sub = extract32(op_id, 0, 1);
+        bool is_high = extract32(op_id, 2, 1);
+        bool is_signed = false;
+        bool src64 = false;
+
+        /* Note that op_id is sf:op54:op31:o0 so it includes the 32/64 size flag */
+        switch (op_id) {
+        case 0x42: /* SMADDL */
+        case 0x43: /* SMSUBL */
+        case 0x44: /* SMULH */
+                is_signed = true;
+                break;
+        case 0x0: /* MADD (32bit) */
+        case 0x1: /* MSUB (32bit) */
+        case 0x40: /* MADD (64bit) */
+        case 0x41: /* MSUB (64bit) */
+        case 0x4a: /* UMADDL */
+        case 0x4b: /* UMSUBL */
+        case 0x4c: /* UMULH */
+                break;
+        default:
+                UnallocatedOp (insn);
+                return;
+        }
+        if (is_high) {
+                /* SMULH, UMULH ... [Multiply High] */
+                cb->Mul2Reg (rd, GPR_DUMMY, rn, rm, is_signed);
+        } else {
+                /*
+                 * sf = 0: MADD(32bit), MSUB(32bit) ... Wd = Wa +/- Wn * Wm
+                 * sf = 1: (op_id < 0x42) MADD(64bit), MSUB(64bit) ... Xd = Xa +/- Xn * Xm
+                           (sign = 0) UMADDL(UMULL), UMSUBL(UMNEGL) ... [Multiply Long 32bit*32bit] Xd = Wa +/- Wn * Wm
+                 *         (sign = 1) SMADDL(SMULL), SMSUBL(SMNEGL) ... [Multiply Long 32bit*32bit] Xd = Wa +/- Wn * Wm
+                 */
+                if (op_id < 0x42) {
+                        /* MADD(64bit), MSUB(64bit) */
+                        src64 = true;
+                }
+                cb->MulReg (GPR_DUMMY, rn, rm, is_signed, sf, src64);
+                if (is_sub)
+                        cb->SubReg (rd, ra, GPR_DUMMY, false, true);
+                else
+                        cb->AddReg (rd, ra, GPR_DUMMY, false, true);
+        }
+
+}
+
+template<typename CB>
+static void DisasAddSubcReg(uint32_t insn, CB *cb) {
+        unsigned int sf = extract32(insn, 31, 1);
+        unsigned int sub_op = extract32(insn, 30, 1);
+        unsigned int setflags = extract32(insn, 29, 1);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (sub_op) {
+                /* ADC, ADCS */
+                cb->SubcReg (rd, rn, rm, setflags, sf);
+        } else {
+                /* SBC, SBCS */
+                cb->AddcReg (rd, rn, rm, setflags, sf);
+        }
+}
+
+template<typename CB>
+static void DisasCondCmp(uint32_t insn, CB *cb) {
+        unsigned int sf = extract32(insn, 31, 1);
+        unsigned int op = extract32(insn, 30, 1);
+        unsigned int is_imm = extract32(insn, 11, 1);
+        unsigned int y = extract32(insn, 16, 5); /* y = rm (reg) or imm5 (imm) */
+        unsigned int cond = extract32(insn, 12, 4);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int nzcv = extract32(insn, 0, 4);
+        if (!extract32(insn, 29, 1)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (insn & (1 << 10 | 1 << 4)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        /* CCMN, CCMP */
+        if (is_imm)
+                cb->CondCmpI64(rn, y, nzcv, cond, op, sf);
+        else
+                cb->CondCmpReg(rn, y, nzcv, cond, op, sf);
+}
+
+template<typename CB>
+static void DisasCondSel(uint32_t insn, CB *cb) {
+        unsigned int sf = extract32(insn, 31, 1);
+        unsigned int else_inv = extract32(insn, 30, 1);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int cond = extract32(insn, 12, 4);
+        unsigned int else_inc = extract32(insn, 10, 1);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (extract32(insn, 29, 1) || extract32(insn, 11, 1)) {
+                /* S == 1 or op2<1> == 1 */
+                UnallocatedOp (insn);
+                return;
+        }
+        bool cond_inv = false;
+        //debug_print("rn: %u, rm: %u, else_inc: %u, else_inv: %u cond: %u\n", rn, rm, else_inc, else_inv, cond);
+        cb->MovReg (GPR_DUMMY, rm, true);
+        if (else_inv) {
+                cb->NotReg (GPR_DUMMY, GPR_DUMMY, sf);
+        }
+        if (else_inc) {
+                cb->AddI64 (GPR_DUMMY, GPR_DUMMY, 1, false, sf);
+        }
+        cb->CondMovReg (cond, rd, rn, GPR_DUMMY, sf);
+}
+
+template<typename CB>
+static void DisasDataProc1src(uint32_t insn, CB *cb) {
+        if (extract32(insn, 29, 1) || extract32(insn, 16, 5)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        unsigned int sf = extract32(insn, 31, 1);
+        unsigned int opcode = extract32(insn, 10, 6);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+
+        switch (opcode) {
+        case 0: /* RBIT */
+                cb->RevBit (rd, rn, sf);
+                break;
+        case 1: /* REV16 */
+                cb->RevByte16 (rd, rn, sf);
+                break;
+        case 2: /* REV32 */
+                cb->RevByte32 (rd, rn, sf);
+                break;
+        case 3: /* REV64 */
+                cb->RevByte64 (rd, rn, sf);
+                break;
+        case 4: /* CLZ */
+                cb->CntLeadZero (rd, rn, sf);
+                break;
+        case 5: /* CLS */
+                cb->CntLeadSign (rd, rn, sf);
+                break;
+        }
+}
+
+template<typename CB>
+static void DisasDataProc2src(uint32_t insn, CB *cb) {
+        unsigned int sf = extract32(insn, 31, 1);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int opcode = extract32(insn, 10, 6);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (extract32(insn, 29, 1)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        switch (opcode) {
+        case 2: /* UDIV */
+                cb->DivReg (rd, rn, rm, false, sf);
+                break;
+        case 3: /* SDIV */
+                cb->DivReg (rd, rn, rm, true, sf);
+                break;
+        case 8: /* LSLV */
+                cb->ShiftReg (rd, rn, rm, ShiftType_LSL, sf);
+                break;
+        case 9: /* LSRV */
+                cb->ShiftReg (rd, rn, rm, ShiftType_LSR, sf);
+                break;
+        case 10: /* ASRV */
+                cb->ShiftReg (rd, rn, rm, ShiftType_ASR, sf);
+                break;
+        case 11: /* RORV */
+                cb->ShiftReg (rd, rn, rm, ShiftType_ROR, sf);
+                break;
+        case 16:
+        case 17:
+        case 18:
+        case 19:
+        case 20:
+        case 21:
+        case 22:
+        case 23: /* CRC32 */
+        {
+                unsigned int sz = extract32(opcode, 0, 2);
+                bool crc32c = extract32(opcode, 2, 1);
+                /* Only CRC32X/CRC32CX take an X register */
+                if (sf != (sz == 3)) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                cb->Crc32 (rd, rn, rm, sz, crc32c);
+                break;
+         }
+         default:
+                UnallocatedOp (insn);
+                break;
+        }
+}
+
+static bool DisasLdstCompute64bit(unsigned int size, bool is_signed, unsigned int opc) {
+        unsigned int opc0 = extract32(opc, 0, 1);
+        unsigned int regsize;
+
+        if (is_signed) {
+                regsize = opc0 ? 32 : 64;
+        } else {
+                regsize = size == 3 ? 64 : 32;
+        }
+        return regsize == 64;
+}
+
+/* Load/Store exclusive ... literal means PC-relative immediate value */
+template<typename CB>
+static void DisasLdstExcl(uint32_t insn, CB *cb) {
+        unsigned int rt = extract32(insn, 0, 5);
+        unsigned int rn = ARMv8::HandleAsSP(extract32(insn, 5, 5));
+        unsigned int rt2 = extract32(insn, 10, 5);
+        unsigned int is_lasr = extract32(insn, 15, 1);
+        unsigned int rs = extract32(insn, 16, 5);
+        unsigned int is_pair = extract32(insn, 21, 1);
+        unsigned int is_store = !extract32(insn, 22, 1);
+        unsigned int is_excl = !extract32(insn, 23, 1);
+        unsigned int size = extract32(insn, 30, 2);
+        if ((!is_excl && !is_pair && !is_lasr) ||
+                (!is_excl && is_pair) ||
+                (is_pair && size < 2)) {
+                UnallocatedOp(insn);
+                return;
+        }
+        if (is_excl) {
+                if (!is_store) {
+                        cb->LoadExclusive (rt, rt2, rn, size, is_pair);
+                        if (is_lasr)
+                                cb->Barrier (Barrier_ACQUIRE);
+                } else {
+                        if (is_lasr)
+                                cb->Barrier (Barrier_RELEASE);
+                        cb->StoreExclusive (rs, rt, rt2, rn, size, is_pair);
+                }
+        } else {
+                bool sf = DisasLdstCompute64bit(size, false, 0);
+                /* Generate ISS for non-exclusive accesses including LASR.  */
+                if (is_store) {
+                        if (is_lasr)
+                                cb->Barrier (Barrier_RELEASE);
+                        cb->StoreRegI64(rt, rn, size, false, false);
+                        /* STLR must not pass a following LDAR (RCsc) */
+                        if (is_lasr)
+                                cb->Barrier (Barrier_FULL);
+                } else {
+                        cb->LoadRegI64(rt, rn, size, false, false);
+                        if (is_lasr)
+                                cb->Barrier (Barrier_ACQUIRE);
+                }
+        }
+}
+/* Load register (literal) ... literal means PC-relative immediate value */
+template<typename CB>
+static void DisasLdLit(uint32_t insn, CB *cb) {
+        unsigned int rt = extract32(insn, 0, 5);
+        int64_t imm = sextract32(insn, 5, 19) << 2;
+        bool is_vector = extract32(insn, 26, 1);
+        unsigned int opc = extract32(insn, 30, 2);
+        bool sf = opc != 0;
+        bool is_signed = false;
+        int size = 2;
+        if (is_vector) {
+                /* LDR (SIMD&FP) */
+                size = opc + 2;
+        } else {
+                if (opc == 3) {
+                        return;
+                }
+                size = 2 + extract32(opc, 0, 1);
+                is_signed = extract32(opc, 1, 1);
+        }
+        cb->AddI64 (rt, PC_IDX, imm - 4, false, true);
+        cb->LoadRegI64 (rt, rt, size, is_signed, false);
+}
+
+/* Load/Store register ... register offset */
+template<typename CB>
+static void DisasLdstRegRoffset(uint32_t insn, CB *cb,
+                                unsigned int opc,
+                                unsigned int size,
+                                unsigned int rt,
+                                bool is_vector) {
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int shift = extract32(insn, 12, 1);
+        unsigned int rm = ARMv8::HandleAsSP (extract32(insn, 16, 5));
+        unsigned int opt = extract32(insn, 13, 3);
+        bool is_signed = false;
+        bool is_store = false;
+        bool is_extended = false;
+
+        if (extract32(opt, 1, 1) == 0) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        if (is_vector) {
+                /* "LDR/STR [base, Xm/Wm] (SIMD&FP)") */
+                size |= (opc & 2) << 1;
+                is_store = !extract32(opc, 0, 1);
+        } else {
+                if (size == 3 && opc == 2) {
+                        /* PRFM - prefetch */
+                        return;
+                }
+                if (opc == 3 && size > 1) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                is_store = (opc == 0);
+                is_signed = extract32(opc, 1, 1);
+                //is_extended = (size < 3) && extract32(opc, 0, 1);
+                is_extended = (size < 3); //TODO: treat other case, size = 0, 1(8bit-> or 16bit->)
+        }
+        //bool sf = DisasLdstCompute64bit (size, is_signed, opc);
+        /* TODO: Calculate address here (not in callback) */
+        bool sf = (opt & 0x1) ? true : false; // XXX: Correct?
+        cb->ExtendReg (GPR_DUMMY, rm, opt, sf);
+        cb->ShiftI64 (GPR_DUMMY, GPR_DUMMY, ShiftType_LSL, shift ? size : 0, sf);
+        if (is_vector) {
+                if (is_store) {
+                        cb->StoreFpReg (rt, rn, GPR_DUMMY, size, false, sf);
+                } else {
+                        cb->LoadFpReg (rt, rn, GPR_DUMMY, size, false, sf);
+                }
+        } else {
+                if (is_store) {
+                        cb->StoreReg (rt, rn, GPR_DUMMY, size, is_signed, is_extended, false, sf);
+                } else {
+                        cb->LoadReg (rt, rn, GPR_DUMMY, size, is_signed, is_extended, false, sf);
+                }
+        }
+}
+
+/*
+ * Load/store register (unscaled immediate)
+ * Load/store immediate pre/post-indexed
+ * Load/store register unprivileged
+ */
+template<typename CB>
+static void DisasLdstRegImm9(uint32_t insn, CB *cb,
+                                unsigned int opc,
+                                unsigned int size,
+                                unsigned int rt,
+                                bool is_vector) {
+        unsigned int rn = ARMv8::HandleAsSP (extract32(insn, 5, 5));
+        uint64_t imm9 = sextract32(insn, 12, 9);
+        unsigned int idx = extract32(insn, 10, 2);
+        bool is_signed = false;
+        bool is_store = false;
+        bool is_extended = false;
+        bool is_unpriv = (idx == 2);
+        bool iss_valid = !is_vector;
+        bool post_index;
+        bool writeback;
+
+        //debug_print ("ldst uimm9\n");
+
+        if (is_vector) {
+                /* LDR/STR [base, #imm9] (SIMD&FP) */
+                size |= (opc & 2) << 1;
+                if (size > 4 && is_unpriv) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                is_store = ((opc & 1) == 0);
+        } else {
+                if (size == 3 && opc == 2) {
+                        /* PRFM - prefetch */
+                        if (is_unpriv) {
+                                UnallocatedOp (insn);
+                                return;
+                        }
+                        return;
+                }
+                if (opc == 3 && size > 1) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                is_store = (opc == 0);
+                is_signed = extract32(opc, 1, 1);
+                //is_extended = (size < 3) && extract32(opc, 0, 1);
+                is_extended = (size < 3); //TODO: treat other case, size = 0, 1(8bit-> or 16bit->)
+        }
+        bool sf = DisasLdstCompute64bit (size, is_signed, opc);
+        switch (idx) {
+        case 0:
+        case 2:
+                post_index = false;
+                writeback = false;
+                break;
+        case 1:
+                post_index = true;
+                writeback = true;
+                break;
+        case 3:
+                post_index = false;
+                writeback = true;
+                break;
+        default:
+                ns_abort ("Unreachable status\n");
+        }
+
+        cb->MovReg (GPR_DUMMY, rn, true);
+        if (!post_index) {
+                cb->AddI64 (GPR_DUMMY, rn, imm9, false, true);
+        }
+        if (is_vector) {
+                if (is_store) {
+                        cb->StoreFpRegI64 (rt, GPR_DUMMY, size);
+                } else {
+                        cb->LoadFpRegI64 (rt, GPR_DUMMY, size);
+                }
+        } else {
+                if (is_store) {
+                        cb->StoreRegI64 (rt, GPR_DUMMY, size, is_signed, is_extended);
+                } else {
+                        cb->LoadRegI64 (rt, GPR_DUMMY, size, is_signed, is_extended);
+                }
+        }
+        if (writeback) {
+                cb->AddI64 (rn, rn, imm9, false, true);
+        }
+}
+
+template<typename CB>
+static void DisasLdstRegUnsignedImm(uint32_t insn, CB *cb,
+                                unsigned int opc,
+                                unsigned int size,
+                                unsigned int rt,
+                                bool is_vector) {
+        unsigned int rn = ARMv8::HandleAsSP (extract32(insn, 5, 5));
+        uint64_t imm12 = extract32(insn, 10, 12);
+        uint64_t offset;
+
+        bool is_store;
+        bool is_signed = false;
+        bool is_extended = false;
+        //debug_print ("ldst unsigned imm\n");
+        if (is_vector) {
+                /* LDR/STR [base, #uimm12] (SIMD&FP) */
+                size |= (opc & 2) << 1;
+                if (size > 4) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                is_store = !extract32(opc, 0, 1);
+                if (!FpAccessCheck (insn)) {
+                        return;
+                }
+        } else {
+                if (size == 3 && opc == 2) {
+                        /* PRFM - prefetch */
+                        return;
+                }
+                if (opc == 3 && size > 1) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                is_store = (opc == 0);
+                is_signed = extract32(opc, 1, 1);
+                //is_extended = (size < 3) && extract32(opc, 0, 1);
+                is_extended = (size < 3); //TODO: treat other case, size = 0, 1(8bit-> or 16bit->)
+        }
+        offset = imm12 << size;
+        cb->AddI64 (GPR_DUMMY, rn, offset, false, true);
+        if (is_vector) {
+                if (is_store) {
+                        cb->StoreFpRegI64 (rt, GPR_DUMMY, size);
+                } else {
+                        cb->LoadFpRegI64 (rt, GPR_DUMMY, size);
+                }
+        } else {
+                bool sf = DisasLdstCompute64bit (size, is_signed, opc);
+                if (is_store) {
+                        cb->StoreRegI64 (rt, GPR_DUMMY, size, is_signed, is_extended);
+                } else {
+                        cb->LoadRegI64 (rt, GPR_DUMMY, size, is_signed, is_extended);
+                }
+        }
+}
+
+/*
+ * Load/store register (unscaled immediate)
+ * Load/store immediate pre/post-indexed
+ * Load/store register unprivileged
+ */
+template<typename CB>
+static void DisasLdstPair(uint32_t insn, CB *cb) {
+        unsigned int rt = extract32(insn, 0, 5);
+        unsigned int rn = ARMv8::HandleAsSP (extract32(insn, 5, 5));
+        unsigned int rt2 = extract32(insn, 10, 5);
+        uint64_t offset = sextract64(insn, 15, 7);
+        unsigned int index = extract32(insn, 23, 2);
+        bool is_vector = extract32(insn, 26, 1);
+        bool is_load = extract32(insn, 22, 1);
+        unsigned int opc = extract32(insn, 30, 2);
+
+        bool is_signed = false;
+        bool post_index = false;
+        bool writeback = false;
+
+        int size;
+
+        if (opc == 3) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        if (is_vector) {
+                /* LDP/STP Xt1, Xt2, [base, #simm7] (SIMD&FP) */
+                size = 2 + opc;
+        } else {
+                size = 2 + extract32 (opc, 1, 1);
+                is_signed = extract32 (opc, 0, 1);
+                if (!is_load && is_signed) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+        }
+
+        bool sf = DisasLdstCompute64bit (size, is_signed, opc);
+
+        switch (index) {
+        case 0:
+                if (is_signed) {
+                        /* There is no non-temporal-hint version of LDPSW */
+                        UnallocatedOp (insn);
+                        return;
+                }
+                post_index = false;
+                break;
+        case 1: /* post-index */
+                post_index = true;
+                writeback = true;
+                break;
+        case 2: /* signed offset, rn not update */
+                post_index = false;
+                break;
+        case 3: /* pre-index */
+                post_index = false;
+                writeback = true;
+                break;
+        default:
+                ns_abort ("Unreachable status\n");
+        }
+
+        offset <<= size;
+        unsigned int addr = rn;
+        if (!post_index && offset) {
+                cb->AddI64 (GPR_DUMMY, rn, offset, false, true);
+                addr = GPR_DUMMY;
+        }
+        cb->LoadStorePair (rt, rt2, addr, size, is_signed, is_vector, is_load);
+        if (writeback) {
+                cb->AddI64 (rn, rn, offset, false, true);
+        }
+}
+
+template<typename CB>
+static void DisasLdStMulti(uint32_t insn, CB *cb) {
+        unsigned int rt = extract32(insn, 0, 5);
+        unsigned int rn = ARMv8::HandleAsSP (extract32(insn, 5, 5));
+        unsigned int size = extract32(insn, 10, 2);
+        unsigned int opcode = extract32(insn, 12, 4);
+        bool is_store = !extract32(insn, 22, 1);
+        bool is_postidx = extract32(insn, 23, 1);
+        bool is_q = extract32(insn, 30, 1);
+        int rpt;    /* num iterations */
+        int selem;  /* structure elements */
+
+        if (extract32(insn, 31, 1) || extract32(insn, 21, 1)) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        /* From the shared decode logic */
+        switch (opcode) {
+        case 0x0: // LD/ST4 (4 register)
+                rpt = 1;
+                selem = 4;
+                break;
+        case 0x2: // LD/ST1 (4 register)
+                rpt = 4;
+                selem = 1;
+                break;
+        case 0x4: // LD/ST3 (3 register)
+                rpt = 1;
+                selem = 3;
+                break;
+        case 0x6: // LD/ST1 (3 register)
+                rpt = 3;
+                selem = 1;
+                break;
+        case 0x7: // LD/ST1 (1 register)
+                rpt = 1;
+                selem = 1;
+                break;
+        case 0x8: // LD/ST2 (2 register)
+                rpt = 1;
+                selem = 2;
+                break;
+        case 0xa: // LD/ST1 (2 register)
+                rpt = 2;
+                selem = 1;
+                break;
+        default:
+                UnallocatedOp (insn);
+                return;
+        }
+
+        if (size == 3 && !is_q && selem != 1) {
+                /* reserved */
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->LoadStoreMulti (rt, rn, size, rpt, selem, is_q, !is_store);
+        if (is_postidx) {
+                unsigned int rm = extract32(insn, 16, 5);
+                if (rm == 31) {// post-index with <imm>
+                        cb->AddI64 (rn, rn, rpt * selem * (is_q ? 16 : 8), false, true);
+                } else { // post-index with <Xm>
+                        cb->AddReg (rn, rn, rm, false, true);
+                }
+        }
+}
+
+template<typename CB>
+static void DisasLdStSingle(uint32_t insn, CB *cb) {
+        unsigned int rt = extract32(insn, 0, 5);
+        unsigned int rn = ARMv8::HandleAsSP (extract32(insn, 5, 5));
+        unsigned int size = extract32(insn, 10, 2);
+        unsigned int S = extract32(insn, 12, 1);
+        unsigned int opc = extract32(insn, 13, 3);
+        unsigned int R = extract32(insn, 21, 1);
+        unsigned int is_load = extract32(insn, 22, 1);
+        unsigned int is_postidx = extract32(insn, 23, 1);
+        unsigned int is_q = extract32(insn, 30, 1);
+
+        unsigned int scale = extract32(opc, 1, 2);
+        int elements = (is_q ? 128 : 64) / (8 << size);
+        unsigned int selem = (extract32(opc, 0, 1) << 1 | R) + 1;
+        bool replicate = false;
+        unsigned int index = is_q << 3 | S << 2 | size;
+        unsigned int ebytes, xs;
+        switch (scale) {
+        case 3:
+                if (!is_load || S) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                scale = size;
+                replicate = true;
+                break;
+        case 0:
+                break;
+        case 1:
+                if (extract32(size, 0, 1)) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                index >>= 1;
+                break;
+        case 2:
+                if (extract32(size, 1, 1)) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                if (!extract32(size, 0, 1)) {
+                        index >>= 2;
+                } else {
+                        if (S) {
+                                UnallocatedOp (insn);
+                                return;
+                        }
+                        index >>= 3;
+                        scale = 3;
+                }
+                break;
+        default:
+                ns_abort("LD/ST Single unknwon scale");
+        }
+        ebytes = 1 << scale;
+        cb->MovReg(GPR_DUMMY, rn, true);
+        for (int xs = 0; xs < selem; xs++) {
+                if (replicate) {
+                        /* Load and replicate to all elements */
+                        for (int e = 0; e < elements; e++) {
+                                cb->LoadVecReg (rt, e, GPR_DUMMY, scale);
+                        }
+                } else {
+                        /* Load/store one element per register */
+                        if (is_load) {
+                                cb->LoadVecReg (rt, index, GPR_DUMMY, scale);
+                        } else {
+                                cb->StoreVecReg (GPR_DUMMY, index, rt, scale);
+                        }
+                }
+                cb->AddI64 (GPR_DUMMY, GPR_DUMMY, ebytes, false, true);
+                rt = (rt + 1) % 32;
+        }
+        if (is_postidx) {
+                unsigned int rm = extract32(insn, 16, 5);
+                if (rm == 31) {// post-index with <imm>
+                        cb->MovReg(rn, GPR_DUMMY, true);
+                } else { // post-index with <Xm>
+                        cb->AddReg (rn, rn, rm, false, true);
+                }
+        }
+}
+
+/* See VFPExpandImm() in ARM ARM */
+static uint64_t VFPExpandImm(unsigned int imm8, bool dbl) {
+        uint64_t imm;
+        if (dbl) {
+                imm = (uint64_t) (imm8 & 0x3f) << 48;
+                imm |= (imm8 & 0x40) ? 0x3fc0000000000000ULL : 0x4000000000000000ULL;
+                if (imm8 & 0x80)
+                        imm |= 0x8000000000000000ULL;
+        } else {
+                imm = (imm8 & 0x3f) << 19;
+                imm |= (imm8 & 0x40) ? 0x3e000000 : 0x40000000;
+                if (imm8 & 0x80)
+                        imm |= 0x80000000;
+        }
+        return imm;
+}
+
+/* Scalar FP only has single and double (type 3, half precision, needs ARMv8.2) */
+static inline bool FpTypeSupported(uint32_t insn, unsigned int type) {
+        if (type == 3) {
+                UnsupportedOp ("Half precision arithmetic");
+                return false;
+        }
+        if (type == 2) {
+                UnallocatedOp (insn);
+                return false;
+        }
+        return true;
+}
+
+template<typename CB>
+static void DisasFp1Src(uint32_t insn, CB *cb) {
+        unsigned int type = extract32(insn, 22, 2);
+        unsigned int opcode = extract32(insn, 15, 6);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        switch (opcode) {
+        case 0x4: case 0x5: case 0x7:
+        {
+                /* FCVT between half/single/double precision */
+                unsigned int dtype = extract32(opcode, 0, 2);
+                if (type == 2 || dtype == type) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                cb->FpConvert(rd, rn, type, dtype);
+                break;
+        }
+        case 0x0 ... 0x3:
+        case 0x8 ... 0xc:
+        case 0xe ... 0xf:
+                if (!FpTypeSupported (insn, type))
+                        return;
+                switch (opcode) {
+                        case 0x0: /* FMOV */
+                                cb->FMovReg(rd, rn, type);
+                                break;
+                        case 0x1: /* FABS */
+                                cb->FpUnary(rd, rn, type, 1, FpOp_ABS);
+                                break;
+                        case 0x2: /* FNEG */
+                                cb->FpUnary(rd, rn, type, 1, FpOp_NEG);
+                                break;
+                        case 0x3: /* FSQRT */
+                                cb->FpUnary(rd, rn, type, 1, FpOp_SQRT);
+                                break;
+                        case 0x8: /* FRINTN */
+                        case 0x9: /* FRINTP */
+                        case 0xa: /* FRINTM */
+                        case 0xb: /* FRINTZ */
+                        case 0xc: /* FRINTA */
+                                cb->FpUnary(rd, rn, type, 1, FpOp_RINTN + (opcode - 0x8));
+                                break;
+                        case 0xe: /* FRINTX */
+                                cb->FpUnary(rd, rn, type, 1, FpOp_RINTX);
+                                break;
+                        case 0xf: /* FRINTI */
+                                cb->FpUnary(rd, rn, type, 1, FpOp_RINTI);
+                                break;
+                }
+                break;
+        default:
+                UnallocatedOp (insn);
+                break;
+        }
+}
+
+template<typename CB>
+static void DisasFp2Src(uint32_t insn, CB *cb) {
+        unsigned int type = extract32(insn, 22, 2);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int opcode = extract32(insn, 12, 4);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        static const int ops[] = {
+                FpOp_MUL, FpOp_DIV, FpOp_ADD, FpOp_SUB, FpOp_MAX,
+                FpOp_MIN, FpOp_MAXNM, FpOp_MINNM, FpOp_NMUL,
+        };
+        if (opcode > 8) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (!FpTypeSupported (insn, type))
+                return;
+        cb->FpArith(rd, rn, rm, type, 1, ops[opcode]);
+}
+
+template<typename CB>
+static void DisasFp3Src(uint32_t insn, CB *cb) {
+        unsigned int type = extract32(insn, 22, 2);
+        bool o1 = extract32(insn, 21, 1);
+        unsigned int rm = extract32(insn, 16, 5);
+        bool o0 = extract32(insn, 15, 1);
+        unsigned int ra = extract32(insn, 10, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (!FpTypeSupported (insn, type))
+                return;
+        /* FMADD: a + n*m, FMSUB: a - n*m, FNMADD: -a - n*m, FNMSUB: -a + n*m */
+        cb->FpMulAdd(rd, rn, rm, ra, type, 1, o0 != o1, o1);
+}
+
+template<typename CB>
+static void DisasFpCompare(uint32_t insn, CB *cb) {
+        unsigned int mos = extract32(insn, 29, 3);
+        unsigned int type = extract32(insn, 22, 2);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int op = extract32(insn, 14, 2);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int opc = extract32(insn, 3, 2);
+        unsigned int op2r = extract32(insn, 0, 3);
+        if (mos || op || op2r) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (!FpTypeSupported (insn, type))
+                return;
+        /* opc<0>: compare with zero, opc<1>: FCMPE signals on quiet NaN */
+        cb->FpCompare(rn, rm, type, opc & 1, opc & 2);
+}
+
+template<typename CB>
+static void DisasFpCcomp(uint32_t insn, CB *cb) {
+        unsigned int mos = extract32(insn, 29, 3);
+        unsigned int type = extract32(insn, 22, 2);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int cond = extract32(insn, 12, 4);
+        unsigned int rn = extract32(insn, 5, 5);
+        bool op = extract32(insn, 4, 1);
+        unsigned int nzcv = extract32(insn, 0, 4);
+        if (mos) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (!FpTypeSupported (insn, type))
+                return;
+        cb->FpCondCompare(rn, rm, type, nzcv, cond, op);
+}
+
+template<typename CB>
+static void DisasFpCsel(uint32_t insn, CB *cb) {
+        unsigned int mos = extract32(insn, 29, 3);
+        unsigned int type = extract32(insn, 22, 2);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int cond = extract32(insn, 12, 4);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (mos) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (!FpTypeSupported (insn, type))
+                return;
+        cb->FpCondSelect(rd, rn, rm, type, cond);
+}
+
+template<typename CB>
+static void DisasFpImm(uint32_t insn, CB *cb) {
+        unsigned int mos = extract32(insn, 29, 3);
+        unsigned int type = extract32(insn, 22, 2);
+        unsigned int imm8 = extract32(insn, 13, 8);
+        unsigned int imm5 = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (mos || imm5) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (!FpTypeSupported (insn, type))
+                return;
+        cb->MoviI64(GPR_DUMMY, VFPExpandImm (imm8, type), true);
+        cb->FMovConv(rd, GPR_DUMMY, type, true);
+}
+
+template<typename CB>
+static void DisasFpFixedConv(uint32_t insn, CB *cb) {
+        bool sf = extract32(insn, 31, 1);
+        bool sbit = extract32(insn, 29, 1);
+        unsigned int type = extract32(insn, 22, 2);
+        unsigned int rmode = extract32(insn, 19, 2);
+        unsigned int opcode = extract32(insn, 16, 3);
+        unsigned int scale = extract32(insn, 10, 6);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (sbit || (!sf && scale < 32)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        switch ((rmode << 3) | opcode) {
+        case 0x2: /* SCVTF */
+        case 0x3: /* UCVTF */
+                if (!FpTypeSupported (insn, type))
+                        return;
+                cb->IntToFp(rd, rn, type, sf, opcode == 2, 64 - scale);
+                break;
+        case 0x18: /* FCVTZS */
+        case 0x19: /* FCVTZU */
+                if (!FpTypeSupported (insn, type))
+                        return;
+                cb->FpToInt(rd, rn, type, sf, opcode == 0, FpRounding_ZERO, 64 - scale);
+                break;
+        default:
+                UnallocatedOp (insn);
+                break;
+        }
+}
+
+template<typename CB>
+static void DisasFpIntConv(uint32_t insn, CB *cb) {
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int opcode = extract32(insn, 16, 3);
+        unsigned int rmode = extract32(insn, 19, 2);
+        unsigned int type = extract32(insn, 22, 2);
+        bool sbit = extract32(insn, 29, 1);
+        bool sf = extract32(insn, 31, 1);
+
+        if (sbit) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        if (opcode > 5) {
+                /* FMOV */
+                bool itof = opcode & 1;
+                if (rmode >= 2) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                // Float <-> Int
+                cb->FMovConv(rd, rn, type, itof);
+        } else {
+                if (!FpTypeSupported (insn, type))
+                        return;
+                switch (opcode) {
+                case 0: /* FCVT[NPMZ]S */
+                case 1: /* FCVT[NPMZ]U */
+                        cb->FpToInt(rd, rn, type, sf, opcode == 0, rmode, 0);
+                        break;
+                case 2: /* SCVTF */
+                case 3: /* UCVTF */
+                        if (rmode) {
+                                UnallocatedOp (insn);
+                                return;
+                        }
+                        cb->IntToFp(rd, rn, type, sf, opcode == 2, 0);
+                        break;
+                case 4: /* FCVTAS */
+                case 5: /* FCVTAU */
+                        if (rmode) {
+                                UnallocatedOp (insn);
+                                return;
+                        }
+                        cb->FpToInt(rd, rn, type, sf, opcode == 4, FpRounding_TIEAWAY, 0);
+                        break;
+                }
+        }
+}
+
+template<typename CB>
+static void DisasSimdInse(uint32_t insn, int rd, int rn, int imm4, int imm5, CB *cb) {
+        int size = ctz32(imm5);
+        int src_index, dst_index;
+
+        if (size > 3) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        dst_index = extract32(imm5, 1 + size, 5);
+        src_index = extract32(imm4, size, 4);
+        cb->ReadVecElem(GPR_DUMMY, rn, src_index, size);
+        cb->WriteVecElem(rd, GPR_DUMMY, dst_index, size);
+}
+
+template<typename CB>
+static void DisasSimdInsg(uint32_t insn, int rd, int rn, int imm5, CB *cb) {
+        int size = ctz32(imm5);
+        int idx;
+
+        if (size > 3) {
+                UnallocatedOp (insn);
+                return;
+        }
+
+        idx = extract32(imm5, 1 + size, 4 - size);
+        cb->WriteVecElem(rd, rn, idx, size);
+}
+
+template<typename CB>
+static void DisasSimdDupe(uint32_t insn, int is_q, int rd, int rn,
+                          int imm5, CB *cb) {
+        int size = ctz32(imm5);
+        unsigned int index = imm5 >> (size + 1);
+
+        if (size > 3 || (size == 3 && !is_q)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->DupVecReg(rd, rn, index, size, is_q ? 128 : 64);
+}
+
+template<typename CB>
+static void DisasSimdDupg(uint32_t insn, int is_q, int rd, int rn,
+                          int imm5, CB *cb) {
+        int size = ctz32(imm5);
+
+        if (size > 3 || (size == 3 && !is_q)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->DupVecRegFromGen(rd, rn, size, is_q ? 128 : 64);
+}
+
+static uint64_t BitfieldReplicate(uint64_t mask, unsigned int e) {
+        while (e < 64) {
+                mask |= mask << e;
+                e *= 2;
+        }
+        return mask;
+}
+
+template<typename CB>
+static void DisasSimdModImm(uint32_t insn, CB *cb) {
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int cmode = extract32(insn, 12, 4);
+        unsigned int cmode_3_1 = extract32(cmode, 1, 3);
+        unsigned int cmode_0 = extract32(cmode, 0, 1);
+        unsigned int o2 = extract32(insn, 11, 1);
+        uint64_t abcdefgh = extract32(insn, 5, 5) | (extract32(insn, 16, 3) << 5);
+        bool is_neg = extract32(insn, 29, 1);
+        bool is_q = extract32(insn, 30, 1);
+        uint64_t imm = 0;
+        /* See AdvSIMDExpandImm() in ARM ARM */
+        switch (cmode_3_1) {
+        case 0: /* Replicate(Zeros(24):imm8, 2) */
+        case 1: /* Replicate(Zeros(16):imm8:Zeros(8), 2) */
+        case 2: /* Replicate(Zeros(8):imm8:Zeros(16), 2) */
+        case 3: /* Replicate(imm8:Zeros(24), 2) */
+        {
+                int shift = cmode_3_1 * 8;
+                imm = BitfieldReplicate(abcdefgh << shift, 32);
+                break;
+        }
+        case 4: /* Replicate(Zeros(8):imm8, 4) */
+        case 5: /* Replicate(imm8:Zeros(8), 4) */
+        {
+                int shift = (cmode_3_1 & 0x1) * 8;
+                imm = BitfieldReplicate(abcdefgh << shift, 16);
+                break;
+        }
+        case 6:
+                if (cmode_0) {
+                        /* Replicate(Zeros(8):imm8:Ones(16), 2) */
+                        imm = (abcdefgh << 16) | 0xffff;
+                } else {
+                        /* Replicate(Zeros(16):imm8:Ones(8), 2) */
+                        imm = (abcdefgh << 8) | 0xff;
+                }
+                imm = BitfieldReplicate(imm, 32);
+                break;
+        case 7:
+                if (!cmode_0 && !is_neg) {
+                        imm = BitfieldReplicate(abcdefgh, 8);
+                } else if (!cmode_0 && is_neg) {
+                        int i;
+                        imm = 0;
+                        for (i = 0; i < 8; i++) {
+                                if ((abcdefgh) & (1 << i)) {
+                                        imm |= 0xffULL << (i * 8);
+                                }
+                        }
+                } else if (cmode_0) {
+                        if (is_neg) {
+                                imm = (abcdefgh & 0x3f) << 48;
+                                if (abcdefgh & 0x80) {
+                                        imm |= 0x8000000000000000ULL;
+                                }
+                                if (abcdefgh & 0x40) {
+                                        imm |= 0x3fc0000000000000ULL;
+                                } else {
+                                        imm |= 0x4000000000000000ULL;
+                                }
+                        } else {
+                                if (o2) {
+                                        /* FMOV (vector, immediate) - half-precision */
+                                        UnsupportedOp ("FMOV (vector, immediate)");
+                                        //imm = vfp_expand_imm(MO_16, abcdefgh);
+                                        /* now duplicate across the lanes */
+                                        imm = BitfieldReplicate(imm, 16);
+                                } else {
+                                        imm = (abcdefgh & 0x3f) << 19;
+                                        if (abcdefgh & 0x80) {
+                                                imm |= 0x80000000;
+                                        }
+                                        if (abcdefgh & 0x40) {
+                                                imm |= 0x3e000000;
+                                        } else {
+                                                imm |= 0x40000000;
+                                        }
+                                        imm |= (imm << 32);
+                                }
+                        }
+                }
+                break;
+        default:
+                ns_abort("cmode_3_1: %x\n", cmode_3_1);
+        }
+
+        if (cmode_3_1 != 7 && is_neg) {
+                imm = ~imm;
+        }
+        if (!((cmode & 0x9) == 0x1 || (cmode & 0xd) == 0x9)) {
+                /* MOVI or MVNI, with MVNI negation handled above.  */
+                cb->DupVecImmI64(rd, imm, 3, is_q ? 128 : 64);
+        } else {
+                /* ORR or BIC, with BIC negation to AND handled above.  */
+                UnsupportedOp ("ORR/BIC (vector, immediate)");
+        }
+}
+
+template<typename CB>
+static void DisasSimdUmovSmov(uint32_t insn, int is_q, int is_signed, int rn, int rd, int imm5, CB *cb) {
+        int size = ctz32(imm5);
+        int element;
+
+        /* Check for UnallocatedEncodings */
+        if (is_signed) {
+                if (size > 2 || (size == 2 && !is_q)) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+        } else {
+                if (size > 3 || (size < 3 && is_q) || (size == 3 && !is_q)) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+        }
+
+        element = extract32(imm5, 1 + size, 4);
+
+        cb->ReadVecElem(rd, rn, element, size);
+        if (is_signed && !is_q) {
+                cb->SExt32 (rd, rd);
+        }
+}
+
+template<typename CB>
+static void DisasSimdCopy(uint32_t insn, CB *cb) {
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int imm4 = extract32(insn, 11, 4);
+        unsigned int op = extract32(insn, 29, 1);
+        unsigned int is_q = extract32(insn, 30, 1);
+        unsigned int imm5 = extract32(insn, 16, 5);
+
+        if (op) {
+                if (is_q) {
+                        /* INS (element) */
+                        DisasSimdInse (insn, rd, rn, imm4, imm5, cb);
+                } else {
+                        UnallocatedOp (insn);
+                }
+        } else {
+                switch (imm4) {
+                case 0:
+                        /* DUP (element - vector) */
+                        DisasSimdDupe(insn, is_q, rd, rn, imm5, cb);
+                        break;
+                case 1:
+                        /* DUP (general) */
+                        DisasSimdDupg(insn, is_q, rd, rn, imm5, cb);
+                        break;
+                case 3:
+                        if (is_q) {
+                                /* INS (general) */
+                                DisasSimdInsg (insn, rd, rn, imm5, cb);
+                        } else {
+                                UnallocatedOp (insn);
+                        }
+                        break;
+                case 5:
+                case 7:
+                        /* UMOV/SMOV (is_q indicates 32/64; imm4 indicates signedness) */
+                        DisasSimdUmovSmov(insn, is_q, (imm4 == 5), rn, rd, imm5, cb);
+                        break;
+                default:
+                        UnallocatedOp (insn);
+                        break;
+                }
+        }
+}
+
+template<typename CB>
+static void Handle3Same(uint32_t insn, unsigned int opcode, bool u,
+        unsigned int rd, unsigned rn, unsigned int rm, bool is_q, unsigned int size, CB *cb) {
+        switch (opcode) {
+                case 0x1: /* SQADD, UQADD */
+                        cb->AddSatVec (rd, rn, rm, size, is_q, !u);
+                        break;
+                case 0x5: /* SQSUB, UQSUB */
+                        cb->SubSatVec (rd, rn, rm, size, is_q, !u);
+                        break;
+                case 0x6: /* CMGT, CMHI */
+                        cb->CompareGreaterVec (rd, rn, rm, size, is_q, !u, false);
+                        break;
+                case 0x7: /* CMGE, CMHS */
+                        cb->CompareGreaterVec (rd, rn, rm, size, is_q, !u, true);
+                        break;
+                case 0x11: /* CMTST, CMEQ */
+                        if (u) {
+                                // CMEQ
+                                cb->CompareEqualVec (rd, rn, rm, size, is_q);
+                        } else {
+                                // CMTST
+                                cb->CompareTestBitsVec (rd, rn, rm, size, is_q);
+                        }
+                        break;
+                case 0x8: /* SSHL, USHL */
+                        UnsupportedOp ("SSHL");
+                        break;
+                case 0x9: /* SQSHL, UQSHL */
+                        UnsupportedOp ("SQSHL");
+                        break;
+                case 0xa: /* SRSHL, URSHL */
+                        UnsupportedOp ("SRSHL");
+                        break;
+                case 0xb: /* SQRSHL, UQRSHL */
+                        UnsupportedOp ("SQRSHL");
+                        break;
+                case 0xc: /* SMAX, UMAX */
+                        cb->MaxVec (rd, rn, rm, size, is_q, !u);
+                        break;
+                case 0xd: /* SMIN, UMIN */
+                        cb->MinVec (rd, rn, rm, size, is_q, !u);
+                        break;
+                case 0x10: /* ADD, SUB */
+                        if (u) {
+                                cb->SubVec (rd, rn, rm, size, is_q);
+                        } else {
+                                cb->AddVec (rd, rn, rm, size, is_q);
+                        }
+                        break;
+                case 0x13: /* MUL, PMUL */
+                        if (u) {
+                                UnsupportedOp ("PMUL");
+                        } else {
+                                cb->MulVec (rd, rn, rm, size, is_q);
+                        }
+                        break;
+                default:
+                        UnallocatedOp (insn);
+                        break;
+        }
+}
+
+template<typename CB>
+static void Handle3SamePair(uint32_t insn, int is_q, bool u, unsigned int opcode,
+        unsigned int rd, unsigned int rn, unsigned int rm, unsigned int size, CB *cb) {
+        /* TODO
+        if (opcode >= 0x58) {
+                fpst = get_fpstatus_ptr(false);
+        } else {
+                fpst = NULL;
+        } */
+        int ebytes = 1 << size;
+        int elements = (is_q ? 128 : 64) / (8 << size);
+        for (int e = 0; e < elements; e++) {
+                unsigned int reg_idx = e < (elements / 2) ? rn : rm;
+                int base = e < (elements / 2) ? e : (e - elements / 2);
+                //ns_print("ADDP V[%u][%u] = V[%u][%u] + V[%u][%u]\n", rd, e, reg_idx, 2 * e, reg_idx, 2 * e + 1);
+                cb->ReadVecElem(GPR_DUMMY, reg_idx, 2 * base, size);
+                cb->ReadVecElem(GPR_DUMMY2, reg_idx, 2 * base + 1, size);
+                switch (opcode) {
+                        case 0x17: /* ADDP */
+                                cb->AddReg (GPR_DUMMY, GPR_DUMMY, GPR_DUMMY2, false, true);
+                                break;
+                        case 0x58: /* FMAXNMP */
+                                UnsupportedOp ("FMAXNMP");
+                                break;
+                        case 0x5a: /* FADDP */
+                                UnsupportedOp ("FADDP");
+                                break;
+                        case 0x5e: /* FMAXP */
+                                UnsupportedOp ("FMAXP");
+                                break;
+                        case 0x78: /* FMINNMP */
+                                UnsupportedOp ("FMINNMP");
+                                break;
+                        case 0x7e: /* FMINP */
+                                UnsupportedOp ("FMINP");
+                                break;
+                }
+                cb->WriteVecElem(VREG_DUMMY, GPR_DUMMY, e, size);
+        }
+        // V[rd] = V[dummy] XXX: More optimize
+        cb->ReadVecElem(GPR_DUMMY, VREG_DUMMY, 0, 3);
+        cb->WriteVecElem(rd, GPR_DUMMY, 0, 3);
+        cb->ReadVecElem(GPR_DUMMY, VREG_DUMMY, 1, 3);
+        cb->WriteVecElem(rd, GPR_DUMMY, 1, 3); 
+}
+
+template<typename CB>
+static void DisasSimd3SameLogic(uint32_t insn, CB *cb) {
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int size = extract32(insn, 22, 2);
+        bool is_u = extract32(insn, 29, 1);
+        bool is_q = extract32(insn, 30, 1);
+        switch (size + 4 * is_u) {
+        case 0: /* AND */
+                cb->AndVecReg(rd, rn, rm);
+                return;
+        case 1: /* BIC */
+                cb->BicVecReg(rd, rn, rm);
+                return;
+        case 2: /* ORR */
+                cb->OrrVecReg(rd, rn, rm);
+                return;
+        case 3: /* ORN */
+                cb->NotVecReg(VREG_DUMMY, rm);
+                cb->OrrVecReg(rd, rn, VREG_DUMMY);
+                return;
+        case 4: /* EOR */
+                cb->EorVecReg(rd, rn, rm);
+                return;
+        case 5: /* BSL bitwise select */
+                UnsupportedOp ("BSL");
+                return;
+        case 6: /* BIT, bitwise insert if true */
+                UnsupportedOp ("BIT");
+                return;
+        case 7: /* BIF, bitwise insert if false */
+                UnsupportedOp ("BIF");
+                return;
+        default:
+                ns_abort ("Unreachable\n");
+        }
+}
+template<typename CB>
+static void DisasSimd3SameInt(uint32_t insn, CB *cb) {
+        unsigned int is_q = extract32(insn, 30, 1);
+        unsigned int u = extract32(insn, 29, 1);
+        unsigned int size = extract32(insn, 22, 2);
+        unsigned int opcode = extract32(insn, 11, 5);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        switch (opcode) {
+                case 0xc: /* SMAX, UMAX */
+                case 0xd: /* SMIN, UMIN */
+                case 0x13: /* MUL, PMUL */
+                        if (size == 3) {
+                                UnallocatedOp (insn);
+                                return;
+                        }
+                        break;
+                default:
+                        if (size == 3 && !is_q) {
+                                UnallocatedOp (insn);
+                                return;
+                        }
+                        break;
+        }
+        /* One callback covers every element of the register */
+        Handle3Same (insn, opcode, u, rd, rn, rm, is_q, size, cb);
+}
+/* fpopcode is opcode | size<1> << 5 | U << 6, see DisasSimd3SameFloat */
+template<typename CB>
+static void Handle3SameFloat(uint32_t insn, unsigned int fpopcode, unsigned int rd, unsigned int rn,
+        unsigned int rm, bool dbl, int elements, CB *cb) {
+        switch (fpopcode) {
+                case 0x18: /* FMAXNM */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_MAXNM);
+                        break;
+                case 0x19: /* FMLA */
+                        cb->FpMulAdd (rd, rn, rm, rd, dbl, elements, false, false);
+                        break;
+                case 0x1a: /* FADD */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_ADD);
+                        break;
+                case 0x1b: /* FMULX */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_MULX);
+                        break;
+                case 0x1c: /* FCMEQ */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_CMEQ);
+                        break;
+                case 0x1e: /* FMAX */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_MAX);
+                        break;
+                case 0x1f: /* FRECPS */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_RECPS);
+                        break;
+                case 0x38: /* FMINNM */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_MINNM);
+                        break;
+                case 0x39: /* FMLS */
+                        cb->FpMulAdd (rd, rn, rm, rd, dbl, elements, true, false);
+                        break;
+                case 0x3a: /* FSUB */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_SUB);
+                        break;
+                case 0x3e: /* FMIN */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_MIN);
+                        break;
+                case 0x3f: /* FRSQRTS */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_RSQRTS);
+                        break;
+                case 0x5b: /* FMUL */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_MUL);
+                        break;
+                case 0x5c: /* FCMGE */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_CMGE);
+                        break;
+                case 0x5d: /* FACGE */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_ACGE);
+                        break;
+                case 0x5f: /* FDIV */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_DIV);
+                        break;
+                case 0x7a: /* FABD */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_ABD);
+                        break;
+                case 0x7c: /* FCMGT */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_CMGT);
+                        break;
+                case 0x7d: /* FACGT */
+                        cb->FpArith (rd, rn, rm, dbl, elements, FpOp_ACGT);
+                        break;
+                /* Pairwise (vector only) */
+                case 0x58: /* FMAXNMP */
+                        cb->FpPairwise (rd, rn, rm, dbl, elements, FpOp_MAXNM);
+                        break;
+                case 0x5a: /* FADDP */
+                        cb->FpPairwise (rd, rn, rm, dbl, elements, FpOp_ADD);
+                        break;
+                case 0x5e: /* FMAXP */
+                        cb->FpPairwise (rd, rn, rm, dbl, elements, FpOp_MAX);
+                        break;
+                case 0x78: /* FMINNMP */
+                        cb->FpPairwise (rd, rn, rm, dbl, elements, FpOp_MINNM);
+                        break;
+                case 0x7e: /* FMINP */
+                        cb->FpPairwise (rd, rn, rm, dbl, elements, FpOp_MIN);
+                        break;
+                default:
+                        UnallocatedOp (insn);
+                        break;
+        }
+}
+
+template<typename CB>
+static void DisasSimd3SameFloat(uint32_t insn, CB *cb) {
+        bool is_q = extract32(insn, 30, 1);
+        unsigned int u = extract32(insn, 29, 1);
+        unsigned int size = extract32(insn, 22, 2);
+        unsigned int opcode = extract32(insn, 11, 5);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        /* U, size<1> and opcode select the operation, size<0> is the precision */
+        unsigned int fpopcode = opcode | (extract32(size, 1, 1) << 5) | (u << 6);
+        bool dbl = extract32(size, 0, 1);
+        if (dbl && !is_q) {
+                UnallocatedOp (insn);
+                return;
+        }
+        Handle3SameFloat (insn, fpopcode, rd, rn, rm, dbl, (is_q ? 4 : 2) >> dbl, cb);
+}
+
+/* Vector variant, op <Vd>.<T>, <Vn>.<T>, <Vm>.<T> means, Vd.ns[T] = Vn.ns[T] op Vm.ns[T] */
+template<typename CB>
+static void DisasSimdThreeRegSame(uint32_t insn, CB *cb) {
+        unsigned int opcode = extract32(insn, 11, 5);
+
+        switch (opcode) {
+                case 0x3: /* logic ops */
+                        DisasSimd3SameLogic (insn, cb);
+                        break;
+                case 0x17: /* ADDP */
+                case 0x14: /* SMAXP, UMAXP */
+                case 0x15: /* SMINP, UMINP */
+                {
+                        /* Pairwise operations */
+                        unsigned int is_q = extract32(insn, 30, 1);
+                        unsigned int u = extract32(insn, 29, 1);
+                        unsigned int size = extract32(insn, 22, 2);
+                        unsigned int rm = extract32(insn, 16, 5);
+                        unsigned int rn = extract32(insn, 5, 5);
+                        unsigned int rd = extract32(insn, 0, 5);
+                        if (opcode == 0x17) {
+                                if (u || (size == 3 && !is_q)) {
+                                        UnallocatedOp (insn);
+                                }
+                        } else {
+                                if (size == 3) {
+                                        UnallocatedOp (insn);
+                                }
+                        }
+                        Handle3SamePair(insn, is_q, u, opcode, rd, rn, rm, size, cb);
+                        break;
+                }
+                case 0x18 ... 0x1f:
+                        /* floating point ops, sz[1] and U are part of opcode */
+                        DisasSimd3SameFloat (insn, cb);
+                        break;
+                default:
+                        DisasSimd3SameInt(insn, cb);
+                        break;
+        }
+}
+
+/* Scalar variant, op <V><d>, <V><n>, <V><m> means, Vd.ns[0] = Vn.ns[0] op Vm.ns[0] */
+template<typename CB>
+static void DisasSimdScalarThreeRegSame(uint32_t insn, CB *cb) {
+        unsigned int rd = extract32(insn, 0, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int opcode = extract32(insn, 11, 5);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int size = extract32(insn, 22, 2);
+        bool u = extract32(insn, 29, 1);
+        if (opcode >= 0x18) {
+                /* Floating point: U, size[1] and opcode indicate operation */
+                int fpopcode = opcode | (extract32(size, 1, 1) << 5) | (u << 6);
+                switch (fpopcode) {
+                case 0x1b: /* FMULX */
+                case 0x1f: /* FRECPS */
+                case 0x3f: /* FRSQRTS */
+                case 0x5d: /* FACGE */
+                case 0x7d: /* FACGT */
+                case 0x1c: /* FCMEQ */
+                case 0x5c: /* FCMGE */
+                case 0x7c: /* FCMGT */
+                case 0x7a: /* FABD */
+                        break;
+                default:
+                        UnallocatedOp (insn);
+                        return;
+                }
+
+                Handle3SameFloat (insn, fpopcode, rd, rn, rm, extract32(size, 0, 1), 1, cb);
+                return;
+        }
+
+        switch (opcode) {
+        case 0x1: /* SQADD, UQADD */
+        case 0x5: /* SQSUB, UQSUB */
+                if (size != 3) {
+                        /* Would need a single B/H/S lane */
+                        UnsupportedOp ("Scalar saturating op");
+                        return;
+                }
+                break;
+        case 0x9: /* SQSHL, UQSHL */
+        case 0xb: /* SQRSHL, UQRSHL */
+                break;
+        case 0x8: /* SSHL, USHL */
+        case 0xa: /* SRSHL, URSHL */
+        case 0x6: /* CMGT, CMHI */
+        case 0x7: /* CMGE, CMHS */
+        case 0x11: /* CMTST, CMEQ */
+        case 0x10: /* ADD, SUB (vector) */
+                if (size != 3) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                break;
+        case 0x16: /* SQDMULH, SQRDMULH (vector) */
+                if (size != 1 && size != 2) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                break;
+        default:
+                UnallocatedOp (insn);
+                return;
+        }
+        /* A scalar is the low element of a 64bit vector, the rest is cleared */
+        Handle3Same (insn, opcode, u, rd, rn, rm, false, size, cb);
+}
+
+/* FP compare against zero: lt/le swap the operands of gt/ge */
+template<typename CB>
+static void HandleFpCompareZero(unsigned int fpopcode, unsigned int rd, unsigned int rn,
+        bool dbl, int elements, CB *cb) {
+        cb->DupVecImmI64 (VREG_DUMMY, 0, 3, 128);
+        switch (fpopcode) {
+                case 0x2c: /* FCMGT (zero) */
+                        cb->FpArith (rd, rn, VREG_DUMMY, dbl, elements, FpOp_CMGT);
+                        break;
+                case 0x2d: /* FCMEQ (zero) */
+                        cb->FpArith (rd, rn, VREG_DUMMY, dbl, elements, FpOp_CMEQ);
+                        break;
+                case 0x2e: /* FCMLT (zero) */
+                        cb->FpArith (rd, VREG_DUMMY, rn, dbl, elements, FpOp_CMGT);
+                        break;
+                case 0x6c: /* FCMGE (zero) */
+                        cb->FpArith (rd, rn, VREG_DUMMY, dbl, elements, FpOp_CMGE);
+                        break;
+                case 0x6d: /* FCMLE (zero) */
+                        cb->FpArith (rd, VREG_DUMMY, rn, dbl, elements, FpOp_CMGE);
+                        break;
+        }
+}
+
+/* Floating point part of two reg misc, shared by vector and scalar (elements == 1) forms.
+ * fpopcode is opcode | size<1> << 5 | U << 6 */
+template<typename CB>
+static void HandleTwoRegMiscFp(uint32_t insn, unsigned int fpopcode, unsigned int rd, unsigned int rn,
+        bool dbl, int elements, CB *cb) {
+        switch (fpopcode) {
+                case 0x2c: /* FCMGT (zero) */
+                case 0x2d: /* FCMEQ (zero) */
+                case 0x2e: /* FCMLT (zero) */
+                case 0x6c: /* FCMGE (zero) */
+                case 0x6d: /* FCMLE (zero) */
+                        HandleFpCompareZero (fpopcode, rd, rn, dbl, elements, cb);
+                        break;
+                case 0x2f: /* FABS */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_ABS);
+                        break;
+                case 0x6f: /* FNEG */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_NEG);
+                        break;
+                case 0x7f: /* FSQRT */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_SQRT);
+                        break;
+                case 0x3d: /* FRECPE */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RECPE);
+                        break;
+                case 0x7d: /* FRSQRTE */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RSQRTE);
+                        break;
+                case 0x18: /* FRINTN */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RINTN);
+                        break;
+                case 0x19: /* FRINTM */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RINTM);
+                        break;
+                case 0x38: /* FRINTP */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RINTP);
+                        break;
+                case 0x39: /* FRINTZ */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RINTZ);
+                        break;
+                case 0x58: /* FRINTA */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RINTA);
+                        break;
+                case 0x59: /* FRINTX */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RINTX);
+                        break;
+                case 0x79: /* FRINTI */
+                        cb->FpUnary (rd, rn, dbl, elements, FpOp_RINTI);
+                        break;
+                case 0x1a: /* FCVTNS */
+                case 0x1b: /* FCVTMS */
+                case 0x3a: /* FCVTPS */
+                case 0x3b: /* FCVTZS */
+                case 0x5a: /* FCVTNU */
+                case 0x5b: /* FCVTMU */
+                case 0x7a: /* FCVTPU */
+                case 0x7b: /* FCVTZU */
+                {
+                        int rounding = extract32(fpopcode, 5, 1) | (extract32(fpopcode, 0, 1) << 1);
+                        cb->FpToIntVec (rd, rn, dbl, elements, !(fpopcode & 0x40), rounding);
+                        break;
+                }
+                case 0x1c: /* FCVTAS */
+                case 0x5c: /* FCVTAU */
+                        cb->FpToIntVec (rd, rn, dbl, elements, !(fpopcode & 0x40), FpRounding_TIEAWAY);
+                        break;
+                case 0x1d: /* SCVTF */
+                case 0x5d: /* UCVTF */
+                        cb->IntToFpVec (rd, rn, dbl, elements, !(fpopcode & 0x40));
+                        break;
+                case 0x3c: /* URECPE */
+                case 0x7c: /* URSQRTE */
+                        UnsupportedOp ("URECPE/URSQRTE");
+                        break;
+                case 0x3f: /* FRECPX */
+                        UnsupportedOp ("FRECPX");
+                        break;
+                case 0x56: /* FCVTXN */
+                        UnsupportedOp ("FCVTXN");
+                        break;
+                default:
+                        UnallocatedOp (insn);
+                        break;
+        }
+}
+
+template<typename CB>
+static void DisasSimdTwoRegMisc(uint32_t insn, CB *cb) {
+        bool is_q = extract32(insn, 30, 1);
+        unsigned int u = extract32(insn, 29, 1);
+        unsigned int size = extract32(insn, 22, 2);
+        unsigned int opcode = extract32(insn, 12, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (extract32(insn, 17, 2)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        switch (opcode) {
+        case 0xc ... 0xf:
+        case 0x16 ... 0x1f:
+        {
+                /* Floating point: U, size<1> and opcode indicate operation, size<0> the precision */
+                unsigned int fpopcode = opcode | (extract32(size, 1, 1) << 5) | (u << 6);
+                bool dbl = extract32(size, 0, 1);
+                if (fpopcode == 0x16 || fpopcode == 0x17) {
+                        /* FCVTN/FCVTN2 (double -> single), FCVTL/FCVTL2 (single -> double) */
+                        if (!dbl) {
+                                UnsupportedOp ("FCVTN/FCVTL half precision");
+                                return;
+                        }
+                        cb->FpConvertVec (rd, rn, fpopcode == 0x17, is_q);
+                        return;
+                }
+                if (dbl && !is_q) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                HandleTwoRegMiscFp (insn, fpopcode, rd, rn, dbl, (is_q ? 4 : 2) >> dbl, cb);
+                break;
+        }
+        default:
+                UnsupportedOp ("2 reg misc (integer)");
+                break;
+        }
+}
+
+template<typename CB>
+static void DisasSimdScalarTwoRegMisc(uint32_t insn, CB *cb) {
+        unsigned int u = extract32(insn, 29, 1);
+        unsigned int size = extract32(insn, 22, 2);
+        unsigned int opcode = extract32(insn, 12, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (extract32(insn, 17, 2)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        switch (opcode) {
+        case 0xc ... 0xf:
+        case 0x16 ... 0x1d:
+        case 0x1f:
+        {
+                unsigned int fpopcode = opcode | (extract32(size, 1, 1) << 5) | (u << 6);
+                HandleTwoRegMiscFp (insn, fpopcode, rd, rn, extract32(size, 0, 1), 1, cb);
+                break;
+        }
+        default:
+                UnsupportedOp ("Scalar 2 reg misc (integer)");
+                break;
+        }
+}
+
+/* FP by element: Vm[index] is broadcast into VREG_DUMMY and the same element op is used */
+template<typename CB>
+static void DisasSimdIndexed(uint32_t insn, CB *cb) {
+        bool is_scalar = extract32(insn, 28, 1);
+        bool is_q = extract32(insn, 30, 1);
+        bool u = extract32(insn, 29, 1);
+        unsigned int size = extract32(insn, 22, 2);
+        unsigned int l = extract32(insn, 21, 1);
+        unsigned int m = extract32(insn, 20, 1);
+        unsigned int rm = extract32(insn, 16, 4) | (m << 4);
+        unsigned int opcode = extract32(insn, 12, 4);
+        unsigned int h = extract32(insn, 11, 1);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        switch (opcode) {
+        case 0x1: /* FMLA */
+        case 0x5: /* FMLS */
+        case 0x9: /* FMUL, FMULX */
+                if (size < 2) {
+                        UnsupportedOp ("Half precision by element");
+                        return;
+                }
+                if ((opcode != 0x9 && u) || (size == 3 && (l || (!is_q && !is_scalar)))) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                break;
+        default:
+                UnsupportedOp ("Integer by element");
+                return;
+        }
+        bool dbl = size == 3;
+        unsigned int index = dbl ? h : (h << 1) | l;
+        int elements = is_scalar ? 1 : (is_q ? 4 : 2) >> dbl;
+        cb->DupVecReg (VREG_DUMMY, rm, index, size, 128);
+        switch (opcode) {
+        case 0x1: /* FMLA */
+                cb->FpMulAdd (rd, rn, VREG_DUMMY, rd, dbl, elements, false, false);
+                break;
+        case 0x5: /* FMLS */
+                cb->FpMulAdd (rd, rn, VREG_DUMMY, rd, dbl, elements, true, false);
+                break;
+        case 0x9: /* FMUL, FMULX */
+                cb->FpArith (rd, rn, VREG_DUMMY, dbl, elements, u ? FpOp_MULX : FpOp_MUL);
+                break;
+        }
+}
+
+template<typename CB>
+static void DisasSimdScalarPairwise(uint32_t insn, CB *cb) {
+        bool u = extract32(insn, 29, 1);
+        unsigned int size = extract32(insn, 22, 2);
+        unsigned int opcode = extract32(insn, 12, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+        if (extract32(insn, 17, 2)) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (opcode == 0x1b && !u) {
+                /* ADDP (scalar) */
+                if (size != 3) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                cb->ReadVecElem (GPR_DUMMY, rn, 0, 3);
+                cb->ReadVecElem (GPR_DUMMY2, rn, 1, 3);
+                cb->AddReg (GPR_DUMMY, GPR_DUMMY, GPR_DUMMY2, false, true);
+                cb->FMovConv (rd, GPR_DUMMY, 1, true);
+                return;
+        }
+        if (!u) {
+                UnsupportedOp ("Half precision pairwise");
+                return;
+        }
+        /* The two elements of Vn are reduced into one */
+        bool dbl = extract32(size, 0, 1);
+        bool min = extract32(size, 1, 1);
+        switch (opcode) {
+        case 0xc: /* FMAXNMP, FMINNMP */
+                cb->FpPairwise (rd, rn, rn, dbl, 1, min ? FpOp_MINNM : FpOp_MAXNM);
+                break;
+        case 0xd: /* FADDP */
+                if (min) {
+                        UnallocatedOp (insn);
+                        return;
+                }
+                cb->FpPairwise (rd, rn, rn, dbl, 1, FpOp_ADD);
+                break;
+        case 0xf: /* FMAXP, FMINP */
+                cb->FpPairwise (rd, rn, rn, dbl, 1, min ? FpOp_MIN : FpOp_MAX);
+                break;
+        default:
+                UnallocatedOp (insn);
+                break;
+        }
+}
+
+template<typename CB>
+static void DisasSimdScalarCopy(uint32_t insn, CB *cb) {
+        unsigned int fd = extract32(insn, 0, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int imm4 = extract32(insn, 11, 4);
+        unsigned int imm5 = extract32(insn, 16, 5);
+        unsigned int op = extract32(insn, 29, 1);
+        int size = ctz32(imm5);
+
+        if (op != 0 || imm4 != 0) {
+                UnallocatedOp (insn);
+                return;
+        }
+        if (size > 3) {
+                UnallocatedOp (insn);
+        }
+        int index = imm5 >> (size + 1);
+        cb->ReadVecReg (fd, rn, index, size);
+}
+
+/* Only the polynomial multiplies (PMULL, PMULL2) of the group are handled */
+template<typename CB>
+static void DisasSimdThreeRegDiff(uint32_t insn, CB *cb) {
+        bool is_q = extract32(insn, 30, 1);
+        unsigned int u = extract32(insn, 29, 1);
+        unsigned int size = extract32(insn, 22, 2);
+        unsigned int opcode = extract32(insn, 12, 4);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+
+        if (opcode != 0xe || u) {
+                UnsupportedOp ("3 reg diff (except PMULL)");
+                return;
+        }
+        if (size != 0 && size != 3) {
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->PolyMulLong (rd, rn, rm, size, is_q);
+}
+
+/* AESE, AESD, AESMC, AESIMC */
+template<typename CB>
+static void DisasCryptoAes(uint32_t insn, CB *cb) {
+        unsigned int opcode = extract32(insn, 12, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+
+        /* size (insn[23:22]) other than 0 is unallocated */
+        if (extract32(insn, 22, 2) || extract32(insn, 17, 2) || opcode < 0x4 || opcode > 0x7) {
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->CryptoAes (rd, rn, AesOp_AESE + (opcode - 0x4));
+}
+
+/* SHA1C, SHA1P, SHA1M, SHA1SU0, SHA256H, SHA256H2, SHA256SU1 */
+template<typename CB>
+static void DisasCryptoThreeRegSha(uint32_t insn, CB *cb) {
+        unsigned int opcode = extract32(insn, 12, 3);
+        unsigned int rm = extract32(insn, 16, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+
+        if (extract32(insn, 22, 2) || opcode == 0x7) {
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->CryptoSha (rd, rn, rm, ShaOp_SHA1C + opcode);
+}
+
+/* SHA1H, SHA1SU1, SHA256SU0 */
+template<typename CB>
+static void DisasCryptoTwoRegSha(uint32_t insn, CB *cb) {
+        unsigned int opcode = extract32(insn, 12, 5);
+        unsigned int rn = extract32(insn, 5, 5);
+        unsigned int rd = extract32(insn, 0, 5);
+
+        if (extract32(insn, 22, 2) || extract32(insn, 17, 2) || opcode > 0x2) {
+                UnallocatedOp (insn);
+                return;
+        }
+        cb->CryptoSha (rd, rn, 0, ShaOp_SHA1H + opcode);
+}
+
+/*
+ * Decode table
+ * Each leaf decoder is described by a pattern/mask rule (the first match wins).
+ * At compile time the rules are folded into a two level table. The first level
+ * is indexed by insn[31:21]. Groups which also depend on insn[20:19] or
+ * insn[15:10] (load/store register, FP and SIMD) go through a shared second
+ * level table indexed by those bits.
+ */
+enum DecodeLeaf : uint8_t {
+        DECODE_UNALLOCATED = 0,
+        DECODE_PC_REL_ADDR,
+        DECODE_ADD_SUB_IMM,
+        DECODE_LOG_IMM,
+        DECODE_MOVW_IMM,
+        DECODE_BITFIELD,
+        DECODE_EXTRACT,
+        DECODE_UNCOND_BR_IMM,
+        DECODE_COMP_BR_IMM,
+        DECODE_TEST_BR_IMM,
+        DECODE_COND_BR_IMM,
+        DECODE_EXCEPTION,
+        DECODE_SYSTEM,
+        DECODE_UNCOND_BR_REG,
+        DECODE_LDST_EXCL,
+        DECODE_LD_LIT,
+        DECODE_LDST_PAIR,
+        DECODE_LDST_REG_ROFFSET,
+        DECODE_LDST_REG_IMM9,
+        DECODE_LDST_REG_UNSIGNED_IMM,
+        DECODE_LDST_MULTI,
+        DECODE_LDST_SINGLE,
+        DECODE_LOGIC_REG,
+        DECODE_ADD_SUB_EXT_REG,
+        DECODE_ADD_SUB_REG,
+        DECODE_DATA_PROC_3SRC,
+        DECODE_ADD_SUBC_REG,
+        DECODE_COND_CMP,
+        DECODE_COND_SEL,
+        DECODE_DATA_PROC_1SRC,
+        DECODE_DATA_PROC_2SRC,
+        DECODE_FP_3SRC,
+        DECODE_FP_FIXED_CONV,
+        DECODE_FP_CCOMP,
+        DECODE_FP_2SRC,
+        DECODE_FP_CSEL,
+        DECODE_FP_IMM,
+        DECODE_FP_COMPARE,
+        DECODE_FP_1SRC,
+        DECODE_FP_INT_CONV,
+        DECODE_SIMD_THREE_REG_SAME,
+        DECODE_SIMD_COPY,
+        DECODE_SIMD_MOD_IMM,
+        DECODE_SIMD_SCALAR_THREE_REG_SAME,
+        DECODE_SIMD_SCALAR_COPY,
+        DECODE_SIMD_TWO_REG_MISC,
+        DECODE_SIMD_SCALAR_TWO_REG_MISC,
+        DECODE_SIMD_SCALAR_PAIRWISE,
+        DECODE_SIMD_INDEXED,
+        DECODE_SIMD_THREE_REG_DIFF,
+        DECODE_CRYPTO_AES,
+        DECODE_CRYPTO_THREE_REG_SHA,
+        DECODE_CRYPTO_TWO_REG_SHA,
+};
+
+struct DecodeRule {
+        uint32_t pattern;
+        uint32_t mask;
+        DecodeLeaf leaf;
+};
+
+static constexpr DecodeRule decode_rules[] = {
+    /* pattern  ,  mask     ,  leaf                        */
+    /* C4.1.2 Data processing - immediate */
+    { 0x10000000, 0x1f000000, DECODE_PC_REL_ADDR },
+    { 0x11000000, 0x1f000000, DECODE_ADD_SUB_IMM },
+    { 0x12000000, 0x1f800000, DECODE_LOG_IMM },
+    { 0x12800000, 0x1f800000, DECODE_MOVW_IMM },
+    { 0x13000000, 0x1f800000, DECODE_BITFIELD },
+    { 0x13800000, 0x1f800000, DECODE_EXTRACT },
+    /* C4.1.3 Branches, exception generating and system instructions */
+    { 0x14000000, 0x7c000000, DECODE_UNCOND_BR_IMM },
+    { 0x34000000, 0x7e000000, DECODE_COMP_BR_IMM },
+    { 0x36000000, 0x7e000000, DECODE_TEST_BR_IMM },
+    { 0x54000000, 0xfe000000, DECODE_COND_BR_IMM },
+    { 0xd4000000, 0xff000000, DECODE_EXCEPTION },
+    { 0xd5000000, 0xff000000, DECODE_SYSTEM },
+    { 0xd6000000, 0xfe000000, DECODE_UNCOND_BR_REG },
+    /* C4.1.4 Loads and stores */
+    { 0x08000000, 0x3f000000, DECODE_LDST_EXCL },
+    { 0x18000000, 0x3b000000, DECODE_LD_LIT },
+    { 0x28000000, 0x3a000000, DECODE_LDST_PAIR },
+    { 0x38200800, 0x3b200c00, DECODE_LDST_REG_ROFFSET },
+    { 0x38000000, 0x3b000000, DECODE_LDST_REG_IMM9 },
+    { 0x39000000, 0x3b000000, DECODE_LDST_REG_UNSIGNED_IMM },
+    { 0x0c000000, 0x3f000000, DECODE_LDST_MULTI },
+    { 0x0d000000, 0x3f000000, DECODE_LDST_SINGLE },
+    /* C4.1.6 Data processing - register */
+    { 0x0a000000, 0x1f000000, DECODE_LOGIC_REG },
+    { 0x0b200000, 0x1f200000, DECODE_ADD_SUB_EXT_REG },
+    { 0x0b000000, 0x1f200000, DECODE_ADD_SUB_REG },
+    { 0x1b000000, 0x1f000000, DECODE_DATA_PROC_3SRC },
+    { 0x1a000000, 0x1fe00000, DECODE_ADD_SUBC_REG },
+    { 0x1a400000, 0x1fe00000, DECODE_COND_CMP },
+    { 0x1a800000, 0x1fe00000, DECODE_COND_SEL },
+    { 0x5ac00000, 0x5fe00000, DECODE_DATA_PROC_1SRC },
+    { 0x1ac00000, 0x5fe00000, DECODE_DATA_PROC_2SRC },
+    /* C4.1.5 Data Processing -- Scalar Floating-Point */
+    { 0x1f000000, 0x5f000000, DECODE_FP_3SRC },
+    { 0x1e000000, 0x5f200000, DECODE_FP_FIXED_CONV },
+    { 0x1e200400, 0x5f200c00, DECODE_FP_CCOMP },
+    { 0x1e200800, 0x5f200c00, DECODE_FP_2SRC },
+    { 0x1e200c00, 0x5f200c00, DECODE_FP_CSEL },
+    { 0x1e201000, 0x5f201c00, DECODE_FP_IMM },       /* [15:12] == xxx1 */
+    { 0x1e202000, 0x5f203c00, DECODE_FP_COMPARE },   /* [15:12] == xx10 */
+    { 0x1e204000, 0x5f207c00, DECODE_FP_1SRC },      /* [15:12] == x100 */
+    { 0x1e200000, 0x5f20fc00, DECODE_FP_INT_CONV },  /* [15:12] == 0000 */
+    /* C4.1.5 Data Processing -- Advanced SIMD */
+    { 0x0e200400, 0x9f200400, DECODE_SIMD_THREE_REG_SAME },
+    // { 0x0e008400, 0x9f208400, disas_simd_three_reg_same_extra },
+    { 0x0e200000, 0x9f200c00, DECODE_SIMD_THREE_REG_DIFF },
+    { 0x0e200800, 0x9f380c00, DECODE_SIMD_TWO_REG_MISC },  /* [18:17] checked by decoder */
+    // { 0x0e300800, 0x9f3e0c00, disas_simd_across_lanes },
+    { 0x0e000400, 0x9fe08400, DECODE_SIMD_COPY },
+    { 0x0f000000, 0x9f000400, DECODE_SIMD_INDEXED }, /* vector indexed */
+    // /* simd_mod_imm decode is a subset of simd_shift_imm, so must precede it */
+    { 0x0f000400, 0x9ff80400, DECODE_SIMD_MOD_IMM },
+    // { 0x0f000400, 0x9f800400, disas_simd_shift_imm },
+    // { 0x0e000000, 0xbf208c00, disas_simd_tb },
+    // { 0x0e000800, 0xbf208c00, disas_simd_zip_trn },
+    // { 0x2e000000, 0xbf208400, disas_simd_ext },
+    { 0x5e200400, 0xdf200400, DECODE_SIMD_SCALAR_THREE_REG_SAME },
+    // { 0x5e008400, 0xdf208400, disas_simd_scalar_three_reg_same_extra },
+    // { 0x5e200000, 0xdf200c00, disas_simd_scalar_three_reg_diff },
+    { 0x5e200800, 0xdf380c00, DECODE_SIMD_SCALAR_TWO_REG_MISC },  /* [18:17] checked by decoder */
+    { 0x5e300800, 0xdf380c00, DECODE_SIMD_SCALAR_PAIRWISE },  /* [18:17] checked by decoder */
+    { 0x5e000400, 0xdfe08400, DECODE_SIMD_SCALAR_COPY },
+    { 0x5f000000, 0xdf000400, DECODE_SIMD_INDEXED }, /* scalar indexed */
+    // { 0x5f000400, 0xdf800400, disas_simd_scalar_shift_imm },
+    { 0x4e280800, 0xff380c00, DECODE_CRYPTO_AES },  /* [18:17] checked by decoder */
+    { 0x5e000000, 0xff208c00, DECODE_CRYPTO_THREE_REG_SHA },
+    { 0x5e280800, 0xff380c00, DECODE_CRYPTO_TWO_REG_SHA },  /* [18:17] checked by decoder */
+    // { 0xce608000, 0xffe0b000, disas_crypto_three_reg_sha512 },
+    // { 0xcec08000, 0xfffff000, disas_crypto_two_reg_sha512 },
+    // { 0xce000000, 0xff808000, disas_crypto_four_reg },
+    // { 0xce800000, 0xffe00000, disas_crypto_xar },
+    // { 0xce408000, 0xffe0c000, disas_crypto_three_reg_imm2 },
+    // { 0x0e400400, 0x9f60c400, disas_simd_three_reg_same_fp16 },
+    // { 0x0e780800, 0x8f7e0c00, disas_simd_two_reg_misc_fp16 },
+    // { 0x5e400400, 0xdf60c400, disas_simd_scalar_three_reg_same_fp16 },
+};
+
+#define DECODE_NUM_RULES (sizeof(decode_rules) / sizeof(decode_rules[0]))
+#define DECODE_L1_SHIFT  21
+#define DECODE_L1_SIZE   (1 << 11)
+#define DECODE_L2_SIZE   (1 << 8)
+#define DECODE_L2_MASK   0x0018fc00U // insn[20:19], insn[15:10]
+#define DECODE_SUBTABLE  0x8000
+
+static_assert (DECODE_NUM_RULES <= 64, "Decode rule set doesn't fit in uint64_t");
+
+static constexpr bool DecodeRulesCovered() {
+        for (const DecodeRule &rule : decode_rules) {
+                if (rule.mask & ~(DECODE_L2_MASK | ~((1U << DECODE_L1_SHIFT) - 1)))
+                        return false;
+        }
+        return true;
+}
+static_assert (DecodeRulesCovered (), "Decode rule depends on bits not indexed by decode table");
+
+static constexpr uint32_t DecodeL2Index(uint32_t insn) {
+        return ((insn >> 19) & 0x3) << 6 | ((insn >> 10) & 0x3f);
+}
+
+static constexpr uint32_t DecodeL2Insn(uint32_t index) {
+        return (index >> 6) << 19 | (index & 0x3f) << 10;
+}
+
+/* Rules which can match an instruction with insn[31:21] == index */
+static constexpr uint64_t DecodeCandidates(uint32_t index) {
+        uint32_t insn = index << DECODE_L1_SHIFT;
+        uint64_t set = 0;
+        for (unsigned int r = 0; r < DECODE_NUM_RULES; r++) {
+                if (((insn ^ decode_rules[r].pattern) & decode_rules[r].mask & ~DECODE_L2_MASK) == 0)
+                        set |= 1ULL << r;
+        }
+        return set;
+}
+
+/* First candidate matching insn[20:19], insn[15:10] */
+static constexpr DecodeLeaf DecodeFirstMatch(uint64_t set, uint32_t insn) {
+        for (unsigned int r = 0; r < DECODE_NUM_RULES; r++) {
+                if ((set & (1ULL << r)) && ((insn ^ decode_rules[r].pattern) & decode_rules[r].mask & DECODE_L2_MASK) == 0)
+                        return decode_rules[r].leaf;
+        }
+        return DECODE_UNALLOCATED;
+}
+
+/* Second level is needed unless the first candidate ignores insn[20:19], insn[15:10] */
+static constexpr bool DecodeNeedsL2(uint64_t set) {
+        for (unsigned int r = 0; r < DECODE_NUM_RULES; r++) {
+                if (set & (1ULL << r))
+                        return (decode_rules[r].mask & DECODE_L2_MASK) != 0;
+        }
+        return false;
+}
+
+/* Second level tables are shared between first level entries with the same candidates */
+static constexpr unsigned int DecodeNumSubTables() {
+        uint64_t sets[DECODE_L1_SIZE] = {};
+        unsigned int num = 0;
+        for (uint32_t index = 0; index < DECODE_L1_SIZE; index++) {
+                uint64_t set = DecodeCandidates (index);
+                if (!DecodeNeedsL2 (set))
+                        continue;
+                unsigned int i = 0;
+                while (i < num && sets[i] != set)
+                        i++;
+                if (i == num)
+                        sets[num++] = set;
+        }
+        return num;
+}
+
+template<unsigned int N> struct DecodeTable {
+        uint16_t l1[DECODE_L1_SIZE];
+        DecodeLeaf l2[N][DECODE_L2_SIZE];
+};
+
+template<unsigned int N> static constexpr DecodeTable<N> BuildDecodeTable() {
+        DecodeTable<N> table = {};
+        uint64_t sets[N] = {};
+        unsigned int num = 0;
+        for (uint32_t index = 0; index < DECODE_L1_SIZE; index++) {
+                uint64_t set = DecodeCandidates (index);
+                if (!DecodeNeedsL2 (set)) {
+                        table.l1[index] = DecodeFirstMatch (set, 0);
+                        continue;
+                }
+                unsigned int i = 0;
+                while (i < num && sets[i] != set)
+                        i++;
+                if (i == num) {
+                        sets[num++] = set;
+                        for (uint32_t j = 0; j < DECODE_L2_SIZE; j++)
+                                table.l2[i][j] = DecodeFirstMatch (set, DecodeL2Insn (j));
+                }
+                table.l1[index] = DECODE_SUBTABLE | i;
+        }
+        return table;
+}
+
+static constexpr auto decode_table = BuildDecodeTable<DecodeNumSubTables ()> ();
+
+static inline DecodeLeaf DecodeLookup(uint32_t insn) {
+        uint16_t ent = decode_table.l1[insn >> DECODE_L1_SHIFT];
+        if (ent & DECODE_SUBTABLE)
+                return decode_table.l2[ent & ~DECODE_SUBTABLE][DecodeL2Index (insn)];
+        return (DecodeLeaf) ent;
+}
+
+template<typename CB>
+void DisasA64(uint32_t insn, CB *cb) {
+        switch (DecodeLookup (insn)) {
+        case DECODE_PC_REL_ADDR:
+                DisasPCRelAddr (insn, cb);
+                break;
+        case DECODE_ADD_SUB_IMM:
+                DisasAddSubImm (insn, cb);
+                break;
+        case DECODE_LOG_IMM:
+                DisasLogImm (insn, cb);
+                break;
+        case DECODE_MOVW_IMM:
+                DisasMovwImm (insn, cb);
+                break;
+        case DECODE_BITFIELD:
+                DisasBitfield (insn, cb);
+                break;
+        case DECODE_EXTRACT:
+                DisasExtract (insn, cb);
+                break;
+        case DECODE_UNCOND_BR_IMM:
+                DisasUncondBrImm (insn, cb);
+                break;
+        case DECODE_COMP_BR_IMM:
+                DisasCompBrImm (insn, cb);
+                break;
+        case DECODE_TEST_BR_IMM:
+                DisasTestBrImm (insn, cb);
+                break;
+        case DECODE_COND_BR_IMM:
+                DisasCondBrImm (insn, cb);
+                break;
+        case DECODE_EXCEPTION:
+                DisasException (insn, cb);
+                break;
+        case DECODE_SYSTEM:
+                DisasSystem (insn, cb);
+                break;
+        case DECODE_UNCOND_BR_REG:
+                DisasUncondBrReg (insn, cb);
+                break;
+        case DECODE_LDST_EXCL:
+                DisasLdstExcl (insn, cb);
+                break;
+        case DECODE_LD_LIT:
+                DisasLdLit (insn, cb);
+                break;
+        case DECODE_LDST_PAIR:
+                DisasLdstPair (insn, cb);
+                break;
+        case DECODE_LDST_REG_ROFFSET:
+                DisasLdstRegRoffset (insn, cb, extract32(insn, 22, 2), extract32(insn, 30, 2),
+                                     extract32(insn, 0, 5), extract32(insn, 26, 1));
+                break;
+        case DECODE_LDST_REG_IMM9:
+                /*
+                 * Load/store register (unscaled immediate)
+                 * Load/store immediate pre/post-indexed
+                 * Load/store register unprivileged
+                 */
+                DisasLdstRegImm9 (insn, cb, extract32(insn, 22, 2), extract32(insn, 30, 2),
+                                  extract32(insn, 0, 5), extract32(insn, 26, 1));
+                break;
+        case DECODE_LDST_REG_UNSIGNED_IMM:
+                DisasLdstRegUnsignedImm (insn, cb, extract32(insn, 22, 2), extract32(insn, 30, 2),
+                                         extract32(insn, 0, 5), extract32(insn, 26, 1));
+                break;
+        case DECODE_LDST_MULTI:
+                DisasLdStMulti (insn, cb);
+                break;
+        case DECODE_LDST_SINGLE:
+                DisasLdStSingle (insn, cb);
+                break;
+        case DECODE_LOGIC_REG:
+                DisasLogicReg (insn, cb);
+                break;
+        case DECODE_ADD_SUB_EXT_REG:
+                DisasAddSubExtReg (insn, cb);
+                break;
+        case DECODE_ADD_SUB_REG:
+                DisasAddSubReg (insn, cb);
+                break;
+        case DECODE_DATA_PROC_3SRC:
+                DisasDataProc3src (insn, cb);
+                break;
+        case DECODE_ADD_SUBC_REG:
+                DisasAddSubcReg (insn, cb);
+                break;
+        case DECODE_COND_CMP:
+                DisasCondCmp (insn, cb);
+                break;
+        case DECODE_COND_SEL:
+                DisasCondSel (insn, cb);
+                break;
+        case DECODE_DATA_PROC_1SRC:
+                DisasDataProc1src (insn, cb);
+                break;
+        case DECODE_DATA_PROC_2SRC:
+                DisasDataProc2src (insn, cb);
+                break;
+        case DECODE_FP_3SRC:
+                DisasFp3Src (insn, cb);
+                break;
+        case DECODE_FP_FIXED_CONV:
+                DisasFpFixedConv (insn, cb);
+                break;
+        case DECODE_FP_CCOMP:
+                DisasFpCcomp (insn, cb);
+                break;
+        case DECODE_FP_2SRC:
+                DisasFp2Src (insn, cb);
+                break;
+        case DECODE_FP_CSEL:
+                DisasFpCsel (insn, cb);
+                break;
+        case DECODE_FP_IMM:
+                DisasFpImm (insn, cb);
+                break;
+        case DECODE_FP_COMPARE:
+                DisasFpCompare (insn, cb);
+                break;
+        case DECODE_FP_1SRC:
+                DisasFp1Src (insn, cb);
+                break;
+        case DECODE_FP_INT_CONV:
+                DisasFpIntConv (insn, cb);
+                break;
+        case DECODE_SIMD_THREE_REG_SAME:
+                DisasSimdThreeRegSame (insn, cb);
+                break;
+        case DECODE_SIMD_COPY:
+                DisasSimdCopy (insn, cb);
+                break;
+        case DECODE_SIMD_MOD_IMM:
+                DisasSimdModImm (insn, cb);
+                break;
+        case DECODE_SIMD_SCALAR_THREE_REG_SAME:
+                DisasSimdScalarThreeRegSame (insn, cb);
+                break;
+        case DECODE_SIMD_SCALAR_COPY:
+                DisasSimdScalarCopy (insn, cb);
+                break;
+        case DECODE_SIMD_TWO_REG_MISC:
+                DisasSimdTwoRegMisc (insn, cb);
+                break;
+        case DECODE_SIMD_SCALAR_TWO_REG_MISC:
+                DisasSimdScalarTwoRegMisc (insn, cb);
+                break;
+        case DECODE_SIMD_SCALAR_PAIRWISE:
+                DisasSimdScalarPairwise (insn, cb);
+                break;
+        case DECODE_SIMD_INDEXED:
+                DisasSimdIndexed (insn, cb);
+                break;
+        case DECODE_SIMD_THREE_REG_DIFF:
+                DisasSimdThreeRegDiff (insn, cb);
+                break;
+        case DECODE_CRYPTO_AES:
+                DisasCryptoAes (insn, cb);
+                break;
+        case DECODE_CRYPTO_THREE_REG_SHA:
+                DisasCryptoThreeRegSha (insn, cb);
+                break;
+        case DECODE_CRYPTO_TWO_REG_SHA:
+                DisasCryptoTwoRegSha (insn, cb);
+                break;
+        default:
+                UnallocatedOp (insn);
+                break;
+        }
+}
+
+};
+#endif
@@ -1,7 +1,7 @@
 #ifndef _INTERPRETER_HPP
 #define _INTERPRETER_HPP
 
-class IntprCallback : public DisasCallback {
+class IntprCallback final : public DisasCallback {
 public:
 /* Mov with Immediate value */
 void MoviI64(unsigned int reg_idx, uint64_t imm, bool bit64);
@@ -53,6 +53,20 @@ void LoadReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, in
 void LoadRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend);
 void StoreReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64);
 void StoreRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend);
+/* LDP/STP: both registers in one access of 2 << size bytes at [Xad] */
+void LoadStorePair(unsigned int rt_idx, unsigned int rt2_idx, unsigned int ad_idx, int size, bool is_sign, bool is_vector, bool is_load);
+
+/* Exclusive Load/Store. The store writes 0 to Rs on success, 1 on failure */
+void LoadExclusive(unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair);
+void StoreExclusive(unsigned int rs_idx, unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair);
+void ClearExclusive();
+
+/* Memory barrier. type is a Disassembler::BarrierType */
+void Barrier(int type);
+
+/* WFE, WFI, YIELD, SEV, SEVL. type is a Disassembler::HintType */
+void Hint(int type);
+
 void _LoadReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend);
 void _StoreReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend);
 
@@ -75,6 +89,8 @@ void RevByte64(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
 void CntLeadZero(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
 /* Count Leading Signed bits */
 void CntLeadSign(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+/* CRC32 (IEEE) or CRC32C (Castagnoli) of the low 8 << size bits of Rm into Wn */
+void Crc32(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, int size, bool castagnoli);
 
 /* Conditional compare... with Immediate value */
 void CondCmpI64(unsigned int rn_idx, unsigned int imm, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64);
@@ -97,22 +113,54 @@ void SetPCReg(unsigned int rt_idx);
 void SVC(unsigned int svc_num);
 /* Breakpoint exception */
 void BRK(unsigned int memo);
+/* Host implementation of a hooked guest function (HLE) */
+void HleCall(unsigned int id);
 
 /* Read/Write Sysreg */
 void ReadWriteSysReg(unsigned int rd_idx, int offset, bool read);
 /* Read/Write NZCV */
 void ReadWriteNZCV(unsigned int rd_idx, bool read);
+/* Read/Write FPCR and FPSR */
+void ReadWriteFPCR(unsigned int rd_idx, bool read);
+void ReadWriteFPSR(unsigned int rd_idx, bool read);
+
+/* DC ZVA: zero the DCZID_EL0 sized block containing Xt */
+void DcZva(unsigned int rt_idx);
 
 /* Fp Mov between registers */
 void FMovReg(unsigned int fd_idx, unsigned int fn_idx, int type);
 /* Fp Mov between registers (float <-> int)*/
 void FMovConv(unsigned int rd_idx, unsigned int rn_idx, int type, bool itof);
 
+/* Fp ops on the low elements (single or double) of vector registers, the rest of Vd is cleared.
+ * Scalar instructions are the one element case. op is a Disassembler::FpOpType */
+void FpArith(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op);
+void FpPairwise(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op);
+void FpMulAdd(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, unsigned int va_idx, bool dbl, int elements, bool neg_prod, bool neg_acc);
+void FpUnary(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, int op);
+
+/* Fp precision conversion (type: 0 single, 1 double, 3 half) */
+void FpConvert(unsigned int vd_idx, unsigned int vn_idx, int from_type, int to_type);
+void FpConvertVec(unsigned int vd_idx, unsigned int vn_idx, bool to_dbl, bool is_q);
+
+/* Fp <-> (fixed point) integer conversion. rounding is a Disassembler::FpRounding */
+void FpToInt(unsigned int rd_idx, unsigned int vn_idx, bool dbl, bool bit64, bool sign, int rounding, int fbits);
+void IntToFp(unsigned int vd_idx, unsigned int rn_idx, bool dbl, bool bit64, bool sign, int fbits);
+void FpToIntVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign, int rounding);
+void IntToFpVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign);
+
+/* Fp compare into NZCV and conditional select */
+void FpCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, bool cmp_zero, bool signal);
+void FpCondCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int nzcv, unsigned int cond, bool signal);
+void FpCondSelect(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int cond);
+
 /* #######  Vector ####### */
 
 /* Load/Store for vector */
 void LoadVecReg(unsigned int vd_idx, int element, unsigned int rn_idx, int size);
 void StoreVecReg(unsigned int rd_idx, int element, unsigned int vn_idx, int size);
+/* LD1-LD4/ST1-ST4: rpt * selem registers from Vt on, structures of selem elements (de)interleaved, in one access at [Xad] */
+void LoadStoreMulti(unsigned int vt_idx, unsigned int ad_idx, int size, int rpt, int selem, bool is_q, bool is_load);
 
 /* Load/Store for FP */
 void LoadFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64);
@@ -145,21 +193,52 @@ void DupVecReg(unsigned int vd_idx, unsigned int vn_idx, unsigned int index, int
 void DupVecRegFromGen(unsigned int vd_idx, unsigned int rn_idx, int size, int dstsize);
 
 /* Compare Bit wise equal */
-void CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int index, int size);
+void CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
 
 /* Compare Bit wise test bits nonzero */
-void CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int index, int size);
+void CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+
+/* Compare greater than (or equal), signed or unsigned */
+void CompareGreaterVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign, bool equal);
+
+/* Element wise arithmetic between vector registers */
+void AddVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void SubVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void MulVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void MaxVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void MinVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+
+/* Saturating add/sub (QC is not tracked) */
+void AddSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void SubSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+
+/* Polynomial multiply long of 8bit (size 0) or 64bit (size 3) lanes. upper takes the sources' upper halves (PMULL2) */
+void PolyMulLong(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool upper);
+
+/* AES round steps. op is a Disassembler::AesOpType */
+void CryptoAes(unsigned int vd_idx, unsigned int vn_idx, int op);
+/* SHA1/SHA256 hash updates and message schedule. op is a Disassembler::ShaOpType, two register ops ignore vm_idx */
+void CryptoSha(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int op);
+
+/* Superinstructions (Optimizer::Fuse): two guest instructions, the first one ends in between */
+/* CMP (immediate or register) + B.cond */
+void CmpI64Branch(unsigned int rn_idx, uint64_t imm, bool bit64, unsigned int cond, uint64_t addr);
+void CmpRegBranch(unsigned int rn_idx, unsigned int rm_idx, bool bit64, unsigned int cond, uint64_t addr);
+/* LDR + CBZ/CBNZ of the loaded register */
+void LoadBranchZero(unsigned int rt_idx, unsigned int ad_idx, int size, bool is_sign, bool extend, unsigned int cond, uint64_t addr, bool bit64);
+/* Two constants (ADRP + ADD to another register, MOV + MOV) */
+void MoviPair(unsigned int rd_idx, uint64_t imm, bool bit64, unsigned int rd2_idx, uint64_t imm2, bool bit64_2);
 
 };
 
-/* Global Interpreter singleton class .*/
-class Interpreter {
+/* Interpreter singleton class, one instance per vCPU thread .*/
+class Interpreter : public CpuEngine {
 private:
 Interpreter() = default;
 ~Interpreter() = default;
 
-static Interpreter *inst;
-static IntprCallback *disas_cb;
+static thread_local Interpreter *inst;
+static thread_local IntprCallback *disas_cb;
 public:
 Interpreter(const Interpreter&) = delete;
 Interpreter& operator=(const Interpreter&) = delete;
@@ -188,5 +267,7 @@ static void destroy() {
 }
 void Run();
 int SingleStep();
+void RunBlock(BasicBlock *block);
+void RunThreaded(BasicBlock *block);
 };
 #endif
@@ -0,0 +1,283 @@
+#ifndef _JIT_HPP
+#define _JIT_HPP
+
+/* x86-64 dynamic recompiler.
+ * Decoded blocks (see BlockCache) are translated to host code. Simple integer
+ * ops and branches are emitted natively; other ops call back into IntprCallback
+ * with the recorded MicroOp. Guest state is addressed through rbx.
+ * Exits to known targets are patched to jump straight into the next block,
+ * indirect branches go through a PC -> code table and a return address stack.
+ * With fastmem, integer loads and stores access guest memory directly. */
+
+#define JIT_CODE_CACHE_SIZE     (32 * 1024 * 1024)
+#define JIT_BLOCK_MAX_SIZE      (128 * 1024) // Upper bound of generated code per block
+#define JIT_IBTC_SIZE           4096 // Indirect branch target cache (power of 2)
+#define JIT_RAS_SIZE            32 // Return address stack (power of 2)
+#define JIT_INVALID_ADDR        (~0ULL)
+
+struct JitLookupEntry {
+        uint64_t addr;
+        uint8_t *code;
+};
+
+/* Lookup tables read by generated code */
+struct JitRuntime {
+        JitLookupEntry ibtc[JIT_IBTC_SIZE];
+        JitLookupEntry ras[JIT_RAS_SIZE];
+        uint32_t ras_top;
+};
+
+class JitBlock {
+public:
+        uint64_t addr;
+        unsigned int num_insts;
+        uint8_t *code;
+        std::deque<MicroOp> fallback_ops; // Referenced from generated code
+        bool idle; // Polling self loop: never chained, so the dispatcher sees each iteration
+        JitBlock(uint64_t _addr, unsigned int _num_insts) : addr(_addr), num_insts(_num_insts), code(nullptr), idle(false) {}
+};
+
+class JitCallback : public DisasCallback {
+private:
+JitBlock *block;
+uint8_t *ptr;
+uint8_t *exit_stub;
+uint64_t cur_pc;
+bool pc_in_mem; // Guest PC in memory is valid for current instruction
+bool zero_dirty; // Zero register may have been written
+
+/* How the block is left */
+enum ExitType {
+        EXIT_NEXT,     // Fall through (or PC set by fallback)
+        EXIT_DIRECT,   // Go to exit_target
+        EXIT_COND,     // Go to exit_target if exit_cc holds, else fall through
+        EXIT_INDIRECT, // Go to address held in rax
+        EXIT_DISPATCH, // Return to dispatcher (SVC/BRK may stop CPU)
+};
+ExitType exit_type;
+int exit_cc;
+uint64_t exit_target;
+uint64_t link_addr; // Return address set by BL/BLR
+bool exit_ret; // RET (pop return address stack)
+
+void Emit8(uint8_t val);
+void Emit32(uint32_t val);
+void Emit64(uint64_t val);
+void EmitRex(bool w, unsigned int reg, unsigned int rm);
+void EmitMem(unsigned int op, unsigned int reg, bool w, int32_t off);
+void EmitMemBase(unsigned int op, unsigned int reg, unsigned int base, bool w, int32_t off);
+void LoadGpr(unsigned int host, unsigned int idx, bool bit64);
+void StoreGpr(unsigned int host, unsigned int idx);
+void MovImm(unsigned int host, uint64_t imm);
+void AluReg(unsigned int op, unsigned int dst, unsigned int src, bool bit64);
+void AluImm(unsigned int ext, unsigned int dst, uint64_t imm, bool bit64);
+void ShiftImm(unsigned int ext, unsigned int reg, unsigned int amount, bool bit64);
+void Setcc(int cc, unsigned int reg);
+void Movzx8(unsigned int dst, unsigned int src);
+void StoreFlags(bool sub);
+int CondTest(unsigned int cond);
+void StorePC(uint64_t val);
+void SyncPC();
+void CallHelper(void *fn, uint64_t arg);
+void ArithImm(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64, bool sub);
+void ArithReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64, unsigned int op);
+void EmitFallback(const MicroOp &op);
+uint8_t *EmitJmp();
+void PatchJump(uint8_t *patch);
+bool FastmemInline(int size);
+uint8_t *EmitFastmemAddr();
+void EmitGuestLoad(unsigned int rd_idx, int size, bool sext32);
+void EmitGuestStore(unsigned int rd_idx, int size);
+void EmitExit(uint64_t target);
+void EmitIndirect(bool ret);
+uint8_t *EmitRasPush(uint64_t ret_addr);
+
+template<typename... Args> void Fallback(MicroOpType type, Args... args) {
+        MicroOp op = { (uint16_t) type, { ((uint64_t) args)... } };
+        EmitFallback (op);
+}
+public:
+/* Start translation of block at ptr */
+void Begin(JitBlock *_block, uint8_t *_ptr, uint8_t *_exit_stub);
+/* End of guest instruction */
+void NextInsn();
+/* Close the block and return the end of generated code */
+uint8_t *End();
+
+void MoviI64(unsigned int reg_idx, uint64_t imm, bool bit64);
+void DepositI64(unsigned int rd_idx, uint64_t imm, unsigned int pos, unsigned int len, bool bit64);
+void DepositReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64);
+void DepositZeroI64(unsigned int rd_idx, uint64_t imm, unsigned int pos, unsigned int len, bool bit64);
+void DepositZeroReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64);
+void MovReg(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void CondMovReg(unsigned int cond, unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64);
+void AddI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64);
+void SubI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t imm, bool setflags, bool bit64);
+void AddReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void SubReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void MulReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign, bool dst64, bool src64);
+void Mul2Reg(unsigned int rh_idx, unsigned int rl_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign);
+void DivReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool sign, bool bit64);
+void ShiftReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, unsigned int shift_type, bool bit64);
+void AddcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void SubcReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void AndI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool setflags, bool bit64);
+void OrrI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool bit64);
+void EorI64(unsigned int rd_idx, unsigned int rn_idx, uint64_t wmask, bool bit64);
+void ShiftI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int shift_type, unsigned int shift_amount, bool bit64);
+void AndReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void OrrReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64);
+void EorReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool bit64);
+void BicReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, bool setflags, bool bit64);
+void NotReg(unsigned int rd_idx, unsigned int rm_idx, bool bit64);
+void ExtendReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int extend_type, bool bit64);
+void LoadReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64);
+void LoadRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend);
+void StoreReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool is_sign, bool extend, bool post, bool bit64);
+void StoreRegI64(unsigned int rd_idx, unsigned int ad_idx, int size, bool is_sign, bool extend);
+void LoadStorePair(unsigned int rt_idx, unsigned int rt2_idx, unsigned int ad_idx, int size, bool is_sign, bool is_vector, bool is_load);
+void LoadExclusive(unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair);
+void StoreExclusive(unsigned int rs_idx, unsigned int rt_idx, unsigned int rt2_idx, unsigned int rn_idx, int size, bool pair);
+void ClearExclusive();
+void Barrier(int type);
+void Hint(int type);
+void _LoadReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend);
+void _StoreReg(unsigned int rd_idx, uint64_t addr, int size, bool is_sign, bool extend);
+void SExtractI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64);
+void UExtractI64(unsigned int rd_idx, unsigned int rn_idx, unsigned int pos, unsigned int len, bool bit64);
+void SExt32(unsigned int rd_idx, unsigned int rn_idx);
+void RevBit(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void RevByte16(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void RevByte32(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void RevByte64(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void CntLeadZero(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void CntLeadSign(unsigned int rd_idx, unsigned int rn_idx, bool bit64);
+void Crc32(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx, int size, bool castagnoli);
+void CondCmpI64(unsigned int rn_idx, unsigned int imm, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64);
+void CondCmpReg(unsigned int rn_idx, unsigned int rm_idx, unsigned int nzcv, unsigned int cond, unsigned int op, bool bit64);
+void BranchI64(uint64_t imm);
+void BranchCondiI64(unsigned int cond, unsigned int rt_idx, uint64_t imm, uint64_t addr, bool bit64);
+void BranchFlag(unsigned int cond, uint64_t addr);
+void SetPCReg(unsigned int rt_idx);
+void SVC(unsigned int svc_num);
+void BRK(unsigned int memo);
+void HleCall(unsigned int id);
+void ReadWriteSysReg(unsigned int rd_idx, int offset, bool read);
+void ReadWriteNZCV(unsigned int rd_idx, bool read);
+void ReadWriteFPCR(unsigned int rd_idx, bool read);
+void ReadWriteFPSR(unsigned int rd_idx, bool read);
+void DcZva(unsigned int rt_idx);
+void FMovReg(unsigned int fd_idx, unsigned int fn_idx, int type);
+void FMovConv(unsigned int rd_idx, unsigned int rn_idx, int type, bool itof);
+void FpArith(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op);
+void FpPairwise(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, int elements, int op);
+void FpMulAdd(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, unsigned int va_idx, bool dbl, int elements, bool neg_prod, bool neg_acc);
+void FpUnary(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, int op);
+void FpConvert(unsigned int vd_idx, unsigned int vn_idx, int from_type, int to_type);
+void FpConvertVec(unsigned int vd_idx, unsigned int vn_idx, bool to_dbl, bool is_q);
+void FpToInt(unsigned int rd_idx, unsigned int vn_idx, bool dbl, bool bit64, bool sign, int rounding, int fbits);
+void IntToFp(unsigned int vd_idx, unsigned int rn_idx, bool dbl, bool bit64, bool sign, int fbits);
+void FpToIntVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign, int rounding);
+void IntToFpVec(unsigned int vd_idx, unsigned int vn_idx, bool dbl, int elements, bool sign);
+void FpCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, bool cmp_zero, bool signal);
+void FpCondCompare(unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int nzcv, unsigned int cond, bool signal);
+void FpCondSelect(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, bool dbl, unsigned int cond);
+void AndVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx);
+void OrrVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx);
+void EorVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx);
+void BicVecReg(unsigned int rd_idx, unsigned int rn_idx, unsigned int rm_idx);
+void NotVecReg(unsigned int rd_idx, unsigned int rm_idx);
+void LoadVecReg(unsigned int vd_idx, int element, unsigned int rn_idx, int size);
+void StoreVecReg(unsigned int rd_idx, int element, unsigned int vn_idx, int size);
+void LoadStoreMulti(unsigned int vt_idx, unsigned int ad_idx, int size, int rpt, int selem, bool is_q, bool is_load);
+void LoadFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64);
+void StoreFpReg(unsigned int rd_idx, unsigned int base_idx, unsigned int rm_idx, int size, bool post, bool bit64);
+void LoadFpRegI64(unsigned int fd_idx, unsigned int ad_idx, int size);
+void StoreFpRegI64(unsigned int fd_idx, unsigned int ad_idx, int size);
+void ReadVecReg(unsigned int fd_idx, unsigned int vn_idx, unsigned int index, int size);
+void ReadVecElem(unsigned int rd_idx, unsigned int vn_idx, unsigned int index, int size);
+void WriteVecElem(unsigned int vd_idx, unsigned int rn_idx, unsigned int index, int size);
+void DupVecImmI32(unsigned int vd_idx, uint32_t imm, int size, int dstsize);
+void DupVecImmI64(unsigned int vd_idx, uint64_t imm, int size, int dstsize);
+void DupVecReg(unsigned int vd_idx, unsigned int vn_idx, unsigned int index, int size, int dstsize);
+void DupVecRegFromGen(unsigned int vd_idx, unsigned int rn_idx, int size, int dstsize);
+void CompareEqualVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void CompareTestBitsVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void CompareGreaterVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign, bool equal);
+void AddVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void SubVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void MulVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q);
+void MaxVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void MinVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void AddSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void SubSatVec(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool is_q, bool sign);
+void PolyMulLong(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int size, bool upper);
+void CryptoAes(unsigned int vd_idx, unsigned int vn_idx, int op);
+void CryptoSha(unsigned int vd_idx, unsigned int vn_idx, unsigned int vm_idx, int op);
+
+/* Superinstructions: emitted as their two parts */
+void CmpI64Branch(unsigned int rn_idx, uint64_t imm, bool bit64, unsigned int cond, uint64_t addr);
+void CmpRegBranch(unsigned int rn_idx, unsigned int rm_idx, bool bit64, unsigned int cond, uint64_t addr);
+void LoadBranchZero(unsigned int rt_idx, unsigned int ad_idx, int size, bool is_sign, bool extend, unsigned int cond, uint64_t addr, bool bit64);
+void MoviPair(unsigned int rd_idx, uint64_t imm, bool bit64, unsigned int rd2_idx, uint64_t imm2, bool bit64_2);
+};
+
+/* Returns exit site to be chained to the next block, or nullptr */
+typedef uint8_t *(*JitEntry)(ARMv8::ARMv8State *state, uint8_t *code);
+
+/* JIT singleton class, one instance per vCPU thread (code is never shared between cores) .*/
+class Jit : public CpuEngine {
+private:
+Jit() = default;
+~Jit() = default;
+
+static thread_local Jit *inst;
+static thread_local JitCallback *jit_cb;
+static thread_local IntprCallback *intpr_cb;
+
+uint8_t *code_cache, *code_ptr, *code_start;
+uint8_t *exit_stub;
+JitEntry entry;
+std::unordered_map<uint64_t, JitBlock *> blocks;
+uint64_t cache_gen;
+uint64_t flush_count;
+
+JitBlock *Compile(BasicBlock *bb);
+JitBlock *Lookup(uint64_t addr);
+void Link(uint8_t *site, uint8_t *target);
+void Flush();
+public:
+JitRuntime runtime;
+
+Jit(const Jit&) = delete;
+Jit& operator=(const Jit&) = delete;
+Jit(Jit&&) = delete;
+Jit& operator=(Jit&&) = delete;
+
+void Init();
+
+static Jit *get_instance() {
+	return inst;
+}
+
+static void create() {
+	if (!inst) {
+		inst = new Jit;
+		inst->jit_cb = new JitCallback;
+		inst->intpr_cb = new IntprCallback;
+	}
+}
+
+static void destroy() {
+	if (inst) {
+		delete inst->jit_cb;
+		delete inst->intpr_cb;
+		delete inst;
+		inst = nullptr;
+	}
+}
+static void Fallback(const MicroOp *op);
+void Run();
+int SingleStep();
+};
+#endif
@@ -21,6 +21,17 @@ void WriteU16(const uint64_t gva, uint16_t value);
 void WriteU32(const uint64_t gva, uint32_t value);
 void WriteU64(const uint64_t gva, uint64_t value);
 
+/* len contiguous bytes within one region (LDP/STP, LD1-LD4/ST1-ST4) */
+void ReadRange(const uint64_t gva, void *dst, int len);
+void WriteRange(const uint64_t gva, const void *src, int len);
+/* len zero bytes within one region (DC ZVA) */
+void ZeroRange(const uint64_t gva, int len);
+
+/* Single-copy atomic access of 1 << size bytes (size 0 - 4) for the exclusive monitor.
+ * 16 byte reads may tear, the compare-and-swap catches that */
+void ReadExclusive(const uint64_t gva, int size, uint64_t *val);
+bool CompareAndSwap(const uint64_t gva, int size, const uint64_t *expected, const uint64_t *val);
+
 uint64_t GvaToHva(const uint64_t gva);
 template<typename T> T* GuestPtr(uint64_t addr) {
         return reinterpret_cast<T*>(GvaToHva(addr));
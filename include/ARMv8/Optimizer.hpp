@@ -0,0 +1,20 @@
+#ifndef _OPTIMIZER_HPP
+#define _OPTIMIZER_HPP
+
+/* Block local optimization of recorded micro-ops.
+ * The recorded op list is the IR: passes rewrite it in place after translation,
+ * so the interpreter and the JIT both consume the optimized ops. */
+
+namespace Optimizer {
+
+extern bool enabled;
+/* Count fused instruction pairs (--fusion-stats) */
+extern bool stats;
+void Run(BasicBlock *block);
+void PrintStats();
+/* Self loop only polling memory: spinning on it can't get anywhere until another core writes */
+bool IsIdleLoop(BasicBlock *block);
+
+}
+
+#endif
@@ -1,11 +1,15 @@
 #ifndef _CPU_HPP
 #define _CPU_HPP
 
+/* Application cores of the guest. Each one is a vCPU run by its own host thread */
+#define CPU_NUM_CORES 4
+
 namespace Cpu {
 
 enum class State {
 	Running = 0,
 	PowerDown = 1,
+	Halted = 2, // Core is parked until it is given something to run
 };
 
 void Init();
@@ -14,10 +18,21 @@ void Run();
 
 void Stop();
 
+/* Machine wide state change (applies to every core) */
 void SetState(State _state);
 
+/* State of the core running on the calling thread */
 State GetState();
 
+/* Run (Running) or park (Halted) a single core */
+void SetCoreState(unsigned int core, State _state);
+
+/* Core id of the calling vCPU thread */
+unsigned int CurrentCore();
+
+/* Cores actually run (1 - CPU_NUM_CORES). Guest threads are spread over them */
+extern unsigned int num_cores;
+
 void DumpMachine();
 
 extern FILE *TraceOut;
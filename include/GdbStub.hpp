@@ -18,6 +18,8 @@ namespace GdbStub {
 extern volatile bool enabled;
 extern volatile bool step;
 extern volatile bool cont;
+/* Set while the stub itself accesses guest memory, which hits no watchpoint */
+extern thread_local bool quiet;
 
 enum RSState {
     RS_INACTIVE,
@@ -0,0 +1,24 @@
+#ifndef _HLE_HPP
+#define _HLE_HPP
+
+/*
+ * High level emulation of hot guest library routines (memcpy, strlen, ...).
+ * Functions are found by name in the dynamic symbol table of loaded modules.
+ * The block at a hooked entry point runs the host implementation over guest
+ * memory, which sets the return registers, and then returns to LR.
+ */
+namespace HLE {
+
+extern bool enabled;
+
+/* Hook the exports of the size bytes module at base that we have implementations for */
+void HookModule(uint64_t base, uint64_t size);
+/* False if no implementation goes by that name */
+bool Hook(uint64_t addr, const std::string &name);
+/* Hook id of the function at addr, or -1 */
+int Find(uint64_t addr);
+/* Run hook id on the calling core's registers */
+void Call(unsigned int id);
+
+}
+#endif
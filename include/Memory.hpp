@@ -9,23 +9,29 @@
 class RAMBlock {
 public:
 std::string name;
-unsigned int length;
+uint64_t length;
 int perm;
 uint64_t addr; //gpa (guest physical address)
-uint8_t *block;
+uint8_t *block; // Host backing, released by Memory page range by page range
 RAMBlock() { block = nullptr; }
-RAMBlock(std::string _name, uint64_t _addr, unsigned int _length, int _perm); //straight mapping
-RAMBlock(std::string _name, uint64_t _addr, unsigned int _length, uint8_t *raw, int _perm);
-~RAMBlock() {
-        if (block) {
-                delete[] block;
-        }
-}
+RAMBlock(std::string _name, uint64_t _addr, uint64_t _length, int _perm); //straight mapping
+RAMBlock(std::string _name, uint64_t _addr, uint64_t _length, uint8_t *raw, int _perm);
 bool operator<(const RAMBlock &as) {
 	return name < as.name;
 }
 };
 
+/* Guest pages. The page table covers a 39 bit address space */
+#define GUEST_PAGE_BITS 12
+#define GUEST_PAGE_SIZE ((uint64_t) 1 << GUEST_PAGE_BITS)
+#define GUEST_PAGE_MASK (GUEST_PAGE_SIZE - 1)
+#define GUEST_VA_BITS 39
+
+struct PageEntry {
+        std::atomic<uint8_t *> host; // Host address of the page start, nullptr if unmapped
+        std::atomic<int> perm; // PROT_READ | PROT_WRITE | PROT_EXEC
+};
+
 class Nsemu;
 namespace Memory
 {
@@ -36,8 +42,31 @@ extern uint64_t heap_size;
 void InitMemmap(Nsemu *nsemu);
 void AddMemmap(uint64_t addr, unsigned int len);
 void DelMemmap(uint64_t addr, unsigned int len);
-std::list<std::tuple<uint64_t,uint64_t, int>> GetRegions();
+/* Mapped (perm) and free (-1) ranges covering the address space in order, ends inclusive */
+typedef std::vector<std::tuple<uint64_t, uint64_t, int>> RegionList;
+std::shared_ptr<const RegionList> GetRegions();
+/* Move the end of the heap at heap_base, false if size is beyond the heap region */
+bool SetHeapSize(uint64_t size);
+/* Entry of GetRegions containing addr */
+std::tuple<uint64_t, uint64_t, int> QueryRegion(uint64_t addr);
+
+/* Page table entry of gva, nullptr if no page around it was ever mapped */
+PageEntry *LookupPage(uint64_t gva);
+/* host backs [gva, gva + len), both page aligned */
+void MapPages(uint64_t gva, uint8_t *host, uint64_t len, int perm);
+void UnmapPages(uint64_t gva, uint64_t len);
+/* Bumped whenever a mapping goes away or changes, so that software TLBs get flushed */
+extern std::atomic<uint64_t> tlb_generation;
+
+/* Fastmem (--fastmem): the whole guest address space is reserved in host VA
+ * and guest memory lives at fastmem_base + gva, so an access needs no
+ * translation. Unmapped pages are PROT_NONE and fault on the host */
+extern bool fastmem;
+extern uint8_t *fastmem_base; // nullptr unless fastmem is on
+/* True if host fault address is in the reservation, with the guest address */
+bool FastmemFault(const void *host, uint64_t *gva);
 
+/* Contiguous within the region gpa is in */
 void *GetRawPtr(uint64_t gpa, unsigned int len);
 bool CopytoEmu(Nsemu *nsemu, void *data, uint64_t addr, unsigned int len);
 bool CopytoEmuByName(Nsemu *nsemu, void *data, std::string name, unsigned int len);
@@ -16,6 +16,8 @@ class Nso : NintendoObject {
 public:
 Nso(std::string path) : NintendoObject (path) {}
 int load(Nsemu *nsemu);
+uint64_t text_addr;
+uint32_t text_size;
 };
 
 typedef struct {
@@ -6,10 +6,18 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cfenv>
+#include <chrono>
 #include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <csetjmp>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <ios>
@@ -18,10 +26,15 @@
 #include <sstream>
 #include <string>
 #include <list>
+#include <limits>
 #include <tuple>
+#include <type_traits>
 #include <map>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 #include <vector>
 
 using namespace std;
@@ -33,9 +46,13 @@ using namespace std;
 #include "Cpu.hpp"
 #include "Kernel.hpp"
 #include "Svc.hpp"
+#include "Hle.hpp"
 #include "ARMv8/ARMv8.hpp"
 #include "ARMv8/Disassembler.hpp"
+#include "ARMv8/BlockCache.hpp"
+#include "ARMv8/Optimizer.hpp"
 #include "ARMv8/Interpreter.hpp"
+#include "ARMv8/Jit.hpp"
 #include "ARMv8/MMU.hpp"
 
 class KObject {
@@ -4,6 +4,16 @@
 namespace SVC {
 
 extern std::function<void()> svc_handlers[0x80];
+/* Kernel objects are shared by all cores: SVC handlers run one at a time */
+extern std::mutex kernel_lock;
+
+/* Kernel result codes (module 1) */
+#define KERNEL_RESULT(desc) (((desc) << 9) | 1)
+#define ERR_INVALID_PRIORITY        KERNEL_RESULT(112)
+#define ERR_INVALID_CORE_ID         KERNEL_RESULT(113)
+#define ERR_INVALID_HANDLE          KERNEL_RESULT(114)
+#define ERR_INVALID_COMBINATION     KERNEL_RESULT(116)
+#define ERR_INVALID_STATE           KERNEL_RESULT(125)
 
 void Init();
 
@@ -49,9 +59,9 @@ void ExitThread();
 uint64_t SleepThread(uint64_t ns);
 std::tuple<uint64_t, uint64_t> GetThreadPriority(uint32_t handle);
 uint64_t SetThreadPriority(uint32_t handle, uint64_t priority);
-std::tuple<uint64_t, uint64_t, uint64_t> GetThreadCoreMask(uint64_t tmp);
-uint64_t SetThreadCoreMask(uint64_t tmp);
-uint64_t GetCurrentProcessorNumber(uint64_t tmp);
+std::tuple<uint64_t, uint64_t, uint64_t> GetThreadCoreMask(uint32_t handle);
+uint64_t SetThreadCoreMask(uint32_t handle, uint32_t ideal_core, uint64_t affinity_mask);
+uint64_t GetCurrentProcessorNumber();
 uint64_t SignalEvent(uint32_t handle);
 uint64_t ClearEvent(uint32_t handle);
 uint64_t MapMemoryBlock(uint32_t handle, uint64_t addr, uint64_t size, uint64_t perm);
@@ -1,16 +1,77 @@
 #ifndef _THREAD_HPP
 #define _THREAD_HPP
 
+#define THREAD_PRIO_NUM 64 // 0 is the highest
+#define THREAD_PRIO_DEFAULT 44
+/* Guest instructions a thread runs before the core looks for another thread of the same priority */
+#define THREAD_QUANTUM 200000
+/* Iterations of a polling loop (Optimizer::IsIdleLoop) before its thread is parked */
+#define IDLE_SPIN_LIMIT 64
+/* How long a parked thread sleeps when nothing wakes it earlier */
+#define IDLE_PARK_NS 100000
+
+enum class ThreadState {
+        Created, // Waiting for StartThread
+        Ready, // In a run queue
+        Running,
+        Sleeping,
+        Terminated,
+};
+
 class KObject;
 class Thread : public KObject {
 public:
         uint32_t handle;
-        Thread() : KObject() { }
+        unsigned long id;
+        int priority;
+        ThreadState state;
+        int ideal_core; // Core the thread prefers to run on
+        uint64_t affinity_mask; // Cores the thread may run on
+        ARMv8::ARMv8State context; // Registers while the thread is off core
+        std::chrono::steady_clock::time_point wake_time; // While Sleeping
+        bool wait_event; // Sleeping in WaitForEvent: SendEvent wakes it up early
+        Thread() : KObject(), priority(THREAD_PRIO_DEFAULT), state(ThreadState::Created), ideal_core(0), affinity_mask(1), context(), wait_event(false) { }
 };
 
+/* Pseudo handle referring to the calling thread */
+#define CURRENT_THREAD_HANDLE 0xFFFF8000
+
+/*
+ * Guest threads are multiplexed on the vCPUs. Each core picks the highest
+ * priority ready thread its affinity allows, and round robins threads of
+ * the same priority every THREAD_QUANTUM instructions. Switching happens
+ * only between blocks (from ThreadManager::Schedule), SVCs just change
+ * thread states and ask the calling core to reschedule.
+ */
 namespace ThreadManager {
 void Init();
-Thread *Create();
+/* New thread in Created state, with its own TLS */
+Thread *Create(uint64_t entry, uint64_t arg, uint64_t sp, int priority, int core);
+/* Guest thread running on the calling core */
+Thread *Current();
+/* Resolves CURRENT_THREAD_HANDLE too. nullptr if handle isn't a thread */
+Thread *FromHandle(uint32_t handle);
+
+void Start(Thread *thread);
+void Exit();
+/* Yield when ns is 0, -1 or -2 */
+void Sleep(int64_t ns);
+/* Park the calling thread for ns or until an event (WFE, WFI, polling loops).
+ * Returns at once if consume is set and the core's event register was set */
+void WaitForEvent(int64_t ns, bool consume);
+/* SEV (all cores) or SEVL (calling core only) */
+void SendEvent(bool local);
+/* Cheap check whether SendEvent would wake anyone */
+bool HasEventWaiters();
+void SetPriority(Thread *thread, int priority);
+/* Moves the thread off a core it may no longer run on */
+void SetCoreMask(Thread *thread, int ideal_core, uint64_t affinity_mask);
+
+/* Called by the calling core between blocks once its quantum is used up.
+ * Switches arm_state to the next thread, or halts the core if there is none */
+void Schedule();
+/* When an idle core must look at sleeping threads again */
+std::chrono::steady_clock::time_point NextWakeup(unsigned int core);
 }
 
 #endif